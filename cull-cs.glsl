@@ -0,0 +1,100 @@
+#version 430 core
+layout(local_size_x = 64) in;
+
+struct ObjectData {
+	mat4 ModelMatrix;
+	mat4 NormalMatrix;
+	vec4 BoundsMin;
+	vec4 BoundsMax;
+};
+
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Objects {
+	ObjectData objects[];
+};
+
+layout(std430, binding = 1) buffer Commands {
+	DrawCommand commands[];
+};
+
+uniform mat4 ViewProjection;
+uniform mat4 HiZViewProjection;
+uniform int HiZLevels;
+uniform uint CommandCount;
+uniform int Occlusion;
+layout(binding = 0) uniform sampler2D HiZ;
+
+vec3 corner(ObjectData o, int c) {
+	return vec3((c & 1) != 0 ? o.BoundsMax.x : o.BoundsMin.x,
+	            (c & 2) != 0 ? o.BoundsMax.y : o.BoundsMin.y,
+	            (c & 4) != 0 ? o.BoundsMax.z : o.BoundsMin.z);
+}
+
+// Same test as GpuCuller::cullCPU.
+bool frustumVisible(ObjectData o) {
+	mat4 mvp = ViewProjection * o.ModelMatrix;
+	int outside[6] = int[6](0, 0, 0, 0, 0, 0);
+	for (int c = 0; c < 8; c++) {
+		vec4 clip = mvp * vec4(corner(o, c), 1.0);
+		outside[0] += int(clip.x < -clip.w);
+		outside[1] += int(clip.x > clip.w);
+		outside[2] += int(clip.y < -clip.w);
+		outside[3] += int(clip.y > clip.w);
+		outside[4] += int(clip.z < -clip.w);
+		outside[5] += int(clip.z > clip.w);
+	}
+	for (int p = 0; p < 6; p++) {
+		if (outside[p] == 8) return false;
+	}
+	return true;
+}
+
+// Projects the box with last frame's matrices and compares its nearest depth
+// with the farthest depth stored in the Hi-Z texels covering it.
+bool occlusionVisible(ObjectData o) {
+	mat4 mvp = HiZViewProjection * o.ModelMatrix;
+	vec3 minNdc = vec3(1.0);
+	vec3 maxNdc = vec3(-1.0);
+	for (int c = 0; c < 8; c++) {
+		vec4 clip = mvp * vec4(corner(o, c), 1.0);
+		if (clip.w <= 0.0) return true;
+		vec3 ndc = clip.xyz / clip.w;
+		minNdc = min(minNdc, ndc);
+		maxNdc = max(maxNdc, ndc);
+	}
+	vec2 size = vec2(textureSize(HiZ, 0));
+	vec2 minUv = clamp(minNdc.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 maxUv = clamp(maxNdc.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 extent = (maxUv - minUv) * size;
+	int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+	level = clamp(level, 0, HiZLevels - 1);
+
+	ivec2 levelSize = textureSize(HiZ, level);
+	ivec2 p0 = clamp(ivec2(minUv * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 p1 = clamp(ivec2(maxUv * vec2(levelSize)), ivec2(0), levelSize - 1);
+	float farthest = max(max(texelFetch(HiZ, p0, level).r,
+	                         texelFetch(HiZ, ivec2(p1.x, p0.y), level).r),
+	                     max(texelFetch(HiZ, ivec2(p0.x, p1.y), level).r,
+	                         texelFetch(HiZ, p1, level).r));
+	float nearest = minNdc.z * 0.5 + 0.5;
+	return nearest <= farthest;
+}
+
+void main(void)
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= CommandCount) return;
+	ObjectData o = objects[commands[i].baseInstance];
+	bool visible = frustumVisible(o);
+	if (visible && Occlusion != 0) {
+		visible = occlusionVisible(o);
+	}
+	commands[i].instanceCount = visible ? 1u : 0u;
+}
@@ -0,0 +1,47 @@
+#version 330 core
+#ifdef PRECOMPUTED_MATRICES
+uniform Object {
+    mat4 ModelMatrix;
+    mat4 NormalMatrix;
+    mat4 ModelViewProjection;
+};
+#else
+uniform mat4 ModelMatrix;
+#endif
+uniform Camera {
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
+#ifdef SKINNED
+#define MAX_BONES 128
+uniform Bones {
+    mat4 BoneMatrices[MAX_BONES];
+};
+#endif
+
+in vec3 inPosition;
+#ifdef SKINNED
+in uvec4 inBoneIndices;
+in vec4 inBoneWeights;
+#endif
+
+// Must match global-vs.glsl exactly for the GL_EQUAL shading pass.
+invariant gl_Position;
+
+void main(void)
+{
+#ifdef SKINNED
+	mat4 Skin = inBoneWeights.x * BoneMatrices[inBoneIndices.x]
+	          + inBoneWeights.y * BoneMatrices[inBoneIndices.y]
+	          + inBoneWeights.z * BoneMatrices[inBoneIndices.z]
+	          + inBoneWeights.w * BoneMatrices[inBoneIndices.w];
+	vec4 position = Skin * vec4(inPosition, 1.0);
+#else
+	vec4 position = vec4(inPosition, 1.0);
+#endif
+#ifdef PRECOMPUTED_MATRICES
+	gl_Position = ModelViewProjection * position;
+#else
+	gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * position;
+#endif
+}
@@ -1,5 +1,9 @@
 #version 330 core
+#ifdef EFFECT
+const int effect = EFFECT;  // specialised permutation, branches fold away
+#else
 uniform int effect;
+#endif
 
 in vec3 Position;
 in vec3 Normal;
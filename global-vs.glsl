@@ -1,25 +1,64 @@
 #version 330 core
+#ifdef PRECOMPUTED_MATRICES
+uniform Object {
+    mat4 ModelMatrix;
+    mat4 NormalMatrix;
+    mat4 ModelViewProjection;
+};
+#else
 uniform mat4 ModelMatrix;
+#endif
 uniform Camera {
     mat4 ViewMatrix;
     mat4 ProjectionMatrix;
 };
+#ifdef SKINNED
+#define MAX_BONES 128
+uniform Bones {
+    mat4 BoneMatrices[MAX_BONES];
+};
+#endif
 
 in vec3 inPosition;
 in vec3 inNormal;
 in vec2 inTexcoord;
+#ifdef SKINNED
+in uvec4 inBoneIndices;
+in vec4 inBoneWeights;
+#endif
 
 out vec2 fragTexcoord;
 out vec3 Position;
 out vec3 Normal;
 out vec3 Eye;
 
+invariant gl_Position;
+
 
 void main(void)
 {
-	Position = vec3(ModelMatrix * vec4(inPosition, 1.0));
-	Normal = normalize(mat3(transpose(inverse(ModelMatrix))) * inNormal);
+#ifdef SKINNED
+	mat4 Skin = inBoneWeights.x * BoneMatrices[inBoneIndices.x]
+	          + inBoneWeights.y * BoneMatrices[inBoneIndices.y]
+	          + inBoneWeights.z * BoneMatrices[inBoneIndices.z]
+	          + inBoneWeights.w * BoneMatrices[inBoneIndices.w];
+	vec4 position = Skin * vec4(inPosition, 1.0);
+#else
+	vec4 position = vec4(inPosition, 1.0);
+#endif
+#ifdef SKINNED
+	vec3 normal = mat3(Skin) * inNormal;
+#else
+	vec3 normal = inNormal;
+#endif
+	Position = vec3(ModelMatrix * position);
 	Eye = ViewMatrix[3].xyz;
 	fragTexcoord = inTexcoord;
-	gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * vec4(inPosition, 1.0);
+#ifdef PRECOMPUTED_MATRICES
+	Normal = normalize(mat3(NormalMatrix) * normal);
+	gl_Position = ModelViewProjection * position;
+#else
+	Normal = normalize(mat3(transpose(inverse(ModelMatrix))) * normal);
+	gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * position;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform int Level;
+layout(binding = 0) uniform sampler2D DepthTexture;
+layout(r32f, binding = 0) writeonly uniform image2D Destination;
+layout(r32f, binding = 1) readonly uniform image2D Source;
+
+// Level 0 copies the depth buffer; every other level keeps the farthest depth
+// of the texels it covers, including the extra row/column of odd sizes.
+void main(void)
+{
+	ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(Destination);
+	if (any(greaterThanEqual(p, size))) return;
+
+	float depth;
+	if (Level == 0) {
+		depth = texelFetch(DepthTexture, p, 0).r;
+	} else {
+		ivec2 sourceSize = imageSize(Source);
+		ivec2 last = sourceSize - 1;
+		ivec2 base = p * 2;
+		ivec2 extra = ivec2(p.x == size.x - 1 && (sourceSize.x & 1) != 0 ? 2 : 1,
+		                    p.y == size.y - 1 && (sourceSize.y & 1) != 0 ? 2 : 1);
+		depth = 0.0;
+		for (int y = 0; y <= extra.y; y++) {
+			for (int x = 0; x <= extra.x; x++) {
+				depth = max(depth, imageLoad(Source, min(base + ivec2(x, y), last)).r);
+			}
+		}
+	}
+	imageStore(Destination, p, vec4(depth));
+}
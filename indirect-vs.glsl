@@ -0,0 +1,37 @@
+#version 430 core
+struct ObjectData {
+	mat4 ModelMatrix;
+	mat4 NormalMatrix;
+	vec4 BoundsMin;
+	vec4 BoundsMax;
+};
+
+layout(std430, binding = 0) readonly buffer Objects {
+	ObjectData objects[];
+};
+
+uniform Camera {
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
+
+in vec3 inPosition;
+in vec3 inNormal;
+in vec2 inTexcoord;
+in uint inObjectIndex;
+
+out vec2 fragTexcoord;
+out vec3 Position;
+out vec3 Normal;
+out vec3 Eye;
+
+
+void main(void)
+{
+	mat4 ModelMatrix = objects[inObjectIndex].ModelMatrix;
+	Position = vec3(ModelMatrix * vec4(inPosition, 1.0));
+	Normal = normalize(mat3(objects[inObjectIndex].NormalMatrix) * inNormal);
+	Eye = ViewMatrix[3].xyz;
+	fragTexcoord = inTexcoord;
+	gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * vec4(inPosition, 1.0);
+}
@@ -27,6 +27,7 @@
 class MyApp : public mgl::App {
 public:
 	void initCallback(GLFWwindow* win) override;
+	void updateCallback(GLFWwindow* win, double elapsed) override;
 	void displayCallback(GLFWwindow* win, double elapsed) override;
 	void windowSizeCallback(GLFWwindow* win, int width, int height) override;
 	void keyCallback(GLFWwindow* window, int key, int scancode, int action,
@@ -39,6 +40,8 @@ public:
 
 private:
 	const GLuint UBO_BP = 0;
+	const GLuint OBJECT_BP = 1;
+	const GLuint BONES_BP = 2;
 	mgl::ShaderProgram* Shaders = nullptr;
 	mgl::Camera* Camera = nullptr;
 	GLint ModelMatrixId;
@@ -46,12 +49,43 @@ private:
 	bool mouseBtnPressed = false;
 	double xposl = 0, yposl = 0;
 	mgl::SceneGraph* Scene = nullptr;
+	mgl::ShaderProgram* IndirectShaders = nullptr;
+	mgl::GpuCuller* Culler = nullptr;
+	std::atomic<bool> gpuCulling{ false };
+	mgl::ShaderProgram* DepthShaders = nullptr;
+	mgl::Query* Fragments = nullptr;
+	mgl::ShaderPermutations* Permutations = nullptr;
+	std::atomic<bool> usePermutations{ true };
+	mgl::ShaderPermutations* DepthPermutations = nullptr;
+	bool precomputeMatrices = true;
+	mgl::FramePipeline* Pipeline = nullptr;
+	mgl::FramePacket* Packet = nullptr;
+	mgl::RenderQueue* DrawnQueue = nullptr;
+	mgl::TaskGraph FrameGraph;
+	glm::mat4 FrameViewProjection;
+	mgl::Animator* Animator = nullptr;
+	mgl::SceneJournal* Journal = nullptr;
+	bool preskinning = false;
+
+	// Views cycled with N, each drawing something other than the main scene.
+	enum Showcase { SHOW_SCENE, SHOW_VIRTUAL, SHOW_GLTF, SHOW_CHUNKED,
+		SHOWCASE_COUNT };
+	Showcase showcase = SHOW_SCENE;
+	mgl::VirtualMesh* Virtual = nullptr;
+	mgl::SceneGraph* GltfScene = nullptr;
+	mgl::ChunkedMesh* Chunked = nullptr;
+	mgl::SceneGraph* ChunkedScene = nullptr;
 
 	void createMeshes();
 	void createShaderPrograms();
 	void createCamera();
 	void createScene();
-	void drawScene();
+	void createCuller();
+	void createFrameGraph();
+	bool usePackets();
+	void createShowcase();
+	void drawShowcase();
+	void drawScene(double elapsed);
 };
 
 ///////////////////////////////////////////////////////////////////////// MESHES
@@ -103,6 +137,61 @@ void MyApp::createShaderPrograms() {
 	Shaders->create();
 
 	ModelMatrixId = Shaders->Uniforms[mgl::MODEL_MATRIX].index;
+
+	Permutations = new mgl::ShaderPermutations();
+	Permutations->addShader(GL_VERTEX_SHADER, "global-vs.glsl");
+	Permutations->addShader(GL_FRAGMENT_SHADER, "global-fs.glsl");
+	Permutations->addAttribute(mgl::POSITION_ATTRIBUTE, mgl::Mesh::POSITION);
+	Permutations->addAttribute(mgl::NORMAL_ATTRIBUTE, mgl::Mesh::NORMAL);
+	Permutations->addAttribute(mgl::TEXCOORD_ATTRIBUTE, mgl::Mesh::TEXCOORD);
+	Permutations->addAttribute(mgl::BONE_INDICES_ATTRIBUTE,
+		mgl::Mesh::BONE_INDICES);
+	Permutations->addAttribute(mgl::BONE_WEIGHTS_ATTRIBUTE,
+		mgl::Mesh::BONE_WEIGHTS);
+	Permutations->addUniformBlock(mgl::CAMERA_BLOCK, UBO_BP);
+	Permutations->addUniformBlock(mgl::OBJECT_BLOCK, OBJECT_BP,
+		mgl::PRECOMPUTED_MATRICES_FEATURE);
+	Permutations->addUniformBlock(mgl::BONES_BLOCK, BONES_BP,
+		mgl::SKINNED_FEATURE);
+	Permutations->addFeature(mgl::PRECOMPUTED_MATRICES_FEATURE,
+		mgl::PRECOMPUTED_MATRICES_DEFINE);
+	Permutations->addFeature(mgl::SKINNED_FEATURE, mgl::SKINNED_DEFINE);
+
+	DepthPermutations = new mgl::ShaderPermutations();
+	DepthPermutations->addShader(GL_VERTEX_SHADER, "depth-vs.glsl");
+	DepthPermutations->addShader(GL_FRAGMENT_SHADER, "depth-fs.glsl");
+	DepthPermutations->addAttribute(mgl::POSITION_ATTRIBUTE, mgl::Mesh::POSITION);
+	DepthPermutations->addAttribute(mgl::BONE_INDICES_ATTRIBUTE,
+		mgl::Mesh::BONE_INDICES);
+	DepthPermutations->addAttribute(mgl::BONE_WEIGHTS_ATTRIBUTE,
+		mgl::Mesh::BONE_WEIGHTS);
+	DepthPermutations->addUniformBlock(mgl::CAMERA_BLOCK, UBO_BP);
+	DepthPermutations->addUniformBlock(mgl::OBJECT_BLOCK, OBJECT_BP,
+		mgl::PRECOMPUTED_MATRICES_FEATURE);
+	DepthPermutations->addUniformBlock(mgl::BONES_BLOCK, BONES_BP,
+		mgl::SKINNED_FEATURE);
+	DepthPermutations->addFeature(mgl::PRECOMPUTED_MATRICES_FEATURE,
+		mgl::PRECOMPUTED_MATRICES_DEFINE);
+	DepthPermutations->addFeature(mgl::SKINNED_FEATURE, mgl::SKINNED_DEFINE);
+	DepthShaders = DepthPermutations->get(0);
+
+	if (mgl::Query::isSupported(GL_FRAGMENT_SHADER_INVOCATIONS_ARB)) {
+		Fragments = new mgl::Query(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+	}
+
+	if (mgl::GpuCuller::isSupported()) {
+		IndirectShaders = new mgl::ShaderProgram();
+		IndirectShaders->addShader(GL_VERTEX_SHADER, "indirect-vs.glsl");
+		IndirectShaders->addShader(GL_FRAGMENT_SHADER, "global-fs.glsl");
+		IndirectShaders->addAttribute(mgl::POSITION_ATTRIBUTE, mgl::Mesh::POSITION);
+		IndirectShaders->addAttribute(mgl::NORMAL_ATTRIBUTE, mgl::Mesh::NORMAL);
+		IndirectShaders->addAttribute(mgl::TEXCOORD_ATTRIBUTE, mgl::Mesh::TEXCOORD);
+		IndirectShaders->addAttribute(mgl::OBJECT_INDEX_ATTRIBUTE,
+			mgl::GpuCuller::OBJECT_INDEX);
+		IndirectShaders->addUniformBlock(mgl::CAMERA_BLOCK, UBO_BP);
+		IndirectShaders->addUniform("effect");
+		IndirectShaders->create();
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////// CAMERA
@@ -151,112 +240,343 @@ void MyApp::createScene() {
 	std::string glass_file = "glass.obj";
 	std::string table_file = "tableColor.obj";
 	std::string background_file = "backgroundPlain.obj";
-	mgl::Node* sceneRoot = new mgl::Node();
+	Scene = new mgl::SceneGraph();
+	mgl::SceneArena& arena = Scene->getArena();
+	mgl::Node* sceneRoot = arena.get(arena.createNode());
 
-	mgl::Node* tableNode = new mgl::Node();
-	mgl::Node* glassNode = new mgl::Node();
-	mgl::Node* backgroundPlainNode = new mgl::Node();
+	mgl::Node* tableNode = arena.get(arena.createNode());
+	mgl::Node* glassNode = arena.get(arena.createNode());
+	mgl::Node* backgroundPlainNode = arena.get(arena.createNode());
 
-	mgl::Mesh* table = new mgl::Mesh();
+	mgl::Mesh* table = arena.get(arena.createMesh());
 	table->joinIdenticalVertices();
 	table->create(mesh_dir + table_file);
-	table->setTransform(nullptr);
 	table->setEffect(0);
 	tableNode->setParent(sceneRoot);
 	tableNode->setMesh(table);
 	
 
-	mgl::Mesh* glass = new mgl::Mesh();
+	mgl::Mesh* glass = arena.get(arena.createMesh());
 	glass->joinIdenticalVertices();
 	glass->create(mesh_dir + glass_file);
-	glass->setTransform(nullptr);
 	glass->setEffect(1);
+	glass->setTransparent(true);
 	glassNode->setParent(tableNode);
 	glassNode->setMesh(glass);
 
-	mgl::Mesh* backgroundPlain = new mgl::Mesh();
-	mgl::Transform* transform = new mgl::Transform();
+	mgl::Mesh* backgroundPlain = arena.get(arena.createMesh());
+	mgl::Transform* transform = arena.get(arena.createTransform());
 	transform->setRotation(180, glm::vec3(0, 1, 0));
 	transform->setTranslate(glm::vec3(3, 0, 0));
-	transform->calculateModelMatrix();
 
 	backgroundPlain->joinIdenticalVertices();
 	backgroundPlain->create(mesh_dir + background_file);
-	backgroundPlain->setTransform(transform);
+	backgroundPlainNode->setTransform(transform);
 
 	backgroundPlain->setEffect(2);
 	backgroundPlainNode->setParent(sceneRoot);
 	backgroundPlainNode->setMesh(backgroundPlain);
 
 	// floor
-	mgl::Node* p2Node = new mgl::Node();
-	mgl::Mesh* p2 = new mgl::Mesh();
-	mgl::Transform* t2 = new mgl::Transform();
+	mgl::Node* p2Node = arena.get(arena.createNode());
+	mgl::Mesh* p2 = arena.get(arena.createMesh());
+	mgl::Transform* t2 = arena.get(arena.createTransform());
 	//t2->setRotation(90, glm::vec3(1, 0, 0));
 	//t2->setTranslate(glm::vec3(5, 0, 0));
 	t2->setScale(glm::vec3(1, 1, 2));
 
-	t2->calculateModelMatrix();
 	p2->joinIdenticalVertices();
 	p2->create(mesh_dir + "plane.obj");
-	p2->setTransform(t2);
+	p2Node->setTransform(t2);
 	p2->setEffect(3);
 	p2Node->setParent(sceneRoot);
 	p2Node->setMesh(p2);
 
 	// wall right
-	mgl::Node* p3Node = new mgl::Node();
-	mgl::Mesh* p3 = new mgl::Mesh();
-	mgl::Transform* t3 = new mgl::Transform();
+	mgl::Node* p3Node = arena.get(arena.createNode());
+	mgl::Mesh* p3 = arena.get(arena.createMesh());
+	mgl::Transform* t3 = arena.get(arena.createTransform());
 	t3->setRotation(90, glm::vec3(1, 0, 0));
 	t3->setTranslate(glm::vec3(0, 0, -2));
 	t3->setScale(glm::vec3(1, 1, 2));
 
-	t3->calculateModelMatrix();
 	p3->joinIdenticalVertices();
 	p3->create(mesh_dir + "plane.obj");
-	p3->setTransform(t3);
+	p3Node->setTransform(t3);
 	p3->setEffect(2);
 	p3Node->setParent(sceneRoot);
 	p3Node->setMesh(p3);
-	Scene = new mgl::SceneGraph();
 	Scene->setRoot(sceneRoot);
-	Scene->save(".\\scene.json");
-	//Scene->load(".\\scene.json");
+	Scene->setDepthShaders(DepthShaders);
+
+	// Animated meshes play their first clip.
+	Animator = new mgl::Animator(BONES_BP);
+	Animator->build(Scene);
+	Animator->play(0);
+	mgl::PermutationKey skinned =
+		Animator->size() > 0 ? mgl::SKINNED_FEATURE : 0;
+	for (int effect = 0; effect < 4; effect++) {
+		Permutations->request(mgl::ShaderPermutations::makeKey(effect,
+			mgl::PRECOMPUTED_MATRICES_FEATURE));
+		if (skinned) {
+			Permutations->request(mgl::ShaderPermutations::makeKey(effect,
+				mgl::PRECOMPUTED_MATRICES_FEATURE | skinned));
+		}
+	}
+	DepthPermutations->request(mgl::ShaderPermutations::makeKey(-1,
+		mgl::PRECOMPUTED_MATRICES_FEATURE | skinned));
+	// The first save writes the whole scene, later ones only the changes.
+	Journal = new mgl::SceneJournal(*Scene, ".\\scene.mgls");
+	Journal->save();
+	//Journal->load();
+	//Scene->save(".\\scene.json", &mgl::Engine::getInstance().getJobs());
 	//Scene->draw();
 }
 
+void MyApp::createCuller() {
+	if (IndirectShaders == nullptr) return;
+	mgl::Engine& engine = mgl::Engine::getInstance();
+	Culler = new mgl::GpuCuller();
+	Culler->build(Scene);
+	Culler->resize(engine.WindowWidth, engine.WindowHeight);
+}
+
+// CPU side of a frame as jobs, filling the frame packet being written: only
+// the GL calls in drawScene stay on the main thread. Each stage splits its
+// own work over the jobs; animation does not depend on the scene stages and
+// runs alongside them.
+void MyApp::createFrameGraph() {
+	Pipeline = new mgl::FramePipeline(OBJECT_BP);
+
+	mgl::JobSystem* jobs = &mgl::Engine::getInstance().getJobs();
+	mgl::TaskGraph::TaskId update = FrameGraph.add([this, jobs] {
+		Scene->update(jobs);
+	});
+	mgl::TaskGraph::TaskId cull = FrameGraph.add([this, jobs] {
+		Scene->cull(FrameViewProjection, jobs);
+	});
+	mgl::TaskGraph::TaskId clear = FrameGraph.add([this] {
+		Packet->queue.clear();
+	});
+	mgl::TaskGraph::TaskId build = FrameGraph.add([this, jobs] {
+		Scene->submit(Packet->queue,
+			precomputeMatrices ? mgl::PRECOMPUTED_MATRICES_FEATURE : 0, jobs);
+	});
+	mgl::TaskGraph::TaskId sort = FrameGraph.add([this, jobs] {
+		Packet->queue.sort(jobs);
+	});
+	mgl::TaskGraph::TaskId prepare = FrameGraph.add([this] {
+		if (precomputeMatrices) {
+			Packet->queue.prepare(&Packet->batch, FrameViewProjection);
+		}
+	});
+	// Bone palettes are sampled into the packet; the GL thread uploads them.
+	FrameGraph.add([this, jobs] {
+		Animator->update(Packet->elapsed, Packet->palettes, jobs);
+	});
+	FrameGraph.precede(update, cull);
+	FrameGraph.precede(cull, build);
+	FrameGraph.precede(clear, build);
+	FrameGraph.precede(build, sort);
+	FrameGraph.precede(sort, prepare);
+}
+
+// The threaded update only supports the render queue path. Called from both
+// threads: the flags it reads are atomic.
+bool MyApp::usePackets() {
+	return mgl::Engine::getInstance().getThreadedUpdate() ||
+		(usePermutations && !(gpuCulling && Culler != nullptr));
+}
+
+///////////////////////////////////////////////////////////////////////// UPDATE
+
+// Runs on the update thread in threaded mode, while the GL thread draws the
+// previous packet; waiting for a free packet paces it to the renderer.
+void MyApp::updateCallback(GLFWwindow* win, double elapsed) {
+	if (!usePackets()) return;
+	mgl::FramePacket* packet = Pipeline->beginWrite(100);
+	if (packet == nullptr) return;
+	{
+		mgl::Engine& engine = mgl::Engine::getInstance();
+		std::lock_guard<std::mutex> lock(engine.getSimulationMutex());
+		packet->elapsed = elapsed;
+		packet->viewMatrix = Camera->getViewMatrix();
+		packet->projectionMatrix = Camera->getProjectionMatrix();
+		packet->queue.setDepthShaders(DepthPermutations);
+		packet->queue.setDepthPrepass(Scene->getDepthPrepass());
+		FrameViewProjection = packet->projectionMatrix * packet->viewMatrix;
+		Packet = packet;
+		FrameGraph.run(engine.getJobs());
+		Packet = nullptr;
+	}
+	Pipeline->endWrite();
+}
+
 /////////////////////////////////////////////////////////////////////////// DRAW
 
 glm::mat4 ModelMatrix(1.0f);
-void MyApp::drawScene() {
+void MyApp::drawScene(double elapsed) {
 	static double time = 0.0;
 
+	// Bone palettes come sampled with the packet, or are sampled here on the
+	// jobs when no packets are used; either way uploaded once per frame.
+	const bool packets = usePackets();
+	mgl::FramePacket* packet = packets ? Pipeline->acquire() : nullptr;
+	if (packet != nullptr) {
+		Animator->upload(packet->palettes);
+	}
+	else if (!packets) {
+		Animator->update(elapsed, &mgl::Engine::getInstance().getJobs());
+		Animator->upload();
+	}
+	Animator->preskin();
+
+	if (Fragments != nullptr) Fragments->begin();
+	if (showcase != SHOW_SCENE) {
+		drawShowcase();
+	}
+	else if (packets) {
+		if (packet != nullptr) {
+			Camera->uploadMatrices(packet->viewMatrix, packet->projectionMatrix);
+			packet->queue.draw(Permutations, &mgl::Engine::getInstance().getJobs());
+			DrawnQueue = &packet->queue;
+		}
+	}
+	else if (gpuCulling && Culler != nullptr) {
+		Scene->update();
+		Culler->updateObjects();
+		Culler->cull(Camera);
+		IndirectShaders->bind();
+		Culler->draw(IndirectShaders);
+		IndirectShaders->unbind();
+		Culler->updateHiZ();
+	}
+	else {
+		Scene->cull(Camera->getProjectionMatrix() * Camera->getViewMatrix());
+		Shaders->bind();
+		glUniformMatrix4fv(ModelMatrixId, 1, GL_FALSE, glm::value_ptr(ModelMatrix));
+		Scene->draw(Shaders);
+		//Mesh->draw();
+		Shaders->unbind();
+	}
+	if (Fragments != nullptr) Fragments->end();
+
+	time += 0.1;
+}
+
+
+/////////////////////////////////////////////////////////////////////// SHOWCASE
+
+// Built on first use, each in a scene of its own so that the main scene and
+// the packets drawn from it are left alone: the glass as a virtual mesh,
+// the main scene saved to and read back from a .glb file, and the table
+// ingested into a chunk file and streamed around the camera.
+void MyApp::createShowcase() {
+	mgl::Engine& engine = mgl::Engine::getInstance();
+	mgl::JobSystem* jobs = &engine.getJobs();
+	if (showcase == SHOW_VIRTUAL && Virtual == nullptr) {
+		Virtual = new mgl::VirtualMesh();
+		Virtual->build(*Mesh, jobs);
+		Virtual->createBufferObjects();
+		std::cout << "Virtual mesh: " << Virtual->getClusters().size()
+			<< " clusters in " << Virtual->getLevelCount() << " levels"
+			<< std::endl;
+	}
+	else if (showcase == SHOW_GLTF && GltfScene == nullptr) {
+		const std::string path = ".\\scene.glb";
+		bool saved;
+		{
+			std::lock_guard<std::mutex> lock(engine.getSimulationMutex());
+			saved = mgl::GltfFile::save(*Scene, path, jobs);
+		}
+		GltfScene = new mgl::SceneGraph();
+		if (!saved || !mgl::GltfFile::load(*GltfScene, path, jobs)) {
+			std::cerr << "WARNING: glTF round trip through " << path
+				<< " failed." << std::endl;
+			delete GltfScene;
+			GltfScene = nullptr;
+		}
+	}
+	else if (showcase == SHOW_CHUNKED && Chunked == nullptr) {
+		const std::string source = ".\\assets\\models\\tableColor.obj";
+		const std::string path = ".\\tableColor.mglc";
+		Chunked = new mgl::ChunkedMesh();
+		if (!Chunked->open(path) &&
+			!(mgl::ChunkedMesh::ingest(source, path) && Chunked->open(path))) {
+			std::cerr << "WARNING: could not make chunks of " << source
+				<< std::endl;
+			delete Chunked;
+			Chunked = nullptr;
+			return;
+		}
+		ChunkedScene = new mgl::SceneGraph();
+		mgl::SceneArena& arena = ChunkedScene->getArena();
+		mgl::Node* root = arena.get(arena.createNode());
+		ChunkedScene->setRoot(root);
+		Chunked->attach(*ChunkedScene, root);
+		std::cout << "Chunked mesh: " << Chunked->getChunkCount() << " chunks"
+			<< std::endl;
+	}
+}
+
+// Drawn with the plain program, from the camera as it is now.
+void MyApp::drawShowcase() {
+	mgl::Engine& engine = mgl::Engine::getInstance();
+	mgl::JobSystem* jobs = &engine.getJobs();
+	const glm::mat4 view = Camera->getViewMatrix();
+	const glm::mat4 projection = Camera->getProjectionMatrix();
+	Camera->uploadMatrices(view, projection);
+	if (showcase == SHOW_VIRTUAL && Virtual != nullptr) {
+		Virtual->select(view * ModelMatrix, projection,
+			static_cast<float>(engine.WindowHeight), 1.f, jobs);
+	}
+	else if (showcase == SHOW_GLTF && GltfScene != nullptr) {
+		GltfScene->cull(projection * view, jobs);
+	}
+	else if (showcase == SHOW_CHUNKED && Chunked != nullptr) {
+		Chunked->update(glm::vec3(glm::inverse(view)[3]),
+			mgl::ChunkedMesh::MEMORY_BUDGET);
+		ChunkedScene->cull(projection * view, jobs);
+	}
+
 	Shaders->bind();
 	glUniformMatrix4fv(ModelMatrixId, 1, GL_FALSE, glm::value_ptr(ModelMatrix));
-	Scene->draw(Shaders);
-	//Mesh->draw();
+	if (showcase == SHOW_VIRTUAL && Virtual != nullptr) {
+		Virtual->draw();
+	}
+	else if (showcase == SHOW_GLTF && GltfScene != nullptr) {
+		GltfScene->draw(Shaders);
+	}
+	else if (showcase == SHOW_CHUNKED && Chunked != nullptr) {
+		ChunkedScene->draw(Shaders);
+	}
 	Shaders->unbind();
-
-	time += 0.1;
 }
 
 
 ////////////////////////////////////////////////////////////////////// CALLBACKS
 
 void MyApp::initCallback(GLFWwindow* win) {
+	mgl::ShaderProgram::setCacheDirectory(".\\shadercache\\");
 	createMeshes();
 	createShaderPrograms();  // after mesh;
 	createCamera();
 	createScene();
+	createCuller();
+	createFrameGraph();
 }
 
 void MyApp::windowSizeCallback(GLFWwindow* win, int winx, int winy) {
 	glViewport(0, 0, winx, winy);
 	// change projection matrices to maintain aspect ratio
+	if (Culler != nullptr) {
+		Culler->resize(winx, winy);
+	}
 }
 
-void MyApp::displayCallback(GLFWwindow* win, double elapsed) { drawScene(); }
+void MyApp::displayCallback(GLFWwindow* win, double elapsed) {
+	drawScene(elapsed);
+}
 
 void MyApp::keyCallback(GLFWwindow* window, int key, int scancode, int action,
 	int mods) {
@@ -280,6 +600,66 @@ void MyApp::keyCallback(GLFWwindow* window, int key, int scancode, int action,
 		}
 	}
 
+	if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
+		Scene->setDepthPrepass(!Scene->getDepthPrepass());
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+		mgl::Engine& engine = mgl::Engine::getInstance();
+		engine.setThreadedUpdate(!engine.getThreadedUpdate());
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS) {
+		usePermutations = !usePermutations;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) {
+		precomputeMatrices = !precomputeMatrices;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && Fragments != nullptr) {
+		std::cout << "Fragment shader invocations: " << Fragments->getResult()
+			<< (Scene->getDepthPrepass() ? " (depth pre-pass)" : "") << std::endl;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+		preskinning = !preskinning;
+		Animator->setPreskinned(preskinning);
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && DrawnQueue != nullptr) {
+		std::cout << "Commands: " << DrawnQueue->getCommandCount()
+			<< ", record " << DrawnQueue->getRecordTime() << " ms, replay "
+			<< DrawnQueue->getReplayTime() << " ms" << std::endl;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS && Journal != nullptr) {
+		Journal->save();
+		std::cout << "Journal: " << Journal->getLastEntryCount()
+			<< " entries saved, " << Journal->getJournalSize() << " bytes"
+			<< std::endl;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) {
+		static const char* names[SHOWCASE_COUNT] = { "scene", "virtual mesh",
+			"glTF round trip", "chunked mesh" };
+		showcase = static_cast<Showcase>((showcase + 1) % SHOWCASE_COUNT);
+		createShowcase();
+		std::cout << "View: " << names[showcase] << std::endl;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && Culler != nullptr) {
+		gpuCulling = !gpuCulling;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && Culler != nullptr) {
+		Culler->setOcclusion(!Culler->getOcclusion());
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS && gpuCulling) {
+		Culler->verify(Camera);
+	}
+
 	glm::vec3 v = glm::normalize(Camera->getViewMatrixInfo().Eye);
 	glm::vec3 s = glm::normalize(glm::cross(v, Camera->getViewMatrixInfo().Up));
 	glm::vec3 u = glm::normalize(glm::cross(s, v));
@@ -13,13 +13,36 @@
 #include <GLFW/glfw3.h>
 
 #include "./mglApp.hpp"
+#include "./mglAssetStore.hpp"
 #include "./mglCamera.hpp"
+#include "./mglChunkedMesh.hpp"
+#include "./mglCommandList.hpp"
+#include "./mglCompression.hpp"
 #include "./mglConventions.hpp"
+#include "./mglCuller.hpp"
 #include "./mglError.hpp"
+#include "./mglFlatScene.hpp"
+#include "./mglFramePipeline.hpp"
+#include "./mglGltfFile.hpp"
+#include "./mglJobs.hpp"
+#include "./mglMappedFile.hpp"
+#include "./mglMatrixBatch.hpp"
 #include "./mglMesh.hpp"
+#include "./mglPermutations.hpp"
+#include "./mglPool.hpp"
+#include "./mglQuery.hpp"
+#include "./mglRenderQueue.hpp"
+#include "./mglSceneFile.hpp"
+#include "./mglSceneJournal.hpp"
+#include "./mglSceneReader.hpp"
+#include "./mglSceneWriter.hpp"
 #include "./mglScenegraph.hpp"
 #include "./mglShader.hpp"
+#include "./mglSkinning.hpp"
+#include "./mglSimd.hpp"
 #include "./mglTransform.hpp"
+#include "./mglTransformBatch.hpp"
+#include "./mglVirtualMesh.hpp"
 
 
 #endif /* MGL_HPP */
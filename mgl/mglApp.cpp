@@ -61,6 +61,9 @@ Engine::Engine(void) {
   WindowWidth = 640, WindowHeight = 480;
   GlMajor = 3, GlMinor = 3;
   Fullscreen = 0, Vsync = 0;
+  Jobs = nullptr;
+  ThreadedUpdate = false;
+  UpdateRunning = false;
   WindowTitle = "OpenGL App GLFW Window 2023(c) Carlos Martinho";
 }
 
@@ -75,6 +78,15 @@ App *Engine::getApp(void) { return GlApp; }
 
 void Engine::setApp(App *app) { GlApp = app; }
 
+JobSystem &Engine::getJobs() { return *Jobs; }
+
+// Takes effect at the start of the next frame.
+void Engine::setThreadedUpdate(bool threaded) { ThreadedUpdate = threaded; }
+
+bool Engine::getThreadedUpdate() { return ThreadedUpdate; }
+
+std::mutex &Engine::getSimulationMutex() { return SimulationMutex; }
+
 void Engine::setOpenGL(int major, int minor) {
   GlMajor = major;
   GlMinor = minor;
@@ -164,7 +176,9 @@ void Engine::setupOpenGL() {
   glViewport(0, 0, WindowWidth, WindowHeight);
 }
 
+// The job system is created on the GL thread, which becomes its worker 0.
 void Engine::init() {
+  Jobs = new JobSystem();
   setupGLFW();
   setupGLEW();
   setupOpenGL();
@@ -177,19 +191,61 @@ void Engine::init() {
 
 //////////////////////////////////////////////////////////////////////////// RUN
 
+void Engine::startUpdateThread() {
+  UpdateRunning = true;
+  UpdateThread = std::thread(&Engine::updateLoop, this);
+}
+
+void Engine::stopUpdateThread() {
+  if (!UpdateThread.joinable()) return;
+  UpdateRunning = false;
+  UpdateThread.join();
+}
+
+// The app paces this loop, typically by waiting for a free frame packet.
+// The thread gets its own job queue, so its tasks never run on the GL thread.
+void Engine::updateLoop() {
+  Jobs->registerThread();
+  double last_time = glfwGetTime();
+  while (UpdateRunning) {
+    double time = glfwGetTime();
+    double elapsed_time = time - last_time;
+    last_time = time;
+    GlApp->updateCallback(Window, elapsed_time);
+  }
+  Jobs->unregisterThread();
+}
+
 void Engine::run() {
   double last_time = glfwGetTime();
   while (!glfwWindowShouldClose(Window)) {
+    if (ThreadedUpdate != UpdateThread.joinable()) {
+      if (ThreadedUpdate) {
+        startUpdateThread();
+      } else {
+        stopUpdateThread();
+      }
+    }
     double time = glfwGetTime();
     double elapsed_time = time - last_time;
     last_time = time;
+    if (!UpdateThread.joinable()) {
+      GlApp->updateCallback(Window, elapsed_time);
+    }
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     GlApp->displayCallback(Window, elapsed_time);
     glfwSwapBuffers(Window);
+    // Input callbacks run from here and must not overlap the update thread.
+    std::lock_guard<std::mutex> lock(SimulationMutex);
     glfwPollEvents();
   }
+  stopUpdateThread();
   glfwDestroyWindow(Window);
   glfwTerminate();
+  delete Jobs;
+  Jobs = nullptr;
+  ThreadedUpdate = false;
+  UpdateRunning = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -12,7 +12,12 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <atomic>
 #include <glm/glm.hpp>
+#include <mutex>
+#include <thread>
+
+#include "mglJobs.hpp"
 
 namespace mgl {
 
@@ -20,10 +25,17 @@ class App;
 class Engine;
 
 //////////////////////////////////////////////////////////////////////////// App
+//
+// updateCallback() runs the scene logic of a frame. It is called right
+// before displayCallback(), or on its own thread when the engine's threaded
+// update is on. It then runs alongside displayCallback(), must not make GL
+// calls, and should hold getSimulationMutex() while touching state that
+// the input callbacks change.
 
 class App {
  public:
   virtual void initCallback(GLFWwindow *window) {}
+  virtual void updateCallback(GLFWwindow *window, double elapsed) {}
   virtual void displayCallback(GLFWwindow *window, double elapsed) {}
   virtual void windowCloseCallback(GLFWwindow *window) {}
   virtual void windowSizeCallback(GLFWwindow *window, int width, int height) {}
@@ -52,6 +64,10 @@ class Engine {
                  int vsync);
   void init();
   void run();
+  JobSystem &getJobs();
+  void setThreadedUpdate(bool threaded);
+  bool getThreadedUpdate();
+  std::mutex &getSimulationMutex();
 
  protected:
   virtual ~Engine();
@@ -64,12 +80,20 @@ class Engine {
   const char *WindowTitle;
   int Fullscreen;
   int Vsync;
+  JobSystem *Jobs;
+  std::atomic<bool> ThreadedUpdate;
+  std::thread UpdateThread;
+  std::atomic<bool> UpdateRunning;
+  std::mutex SimulationMutex;
 
   void setupWindow();
   void setupGLFW();
   void setupGLEW();
   void setupOpenGL();
   void setupCallbacks();
+  void startUpdateThread();
+  void stopUpdateThread();
+  void updateLoop();
 
  public:
   Engine(Engine const &) = delete;
@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Asset Store Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglAssetStore.hpp"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "./mglHash.hpp"
+#include "./mglJobs.hpp"
+#include "./mglMappedFile.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+///////////////////////////////////////////////////////////////////// AssetStore
+
+static bool makeDirectory(const std::string &path) {
+#ifdef _WIN32
+  _mkdir(path.c_str());
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR) != 0;
+}
+
+AssetStore::AssetStore() {}
+
+bool AssetStore::open(const std::string &directory) {
+  Directory = directory;
+  while (Directory.size() > 1 &&
+         (Directory.back() == '/' || Directory.back() == '\\')) {
+    Directory.pop_back();
+  }
+  Stored.clear();
+  Imports.clear();
+  Cache.clear();
+  if (!makeDirectory(Directory)) {
+    std::cerr << "WARNING: could not open asset store " << Directory
+              << std::endl;
+    return false;
+  }
+  std::ifstream index(getIndexPath());
+  uint64_t key, hash;
+  while (index >> std::hex >> key >> hash) Imports[key] = hash;
+  return true;
+}
+
+const std::string &AssetStore::getDirectory() const { return Directory; }
+
+std::string AssetStore::getPath(uint64_t hash) const {
+  return Directory + "/" + hashToString(hash) + ".mesh";
+}
+
+std::string AssetStore::getIndexPath() const {
+  return Directory + "/imports.txt";
+}
+
+bool AssetStore::contains(uint64_t hash) {
+  if (Stored.count(hash) != 0) return true;
+  if (!std::ifstream(getPath(hash), std::ios::binary)) return false;
+  Stored.insert(hash);
+  return true;
+}
+
+// True when the file holds exactly that header and blob.
+static bool holds(const std::string &path, const AssetStore::Header &header,
+                  const std::vector<unsigned char> &blob) {
+  MappedFile file;
+  return file.open(path) && file.size() == sizeof(header) + blob.size() &&
+         std::memcmp(file.data(), &header, sizeof(header)) == 0 &&
+         std::memcmp(file.data() + sizeof(header), blob.data(),
+                     blob.size()) == 0;
+}
+
+// Written aside and renamed into place, so that a crash never leaves a torn
+// file under a hash. A file already stored under the hash is only reused
+// when its record and bytes are those of the mesh: two meshes whose hashes
+// collide cannot both be stored. Returns 0 when the mesh could not be stored.
+uint64_t AssetStore::add(Mesh &mesh) {
+  uint64_t hash = mesh.getContentHash();
+  Header header = {MAGIC, VERSION, 0, SceneFile::describe(mesh, true)};
+  header.mesh.blobOffset = sizeof(Header);
+  std::vector<unsigned char> blob;
+  SceneFile::writeBlob(mesh, header.mesh, blob);
+  header.checksum = checksum64(blob.data(), blob.size());
+
+  const std::string path = getPath(hash);
+  if (contains(hash)) {
+    if (holds(path, header, blob)) return hash;
+    std::cerr << "WARNING: asset " << path
+              << " holds other geometry with the same hash" << std::endl;
+    return 0;
+  }
+  const std::string temporary = path + ".tmp";
+  std::ofstream o(temporary, std::ios::binary | std::ios::trunc);
+  o.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  o.write(reinterpret_cast<const char *>(blob.data()), blob.size());
+  o.close();
+  if (!o || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    if (!contains(hash) || !holds(path, header, blob)) {
+      std::cerr << "WARNING: could not write asset " << path << std::endl;
+      return 0;
+    }
+  }
+  Stored.insert(hash);
+  return hash;
+}
+
+// Loads the geometry into a new source mesh with its own GL objects.
+std::shared_ptr<Mesh> AssetStore::read(uint64_t hash) {
+  const std::string path = getPath(hash);
+  MappedFile file;
+  if (!file.open(path)) return nullptr;
+  Header header;
+  if (file.size() < sizeof(Header)) {
+    std::cerr << "WARNING: invalid asset " << path << std::endl;
+    return nullptr;
+  }
+  std::memcpy(&header, file.data(), sizeof(Header));
+  const SceneFile::MeshRecord &m = header.mesh;
+  const unsigned char *blob = file.data() + sizeof(Header);
+  if (header.magic != MAGIC || header.version != VERSION || m.hash != hash ||
+      (m.flags & SceneFile::EMBEDDED) == 0 ||
+      (m.flags & SceneFile::COMPRESSED) != 0 ||
+      m.blobOffset != sizeof(Header) ||
+      m.blobSize != file.size() - sizeof(Header) ||
+      checksum64(blob, static_cast<size_t>(m.blobSize)) != header.checksum ||
+      !SceneFile::checkBlob(m, blob)) {
+    std::cerr << "WARNING: invalid asset " << path << std::endl;
+    return nullptr;
+  }
+
+  std::shared_ptr<Mesh> source = std::make_shared<Mesh>();
+  SceneFile::readBlob(blob, m, *source);
+  source->ContentHash = hash;
+  Mesh::createBufferObjects(std::vector<Mesh *>(1, source.get()));
+  Stored.insert(hash);
+  return source;
+}
+
+bool AssetStore::resolve(uint64_t hash, Mesh &mesh) {
+  std::weak_ptr<Mesh> &entry = Cache[hash];
+  std::shared_ptr<Mesh> source = entry.lock();
+  if (!source) {
+    source = read(hash);
+    if (!source) {
+      Cache.erase(hash);
+      return false;
+    }
+    entry = source;
+  }
+  mesh.share(source);
+  return true;
+}
+
+SceneFile::MeshResolver AssetStore::resolver() {
+  return [this](uint64_t hash, Mesh &mesh) { return resolve(hash, mesh); };
+}
+
+// Sources are keyed by their bytes and the Assimp flags of the mesh, which
+// change what the import produces. Skinned meshes are neither stored nor
+// shared: they are imported again into the mesh itself.
+bool AssetStore::import(Mesh &mesh, const std::string &filename) {
+  uint64_t key;
+  {
+    MappedFile source;
+    if (!source.open(filename)) {
+      std::cerr << "WARNING: could not open " << filename << std::endl;
+      return false;
+    }
+    key = checksum64(source.data(), source.size(),
+                     hash64(&mesh.AssimpFlags, sizeof(mesh.AssimpFlags)));
+  }
+  std::unordered_map<uint64_t, uint64_t>::iterator found = Imports.find(key);
+  if (found != Imports.end() && resolve(found->second, mesh)) return true;
+
+  std::shared_ptr<Mesh> imported = std::make_shared<Mesh>();
+  imported->setAssimpFlags(mesh.AssimpFlags);
+  imported->create(filename);
+  if (imported->hasBones()) {
+    mesh.create(filename);
+    return true;
+  }
+  uint64_t hash = add(*imported);
+  if (hash == 0) {
+    mesh.share(imported);
+    return true;
+  }
+  std::weak_ptr<Mesh> &entry = Cache[hash];
+  std::shared_ptr<Mesh> cached = entry.lock();
+  if (cached) {
+    imported = cached;
+  } else {
+    entry = imported;
+  }
+  mesh.share(imported);
+
+  Imports[key] = hash;
+  std::ofstream index(getIndexPath(), std::ios::app);
+  index << std::hex << std::setfill('0') << std::setw(16) << key << ' '
+        << std::setw(16) << hash << '\n';
+  if (!index) {
+    std::cerr << "WARNING: could not append to " << getIndexPath()
+              << std::endl;
+  }
+  return true;
+}
+
+// Content hashes of meshes not hashed yet are computed in parallel, each
+// mesh once however many nodes use it.
+bool AssetStore::save(SceneGraph &scene, const std::string &path,
+                      JobSystem *jobs) {
+  std::vector<Mesh *> meshes;
+  std::unordered_set<Mesh *> seen;
+  std::vector<Node *> queue(1, &scene.getRoot());
+  for (size_t i = 0; i < queue.size(); i++) {
+    Mesh *mesh = queue[i]->getMesh();
+    if (mesh != nullptr && seen.insert(mesh).second) meshes.push_back(mesh);
+    for (Node *child : queue[i]->getChildren()) queue.push_back(child);
+  }
+  auto hash = [&meshes](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) meshes[i]->getContentHash();
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, meshes.size(), 1, hash);
+  } else {
+    hash(0, meshes.size());
+  }
+  for (Mesh *mesh : meshes) {
+    if (add(*mesh) == 0) return false;
+  }
+  return SceneFile::save(scene, path, false, false, jobs);
+}
+
+bool AssetStore::load(SceneGraph &scene, const std::string &path,
+                      JobSystem *jobs) {
+  return SceneFile::load(scene, path, resolver(), jobs);
+}
+
+size_t AssetStore::getCachedCount() {
+  for (auto i = Cache.begin(); i != Cache.end();) {
+    i = i->second.expired() ? Cache.erase(i) : std::next(i);
+  }
+  return Cache.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
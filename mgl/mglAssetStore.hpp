@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Asset Store Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_ASSET_STORE_HPP
+#define MGL_ASSET_STORE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mglSceneFile.hpp"
+
+namespace mgl {
+
+class AssetStore;
+class JobSystem;
+class Mesh;
+class SceneGraph;
+
+///////////////////////////////////////////////////////////////////// AssetStore
+//
+// Local content-addressed store for mesh geometry. Each mesh is kept once,
+// in a file named after its content hash holding a SceneFile mesh record and
+// blob, so scenes saved through the store hold hashes only and identical
+// geometry is stored once, whatever the scene or node it came from.
+//
+// Meshes resolved from the store share their GL objects: the first one
+// loads the geometry into a source mesh, later ones with the same hash, in
+// any open scene, draw from it (Mesh::share). The source goes away with the
+// last mesh using it. Source files imported through the store are indexed
+// by their bytes and Assimp flags, so a model is only run through Assimp
+// the first time it is seen.
+
+class AssetStore {
+ public:
+  static const uint32_t MAGIC = 0x414c474d;  // "MGLA"
+  static const uint32_t VERSION = 1;
+
+  // Followed by the blob. The checksum is the checksum64 of the blob.
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t checksum;
+    SceneFile::MeshRecord mesh;
+  };
+
+  AssetStore();
+
+  // Creates the directory when missing and reads its import index.
+  bool open(const std::string &directory);
+  const std::string &getDirectory() const;
+
+  // Stores the geometry under its content hash unless already stored, and
+  // returns the hash, or 0 when it could not be written.
+  uint64_t add(Mesh &mesh);
+  bool contains(uint64_t hash);
+  bool resolve(uint64_t hash, Mesh &mesh);
+  SceneFile::MeshResolver resolver();
+  bool import(Mesh &mesh, const std::string &filename);
+
+  // Scene files holding hashes only, their meshes added to the store.
+  bool save(SceneGraph &scene, const std::string &path,
+            JobSystem *jobs = nullptr);
+  bool load(SceneGraph &scene, const std::string &path,
+            JobSystem *jobs = nullptr);
+
+  // Geometry currently shared with open meshes.
+  size_t getCachedCount();
+
+ private:
+  std::string Directory;
+  std::unordered_set<uint64_t> Stored;
+  std::unordered_map<uint64_t, uint64_t> Imports;  // source key to hash
+  std::unordered_map<uint64_t, std::weak_ptr<Mesh>> Cache;
+
+  std::string getPath(uint64_t hash) const;
+  std::string getIndexPath() const;
+  std::shared_ptr<Mesh> read(uint64_t hash);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_ASSET_STORE_HPP */
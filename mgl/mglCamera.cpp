@@ -48,6 +48,16 @@ void Camera::setProjectionMatrix(const glm::mat4 &projectionmatrix) {
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
+// Writes a snapshot (e.g. from a frame packet) to the uniform buffer only,
+// leaving the camera's own state untouched.
+void Camera::uploadMatrices(const glm::mat4 &view,
+                            const glm::mat4 &projection) {
+  glm::mat4 matrices[2] = {view, projection};
+  glBindBuffer(GL_UNIFORM_BUFFER, UboId);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(matrices), matrices);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
 ProjectionType Camera::getProjectionType() { return projectionType; }
 
 void Camera::setProjectionType(ProjectionType p) {
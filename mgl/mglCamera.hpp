@@ -58,6 +58,7 @@ public:
   void setViewMatrix(const glm::mat4 &viewmatrix);
   glm::mat4 getProjectionMatrix();
   void setProjectionMatrix(const glm::mat4 &projectionmatrix);
+  void uploadMatrices(const glm::mat4 &view, const glm::mat4 &projection);
   ProjectionType getProjectionType();
   void setProjectionType(ProjectionType);
   ViewType getViewType();
@@ -0,0 +1,990 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Chunked Mesh Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglChunkedMesh.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include "./mglHash.hpp"
+#include "./mglMesh.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+const uint32_t ChunkedMesh::MAGIC;
+const uint32_t ChunkedMesh::VERSION;
+const size_t ChunkedMesh::MAX_TRIANGLES;
+const size_t ChunkedMesh::MEMORY_BUDGET;
+
+//////////////////////////////////////////////////////////////// Source Reading
+
+// Buffered sequential reader, so the source is never held in memory. The
+// buffer only grows for a line longer than itself.
+struct ChunkSource {
+  std::ifstream in;
+  std::vector<char> buffer;
+  size_t begin = 0, end = 0;
+  uint64_t start = 0;  // file offset of buffer[0]
+
+  bool open(const std::string &path) {
+    in.open(path, std::ios::binary);
+    buffer.resize(1 << 20);
+    return in.is_open();
+  }
+
+  bool fill() {
+    if (begin > 0) {
+      std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+      start += begin;
+      end -= begin;
+      begin = 0;
+    }
+    if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+    in.read(buffer.data() + end, buffer.size() - end);
+    size_t got = static_cast<size_t>(in.gcount());
+    end += got;
+    return got > 0;
+  }
+
+  // Without the line terminator. False at the end of the file.
+  bool line(std::string &out) {
+    for (size_t scanned = 0;;) {
+      const char *from = buffer.data() + begin;
+      const char *newline = static_cast<const char *>(
+          std::memchr(from + scanned, '\n', end - begin - scanned));
+      if (newline != nullptr) {
+        size_t length = newline - from;
+        out.assign(from, length > 0 && newline[-1] == '\r' ? length - 1
+                                                            : length);
+        begin += length + 1;
+        return true;
+      }
+      scanned = end - begin;
+      if (fill()) continue;
+      if (begin == end) return false;
+      out.assign(buffer.data() + begin, end - begin);
+      begin = end;
+      return true;
+    }
+  }
+
+  bool bytes(void *out, size_t size) {
+    while (end - begin < size) {
+      if (!fill()) return false;
+    }
+    std::memcpy(out, buffer.data() + begin, size);
+    begin += size;
+    return true;
+  }
+
+  uint64_t tell() const { return start + begin; }
+
+  void seek(uint64_t offset) {
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset));
+    start = offset;
+    begin = end = 0;
+  }
+};
+
+// Vertices as packed floats: a position, then a normal when the source has
+// them. Written through a buffer and mapped once complete.
+struct ChunkVertices {
+  std::ofstream out;
+  std::vector<float> buffer;
+  uint64_t count = 0;
+  size_t stride = 3;
+  glm::vec3 boundsMin = glm::vec3(0.f), boundsMax = glm::vec3(0.f);
+
+  void add(const float *values) {
+    glm::vec3 p(values[0], values[1], values[2]);
+    boundsMin = count == 0 ? p : glm::min(boundsMin, p);
+    boundsMax = count == 0 ? p : glm::max(boundsMax, p);
+    buffer.insert(buffer.end(), values, values + stride);
+    if (buffer.size() >= (1 << 18)) flush();
+    count++;
+  }
+
+  void flush() {
+    out.write(reinterpret_cast<const char *>(buffer.data()),
+              buffer.size() * sizeof(float));
+    buffer.clear();
+  }
+};
+
+static const char *skipSpaces(const char *s) {
+  while (*s == ' ' || *s == '\t') s++;
+  return s;
+}
+
+// OBJ keeps positions on "v" lines and polygons on "f" lines, whose corners
+// start with a 1 based or, when negative, relative position index.
+static bool isObjLine(const std::string &line, char kind, const char *&rest) {
+  const char *s = skipSpaces(line.c_str());
+  if (s[0] != kind || (s[1] != ' ' && s[1] != '\t')) return false;
+  rest = s + 2;
+  return true;
+}
+
+static bool readObjVertices(ChunkSource &source, ChunkVertices &vertices,
+                            uint64_t &triangles) {
+  std::string line;
+  const char *rest;
+  triangles = 0;
+  while (source.line(line)) {
+    if (isObjLine(line, 'v', rest)) {
+      float p[3] = {};
+      char *next;
+      for (int i = 0; i < 3; i++) {
+        p[i] = std::strtof(rest, &next);
+        if (next == rest) return false;
+        rest = next;
+      }
+      vertices.add(p);
+    } else if (isObjLine(line, 'f', rest)) {
+      uint64_t corners = 0;
+      for (rest = skipSpaces(rest); *rest != '\0'; rest = skipSpaces(rest)) {
+        while (*rest != '\0' && *rest != ' ' && *rest != '\t') rest++;
+        corners++;
+      }
+      if (corners >= 3) triangles += corners - 2;
+    }
+  }
+  return true;
+}
+
+template <typename F>
+static bool readObjTriangles(ChunkSource &source, uint64_t vertexCount,
+                             F emit) {
+  std::string line;
+  const char *rest;
+  std::vector<uint64_t> corners;
+  uint64_t defined = 0;
+  while (source.line(line)) {
+    if (isObjLine(line, 'v', rest)) {
+      defined++;
+    } else if (isObjLine(line, 'f', rest)) {
+      corners.clear();
+      for (rest = skipSpaces(rest); *rest != '\0'; rest = skipSpaces(rest)) {
+        char *next;
+        long long index = std::strtoll(rest, &next, 10);
+        if (next == rest || index == 0) return false;
+        long long resolved = index > 0 ? index - 1
+                                       : static_cast<long long>(defined) + index;
+        if (resolved < 0 || static_cast<uint64_t>(resolved) >= vertexCount) {
+          return false;
+        }
+        corners.push_back(static_cast<uint64_t>(resolved));
+        rest = next;
+        while (*rest != '\0' && *rest != ' ' && *rest != '\t') rest++;
+      }
+      for (size_t i = 2; i < corners.size(); i++) {
+        emit(corners[0], corners[i - 1], corners[i]);
+      }
+    }
+  }
+  return true;
+}
+
+// PLY: a text header describing elements, each a list of records made of
+// scalar and list properties, then the records in ASCII or binary.
+enum PlyFormat { PLY_ASCII, PLY_LITTLE_ENDIAN, PLY_BIG_ENDIAN };
+
+struct PlyProperty {
+  std::string name;
+  char type;       // 'i' signed, 'u' unsigned or 'f' float
+  size_t size;     // in bytes
+  size_t countSize;  // 0 for a scalar, else the size of the list count
+  char countType;
+};
+
+struct PlyElement {
+  std::string name;
+  uint64_t count;
+  std::vector<PlyProperty> properties;
+};
+
+static bool plyType(const std::string &name, char &type, size_t &size) {
+  static const struct {
+    const char *name;
+    char type;
+    size_t size;
+  } TYPES[] = {{"char", 'i', 1},    {"int8", 'i', 1},    {"uchar", 'u', 1},
+               {"uint8", 'u', 1},   {"short", 'i', 2},   {"int16", 'i', 2},
+               {"ushort", 'u', 2},  {"uint16", 'u', 2},  {"int", 'i', 4},
+               {"int32", 'i', 4},   {"uint", 'u', 4},    {"uint32", 'u', 4},
+               {"float", 'f', 4},   {"float32", 'f', 4}, {"double", 'f', 8},
+               {"float64", 'f', 8}};
+  for (const auto &t : TYPES) {
+    if (name == t.name) {
+      type = t.type;
+      size = t.size;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool readPlyHeader(ChunkSource &source, PlyFormat &format,
+                          std::vector<PlyElement> &elements) {
+  std::string line;
+  if (!source.line(line) || line != "ply") return false;
+  bool formatFound = false;
+  while (source.line(line)) {
+    std::istringstream words(line);
+    std::string word;
+    words >> word;
+    if (word == "end_header") return formatFound;
+    if (word == "format") {
+      std::string name;
+      words >> name;
+      formatFound = true;
+      if (name == "ascii") {
+        format = PLY_ASCII;
+      } else if (name == "binary_little_endian") {
+        format = PLY_LITTLE_ENDIAN;
+      } else if (name == "binary_big_endian") {
+        format = PLY_BIG_ENDIAN;
+      } else {
+        return false;
+      }
+    } else if (word == "element") {
+      PlyElement e;
+      if (!(words >> e.name >> e.count)) return false;
+      elements.push_back(e);
+    } else if (word == "property") {
+      if (elements.empty()) return false;
+      PlyProperty p = {};
+      std::string type;
+      words >> type;
+      if (type == "list") {
+        std::string countType;
+        words >> countType >> type;
+        if (!plyType(countType, p.countType, p.countSize) ||
+            p.countType == 'f') {
+          return false;
+        }
+      }
+      if (!plyType(type, p.type, p.size) || !(words >> p.name)) return false;
+      elements.back().properties.push_back(p);
+    }
+  }
+  return false;
+}
+
+static double plyValue(const unsigned char *bytes, char type, size_t size,
+                       PlyFormat format) {
+  unsigned char v[8];
+  for (size_t i = 0; i < size; i++) {
+    v[i] = format == PLY_BIG_ENDIAN ? bytes[size - 1 - i] : bytes[i];
+  }
+  switch (size * 4 + (type == 'f' ? 2 : type == 'i' ? 1 : 0)) {
+    case 4: return *v;
+    case 5: return static_cast<signed char>(*v);
+    case 8: { uint16_t x; std::memcpy(&x, v, 2); return x; }
+    case 9: { int16_t x; std::memcpy(&x, v, 2); return x; }
+    case 16: { uint32_t x; std::memcpy(&x, v, 4); return x; }
+    case 17: { int32_t x; std::memcpy(&x, v, 4); return x; }
+    case 18: { float x; std::memcpy(&x, v, 4); return x; }
+    case 34: { double x; std::memcpy(&x, v, 8); return x; }
+  }
+  return 0.0;
+}
+
+// Reads one record: its scalars in order, and the items of the list
+// property at listIndex, if any. Other lists are read and dropped.
+static bool readPlyRecord(ChunkSource &source, const PlyElement &element,
+                          PlyFormat format, size_t listIndex,
+                          std::vector<double> &scalars,
+                          std::vector<uint64_t> &list, std::string &line) {
+  scalars.clear();
+  list.clear();
+  const char *text = nullptr;
+  if (format == PLY_ASCII) {
+    if (!source.line(line)) return false;
+    text = line.c_str();
+  }
+  auto next = [&](char type, size_t size, double &value) {
+    if (format == PLY_ASCII) {
+      char *end;
+      value = std::strtod(text, &end);
+      if (end == text) return false;
+      text = end;
+      return true;
+    }
+    unsigned char bytes[8];
+    if (!source.bytes(bytes, size)) return false;
+    value = plyValue(bytes, type, size, format);
+    return true;
+  };
+  for (size_t p = 0; p < element.properties.size(); p++) {
+    const PlyProperty &property = element.properties[p];
+    double value;
+    if (property.countSize == 0) {
+      if (!next(property.type, property.size, value)) return false;
+      scalars.push_back(value);
+      continue;
+    }
+    if (!next(property.countType, property.countSize, value) || value < 0) {
+      return false;
+    }
+    for (uint64_t n = static_cast<uint64_t>(value); n > 0; n--) {
+      double item;
+      if (!next(property.type, property.size, item)) return false;
+      if (p == listIndex) {
+        if (item < 0) return false;
+        list.push_back(static_cast<uint64_t>(item));
+      }
+    }
+  }
+  return true;
+}
+
+static size_t findScalar(const PlyElement &element, const char *name) {
+  size_t scalar = 0;
+  for (const PlyProperty &p : element.properties) {
+    if (p.countSize != 0) continue;
+    if (p.name == name) return scalar;
+    scalar++;
+  }
+  return SIZE_MAX;
+}
+
+struct PlyLayout {
+  PlyFormat format;
+  std::vector<PlyElement> elements;
+  size_t vertexElement = SIZE_MAX, faceElement = SIZE_MAX;
+  size_t coordinates[6];  // x, y, z, nx, ny, nz scalars
+  size_t indexList = SIZE_MAX;
+  uint64_t faceOffset = 0;
+};
+
+// Reads the elements up to the vertices, skipping the faces when they come
+// first but noting where they start.
+static bool readPlyVertices(ChunkSource &source, PlyLayout &ply,
+                            ChunkVertices &vertices) {
+  if (!readPlyHeader(source, ply.format, ply.elements)) return false;
+  for (size_t e = 0; e < ply.elements.size(); e++) {
+    const PlyElement &element = ply.elements[e];
+    if (element.name == "vertex") ply.vertexElement = e;
+    if (element.name != "face") continue;
+    ply.faceElement = e;
+    for (size_t p = 0; p < element.properties.size(); p++) {
+      const PlyProperty &property = element.properties[p];
+      if (property.countSize != 0 && (property.name == "vertex_indices" ||
+                                      property.name == "vertex_index")) {
+        ply.indexList = p;
+      }
+    }
+  }
+  if (ply.vertexElement == SIZE_MAX || ply.faceElement == SIZE_MAX ||
+      ply.indexList == SIZE_MAX) {
+    return false;
+  }
+  static const char *NAMES[] = {"x", "y", "z", "nx", "ny", "nz"};
+  const PlyElement &vertex = ply.elements[ply.vertexElement];
+  for (int i = 0; i < 6; i++) ply.coordinates[i] = findScalar(vertex, NAMES[i]);
+  for (int i = 0; i < 3; i++) {
+    if (ply.coordinates[i] == SIZE_MAX) return false;
+  }
+  vertices.stride = ply.coordinates[3] != SIZE_MAX &&
+                            ply.coordinates[4] != SIZE_MAX &&
+                            ply.coordinates[5] != SIZE_MAX
+                        ? 6
+                        : 3;
+
+  std::vector<double> scalars;
+  std::vector<uint64_t> list;
+  std::string line;
+  for (size_t e = 0; e <= ply.vertexElement; e++) {
+    const PlyElement &element = ply.elements[e];
+    if (e == ply.faceElement) ply.faceOffset = source.tell();
+    for (uint64_t r = 0; r < element.count; r++) {
+      if (!readPlyRecord(source, element, ply.format, SIZE_MAX, scalars, list,
+                         line)) {
+        return false;
+      }
+      if (e != ply.vertexElement) continue;
+      float values[6];
+      for (size_t i = 0; i < vertices.stride; i++) {
+        values[i] = static_cast<float>(scalars[ply.coordinates[i]]);
+      }
+      vertices.add(values);
+    }
+  }
+  // Faces after the vertices may follow other elements.
+  for (size_t e = ply.vertexElement + 1; e < ply.faceElement; e++) {
+    for (uint64_t r = 0; r < ply.elements[e].count; r++) {
+      if (!readPlyRecord(source, ply.elements[e], ply.format, SIZE_MAX,
+                         scalars, list, line)) {
+        return false;
+      }
+    }
+  }
+  if (ply.faceElement > ply.vertexElement) ply.faceOffset = source.tell();
+  return true;
+}
+
+template <typename F>
+static bool readPlyTriangles(ChunkSource &source, const PlyLayout &ply,
+                             uint64_t vertexCount, F emit) {
+  source.seek(ply.faceOffset);
+  const PlyElement &face = ply.elements[ply.faceElement];
+  std::vector<double> scalars;
+  std::vector<uint64_t> corners;
+  std::string line;
+  for (uint64_t r = 0; r < face.count; r++) {
+    if (!readPlyRecord(source, face, ply.format, ply.indexList, scalars,
+                       corners, line)) {
+      return false;
+    }
+    for (uint64_t c : corners) {
+      if (c >= vertexCount) return false;
+    }
+    for (size_t i = 2; i < corners.size(); i++) {
+      emit(corners[0], corners[i - 1], corners[i]);
+    }
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////// Partitioning
+
+// Triangles of a bin, as runs in the spill file, with the bounds of their
+// centroids.
+struct ChunkBin {
+  std::vector<std::pair<uint64_t, uint32_t>> runs;  // offset, triangles
+  uint64_t count = 0;
+  glm::vec3 boundsMin = glm::vec3(0.f), boundsMax = glm::vec3(0.f);
+};
+
+struct ChunkTriangle {
+  uint64_t v[3];
+};
+
+class ChunkPartition {
+ public:
+  ChunkPartition(const float *vertices, size_t stride, std::fstream &spill,
+                 size_t memoryBudget)
+      : Vertices(vertices), Stride(stride), Spill(spill),
+        Budget(memoryBudget) {}
+
+  // A grid of at least cells cells over the centroid bounds, split along
+  // the longest side per cell first.
+  void begin(uint64_t cells, const glm::vec3 &boundsMin,
+             const glm::vec3 &boundsMax) {
+    Min = boundsMin;
+    Extent = boundsMax - boundsMin;
+    Dims[0] = Dims[1] = Dims[2] = 1;
+    cells = std::max<uint64_t>(1, std::min<uint64_t>(cells, 4096));
+    while (uint64_t(Dims[0]) * Dims[1] * Dims[2] < cells) {
+      int axis = 0;
+      for (int a = 1; a < 3; a++) {
+        if (Extent[a] / Dims[a] > Extent[axis] / Dims[axis]) axis = a;
+      }
+      Dims[axis]++;
+    }
+    size_t count = size_t(Dims[0]) * Dims[1] * Dims[2];
+    RunSize = std::max<size_t>(
+        64, std::min<size_t>(65536, Budget / (count * sizeof(ChunkTriangle))));
+    Buffers.assign(count, std::vector<ChunkTriangle>());
+    Bins.assign(count, ChunkBin());
+  }
+
+  void add(const ChunkTriangle &t) {
+    glm::vec3 c = centroid(t);
+    size_t cell = 0;
+    for (int a = 2; a >= 0; a--) {
+      int i = Extent[a] > 0.f
+                  ? static_cast<int>((c[a] - Min[a]) / Extent[a] * Dims[a])
+                  : 0;
+      cell = cell * Dims[a] + std::max(0, std::min(i, Dims[a] - 1));
+    }
+    ChunkBin &bin = Bins[cell];
+    bin.boundsMin = bin.count == 0 ? c : glm::min(bin.boundsMin, c);
+    bin.boundsMax = bin.count == 0 ? c : glm::max(bin.boundsMax, c);
+    bin.count++;
+    std::vector<ChunkTriangle> &buffer = Buffers[cell];
+    if (buffer.empty()) buffer.reserve(RunSize);
+    buffer.push_back(t);
+    if (buffer.size() == RunSize) flush(cell);
+  }
+
+  // The bins with triangles.
+  void end(std::vector<ChunkBin> &bins) {
+    for (size_t cell = 0; cell < Bins.size(); cell++) {
+      flush(cell);
+      std::vector<ChunkTriangle>().swap(Buffers[cell]);
+      if (Bins[cell].count > 0) bins.push_back(std::move(Bins[cell]));
+    }
+    Bins.clear();
+  }
+
+  // Calls f on each run of a bin, read back in pieces.
+  template <typename F>
+  bool forEachRun(const ChunkBin &bin, F f) {
+    std::vector<ChunkTriangle> run;
+    for (const std::pair<uint64_t, uint32_t> &r : bin.runs) {
+      run.resize(r.second);
+      Spill.seekg(static_cast<std::streamoff>(r.first));
+      Spill.read(reinterpret_cast<char *>(run.data()),
+                 run.size() * sizeof(ChunkTriangle));
+      if (!Spill) return false;
+      f(run);
+    }
+    return true;
+  }
+
+  glm::vec3 position(uint64_t v) const {
+    const float *p = Vertices + v * Stride;
+    return glm::vec3(p[0], p[1], p[2]);
+  }
+
+  glm::vec3 normal(uint64_t v) const {
+    const float *p = Vertices + v * Stride;
+    return glm::vec3(p[3], p[4], p[5]);
+  }
+
+ private:
+  const float *Vertices;
+  size_t Stride;
+  std::fstream &Spill;
+  size_t Budget;
+  glm::vec3 Min, Extent;
+  int Dims[3];
+  size_t RunSize;
+  std::vector<std::vector<ChunkTriangle>> Buffers;
+  std::vector<ChunkBin> Bins;
+
+  glm::vec3 centroid(const ChunkTriangle &t) const {
+    return (position(t.v[0]) + position(t.v[1]) + position(t.v[2])) / 3.f;
+  }
+
+  void flush(size_t cell) {
+    std::vector<ChunkTriangle> &buffer = Buffers[cell];
+    if (buffer.empty()) return;
+    Spill.seekp(0, std::ios::end);
+    uint64_t offset = static_cast<uint64_t>(Spill.tellp());
+    Spill.write(reinterpret_cast<const char *>(buffer.data()),
+                buffer.size() * sizeof(ChunkTriangle));
+    Bins[cell].runs.push_back(
+        std::make_pair(offset, static_cast<uint32_t>(buffer.size())));
+    buffer.clear();
+  }
+};
+
+template <typename T>
+static void append(std::vector<unsigned char> &out, const std::vector<T> &v) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(v.data());
+  out.insert(out.end(), bytes, bytes + v.size() * sizeof(T));
+}
+
+// Gives the triangles local vertices and writes them as a chunk, in the
+// SceneFile blob layout: one submesh, positions, normals and indices.
+static bool writeChunk(const ChunkPartition &partition, bool sourceNormals,
+                       const std::vector<ChunkTriangle> &triangles,
+                       std::ofstream &out,
+                       std::vector<ChunkedMesh::ChunkRecord> &chunks) {
+  std::unordered_map<uint64_t, unsigned int> local;
+  local.reserve(triangles.size());
+  std::vector<glm::vec3> positions, normals;
+  std::vector<unsigned int> indices;
+  indices.reserve(triangles.size() * 3);
+  for (const ChunkTriangle &t : triangles) {
+    for (uint64_t v : t.v) {
+      auto inserted = local.insert(
+          std::make_pair(v, static_cast<unsigned int>(positions.size())));
+      if (inserted.second) {
+        positions.push_back(partition.position(v));
+        normals.push_back(sourceNormals ? partition.normal(v)
+                                        : glm::vec3(0.f));
+      }
+      indices.push_back(inserted.first->second);
+    }
+  }
+  if (!sourceNormals) {
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      const glm::vec3 &a = positions[indices[i]];
+      glm::vec3 n = glm::cross(positions[indices[i + 1]] - a,
+                               positions[indices[i + 2]] - a);
+      for (size_t k = 0; k < 3; k++) normals[indices[i + k]] += n;
+    }
+    for (glm::vec3 &n : normals) {
+      float length = glm::length(n);
+      n = length > 0.f ? n / length : glm::vec3(0.f, 1.f, 0.f);
+    }
+  }
+
+  Mesh::MeshData sub;
+  sub.nIndices = static_cast<unsigned int>(indices.size());
+  std::vector<unsigned char> blob;
+  append(blob, std::vector<Mesh::MeshData>(1, sub));
+  append(blob, positions);
+  append(blob, normals);
+  append(blob, indices);
+
+  ChunkedMesh::ChunkRecord r = {};
+  glm::vec3 boundsMin = positions[0], boundsMax = positions[0];
+  for (const glm::vec3 &p : positions) {
+    boundsMin = glm::min(boundsMin, p);
+    boundsMax = glm::max(boundsMax, p);
+  }
+  for (int a = 0; a < 3; a++) {
+    r.boundsMin[a] = boundsMin[a];
+    r.boundsMax[a] = boundsMax[a];
+  }
+  r.checksum = checksum64(blob.data(), blob.size());
+  r.mesh.blobOffset = static_cast<uint64_t>(out.tellp());
+  r.mesh.blobSize = blob.size();
+  r.mesh.subMeshCount = 1;
+  r.mesh.vertexCount = static_cast<uint32_t>(positions.size());
+  r.mesh.indexCount = static_cast<uint32_t>(indices.size());
+  r.mesh.flags = SceneFile::EMBEDDED | SceneFile::NORMALS;
+  static const char PADDING[8] = {};
+  out.write(reinterpret_cast<const char *>(blob.data()), blob.size());
+  out.write(PADDING, (8 - blob.size() % 8) % 8);
+  chunks.push_back(r);
+  return static_cast<bool>(out);
+}
+
+//////////////////////////////////////////////////////////////////// ChunkedMesh
+
+static bool hasExtension(const std::string &path, const char *extension) {
+  size_t n = std::strlen(extension);
+  if (path.size() < n) return false;
+  for (size_t i = 0; i < n; i++) {
+    if (std::tolower(static_cast<unsigned char>(path[path.size() - n + i])) !=
+        extension[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool partition(const std::string &source, const std::string &path,
+                      const std::string &vertexPath,
+                      const std::string &spillPath, size_t maxTriangles,
+                      size_t memoryBudget) {
+  const bool ply = hasExtension(source, ".ply");
+  if (!ply && !hasExtension(source, ".obj")) {
+    std::cerr << "WARNING: " << source << " is neither OBJ nor PLY."
+              << std::endl;
+    return false;
+  }
+  ChunkSource in;
+  if (!in.open(source)) {
+    std::cerr << "WARNING: could not open " << source << std::endl;
+    return false;
+  }
+
+  // Vertices first, to a file that is then mapped.
+  ChunkVertices vertices;
+  vertices.out.open(vertexPath, std::ios::binary | std::ios::trunc);
+  PlyLayout layout;
+  uint64_t triangleEstimate = 0;
+  bool read = ply ? readPlyVertices(in, layout, vertices)
+                  : readObjVertices(in, vertices, triangleEstimate);
+  if (ply && read) triangleEstimate = layout.elements[layout.faceElement].count;
+  vertices.flush();
+  vertices.out.close();
+  if (!read || !vertices.out || vertices.count == 0) {
+    std::cerr << "WARNING: could not read the vertices of " << source
+              << std::endl;
+    return false;
+  }
+  MappedFile mapped;
+  if (!mapped.open(vertexPath)) return false;
+
+  std::fstream spill(spillPath, std::ios::in | std::ios::out |
+                                    std::ios::binary | std::ios::trunc);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!spill || !out) {
+    std::cerr << "WARNING: could not write " << path << std::endl;
+    return false;
+  }
+  ChunkedMesh::Header header = {};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // Then the triangles, streamed into the first grid.
+  const float *data = reinterpret_cast<const float *>(mapped.data());
+  ChunkPartition bins(data, vertices.stride, spill, memoryBudget);
+  bins.begin((triangleEstimate + maxTriangles - 1) / maxTriangles,
+             vertices.boundsMin, vertices.boundsMax);
+  auto emit = [&bins](uint64_t a, uint64_t b, uint64_t c) {
+    ChunkTriangle t = {{a, b, c}};
+    bins.add(t);
+  };
+  in.seek(0);
+  if (ply) {
+    read = readPlyTriangles(in, layout, vertices.count, emit);
+  } else {
+    read = readObjTriangles(in, vertices.count, emit);
+  }
+  if (!read) {
+    std::cerr << "WARNING: could not read the faces of " << source
+              << std::endl;
+    return false;
+  }
+  std::vector<ChunkBin> pending;
+  bins.end(pending);
+
+  // Bins over the limit are binned again over their own bounds. A bin that
+  // does not split, its centroids all in one cell, is cut in order.
+  std::vector<ChunkedMesh::ChunkRecord> chunks;
+  std::vector<ChunkTriangle> triangles;
+  while (!pending.empty()) {
+    ChunkBin bin = std::move(pending.back());
+    pending.pop_back();
+    bool ok = true;
+    if (bin.count > maxTriangles) {
+      std::vector<ChunkBin> split;
+      bins.begin((bin.count + maxTriangles - 1) / maxTriangles, bin.boundsMin,
+                 bin.boundsMax);
+      ok = bins.forEachRun(bin, [&bins](const std::vector<ChunkTriangle> &run) {
+        for (const ChunkTriangle &t : run) bins.add(t);
+      });
+      bins.end(split);
+      if (ok && split.size() > 1) {
+        for (ChunkBin &b : split) pending.push_back(std::move(b));
+        continue;
+      }
+    }
+    triangles.clear();
+    bool written = true;
+    ok = ok && bins.forEachRun(bin, [&](const std::vector<ChunkTriangle> &run) {
+      for (const ChunkTriangle &t : run) {
+        triangles.push_back(t);
+        if (triangles.size() == maxTriangles) {
+          written = written && writeChunk(bins, vertices.stride == 6,
+                                          triangles, out, chunks);
+          triangles.clear();
+        }
+      }
+    });
+    if (ok && written && !triangles.empty()) {
+      written = writeChunk(bins, vertices.stride == 6, triangles, out, chunks);
+    }
+    if (!ok || !written) {
+      std::cerr << "WARNING: could not write " << path << std::endl;
+      return false;
+    }
+  }
+
+  header.magic = ChunkedMesh::MAGIC;
+  header.version = ChunkedMesh::VERSION;
+  header.chunkCount = static_cast<uint32_t>(chunks.size());
+  for (int a = 0; a < 3; a++) {
+    header.boundsMin[a] = vertices.boundsMin[a];
+    header.boundsMax[a] = vertices.boundsMax[a];
+  }
+  header.chunkOffset = static_cast<uint64_t>(out.tellp());
+  out.write(reinterpret_cast<const char *>(chunks.data()),
+            chunks.size() * sizeof(ChunkedMesh::ChunkRecord));
+  header.fileSize = static_cast<uint64_t>(out.tellp());
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.close();
+  if (!out) {
+    std::cerr << "WARNING: could not write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The temporary files sit next to the output and go away in any case.
+bool ChunkedMesh::ingest(const std::string &source, const std::string &path,
+                         size_t maxTriangles, size_t memoryBudget) {
+  const std::string vertexPath = path + ".vertices";
+  const std::string spillPath = path + ".triangles";
+  maxTriangles = std::max<size_t>(1, maxTriangles);
+  bool ok = partition(source, path, vertexPath, spillPath, maxTriangles,
+                      memoryBudget);
+  std::remove(vertexPath.c_str());
+  std::remove(spillPath.c_str());
+  if (!ok) std::remove(path.c_str());
+  return ok;
+}
+
+ChunkedMesh::ChunkedMesh() : Scene(nullptr) {}
+
+ChunkedMesh::~ChunkedMesh() { close(); }
+
+bool ChunkedMesh::validate(const MappedFile &file) {
+  if (file.size() < sizeof(Header)) return false;
+  const Header &h = *reinterpret_cast<const Header *>(file.data());
+  if (h.magic != MAGIC || h.version != VERSION || h.fileSize != file.size() ||
+      h.chunkOffset % 8 != 0 || h.chunkOffset > h.fileSize ||
+      uint64_t(h.chunkCount) * sizeof(ChunkRecord) !=
+          h.fileSize - h.chunkOffset) {
+    return false;
+  }
+  const ChunkRecord *chunks =
+      reinterpret_cast<const ChunkRecord *>(file.data() + h.chunkOffset);
+  for (uint32_t i = 0; i < h.chunkCount; i++) {
+    const SceneFile::MeshRecord &m = chunks[i].mesh;
+    if (m.blobOffset % 8 != 0 || m.blobOffset < sizeof(Header) ||
+        m.blobOffset > h.chunkOffset ||
+        m.blobSize > h.chunkOffset - m.blobOffset ||
+        (m.flags & SceneFile::COMPRESSED) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ChunkedMesh::open(const std::string &path) {
+  close();
+  if (!File.open(path)) {
+    std::cerr << "WARNING: could not open chunked mesh " << path << std::endl;
+    return false;
+  }
+  if (!validate(File)) {
+    std::cerr << "WARNING: invalid chunked mesh " << path << std::endl;
+    File.close();
+    return false;
+  }
+  return true;
+}
+
+// Meshes still loaded are left to their scene.
+void ChunkedMesh::close() {
+  Scene = nullptr;
+  Nodes.clear();
+  Meshes.clear();
+  File.close();
+}
+
+size_t ChunkedMesh::getChunkCount() const {
+  if (!File.isOpen()) return 0;
+  return reinterpret_cast<const Header *>(File.data())->chunkCount;
+}
+
+const ChunkedMesh::ChunkRecord &ChunkedMesh::getChunk(size_t index) const {
+  const Header &h = *reinterpret_cast<const Header *>(File.data());
+  return reinterpret_cast<const ChunkRecord *>(File.data() +
+                                               h.chunkOffset)[index];
+}
+
+glm::vec3 ChunkedMesh::getBoundsMin() const {
+  if (!File.isOpen()) return glm::vec3(0.f);
+  const float *b = reinterpret_cast<const Header *>(File.data())->boundsMin;
+  return glm::vec3(b[0], b[1], b[2]);
+}
+
+glm::vec3 ChunkedMesh::getBoundsMax() const {
+  if (!File.isOpen()) return glm::vec3(0.f);
+  const float *b = reinterpret_cast<const Header *>(File.data())->boundsMax;
+  return glm::vec3(b[0], b[1], b[2]);
+}
+
+// Chunks are checked when first loaded rather than when the file is opened,
+// which would read it all.
+bool ChunkedMesh::loadChunk(size_t index, Mesh &mesh) const {
+  if (index >= getChunkCount()) return false;
+  const ChunkRecord &c = getChunk(index);
+  const unsigned char *blob = File.data() + c.mesh.blobOffset;
+  if (checksum64(blob, static_cast<size_t>(c.mesh.blobSize)) != c.checksum ||
+      !SceneFile::checkBlob(c.mesh, blob)) {
+    std::cerr << "WARNING: chunk " << index << " is damaged." << std::endl;
+    return false;
+  }
+  SceneFile::readBlob(blob, c.mesh, mesh);
+  return true;
+}
+
+void ChunkedMesh::attach(SceneGraph &scene, Node *parent) {
+  detach();
+  Scene = &scene;
+  SceneArena &arena = scene.getArena();
+  for (size_t i = 0; i < getChunkCount(); i++) {
+    Node *node = arena.get(arena.createNode());
+    node->setParent(parent);
+    Nodes.push_back(node);
+  }
+  Meshes.assign(Nodes.size(), Handle<Mesh>());
+}
+
+void ChunkedMesh::detach() {
+  if (Scene != nullptr) {
+    SceneArena &arena = Scene->getArena();
+    for (size_t i = 0; i < Meshes.size(); i++) {
+      if (!Meshes[i].isValid()) continue;
+      Nodes[i]->setMesh(nullptr);
+      arena.destroy(Meshes[i]);
+    }
+  }
+  Scene = nullptr;
+  Nodes.clear();
+  Meshes.clear();
+}
+
+static float boxDistance(const glm::vec3 &p, const float *boundsMin,
+                         const float *boundsMax) {
+  glm::vec3 lo(boundsMin[0], boundsMin[1], boundsMin[2]);
+  glm::vec3 hi(boundsMax[0], boundsMax[1], boundsMax[2]);
+  return glm::length(glm::max(glm::max(lo - p, p - hi), glm::vec3(0.f)));
+}
+
+// Unloads before loading, so memory stays within the budget throughout.
+// The chunks loaded get their GL objects in bulk.
+size_t ChunkedMesh::update(const glm::vec3 &eye, size_t budget) {
+  if (Scene == nullptr) return 0;
+  std::vector<std::pair<float, size_t>> order;
+  for (size_t i = 0; i < Nodes.size(); i++) {
+    const ChunkRecord &c = getChunk(i);
+    order.push_back(
+        std::make_pair(boxDistance(eye, c.boundsMin, c.boundsMax), i));
+  }
+  std::sort(order.begin(), order.end());
+  std::vector<bool> wanted(Nodes.size(), false);
+  size_t used = 0;
+  for (const std::pair<float, size_t> &o : order) {
+    size_t size = static_cast<size_t>(getChunk(o.second).mesh.blobSize);
+    if (used + size > budget) break;
+    used += size;
+    wanted[o.second] = true;
+  }
+
+  SceneArena &arena = Scene->getArena();
+  for (size_t i = 0; i < Nodes.size(); i++) {
+    if (wanted[i] || !Meshes[i].isValid()) continue;
+    Nodes[i]->setMesh(nullptr);
+    arena.destroy(Meshes[i]);
+    Meshes[i] = Handle<Mesh>();
+  }
+  std::vector<Mesh *> loaded;
+  size_t count = 0;
+  for (size_t i = 0; i < Nodes.size(); i++) {
+    if (!wanted[i]) continue;
+    if (!Meshes[i].isValid()) {
+      Handle<Mesh> handle = arena.createMesh();
+      Mesh *mesh = arena.get(handle);
+      if (!loadChunk(i, *mesh)) {
+        arena.destroy(handle);
+        continue;
+      }
+      Meshes[i] = handle;
+      Nodes[i]->setMesh(mesh);
+      loaded.push_back(mesh);
+    }
+    count++;
+  }
+  Mesh::createBufferObjects(loaded);
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
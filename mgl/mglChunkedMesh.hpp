@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Chunked Mesh Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_CHUNKED_MESH_HPP
+#define MGL_CHUNKED_MESH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "mglMappedFile.hpp"
+#include "mglPool.hpp"
+#include "mglSceneFile.hpp"
+
+namespace mgl {
+
+class ChunkedMesh;
+class Mesh;
+class Node;
+class SceneGraph;
+
+//////////////////////////////////////////////////////////////////// ChunkedMesh
+//
+// Meshes too large for memory, such as photogrammetry scans, split in
+// spatial chunks that are loaded on their own. ingest() streams an OBJ or
+// PLY file with bounded memory: vertices go to a temporary file that is
+// mapped, triangles are binned by centroid on a grid into buffers that
+// spill to a second temporary file, and bins still over the triangle limit
+// are binned again, until each one becomes a chunk with its own vertices,
+// 32 bit local indices and bounds.
+//
+// The chunk file is mapped when opened and chunks are read in place, in the
+// SceneFile blob layout. Normals come from the source when a PLY has them,
+// otherwise from the triangles of each chunk. attach() and update() stream
+// the chunks into a scene, nearest to the eye first, within a byte budget.
+
+class ChunkedMesh {
+ public:
+  static const uint32_t MAGIC = 0x434c474d;  // "MGLC"
+  static const uint32_t VERSION = 1;
+  static const size_t MAX_TRIANGLES = 256 * 1024;
+  static const size_t MEMORY_BUDGET = 256 * 1024 * 1024;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunkCount;
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t chunkOffset;
+    uint64_t fileSize;
+  };
+
+  // The blob offset of the mesh record is from the start of the file and
+  // the checksum is the checksum64 of the blob.
+  struct ChunkRecord {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t checksum;
+    SceneFile::MeshRecord mesh;
+  };
+
+  // The source format follows the extension. memoryBudget bounds the bin
+  // buffers; a chunk of maxTriangles is also built in memory.
+  static bool ingest(const std::string &source, const std::string &path,
+                     size_t maxTriangles = MAX_TRIANGLES,
+                     size_t memoryBudget = MEMORY_BUDGET);
+
+  ChunkedMesh();
+  ~ChunkedMesh();
+
+  bool open(const std::string &path);
+  void close();
+  size_t getChunkCount() const;
+  const ChunkRecord &getChunk(size_t index) const;
+  glm::vec3 getBoundsMin() const;
+  glm::vec3 getBoundsMax() const;
+
+  // Fills the mesh with the chunk geometry; no GL objects are created.
+  bool loadChunk(size_t index, Mesh &mesh) const;
+
+  // Adds a node per chunk under parent. update() loads the chunks nearest to
+  // eye whose blobs fit in budget bytes, unloads the others and returns the
+  // number of chunks loaded.
+  void attach(SceneGraph &scene, Node *parent);
+  size_t update(const glm::vec3 &eye, size_t budget);
+
+ private:
+  MappedFile File;
+  SceneGraph *Scene;
+  std::vector<Node *> Nodes;
+  std::vector<Handle<Mesh>> Meshes;
+
+  static bool validate(const MappedFile &file);
+  void detach();
+
+  ChunkedMesh(const ChunkedMesh &) = delete;
+  ChunkedMesh &operator=(const ChunkedMesh &) = delete;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_CHUNKED_MESH_HPP */
@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Command List Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglCommandList.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace mgl {
+
+//////////////////////////////////////////////////////////////////// CommandList
+
+static const GLuint UNKNOWN = ~0u;
+
+CommandList::CommandList() : Program(UNKNOWN), VertexArray(UNKNOWN) {}
+
+CommandList::~CommandList() {}
+
+// Keeps the capacity, so steady frames record without allocating.
+void CommandList::clear() {
+  Commands.clear();
+  Matrices.clear();
+  Program = UNKNOWN;
+  VertexArray = UNKNOWN;
+}
+
+size_t CommandList::size() const { return Commands.size(); }
+
+CommandList::Command &CommandList::push(Op op) {
+  Commands.push_back({op, 0, 0, 0, 0, 0, 0});
+  return Commands.back();
+}
+
+void CommandList::bindProgram(GLuint program) {
+  if (program == Program) return;
+  Program = program;
+  push(BIND_PROGRAM).object = program;
+}
+
+void CommandList::bindVertexArray(GLuint vao) {
+  if (vao == VertexArray) return;
+  VertexArray = vao;
+  push(BIND_VERTEX_ARRAY).object = vao;
+}
+
+void CommandList::bindBufferRange(GLuint bindingpoint, GLuint buffer,
+                                  GLintptr offset, GLsizeiptr size) {
+  Command &command = push(BIND_BUFFER_RANGE);
+  command.object = buffer;
+  command.target = static_cast<GLint>(bindingpoint);
+  command.offset = offset;
+  command.size = size;
+}
+
+void CommandList::uniform(GLint location, GLint value) {
+  if (location < 0) return;
+  Command &command = push(UNIFORM_INT);
+  command.target = location;
+  command.value = value;
+}
+
+void CommandList::uniform(GLint location, const glm::mat4 &value) {
+  if (location < 0) return;
+  Command &command = push(UNIFORM_MATRIX);
+  command.target = location;
+  command.value = static_cast<GLint>(Matrices.size());
+  Matrices.push_back(value);
+}
+
+void CommandList::drawElements(GLsizei count, GLuint firstIndex,
+                               GLint baseVertex) {
+  Command &command = push(DRAW_ELEMENTS);
+  command.count = count;
+  command.offset = static_cast<GLintptr>(firstIndex) * sizeof(GLuint);
+  command.value = baseVertex;
+}
+
+void CommandList::colorMask(bool enabled) {
+  push(COLOR_MASK).value = enabled ? GL_TRUE : GL_FALSE;
+}
+
+void CommandList::depthMask(bool enabled) {
+  push(DEPTH_MASK).value = enabled ? GL_TRUE : GL_FALSE;
+}
+
+void CommandList::depthFunc(GLenum func) {
+  push(DEPTH_FUNC).value = static_cast<GLint>(func);
+}
+
+void CommandList::execute() const {
+  for (const Command &c : Commands) {
+    switch (c.op) {
+      case BIND_PROGRAM:
+        glUseProgram(c.object);
+        break;
+      case BIND_VERTEX_ARRAY:
+        glBindVertexArray(c.object);
+        break;
+      case BIND_BUFFER_RANGE:
+        glBindBufferRange(GL_UNIFORM_BUFFER, c.target, c.object, c.offset,
+                          c.size);
+        break;
+      case UNIFORM_INT:
+        glUniform1i(c.target, c.value);
+        break;
+      case UNIFORM_MATRIX:
+        glUniformMatrix4fv(c.target, 1, GL_FALSE,
+                           glm::value_ptr(Matrices[c.value]));
+        break;
+      case DRAW_ELEMENTS:
+        glDrawElementsBaseVertex(GL_TRIANGLES, c.count, GL_UNSIGNED_INT,
+                                 reinterpret_cast<void *>(c.offset), c.value);
+        break;
+      case COLOR_MASK: {
+        GLboolean mask = static_cast<GLboolean>(c.value);
+        glColorMask(mask, mask, mask, mask);
+        break;
+      }
+      case DEPTH_MASK:
+        glDepthMask(static_cast<GLboolean>(c.value));
+        break;
+      case DEPTH_FUNC:
+        glDepthFunc(static_cast<GLenum>(c.value));
+        break;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
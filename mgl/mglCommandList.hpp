@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Command List Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_COMMAND_LIST_HPP
+#define MGL_COMMAND_LIST_HPP
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace mgl {
+
+class CommandList;
+
+//////////////////////////////////////////////////////////////////// CommandList
+//
+// GL calls recorded as plain structs, to be replayed later by execute().
+// Recording touches no GL state, so lists for disjoint parts of a frame can
+// be filled by worker threads and executed in order on the GL thread.
+// Program and vertex array binds equal to the previous one are dropped.
+// Everything a command refers to (programs, arrays, buffers) must still
+// exist when the list is executed.
+
+class CommandList {
+ public:
+  enum Op : uint8_t {
+    BIND_PROGRAM,
+    BIND_VERTEX_ARRAY,
+    BIND_BUFFER_RANGE,
+    UNIFORM_INT,
+    UNIFORM_MATRIX,
+    DRAW_ELEMENTS,
+    COLOR_MASK,
+    DEPTH_MASK,
+    DEPTH_FUNC
+  };
+
+  struct Command {
+    Op op;
+    GLuint object;  // program, vertex array or buffer
+    GLint target;   // uniform location or binding point
+    GLint value;    // integer value, base vertex or matrix index
+    GLsizei count;
+    GLintptr offset;
+    GLsizeiptr size;
+  };
+
+  CommandList();
+  ~CommandList();
+
+  void clear();
+  void bindProgram(GLuint program);
+  void bindVertexArray(GLuint vao);
+  void bindBufferRange(GLuint bindingpoint, GLuint buffer, GLintptr offset,
+                       GLsizeiptr size);
+  void uniform(GLint location, GLint value);
+  void uniform(GLint location, const glm::mat4 &value);
+  void drawElements(GLsizei count, GLuint firstIndex, GLint baseVertex);
+  void colorMask(bool enabled);
+  void depthMask(bool enabled);
+  void depthFunc(GLenum func);
+
+  void execute() const;
+  size_t size() const;
+
+ private:
+  std::vector<Command> Commands;
+  std::vector<glm::mat4> Matrices;
+  GLuint Program, VertexArray;
+
+  Command &push(Op op);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_COMMAND_LIST_HPP */
@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Block Compression Functions
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglCompression.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace mgl {
+
+/////////////////////////////////////////////////////////////////// Compression
+
+static const int HASH_BITS = 14;
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const size_t END_LITERALS = 5;  // never matched, as in LZ4
+
+static uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths past the 15 of a token nibble follow as bytes of 255 and a rest.
+static unsigned char *writeLength(unsigned char *op, size_t length) {
+  for (; length >= 255; length -= 255) *op++ = 255;
+  *op++ = static_cast<unsigned char>(length);
+  return op;
+}
+
+// A match length of 0 writes the literals alone, which ends a block.
+static unsigned char *writeSequence(unsigned char *op, unsigned char *end,
+                                    const unsigned char *literals,
+                                    size_t literalLength, size_t offset,
+                                    size_t matchLength) {
+  size_t extra = matchLength - (matchLength != 0 ? MIN_MATCH : 0);
+  size_t needed = 1 + literalLength + literalLength / 255 + 1 +
+                  (matchLength != 0 ? 2 + extra / 255 + 1 : 0);
+  if (needed > static_cast<size_t>(end - op)) return nullptr;
+  unsigned char *token = op++;
+  *token = static_cast<unsigned char>(std::min<size_t>(literalLength, 15) << 4);
+  if (literalLength >= 15) op = writeLength(op, literalLength - 15);
+  std::memcpy(op, literals, literalLength);
+  op += literalLength;
+  if (matchLength == 0) return op;
+  *op++ = static_cast<unsigned char>(offset);
+  *op++ = static_cast<unsigned char>(offset >> 8);
+  *token |= static_cast<unsigned char>(std::min<size_t>(extra, 15));
+  if (extra >= 15) op = writeLength(op, extra - 15);
+  return op;
+}
+
+size_t compressBlock(const unsigned char *src, size_t size, unsigned char *dst,
+                     size_t capacity) {
+  unsigned char *op = dst;
+  unsigned char *end = dst + capacity;
+  const unsigned char *anchor = src;
+  const unsigned char *ip = src;
+  const unsigned char *matchLimit = src + size - std::min(size, END_LITERALS);
+
+  if (size > MIN_MATCH + END_LITERALS) {
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+    // Skips ahead faster the longer no match is found.
+    unsigned misses = 0;
+    while (ip + MIN_MATCH <= matchLimit) {
+      uint32_t sequence = read32(ip);
+      uint32_t &entry = table[hash4(sequence)];
+      const unsigned char *ref = src + entry;
+      entry = static_cast<uint32_t>(ip - src);
+      if (ref >= ip || static_cast<size_t>(ip - ref) > MAX_OFFSET ||
+          read32(ref) != sequence) {
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      size_t length = MIN_MATCH;
+      while (ip + length < matchLimit && ip[length] == ref[length]) ++length;
+      op = writeSequence(op, end, anchor, ip - anchor, ip - ref, length);
+      if (op == nullptr) return 0;
+      ip += length;
+      anchor = ip;
+      misses = 0;
+      if (ip + MIN_MATCH <= matchLimit) {
+        table[hash4(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+      }
+    }
+  }
+  op = writeSequence(op, end, anchor, src + size - anchor, 0, 0);
+  return op != nullptr ? static_cast<size_t>(op - dst) : 0;
+}
+
+static bool readLength(const unsigned char *&ip, const unsigned char *end,
+                       size_t &length) {
+  unsigned char b;
+  do {
+    if (ip >= end) return false;
+    b = *ip++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+bool decompressBlock(const unsigned char *src, size_t packed,
+                     unsigned char *dst, size_t size) {
+  const unsigned char *ip = src;
+  const unsigned char *end = src + packed;
+  unsigned char *op = dst;
+  unsigned char *out = dst + size;
+  for (;;) {
+    if (ip >= end) return false;
+    unsigned token = *ip++;
+
+    size_t literals = token >> 4;
+    if (literals == 15 && !readLength(ip, end, literals)) return false;
+    if (literals > static_cast<size_t>(end - ip) ||
+        literals > static_cast<size_t>(out - op)) {
+      return false;
+    }
+    if (literals <= 16 && end - ip >= 16 && out - op >= 16) {
+      std::memcpy(op, ip, 16);
+    } else {
+      std::memcpy(op, ip, literals);
+    }
+    ip += literals;
+    op += literals;
+    if (ip == end) return op == out;
+
+    if (end - ip < 2) return false;
+    size_t offset = ip[0] | (size_t(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+    size_t length = token & 15;
+    if (length == 15 && !readLength(ip, end, length)) return false;
+    length += MIN_MATCH;
+    if (length > static_cast<size_t>(out - op)) return false;
+
+    // Whole words when there is room to overshoot. A short repeating
+    // pattern is first written out to a period of at least eight bytes.
+    const unsigned char *ref = op - offset;
+    if (offset >= 16 && length + 16 <= static_cast<size_t>(out - op)) {
+      for (size_t i = 0; i < length; i += 16) std::memcpy(op + i, ref + i, 16);
+    } else if (offset >= 8 && length + 8 <= static_cast<size_t>(out - op)) {
+      for (size_t i = 0; i < length; i += 8) std::memcpy(op + i, ref + i, 8);
+    } else if (length + 8 <= static_cast<size_t>(out - op)) {
+      size_t period = offset * ((offset + 7) / offset);
+      size_t head = std::min(period, length);
+      for (size_t i = 0; i < head; i++) op[i] = ref[i];
+      for (size_t i = period; i < length; i += 8) {
+        std::memcpy(op + i, op + i - period, 8);
+      }
+    } else {
+      for (size_t i = 0; i < length; i++) op[i] = ref[i];
+    }
+    op += length;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
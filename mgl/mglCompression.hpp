@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Block Compression Functions
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_COMPRESSION_HPP
+#define MGL_COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mgl {
+
+/////////////////////////////////////////////////////////////////// Compression
+//
+// LZ77 block codec in the spirit of LZ4: greedy matches found through a hash
+// of the next four bytes, within a 64KiB window, stored as sequences of a
+// token byte, literals, a two byte offset and extra length bytes. No entropy
+// coding, so decoding is little more than memcpy. Blocks are independent;
+// large data is split in chunks of COMPRESSION_CHUNK bytes by the callers so
+// they can be decoded in parallel, each straight into its place.
+
+const size_t COMPRESSION_CHUNK = 256 * 1024;
+
+// Compresses size bytes from src into at most capacity bytes of dst and
+// returns the compressed size, or 0 when it does not fit.
+size_t compressBlock(const unsigned char *src, size_t size, unsigned char *dst,
+                     size_t capacity);
+
+// Decodes a whole block into exactly size bytes of dst. Every length and
+// offset is checked, so damaged input fails instead of writing out of
+// bounds.
+bool decompressBlock(const unsigned char *src, size_t packed,
+                     unsigned char *dst, size_t size);
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_COMPRESSION_HPP */
@@ -9,25 +9,69 @@
 #ifndef MGL_CONVENTIONS_HPP
 #define MGL_CONVENTIONS_HPP
 
+#include <cstdint>
 #include <string>
 
 namespace mgl {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-const char MODEL_MATRIX[] = "ModelMatrix";
-const char NORMAL_MATRIX[] = "NormalMatrix";
-const char VIEW_MATRIX[] = "ViewMatrix";
-const char PROJECTION_MATRIX[] = "ProjectionMatrix";
-const char TEXTURE_MATRIX[] = "TextureMatrix";
-const char CAMERA_BLOCK[] = "Camera";
-
-const char POSITION_ATTRIBUTE[] = "inPosition";
-const char NORMAL_ATTRIBUTE[] = "inNormal";
-const char TEXCOORD_ATTRIBUTE[] = "inTexcoord";
-const char TANGENT_ATTRIBUTE[] = "inTangent";
-const char BITANGENT_ATTRIBUTE[] = "inBitangent";
-const char COLOR_ATTRIBUTE[] = "inColor";
+constexpr char MODEL_MATRIX[] = "ModelMatrix";
+constexpr char NORMAL_MATRIX[] = "NormalMatrix";
+constexpr char VIEW_MATRIX[] = "ViewMatrix";
+constexpr char PROJECTION_MATRIX[] = "ProjectionMatrix";
+constexpr char TEXTURE_MATRIX[] = "TextureMatrix";
+constexpr char CAMERA_BLOCK[] = "Camera";
+constexpr char OBJECT_BLOCK[] = "Object";
+constexpr char EFFECT_UNIFORM[] = "effect";
+constexpr char EFFECT_DEFINE[] = "EFFECT";
+constexpr char PRECOMPUTED_MATRICES_DEFINE[] = "PRECOMPUTED_MATRICES";
+constexpr char BONES_BLOCK[] = "Bones";
+constexpr char SKINNED_DEFINE[] = "SKINNED";
+
+constexpr char POSITION_ATTRIBUTE[] = "inPosition";
+constexpr char NORMAL_ATTRIBUTE[] = "inNormal";
+constexpr char TEXCOORD_ATTRIBUTE[] = "inTexcoord";
+constexpr char TANGENT_ATTRIBUTE[] = "inTangent";
+constexpr char BITANGENT_ATTRIBUTE[] = "inBitangent";
+constexpr char COLOR_ATTRIBUTE[] = "inColor";
+constexpr char OBJECT_INDEX_ATTRIBUTE[] = "inObjectIndex";
+constexpr char BONE_INDICES_ATTRIBUTE[] = "inBoneIndices";
+constexpr char BONE_WEIGHTS_ATTRIBUTE[] = "inBoneWeights";
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Uniform handles index a small per-program location table, so the draw loop
+// never builds strings or searches maps. The built-in handles below match
+// the names above through their compile-time hashes; others are added with
+// ShaderProgram::getUniformHandle() at initialisation.
+
+constexpr uint32_t nameHash(const char *name) {
+  uint32_t hash = 2166136261u;
+  while (*name != 0) {
+    hash = (hash ^ static_cast<unsigned char>(*name++)) * 16777619u;
+  }
+  return hash;
+}
+
+typedef unsigned int UniformHandle;
+
+const UniformHandle MODEL_MATRIX_HANDLE = 0;
+const UniformHandle NORMAL_MATRIX_HANDLE = 1;
+const UniformHandle VIEW_MATRIX_HANDLE = 2;
+const UniformHandle PROJECTION_MATRIX_HANDLE = 3;
+const UniformHandle TEXTURE_MATRIX_HANDLE = 4;
+const UniformHandle EFFECT_HANDLE = 5;
+const unsigned int MAX_UNIFORM_HANDLES = 64;
+
+// Permutation feature bits shared by the library and the application.
+const uint32_t PRECOMPUTED_MATRICES_FEATURE = 1;
+const uint32_t SKINNED_FEATURE = 2;
+
+constexpr uint32_t BUILTIN_UNIFORM_HASHES[] = {
+    nameHash(MODEL_MATRIX),      nameHash(NORMAL_MATRIX),
+    nameHash(VIEW_MATRIX),       nameHash(PROJECTION_MATRIX),
+    nameHash(TEXTURE_MATRIX),    nameHash(EFFECT_UNIFORM)};
 
 ////////////////////////////////////////////////////////////////////////////////
 }  // namespace mgl
@@ -0,0 +1,442 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU Culling Class (OpenGL 4.3)
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglCuller.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "./mglConventions.hpp"
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////// GpuCuller
+
+GpuCuller::GpuCuller() {
+  VaoId = 0;
+  ObjectBuffer = 0;
+  CommandBuffer = 0;
+  for (GLuint &id : VertexBuffers) id = 0;
+  DepthTexture = 0;
+  HiZTexture = 0;
+  Width = 0, Height = 0, HiZLevels = 0;
+  Occlusion = true;
+  HiZValid = false;
+  ViewProjection = HiZViewProjection = glm::mat4(1.f);
+
+  CullShaders = new ShaderProgram();
+  CullShaders->addShader(GL_COMPUTE_SHADER, "cull-cs.glsl");
+  CullShaders->addUniform("ViewProjection");
+  CullShaders->addUniform("HiZViewProjection");
+  CullShaders->addUniform("HiZLevels");
+  CullShaders->addUniform("CommandCount");
+  CullShaders->addUniform("Occlusion");
+  CullShaders->create();
+
+  HiZShaders = new ShaderProgram();
+  HiZShaders->addShader(GL_COMPUTE_SHADER, "hiz-cs.glsl");
+  HiZShaders->addUniform("Level");
+  HiZShaders->create();
+
+  ViewProjectionId = ShaderProgram::getUniformHandle("ViewProjection");
+  HiZViewProjectionId = ShaderProgram::getUniformHandle("HiZViewProjection");
+  HiZLevelsId = ShaderProgram::getUniformHandle("HiZLevels");
+  CommandCountId = ShaderProgram::getUniformHandle("CommandCount");
+  OcclusionId = ShaderProgram::getUniformHandle("Occlusion");
+  LevelId = ShaderProgram::getUniformHandle("Level");
+}
+
+GpuCuller::~GpuCuller() {
+  destroyBufferObjects();
+  destroyHiZ();
+  delete CullShaders;
+  delete HiZShaders;
+}
+
+bool GpuCuller::isSupported() {
+  return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader &&
+                              GLEW_ARB_shader_storage_buffer_object &&
+                              GLEW_ARB_multi_draw_indirect);
+}
+
+void GpuCuller::setOcclusion(bool enabled) { Occlusion = enabled; }
+
+bool GpuCuller::getOcclusion() { return Occlusion; }
+
+////////////////////////////////////////////////////////////////////////// BUILD
+
+void GpuCuller::collect(Node *node) {
+  Mesh *mesh = node->getMesh();
+  if (mesh != nullptr) {
+    ObjectNodes.push_back(node);
+    ObjectMeshes.push_back(mesh);
+  }
+  for (Node *n : node->getChildren()) {
+    collect(n);
+  }
+}
+
+void GpuCuller::build(SceneGraph *scene) {
+  ObjectNodes.clear();
+  ObjectMeshes.clear();
+  scene->update();
+  collect(&scene->getRoot());
+
+  struct Entry {
+    int effect;
+    DrawElementsIndirectCommand command;
+  };
+  std::vector<Entry> entries;
+  GLuint first_index = 0;
+  GLint first_vertex = 0;
+  for (GLuint i = 0; i < ObjectMeshes.size(); i++) {
+    Mesh *mesh = ObjectMeshes[i];
+    for (const Mesh::MeshData &md : mesh->getMeshData()) {
+      DrawElementsIndirectCommand cmd{};
+      cmd.count = md.nIndices;
+      cmd.instanceCount = 1;
+      cmd.firstIndex = first_index + md.baseIndex;
+      cmd.baseVertex = first_vertex + md.baseVertex;
+      cmd.baseInstance = i;
+      entries.push_back({mesh->getEffect(), cmd});
+    }
+    first_index += static_cast<GLuint>(mesh->getIndices().size());
+    first_vertex += static_cast<GLint>(mesh->getPositions().size());
+  }
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const Entry &a, const Entry &b) {
+                     return a.effect < b.effect;
+                   });
+
+  Commands.clear();
+  Ranges.clear();
+  for (const Entry &e : entries) {
+    if (Ranges.empty() || Ranges.back().effect != e.effect) {
+      Ranges.push_back({e.effect, static_cast<GLuint>(Commands.size()), 0});
+    }
+    Ranges.back().count++;
+    Commands.push_back(e.command);
+  }
+
+  destroyBufferObjects();
+  createBufferObjects();
+  ObjectVersions.assign(ObjectMeshes.size(), 0);
+  updateObjects();
+  HiZValid = false;
+
+#ifdef DEBUG
+  std::cout << "GpuCuller: " << ObjectMeshes.size() << " object(s), "
+            << Commands.size() << " command(s), " << Ranges.size()
+            << " indirect draw(s)" << std::endl;
+#endif
+}
+
+// Objects whose world version moved since their last upload are refreshed,
+// normal matrix included, and sent in contiguous runs. Nodes outside a
+// compiled scene have no version and are always sent.
+void GpuCuller::updateObjects() {
+  Objects.resize(ObjectMeshes.size());
+  ObjectVersions.resize(ObjectMeshes.size(), 0);
+  if (ObjectBuffer == 0) return;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, ObjectBuffer);
+  size_t run = 0;
+  bool running = false;
+  for (size_t i = 0; i < ObjectMeshes.size(); i++) {
+    uint64_t version = ObjectNodes[i]->getWorldVersion();
+    bool changed = version == 0 || version != ObjectVersions[i];
+    if (changed) {
+      Mesh *mesh = ObjectMeshes[i];
+      ObjectData &object = Objects[i];
+      object.modelMatrix = ObjectNodes[i]->getWorldMatrix();
+      object.normalMatrix = glm::mat4(
+          glm::transpose(glm::inverse(glm::mat3(object.modelMatrix))));
+      object.boundsMin = glm::vec4(mesh->getBoundsMin(), 1.f);
+      object.boundsMax = glm::vec4(mesh->getBoundsMax(), 1.f);
+      ObjectVersions[i] = version;
+      if (!running) run = i;
+      running = true;
+    } else if (running) {
+      uploadObjects(run, i);
+      running = false;
+    }
+  }
+  if (running) uploadObjects(run, ObjectMeshes.size());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuCuller::uploadObjects(size_t begin, size_t end) {
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ObjectData) * begin,
+                  sizeof(ObjectData) * (end - begin), &Objects[begin]);
+}
+
+void GpuCuller::createBufferObjects() {
+  std::vector<glm::vec3> positions, normals;
+  std::vector<glm::vec2> texcoords;
+  std::vector<GLuint> indices, object_indices;
+  for (GLuint i = 0; i < ObjectMeshes.size(); i++) {
+    Mesh *mesh = ObjectMeshes[i];
+    const std::vector<glm::vec3> &p = mesh->getPositions();
+    positions.insert(positions.end(), p.begin(), p.end());
+    if (mesh->hasNormals()) {
+      normals.insert(normals.end(), mesh->getNormals().begin(),
+                     mesh->getNormals().end());
+    } else {
+      normals.resize(positions.size(), glm::vec3(0.f));
+    }
+    if (mesh->hasTexcoords()) {
+      texcoords.insert(texcoords.end(), mesh->getTexcoords().begin(),
+                       mesh->getTexcoords().end());
+    } else {
+      texcoords.resize(positions.size(), glm::vec2(0.f));
+    }
+    indices.insert(indices.end(), mesh->getIndices().begin(),
+                   mesh->getIndices().end());
+    object_indices.push_back(i);
+  }
+  if (positions.empty()) return;
+
+  glGenVertexArrays(1, &VaoId);
+  glBindVertexArray(VaoId);
+  {
+    glGenBuffers(5, VertexBuffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VertexBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(positions[0]) * positions.size(),
+                 positions.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(Mesh::POSITION);
+    glVertexAttribPointer(Mesh::POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VertexBuffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(normals[0]) * normals.size(),
+                 normals.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(Mesh::NORMAL);
+    glVertexAttribPointer(Mesh::NORMAL, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VertexBuffers[2]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords[0]) * texcoords.size(),
+                 texcoords.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(Mesh::TEXCOORD);
+    glVertexAttribPointer(Mesh::TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // One entry per object; baseInstance selects it through the divisor.
+    glBindBuffer(GL_ARRAY_BUFFER, VertexBuffers[4]);
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(object_indices[0]) * object_indices.size(),
+                 object_indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(OBJECT_INDEX);
+    glVertexAttribIPointer(OBJECT_INDEX, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(OBJECT_INDEX, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VertexBuffers[3]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(),
+                 indices.data(), GL_STATIC_DRAW);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &ObjectBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, ObjectBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ObjectData) * ObjectMeshes.size(),
+               0, GL_DYNAMIC_DRAW);
+
+  glGenBuffers(1, &CommandBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, CommandBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               sizeof(DrawElementsIndirectCommand) * Commands.size(),
+               Commands.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuCuller::destroyBufferObjects() {
+  if (VaoId == 0) return;
+  glDeleteVertexArrays(1, &VaoId);
+  glDeleteBuffers(5, VertexBuffers);
+  glDeleteBuffers(1, &ObjectBuffer);
+  glDeleteBuffers(1, &CommandBuffer);
+  VaoId = ObjectBuffer = CommandBuffer = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////// HIZ
+
+void GpuCuller::resize(int width, int height) {
+  if (width == Width && height == Height) return;
+  Width = width;
+  Height = height;
+  destroyHiZ();
+  createHiZ();
+}
+
+void GpuCuller::createHiZ() {
+  if (Width <= 0 || Height <= 0) return;
+  HiZLevels = 1 + static_cast<int>(std::floor(std::log2(std::max(Width, Height))));
+
+  glGenTextures(1, &DepthTexture);
+  glBindTexture(GL_TEXTURE_2D, DepthTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, Width, Height, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  glGenTextures(1, &HiZTexture);
+  glBindTexture(GL_TEXTURE_2D, HiZTexture);
+  glTexStorage2D(GL_TEXTURE_2D, HiZLevels, GL_R32F, Width, Height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  HiZValid = false;
+}
+
+void GpuCuller::destroyHiZ() {
+  if (DepthTexture != 0) glDeleteTextures(1, &DepthTexture);
+  if (HiZTexture != 0) glDeleteTextures(1, &HiZTexture);
+  DepthTexture = HiZTexture = 0;
+  HiZValid = false;
+}
+
+void GpuCuller::updateHiZ() {
+  if (HiZTexture == 0) return;
+
+  glBindTexture(GL_TEXTURE_2D, DepthTexture);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, Width, Height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  HiZShaders->bind();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, DepthTexture);
+  for (int level = 0; level < HiZLevels; level++) {
+    int w = std::max(1, Width >> level);
+    int h = std::max(1, Height >> level);
+    glUniform1i(HiZShaders->getUniformLocation(LevelId), level);
+    glBindImageTexture(0, HiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    if (level > 0) {
+      glBindImageTexture(1, HiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY,
+                         GL_R32F);
+    }
+    glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  HiZShaders->unbind();
+
+  HiZViewProjection = ViewProjection;
+  HiZValid = true;
+}
+
+/////////////////////////////////////////////////////////////////////////// CULL
+
+void GpuCuller::cull(Camera *camera) {
+  if (Commands.empty()) return;
+  ViewProjection = camera->getProjectionMatrix() * camera->getViewMatrix();
+
+  CullShaders->bind();
+  glUniformMatrix4fv(CullShaders->getUniformLocation(ViewProjectionId), 1,
+                     GL_FALSE, &ViewProjection[0][0]);
+  glUniformMatrix4fv(CullShaders->getUniformLocation(HiZViewProjectionId), 1,
+                     GL_FALSE, &HiZViewProjection[0][0]);
+  glUniform1i(CullShaders->getUniformLocation(HiZLevelsId), HiZLevels);
+  glUniform1ui(CullShaders->getUniformLocation(CommandCountId),
+               static_cast<GLuint>(Commands.size()));
+  glUniform1i(CullShaders->getUniformLocation(OcclusionId),
+              Occlusion && HiZValid ? 1 : 0);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, HiZTexture);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ObjectBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, CommandBuffer);
+  glDispatchCompute((static_cast<GLuint>(Commands.size()) + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  CullShaders->unbind();
+}
+
+void GpuCuller::draw(ShaderProgram *shaders) {
+  if (Commands.empty()) return;
+  glBindVertexArray(VaoId);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ObjectBuffer);
+  GLint effect = shaders->getUniformLocation(EFFECT_HANDLE);
+  for (const EffectRange &range : Ranges) {
+    glUniform1i(effect, range.effect);
+    glMultiDrawElementsIndirect(
+        GL_TRIANGLES, GL_UNSIGNED_INT,
+        reinterpret_cast<void *>(sizeof(DrawElementsIndirectCommand) *
+                                 range.first),
+        range.count, 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+/////////////////////////////////////////////////////////////////////////// CPU
+
+// Same clip-space test as cull-cs.glsl: an object is rejected only if all
+// eight corners of its bounding box lie outside the same frustum plane.
+std::vector<bool> GpuCuller::cullCPU(Camera *camera) {
+  glm::mat4 vp = camera->getProjectionMatrix() * camera->getViewMatrix();
+  std::vector<bool> visible(Commands.size());
+  for (size_t i = 0; i < Commands.size(); i++) {
+    const ObjectData &object = Objects[Commands[i].baseInstance];
+    glm::mat4 mvp = vp * object.modelMatrix;
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    for (int c = 0; c < 8; c++) {
+      glm::vec4 corner((c & 1) ? object.boundsMax.x : object.boundsMin.x,
+                       (c & 2) ? object.boundsMax.y : object.boundsMin.y,
+                       (c & 4) ? object.boundsMax.z : object.boundsMin.z, 1.f);
+      glm::vec4 clip = mvp * corner;
+      outside[0] += clip.x < -clip.w;
+      outside[1] += clip.x > clip.w;
+      outside[2] += clip.y < -clip.w;
+      outside[3] += clip.y > clip.w;
+      outside[4] += clip.z < -clip.w;
+      outside[5] += clip.z > clip.w;
+    }
+    visible[i] = true;
+    for (int p = 0; p < 6; p++) {
+      if (outside[p] == 8) visible[i] = false;
+    }
+  }
+  return visible;
+}
+
+// Reads back the GPU result and compares it with the CPU frustum culler.
+// With occlusion on the GPU may reject more, but never keep what the CPU
+// rejected; with occlusion off both must agree exactly.
+bool GpuCuller::verify(Camera *camera) {
+  if (Commands.empty()) return true;
+  std::vector<bool> expected = cullCPU(camera);
+  std::vector<DrawElementsIndirectCommand> result(Commands.size());
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, CommandBuffer);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     sizeof(DrawElementsIndirectCommand) * result.size(),
+                     result.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  bool occlusion = Occlusion && HiZValid;
+  size_t gpu_visible = 0, cpu_visible = 0, mismatches = 0;
+  for (size_t i = 0; i < result.size(); i++) {
+    bool gpu = result[i].instanceCount != 0;
+    gpu_visible += gpu;
+    cpu_visible += expected[i];
+    if (gpu && !expected[i]) mismatches++;
+    if (!occlusion && !gpu && expected[i]) mismatches++;
+  }
+  std::cerr << "GpuCuller: GPU " << gpu_visible << "/" << result.size()
+            << " visible, CPU " << cpu_visible << "/" << result.size()
+            << " visible, " << mismatches << " mismatch(es)"
+            << (occlusion ? " [occlusion]" : "") << std::endl;
+  return mismatches == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
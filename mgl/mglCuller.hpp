@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU Culling Class (OpenGL 4.3)
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_CULLER_HPP
+#define MGL_CULLER_HPP
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mglCamera.hpp"
+#include "mglMesh.hpp"
+#include "mglScenegraph.hpp"
+#include "mglShader.hpp"
+
+namespace mgl {
+
+class GpuCuller;
+
+////////////////////////////////////////////////////////////////////// GpuCuller
+//
+// Packs every mesh of a scene into shared buffers, culls them in a compute
+// shader against the view frustum and last frame's Hi-Z depth pyramid, and
+// draws the survivors with glMultiDrawElementsIndirect. Commands are grouped
+// in one range per effect, so the draw cost does not depend on object count.
+// updateObjects() is called every frame, after the scene update and before
+// cull(); it only uploads the objects whose world matrix changed.
+
+class GpuCuller {
+ public:
+  static const GLuint OBJECT_INDEX = 7;
+
+  struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  // The normal matrix is kept as a mat4, as in the Object uniform block.
+  struct ObjectData {
+    glm::mat4 modelMatrix;
+    glm::mat4 normalMatrix;
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+  };
+
+  GpuCuller();
+  ~GpuCuller();
+
+  static bool isSupported();
+
+  void build(SceneGraph *scene);
+  void updateObjects();
+  void resize(int width, int height);
+  void setOcclusion(bool enabled);
+  bool getOcclusion();
+
+  void cull(Camera *camera);
+  void draw(ShaderProgram *shaders);
+  void updateHiZ();
+
+  std::vector<bool> cullCPU(Camera *camera);
+  bool verify(Camera *camera);
+
+ private:
+  struct EffectRange {
+    int effect;
+    GLuint first;
+    GLuint count;
+  };
+
+  std::vector<Node *> ObjectNodes;
+  std::vector<Mesh *> ObjectMeshes;
+  std::vector<ObjectData> Objects;
+  std::vector<uint64_t> ObjectVersions;
+  std::vector<DrawElementsIndirectCommand> Commands;
+  std::vector<EffectRange> Ranges;
+
+  GLuint VaoId, ObjectBuffer, CommandBuffer;
+  GLuint VertexBuffers[5];
+  GLuint DepthTexture, HiZTexture;
+  int Width, Height, HiZLevels;
+  bool Occlusion, HiZValid;
+  glm::mat4 ViewProjection, HiZViewProjection;
+
+  ShaderProgram *CullShaders;
+  ShaderProgram *HiZShaders;
+  UniformHandle ViewProjectionId, HiZViewProjectionId, HiZLevelsId;
+  UniformHandle CommandCountId, OcclusionId, LevelId;
+
+  void collect(Node *node);
+  void uploadObjects(size_t begin, size_t end);
+  void createBufferObjects();
+  void destroyBufferObjects();
+  void createHiZ();
+  void destroyHiZ();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_CULLER_HPP */
@@ -0,0 +1,367 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Flattened Scene Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglFlatScene.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <glm/gtc/type_ptr.hpp>
+#include <utility>
+
+#include "./mglConventions.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////// FlatScene
+
+FlatScene::FlatScene()
+    : Root(nullptr),
+      Holes(0),
+      AnyDirty(false),
+      LevelsStale(true),
+      Version(0) {}
+
+FlatScene::~FlatScene() { clear(); }
+
+Node *FlatScene::getRoot() { return Root; }
+
+size_t FlatScene::size() { return Nodes.size() - Holes; }
+
+const glm::mat4 &FlatScene::getWorldMatrix(int32_t index) {
+  return Worlds[index];
+}
+
+// Stamped from a counter that is never reset whenever update() recomputes
+// the world matrix of the slot, so a copy of the matrix made elsewhere is
+// stale when the version differs from the one it was made at, even across
+// rebuilds. 0 until the first update().
+uint64_t FlatScene::getWorldVersion(int32_t index) {
+  return WorldVersions[index];
+}
+
+void FlatScene::clear() {
+  for (Node *node : Nodes) {
+    if (node != nullptr) {
+      node->scene = nullptr;
+      node->flatIndex = -1;
+    }
+  }
+  Nodes.clear();
+  Parents.clear();
+  Locals.clear();
+  Worlds.clear();
+  Meshes.clear();
+  BoundsMin.clear();
+  BoundsMax.clear();
+  Dirty.clear();
+  WorldVersions.clear();
+  Visible.clear();
+  Pending.clear();
+  Holes = 0;
+  LevelsStale = true;
+}
+
+void FlatScene::build(Node *root) {
+  clear();
+  Root = root;
+  if (Root != nullptr) appendSubtree(Root, -1);
+}
+
+void FlatScene::append(Node *node, int32_t parent) {
+  node->scene = this;
+  node->flatIndex = static_cast<int32_t>(Nodes.size());
+  Mesh *mesh = node->getMesh();
+  Nodes.push_back(node);
+  Parents.push_back(parent);
+  Locals.push_back(glm::mat4(1.f));
+  Worlds.push_back(glm::mat4(1.f));
+  Meshes.push_back(mesh);
+  BoundsMin.push_back(glm::vec3(0.f));
+  BoundsMax.push_back(glm::vec3(0.f));
+  Dirty.push_back(LOCAL_DIRTY);
+  WorldVersions.push_back(0);
+  Visible.push_back(1);
+  AnyDirty = true;
+  LevelsStale = true;
+}
+
+// Breadth-first, so the subtree is laid out parent-first as well.
+void FlatScene::appendSubtree(Node *node, int32_t parent) {
+  std::vector<std::pair<Node *, int32_t>> fifo;
+  fifo.push_back({node, parent});
+  for (size_t head = 0; head < fifo.size(); head++) {
+    Node *n = fifo[head].first;
+    append(n, fifo[head].second);
+    for (Node *child : n->getChildren()) {
+      fifo.push_back({child, n->flatIndex});
+    }
+  }
+}
+
+void FlatScene::remove(Node *node) {
+  if (node->scene != this) return;
+  int32_t i = node->flatIndex;
+  Nodes[i] = nullptr;
+  Meshes[i] = nullptr;
+  Parents[i] = -1;
+  Dirty[i] = CLEAN;
+  node->scene = nullptr;
+  node->flatIndex = -1;
+  Holes++;
+  LevelsStale = true;
+  for (Node *child : node->getChildren()) {
+    remove(child);
+  }
+}
+
+void FlatScene::attach(Node *node) { Pending.push_back({ATTACH, node}); }
+
+void FlatScene::detach(Node *node) { Pending.push_back({DETACH, node}); }
+
+// Immediate removal, for nodes about to be destroyed.
+void FlatScene::erase(Node *node) {
+  remove(node);
+  for (auto &op : Pending) {
+    if (op.second == node) op.second = nullptr;
+  }
+}
+
+// Applies the queued structural changes in order. A node attached under a
+// parent that is itself still pending is skipped; the parent's subtree
+// will bring it in.
+void FlatScene::commit() {
+  if (Pending.empty()) return;
+  std::vector<std::pair<PendingOp, Node *>> pending;
+  pending.swap(Pending);
+  for (auto &op : pending) {
+    Node *node = op.second;
+    if (node == nullptr) {
+      continue;
+    } else if (op.first == DETACH) {
+      remove(node);
+    } else if (node->scene != this && node->parent != nullptr &&
+               node->parent->scene == this) {
+      appendSubtree(node, node->parent->flatIndex);
+    }
+  }
+  if (Holes > 0 && Holes * 2 >= Nodes.size()) {
+    build(Root);
+  }
+}
+
+void FlatScene::invalidate(int32_t index) {
+  Dirty[index] = LOCAL_DIRTY;
+  AnyDirty = true;
+}
+
+// Groups the live slots by depth, parents before children, so that each
+// level can be updated in parallel once the one above is done. Only redone
+// after structural changes.
+void FlatScene::sortLevels() {
+  const size_t n = Nodes.size();
+  std::vector<int32_t> depths(n, -1);
+  LevelStarts.assign(1, 0);
+  for (size_t i = 0; i < n; i++) {
+    if (Nodes[i] == nullptr) continue;
+    int32_t p = Parents[i];
+    depths[i] = p >= 0 ? depths[p] + 1 : 0;
+    size_t level = static_cast<size_t>(depths[i]) + 1;
+    if (LevelStarts.size() <= level) LevelStarts.resize(level + 1, 0);
+    LevelStarts[level]++;
+  }
+  for (size_t l = 1; l < LevelStarts.size(); l++) {
+    LevelStarts[l] += LevelStarts[l - 1];
+  }
+  LevelOrder.resize(LevelStarts.back());
+  std::vector<size_t> next(LevelStarts.begin(), LevelStarts.end() - 1);
+  for (size_t i = 0; i < n; i++) {
+    if (depths[i] >= 0) {
+      LevelOrder[next[depths[i]]++] = static_cast<int32_t>(i);
+    }
+  }
+  LevelsStale = false;
+}
+
+// Changed local transforms of one block of slots, converted in one
+// TransformBatch pass.
+void FlatScene::updateLocals(size_t block) {
+  LocalBlock &b = LocalBlocks[block];
+  const size_t end = std::min(Nodes.size(), (block + 1) * UPDATE_GRAIN);
+  b.batch.clear();
+  b.indices.clear();
+  for (size_t i = block * UPDATE_GRAIN; i < end; i++) {
+    if (Nodes[i] == nullptr || Dirty[i] != LOCAL_DIRTY) continue;
+    Meshes[i] = Nodes[i]->getMesh();
+    Transform *t = Nodes[i]->getLocalTransform();
+    if (t != nullptr) {
+      b.batch.add(t->getTranslate(), t->getRotation(), t->getScale());
+      b.indices.push_back(static_cast<int32_t>(i));
+    } else {
+      Locals[i] = glm::mat4(1.f);
+    }
+  }
+  b.matrices.resize(b.indices.size());
+  b.batch.compute(b.matrices.data());
+  for (size_t k = 0; k < b.indices.size(); k++) {
+    Locals[b.indices[k]] = b.matrices[k];
+  }
+}
+
+// The parent is on the level above, so its matrix and state are final.
+void FlatScene::updateWorld(int32_t i) {
+  int32_t p = Parents[i];
+  if (p >= 0 && Dirty[p] != CLEAN && Dirty[i] == CLEAN) {
+    Dirty[i] = WORLD_DIRTY;
+  }
+  if (Dirty[i] == CLEAN) return;
+  Worlds[i] = p >= 0 ? Worlds[p] * Locals[i] : Locals[i];
+  WorldVersions[i] = ++Version;
+
+  if (Meshes[i] != nullptr) {
+    // World-space AABB of the transformed local box (Arvo).
+    const glm::mat4 &m = Worlds[i];
+    glm::vec3 center =
+        0.5f * (Meshes[i]->getBoundsMax() + Meshes[i]->getBoundsMin());
+    glm::vec3 extent =
+        0.5f * (Meshes[i]->getBoundsMax() - Meshes[i]->getBoundsMin());
+    glm::vec3 c = glm::vec3(m * glm::vec4(center, 1.f));
+    glm::vec3 e;
+    for (int r = 0; r < 3; r++) {
+      e[r] = std::fabs(m[0][r]) * extent.x + std::fabs(m[1][r]) * extent.y +
+             std::fabs(m[2][r]) * extent.z;
+    }
+    BoundsMin[i] = c - e;
+    BoundsMax[i] = c + e;
+  }
+}
+
+// Local matrices first, block by block; then world matrices level by level,
+// so world dirtiness propagates down in the same pass. Dirty flags are only
+// cleared once every level is done, as children read their parent's.
+void FlatScene::update(JobSystem *jobs) {
+  if (!AnyDirty) return;
+  if (LevelsStale) sortLevels();
+  const size_t blocks = (Nodes.size() + UPDATE_GRAIN - 1) / UPDATE_GRAIN;
+  if (LocalBlocks.size() < blocks) LocalBlocks.resize(blocks);
+  auto locals = [this](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) updateLocals(b);
+  };
+  auto worlds = [this](size_t begin, size_t end) {
+    for (size_t k = begin; k < end; k++) updateWorld(LevelOrder[k]);
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, blocks, 1, locals);
+    for (size_t l = 0; l + 1 < LevelStarts.size(); l++) {
+      jobs->parallelFor(LevelStarts[l], LevelStarts[l + 1], UPDATE_GRAIN,
+                        worlds);
+    }
+  } else {
+    locals(0, blocks);
+    worlds(0, LevelOrder.size());
+  }
+  std::fill(Dirty.begin(), Dirty.end(), static_cast<uint8_t>(CLEAN));
+  AnyDirty = false;
+}
+
+// Frustum test of the world bounds against the planes of viewProjection,
+// split over the job system when one is given.
+size_t FlatScene::cull(const glm::mat4 &viewProjection, JobSystem *jobs) {
+  glm::mat4 t = glm::transpose(viewProjection);
+  const glm::vec4 planes[6] = {t[3] + t[0], t[3] - t[0], t[3] + t[1],
+                               t[3] - t[1], t[3] + t[2], t[3] - t[2]};
+  std::atomic<size_t> visible(0);
+  auto body = [&](size_t begin, size_t end) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; i++) {
+      if (Meshes[i] == nullptr) continue;
+      uint8_t inside = 1;
+      for (int p = 0; p < 6 && inside; p++) {
+        const glm::vec4 &pl = planes[p];
+        glm::vec3 v(pl.x >= 0.f ? BoundsMax[i].x : BoundsMin[i].x,
+                    pl.y >= 0.f ? BoundsMax[i].y : BoundsMin[i].y,
+                    pl.z >= 0.f ? BoundsMax[i].z : BoundsMin[i].z);
+        inside = glm::dot(glm::vec3(pl), v) + pl.w >= 0.f;
+      }
+      Visible[i] = inside;
+      count += inside;
+    }
+    visible += count;
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, Nodes.size(), CULL_GRAIN, body);
+  } else {
+    body(0, Nodes.size());
+  }
+  return visible;
+}
+
+// Each block of slots fills a list of its own, appended to the queue in
+// slot order afterwards, so the queue is the same with or without jobs.
+void FlatScene::submit(RenderQueue &queue, PermutationKey features,
+                       JobSystem *jobs) {
+  const size_t n = Nodes.size();
+  const size_t blocks = (n + SUBMIT_GRAIN - 1) / SUBMIT_GRAIN;
+  if (SubmitBlocks.size() < blocks) SubmitBlocks.resize(blocks);
+  auto body = [this, n, features](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) {
+      std::vector<RenderQueue::RenderItem> &items = SubmitBlocks[b];
+      items.clear();
+      const size_t last = std::min(n, (b + 1) * SUBMIT_GRAIN);
+      for (size_t i = b * SUBMIT_GRAIN; i < last; i++) {
+        Mesh *mesh = Meshes[i];
+        if (mesh == nullptr || !Visible[i]) continue;
+        Skin *skin = mesh->getSkin();
+        PermutationKey skinned =
+            skin != nullptr && !skin->isPreskinned() ? SKINNED_FEATURE : 0;
+        items.push_back({ShaderPermutations::makeKey(mesh->getEffect(),
+                                                     features | skinned),
+                         mesh->isTransparent(), mesh, Worlds[i]});
+      }
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, blocks, 1, body);
+  } else {
+    body(0, blocks);
+  }
+  for (size_t b = 0; b < blocks; b++) queue.append(SubmitBlocks[b]);
+}
+
+void FlatScene::draw(ShaderProgram *shaders, DrawFilter filter) {
+  GLint effect = shaders->getUniformLocation(EFFECT_HANDLE);
+  GLint model = shaders->getUniformLocation(MODEL_MATRIX_HANDLE);
+  const size_t n = Nodes.size();
+  for (size_t i = 0; i < n; i++) {
+    Mesh *mesh = Meshes[i];
+    if (mesh == nullptr || !Visible[i]) continue;
+    if ((filter == DRAW_OPAQUE && mesh->isTransparent()) ||
+        (filter == DRAW_TRANSPARENT && !mesh->isTransparent())) {
+      continue;
+    }
+    glUniform1i(effect, mesh->getEffect());
+    glUniformMatrix4fv(model, 1, GL_FALSE, glm::value_ptr(Worlds[i]));
+    mesh->draw();
+  }
+}
+
+// Opaque geometry only: transparent meshes must not hide what is behind them.
+void FlatScene::drawDepth(ShaderProgram *shaders) {
+  GLint model = shaders->getUniformLocation(MODEL_MATRIX_HANDLE);
+  const size_t n = Nodes.size();
+  for (size_t i = 0; i < n; i++) {
+    Mesh *mesh = Meshes[i];
+    if (mesh == nullptr || !Visible[i] || mesh->isTransparent()) continue;
+    glUniformMatrix4fv(model, 1, GL_FALSE, glm::value_ptr(Worlds[i]));
+    mesh->drawDepth();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Flattened Scene Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_FLAT_SCENE_HPP
+#define MGL_FLAT_SCENE_HPP
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mglJobs.hpp"
+#include "mglMesh.hpp"
+#include "mglPermutations.hpp"
+#include "mglRenderQueue.hpp"
+#include "mglShader.hpp"
+#include "mglTransformBatch.hpp"
+
+namespace mgl {
+
+class FlatScene;
+class Node;
+
+enum DrawFilter { DRAW_ALL, DRAW_OPAQUE, DRAW_TRANSPARENT };
+
+////////////////////////////////////////////////////////////////////// FlatScene
+//
+// The node hierarchy compiled into parallel arrays (parent index, local and
+// world matrix, mesh, world bounds) in breadth-first order, so every parent
+// precedes its children. Transform update, culling and submission are
+// forward loops over contiguous memory, split into ranges over the job
+// system when one is given: local matrices block by block, world matrices
+// level by level (a level only reads the one above), draws into a list per
+// block merged in order. Effects are read from the meshes when drawing, as
+// they may change without touching the nodes.
+//
+// Structural changes are queued by the nodes and applied by commit():
+// attached subtrees are appended at the end, which keeps the parent-first
+// order, and detached ones leave holes that are compacted by a rebuild once
+// they make up half of the arrays.
+
+class FlatScene {
+ public:
+  FlatScene();
+  ~FlatScene();
+
+  void build(Node *root);
+  void attach(Node *node);
+  void detach(Node *node);
+  void erase(Node *node);
+  void commit();
+  void invalidate(int32_t index);
+  void update(JobSystem *jobs = nullptr);
+
+  size_t cull(const glm::mat4 &viewProjection, JobSystem *jobs = nullptr);
+  void submit(RenderQueue &queue, PermutationKey features,
+              JobSystem *jobs = nullptr);
+  void draw(ShaderProgram *shaders, DrawFilter filter = DRAW_ALL);
+  void drawDepth(ShaderProgram *shaders);
+
+  Node *getRoot();
+  size_t size();
+  const glm::mat4 &getWorldMatrix(int32_t index);
+  uint64_t getWorldVersion(int32_t index);
+
+ private:
+  static const size_t CULL_GRAIN = 1024;
+  static const size_t UPDATE_GRAIN = 512;
+  static const size_t SUBMIT_GRAIN = 512;
+
+  enum DirtyState : uint8_t { CLEAN = 0, WORLD_DIRTY = 1, LOCAL_DIRTY = 2 };
+  enum PendingOp { ATTACH, DETACH };
+
+  // Scratch of one block of slots in update().
+  struct LocalBlock {
+    TransformBatch batch;
+    std::vector<int32_t> indices;
+    std::vector<glm::mat4> matrices;
+  };
+
+  Node *Root;
+  std::vector<Node *> Nodes;
+  std::vector<int32_t> Parents;
+  std::vector<glm::mat4> Locals;
+  std::vector<glm::mat4> Worlds;
+  std::vector<Mesh *> Meshes;
+  std::vector<glm::vec3> BoundsMin;
+  std::vector<glm::vec3> BoundsMax;
+  std::vector<uint8_t> Dirty;
+  std::vector<uint64_t> WorldVersions;
+  std::vector<uint8_t> Visible;
+  std::vector<std::pair<PendingOp, Node *>> Pending;
+  std::vector<LocalBlock> LocalBlocks;
+  std::vector<int32_t> LevelOrder;  // live slots sorted by depth
+  std::vector<size_t> LevelStarts;  // level l is [start l, start l + 1)
+  std::vector<std::vector<RenderQueue::RenderItem>> SubmitBlocks;
+  size_t Holes;
+  bool AnyDirty, LevelsStale;
+  std::atomic<uint64_t> Version;
+
+  void clear();
+  void sortLevels();
+  void updateLocals(size_t block);
+  void updateWorld(int32_t i);
+  void append(Node *node, int32_t parent);
+  void appendSubtree(Node *node, int32_t parent);
+  void remove(Node *node);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_FLAT_SCENE_HPP */
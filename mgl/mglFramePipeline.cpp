@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Frame Packet and Pipeline Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglFramePipeline.hpp"
+
+#include <chrono>
+
+namespace mgl {
+
+//////////////////////////////////////////////////////////////////// FramePacket
+
+FramePacket::FramePacket(GLuint bindingpoint)
+    : frame(0), elapsed(0.0), viewMatrix(1.f), projectionMatrix(1.f),
+      batch(bindingpoint) {}
+
+////////////////////////////////////////////////////////////////// FramePipeline
+
+FramePipeline::FramePipeline(GLuint bindingpoint)
+    : Writing(NONE), Ready(NONE), Reading(NONE), Frames(0) {
+  Packets[0] = new FramePacket(bindingpoint);
+  Packets[1] = new FramePacket(bindingpoint);
+}
+
+FramePipeline::~FramePipeline() {
+  delete Packets[0];
+  delete Packets[1];
+}
+
+// Returns nullptr if no packet became free in time, so the caller can check
+// whether it should stop.
+FramePacket *FramePipeline::beginWrite(unsigned timeout_ms) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  auto free_slot = [this] {
+    for (int i = 0; i < 2; i++) {
+      if (i != Ready && i != Reading) return i;
+    }
+    return static_cast<int>(NONE);
+  };
+  if (!Released.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                         [&] { return free_slot() != NONE; })) {
+    return nullptr;
+  }
+  Writing = free_slot();
+  Packets[Writing]->frame = ++Frames;
+  return Packets[Writing];
+}
+
+void FramePipeline::endWrite() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Ready = Writing;
+  Writing = NONE;
+}
+
+FramePacket *FramePipeline::acquire() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  if (Ready != NONE) {
+    Reading = Ready;
+    Ready = NONE;
+    Released.notify_one();
+  }
+  return Reading == NONE ? nullptr : Packets[Reading];
+}
+
+uint64_t FramePipeline::getFrameCount() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Frames;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Frame Packet and Pipeline Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_FRAME_PIPELINE_HPP
+#define MGL_FRAME_PIPELINE_HPP
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <vector>
+
+#include "mglMatrixBatch.hpp"
+#include "mglRenderQueue.hpp"
+
+namespace mgl {
+
+class FramePipeline;
+
+//////////////////////////////////////////////////////////////////// FramePacket
+//
+// Everything the GL thread needs to draw one frame: the camera as it was
+// simulated, the bone palettes sampled for it (see Animator) and the sorted,
+// prepared draws with their derived matrices.
+// Once published a packet is only read until it is handed back.
+
+struct FramePacket {
+  uint64_t frame;
+  double elapsed;
+  glm::mat4 viewMatrix;
+  glm::mat4 projectionMatrix;
+  std::vector<unsigned char> palettes;
+  RenderQueue queue;
+  MatrixBatch batch;
+
+  explicit FramePacket(GLuint bindingpoint);
+};
+
+////////////////////////////////////////////////////////////////// FramePipeline
+//
+// Double buffer between an update thread writing packets and the GL thread
+// drawing them. The GL thread never blocks: acquire() switches to the newest
+// published packet and otherwise keeps drawing the one it holds. The update
+// thread waits in beginWrite() while both packets are in use, so it runs at
+// most one frame ahead. Packets own GL buffers: create the pipeline on the
+// GL thread.
+
+class FramePipeline {
+ public:
+  explicit FramePipeline(GLuint bindingpoint);
+  ~FramePipeline();
+
+  FramePacket *beginWrite(unsigned timeout_ms);
+  void endWrite();
+  FramePacket *acquire();
+  uint64_t getFrameCount();
+
+ private:
+  static const int NONE = -1;
+
+  FramePacket *Packets[2];
+  std::mutex Mutex;
+  std::condition_variable Released;
+  int Writing, Ready, Reading;
+  uint64_t Frames;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_FRAME_PIPELINE_HPP */
@@ -0,0 +1,1056 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// glTF Binary File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglGltfFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "./mglJobs.hpp"
+#include "./mglMappedFile.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+/////////////////////////////////////////////////////////////////////// GltfFile
+
+static const uint32_t ARRAY_BUFFER = 34962;
+static const uint32_t ELEMENT_ARRAY_BUFFER = 34963;
+static const uint32_t TRIANGLES = 4;
+
+static const uint32_t COMPONENT_BYTE = 5120;
+static const uint32_t COMPONENT_UNSIGNED_BYTE = 5121;
+static const uint32_t COMPONENT_SHORT = 5122;
+static const uint32_t COMPONENT_UNSIGNED_SHORT = 5123;
+static const uint32_t COMPONENT_UNSIGNED_INT = 5125;
+static const uint32_t COMPONENT_FLOAT = 5126;
+
+static const size_t GRAIN = 4096;
+
+static void forRange(JobSystem *jobs, size_t count,
+                     const std::function<void(size_t, size_t)> &body) {
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, count, GRAIN, body);
+  } else {
+    body(0, count);
+  }
+}
+
+static size_t align4(size_t offset) { return (offset + 3) & ~size_t(3); }
+
+////////////////////////////////////////////////////////////////////// Writing
+
+struct MeshLayout {
+  size_t positions, normals, texcoords, tangents, indices;  // byte offsets
+  size_t vertexCount, indexCount;
+};
+
+static size_t addView(json &views, size_t offset, size_t length, size_t stride,
+                    uint32_t target) {
+  json view = {{"buffer", 0}, {"byteOffset", offset}, {"byteLength", length},
+               {"target", target}};
+  if (stride != 0) view["byteStride"] = stride;
+  views.push_back(view);
+  return views.size() - 1;
+}
+
+static size_t addAccessor(json &accessors, size_t view, size_t offset,
+                          uint32_t componentType, size_t count,
+                          const char *type) {
+  accessors.push_back({{"bufferView", view},
+                       {"byteOffset", offset},
+                       {"componentType", componentType},
+                       {"count", count},
+                       {"type", type}});
+  return accessors.size() - 1;
+}
+
+// glTF asks for the bounds of every position accessor. Each submesh reads
+// from its base vertex to the end, so the bounds of every suffix starting
+// at a base vertex are gathered from the ranges between them.
+static void suffixBounds(const std::vector<glm::vec3> &positions,
+                         const std::vector<size_t> &starts,
+                         std::map<size_t, std::pair<glm::vec3, glm::vec3>> &out) {
+  std::vector<size_t> sorted(starts);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  glm::vec3 low(std::numeric_limits<float>::max());
+  glm::vec3 high(-std::numeric_limits<float>::max());
+  size_t end = positions.size();
+  for (size_t s = sorted.size(); s-- > 0;) {
+    for (size_t v = sorted[s]; v < end; v++) {
+      low = glm::min(low, positions[v]);
+      high = glm::max(high, positions[v]);
+    }
+    out[sorted[s]] = {low, high};
+    end = sorted[s];
+  }
+}
+
+// Texcoords have their origin at the top in glTF, and tangents carry the
+// handedness of the bitangent in w.
+static void writeMesh(Mesh &mesh, const MeshLayout &layout,
+                      unsigned char *bin) {
+  const size_t n = layout.vertexCount;
+  std::memcpy(bin + layout.positions, mesh.getPositions().data(),
+              n * sizeof(glm::vec3));
+  if (mesh.hasNormals()) {
+    std::memcpy(bin + layout.normals, mesh.getNormals().data(),
+                n * sizeof(glm::vec3));
+  }
+  if (mesh.hasTexcoords()) {
+    const std::vector<glm::vec2> &texcoords = mesh.getTexcoords();
+    glm::vec2 *out = reinterpret_cast<glm::vec2 *>(bin + layout.texcoords);
+    for (size_t v = 0; v < n; v++) {
+      out[v] = glm::vec2(texcoords[v].x, 1.f - texcoords[v].y);
+    }
+  }
+  if (layout.tangents != SIZE_MAX) {
+    const std::vector<glm::vec3> &normals = mesh.getNormals();
+    const std::vector<glm::vec3> &tangents = mesh.getTangents();
+    const std::vector<glm::vec3> &bitangents = mesh.getBitangents();
+    bool handed = bitangents.size() == n;
+    glm::vec4 *out = reinterpret_cast<glm::vec4 *>(bin + layout.tangents);
+    for (size_t v = 0; v < n; v++) {
+      float w = 1.f;
+      if (handed &&
+          glm::dot(glm::cross(normals[v], tangents[v]), bitangents[v]) < 0.f) {
+        w = -1.f;
+      }
+      out[v] = glm::vec4(tangents[v], w);
+    }
+  }
+  std::memcpy(bin + layout.indices, mesh.getIndices().data(),
+              layout.indexCount * sizeof(unsigned int));
+}
+
+static json writeMaterial(Mesh &mesh) {
+  json material = json::object();
+  aiString name;
+  if (mesh.material.Get(AI_MATKEY_NAME, name) == AI_SUCCESS &&
+      name.length > 0) {
+    material["name"] = name.C_Str();
+  }
+  aiColor4D color;
+  if (mesh.material.Get(AI_MATKEY_BASE_COLOR, color) == AI_SUCCESS ||
+      mesh.material.Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS) {
+    material["pbrMetallicRoughness"]["baseColorFactor"] = {color.r, color.g,
+                                                           color.b, color.a};
+  }
+  material["alphaMode"] = mesh.isTransparent() ? "BLEND" : "OPAQUE";
+  material["extras"]["effect"] = mesh.getEffect();
+  return material;
+}
+
+// One buffer view per array of a mesh and one primitive per submesh, whose
+// accessors start at its base vertex and base index in those views.
+static json writePrimitives(Mesh &mesh, const MeshLayout &layout,
+                            size_t material, json &views, json &accessors) {
+  const size_t n = layout.vertexCount;
+  size_t positions = addView(views, layout.positions, n * sizeof(glm::vec3),
+                             sizeof(glm::vec3), ARRAY_BUFFER);
+  size_t normals = 0, texcoords = 0, tangents = 0;
+  if (mesh.hasNormals()) {
+    normals = addView(views, layout.normals, n * sizeof(glm::vec3),
+                      sizeof(glm::vec3), ARRAY_BUFFER);
+  }
+  if (mesh.hasTexcoords()) {
+    texcoords = addView(views, layout.texcoords, n * sizeof(glm::vec2),
+                        sizeof(glm::vec2), ARRAY_BUFFER);
+  }
+  if (layout.tangents != SIZE_MAX) {
+    tangents = addView(views, layout.tangents, n * sizeof(glm::vec4),
+                       sizeof(glm::vec4), ARRAY_BUFFER);
+  }
+  size_t indices =
+      addView(views, layout.indices, layout.indexCount * sizeof(unsigned int),
+              0, ELEMENT_ARRAY_BUFFER);
+
+  std::vector<Mesh::MeshData> submeshes = mesh.getMeshData();
+  if (submeshes.empty()) {
+    Mesh::MeshData all;
+    all.nIndices = static_cast<unsigned int>(layout.indexCount);
+    submeshes.push_back(all);
+  }
+  std::vector<size_t> starts;
+  for (const Mesh::MeshData &s : submeshes) starts.push_back(s.baseVertex);
+  std::map<size_t, std::pair<glm::vec3, glm::vec3>> bounds;
+  suffixBounds(mesh.getPositions(), starts, bounds);
+
+  json primitives = json::array();
+  for (const Mesh::MeshData &s : submeshes) {
+    if (s.baseVertex >= n || s.nIndices == 0) continue;
+    const size_t count = n - s.baseVertex;
+    json attributes;
+    size_t position =
+        addAccessor(accessors, positions, s.baseVertex * sizeof(glm::vec3),
+                    COMPONENT_FLOAT, count, "VEC3");
+    const glm::vec3 &low = bounds[s.baseVertex].first;
+    const glm::vec3 &high = bounds[s.baseVertex].second;
+    accessors[position]["min"] = {low.x, low.y, low.z};
+    accessors[position]["max"] = {high.x, high.y, high.z};
+    attributes["POSITION"] = position;
+    if (mesh.hasNormals()) {
+      attributes["NORMAL"] =
+          addAccessor(accessors, normals, s.baseVertex * sizeof(glm::vec3),
+                      COMPONENT_FLOAT, count, "VEC3");
+    }
+    if (mesh.hasTexcoords()) {
+      attributes["TEXCOORD_0"] =
+          addAccessor(accessors, texcoords, s.baseVertex * sizeof(glm::vec2),
+                      COMPONENT_FLOAT, count, "VEC2");
+    }
+    if (layout.tangents != SIZE_MAX) {
+      attributes["TANGENT"] =
+          addAccessor(accessors, tangents, s.baseVertex * sizeof(glm::vec4),
+                      COMPONENT_FLOAT, count, "VEC4");
+    }
+    size_t index =
+        addAccessor(accessors, indices, s.baseIndex * sizeof(unsigned int),
+                    COMPONENT_UNSIGNED_INT, s.nIndices, "SCALAR");
+    primitives.push_back({{"attributes", attributes},
+                          {"indices", index},
+                          {"material", material},
+                          {"mode", TRIANGLES}});
+  }
+  return primitives;
+}
+
+// Nodes are numbered breadth first, the root being node 0. A mesh shared by
+// several nodes is written once.
+bool GltfFile::save(SceneGraph &scene, const std::string &path,
+                    JobSystem *jobs) {
+  json nodes = json::array();
+  json meshes = json::array();
+  json materials = json::array();
+  json accessors = json::array();
+  json views = json::array();
+  std::map<Mesh *, int> meshIndex;  // -1 for meshes without geometry
+  std::vector<Mesh *> sources;
+  std::vector<MeshLayout> layouts;
+  size_t binSize = 0;
+
+  std::vector<Node *> queue = {&scene.getRoot()};
+  for (size_t i = 0; i < queue.size(); i++) {
+    Node *node = queue[i];
+    json j = json::object();
+
+    Transform *t = node->getLocalTransform();
+    if (t != nullptr) {
+      glm::vec3 translate = t->getTranslate();
+      glm::quat rotation = t->getRotation();
+      glm::vec3 scale = t->getScale();
+      j["translation"] = {translate.x, translate.y, translate.z};
+      j["rotation"] = {rotation.x, rotation.y, rotation.z, rotation.w};
+      j["scale"] = {scale.x, scale.y, scale.z};
+    }
+
+    Mesh *mesh = node->getMesh();
+    if (mesh != nullptr) {
+      auto found = meshIndex.find(mesh);
+      if (found == meshIndex.end()) {
+        int index = -1;
+        MeshLayout layout;
+        layout.vertexCount = mesh->getPositions().size();
+        layout.indexCount = mesh->getIndices().size();
+        if (layout.vertexCount > 0 && layout.indexCount > 0) {
+          const size_t n = layout.vertexCount;
+          layout.positions = binSize;
+          binSize += n * sizeof(glm::vec3);
+          layout.normals = binSize;
+          if (mesh->hasNormals()) binSize += n * sizeof(glm::vec3);
+          layout.texcoords = binSize;
+          if (mesh->hasTexcoords()) binSize += n * sizeof(glm::vec2);
+          layout.tangents = SIZE_MAX;
+          if (mesh->hasNormals() && mesh->hasTangentsAndBitangents() &&
+              mesh->getTangents().size() == n) {
+            layout.tangents = binSize;
+            binSize += n * sizeof(glm::vec4);
+          }
+          layout.indices = binSize;
+          binSize += layout.indexCount * sizeof(unsigned int);
+
+          materials.push_back(writeMaterial(*mesh));
+          json primitives = writePrimitives(*mesh, layout, materials.size() - 1,
+                                            views, accessors);
+          if (!primitives.empty()) {
+            meshes.push_back({{"primitives", primitives}});
+            index = static_cast<int>(meshes.size() - 1);
+          }
+          sources.push_back(mesh);
+          layouts.push_back(layout);
+        }
+        found = meshIndex.insert({mesh, index}).first;
+      }
+      if (found->second >= 0) j["mesh"] = found->second;
+    }
+
+    if (!node->getChildren().empty()) {
+      j["children"] = json::array();
+      for (Node *child : node->getChildren()) {
+        j["children"].push_back(queue.size());
+        queue.push_back(child);
+      }
+    }
+    nodes.push_back(j);
+  }
+
+  std::vector<unsigned char> bin(align4(binSize), 0);
+  forRange(jobs, sources.size(), [&](size_t begin, size_t end) {
+    for (size_t m = begin; m < end; m++) {
+      writeMesh(*sources[m], layouts[m], bin.data());
+    }
+  });
+
+  json doc;
+  doc["asset"] = {{"version", "2.0"}, {"generator", "mgl"}};
+  doc["scene"] = 0;
+  json root = json::object();
+  root["nodes"] = json::array({0});
+  doc["scenes"] = json::array({root});
+  doc["nodes"] = nodes;
+  if (!meshes.empty()) {
+    doc["meshes"] = meshes;
+    doc["materials"] = materials;
+    doc["accessors"] = accessors;
+    doc["bufferViews"] = views;
+    doc["buffers"] = json::array({{{"byteLength", binSize}}});
+  }
+  std::string text = doc.dump();
+  text.resize(align4(text.size()), ' ');
+
+  ChunkHeader jsonChunk = {static_cast<uint32_t>(text.size()), JSON_CHUNK};
+  ChunkHeader binChunk = {static_cast<uint32_t>(bin.size()), BIN_CHUNK};
+  size_t length = sizeof(Header) + sizeof(ChunkHeader) + text.size();
+  if (!bin.empty()) length += sizeof(ChunkHeader) + bin.size();
+  Header header = {MAGIC, VERSION, static_cast<uint32_t>(length)};
+
+  std::ofstream o(path, std::ios::binary);
+  o.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  o.write(reinterpret_cast<const char *>(&jsonChunk), sizeof(jsonChunk));
+  o.write(text.data(), text.size());
+  if (!bin.empty()) {
+    o.write(reinterpret_cast<const char *>(&binChunk), sizeof(binChunk));
+    o.write(reinterpret_cast<const char *>(bin.data()), bin.size());
+  }
+  if (!o.good()) {
+    std::cerr << "WARNING: could not write glTF file " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////// Reading
+
+// JSON lookups that report missing or mistyped values instead of throwing.
+static const json *member(const json &j, const char *key) {
+  if (!j.is_object()) return nullptr;
+  json::const_iterator found = j.find(key);
+  return found == j.end() ? nullptr : &*found;
+}
+
+static bool getIndex(const json &j, const char *key, size_t &out) {
+  const json *value = member(j, key);
+  if (value == nullptr || !value->is_number_unsigned()) return false;
+  out = value->get<size_t>();
+  return true;
+}
+
+static size_t getSize(const json &j, const char *key, size_t fallback) {
+  size_t value = fallback;
+  getIndex(j, key, value);
+  return value;
+}
+
+static bool getFloats(const json &j, const char *key, float *out,
+                      size_t count) {
+  const json *value = member(j, key);
+  if (value == nullptr || !value->is_array() || value->size() != count) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (!(*value)[i].is_number()) return false;
+    out[i] = (*value)[i].get<float>();
+  }
+  return true;
+}
+
+static const json *element(const json &doc, const char *key, size_t index) {
+  const json *array = member(doc, key);
+  if (array == nullptr || !array->is_array() || index >= array->size()) {
+    return nullptr;
+  }
+  return &(*array)[index];
+}
+
+struct Accessor {
+  const unsigned char *data;
+  size_t count;
+  size_t stride;
+  uint32_t componentType;
+  int components;
+  bool normalized;
+};
+
+static size_t componentSize(uint32_t type) {
+  switch (type) {
+    case COMPONENT_BYTE:
+    case COMPONENT_UNSIGNED_BYTE:
+      return 1;
+    case COMPONENT_SHORT:
+    case COMPONENT_UNSIGNED_SHORT:
+      return 2;
+    case COMPONENT_UNSIGNED_INT:
+    case COMPONENT_FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+static int componentCount(const json &type) {
+  if (!type.is_string()) return 0;
+  const std::string &name = type.get_ref<const std::string &>();
+  if (name == "SCALAR") return 1;
+  if (name == "VEC2") return 2;
+  if (name == "VEC3") return 3;
+  if (name == "VEC4") return 4;
+  return 0;
+}
+
+// Every element of the accessor must lie inside its view, and the view
+// inside the binary chunk.
+static bool readAccessor(const json &doc, size_t index,
+                         const unsigned char *bin, size_t binSize,
+                         Accessor &a) {
+  const json *accessor = element(doc, "accessors", index);
+  size_t viewIndex, viewLength;
+  if (accessor == nullptr || member(*accessor, "sparse") != nullptr ||
+      !getIndex(*accessor, "bufferView", viewIndex)) {
+    return false;
+  }
+  // Only the buffer of the binary chunk, the first one, is supported.
+  const json *view = element(doc, "bufferViews", viewIndex);
+  if (view == nullptr || !getIndex(*view, "byteLength", viewLength) ||
+      getSize(*view, "buffer", 0) != 0 || bin == nullptr) {
+    return false;
+  }
+  const json *owner = element(doc, "buffers", 0);
+  if (owner == nullptr || member(*owner, "uri") != nullptr) return false;
+
+  const json *type = member(*accessor, "type");
+  const json *normalized = member(*accessor, "normalized");
+  a.componentType =
+      static_cast<uint32_t>(getSize(*accessor, "componentType", 0));
+  a.components = type != nullptr ? componentCount(*type) : 0;
+  a.normalized = normalized != nullptr && normalized->is_boolean() &&
+                 normalized->get<bool>();
+  a.count = getSize(*accessor, "count", 0);
+  const size_t size = componentSize(a.componentType) * a.components;
+  a.stride = getSize(*view, "byteStride", 0);
+  if (a.stride == 0) a.stride = size;
+  if (size == 0 || a.count == 0 || a.stride < size) return false;
+
+  const size_t viewOffset = getSize(*view, "byteOffset", 0);
+  const size_t offset = getSize(*accessor, "byteOffset", 0);
+  if (viewOffset > binSize || viewLength > binSize - viewOffset ||
+      offset > viewLength || viewLength - offset < size ||
+      a.count - 1 > (viewLength - offset - size) / a.stride) {
+    return false;
+  }
+  a.data = bin + viewOffset + offset;
+  return true;
+}
+
+// Whether the data can be used in place as an array of that type.
+static bool isDirect(const Accessor &a, uint32_t type, int components) {
+  return a.componentType == type && a.components == components &&
+         !a.normalized && a.stride == componentSize(type) * components &&
+         reinterpret_cast<uintptr_t>(a.data) % 4 == 0;
+}
+
+static float readComponent(const unsigned char *p, uint32_t type,
+                           bool normalized) {
+  switch (type) {
+    case COMPONENT_FLOAT: {
+      float f;
+      std::memcpy(&f, p, sizeof(f));
+      return f;
+    }
+    case COMPONENT_UNSIGNED_BYTE:
+      return normalized ? *p / 255.f : *p;
+    case COMPONENT_BYTE: {
+      float v = static_cast<int8_t>(*p);
+      return normalized ? std::max(v / 127.f, -1.f) : v;
+    }
+    case COMPONENT_UNSIGNED_SHORT: {
+      uint16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? v / 65535.f : v;
+    }
+    case COMPONENT_SHORT: {
+      int16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return normalized ? std::max(v / 32767.f, -1.f) : v;
+    }
+    default: {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return static_cast<float>(v);
+    }
+  }
+}
+
+// Missing components are zero.
+static void convert(const Accessor &a, float *out, int components,
+                    JobSystem *jobs) {
+  const size_t size = componentSize(a.componentType);
+  forRange(jobs, a.count, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const unsigned char *in = a.data + i * a.stride;
+      for (int c = 0; c < components; c++) {
+        out[i * components + c] =
+            c < a.components
+                ? readComponent(in + c * size, a.componentType, a.normalized)
+                : 0.f;
+      }
+    }
+  });
+}
+
+static void convertIndices(const Accessor &a, unsigned int *out,
+                           JobSystem *jobs) {
+  forRange(jobs, a.count, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const unsigned char *in = a.data + i * a.stride;
+      if (a.componentType == COMPONENT_UNSIGNED_BYTE) {
+        out[i] = *in;
+      } else if (a.componentType == COMPONENT_UNSIGNED_SHORT) {
+        uint16_t v;
+        std::memcpy(&v, in, sizeof(v));
+        out[i] = v;
+      } else {
+        std::memcpy(&out[i], in, sizeof(unsigned int));
+      }
+    }
+  });
+}
+
+// Primitives whose accessors for one attribute step through the same
+// memory with the same layout can share it: firsts receives the element
+// each one starts at and merged an accessor covering them all.
+static bool shareStorage(const std::vector<Accessor> &accessors,
+                         std::vector<size_t> &firsts, Accessor &merged) {
+  merged = accessors[0];
+  for (const Accessor &a : accessors) {
+    if (a.componentType != merged.componentType ||
+        a.components != merged.components ||
+        a.normalized != merged.normalized || a.stride != merged.stride) {
+      return false;
+    }
+    merged.data = std::min(merged.data, a.data);
+  }
+  merged.count = 0;
+  firsts.resize(accessors.size());
+  for (size_t p = 0; p < accessors.size(); p++) {
+    size_t delta = accessors[p].data - merged.data;
+    if (delta % merged.stride != 0) return false;
+    firsts[p] = delta / merged.stride;
+    merged.count = std::max(merged.count, firsts[p] + accessors[p].count);
+  }
+  return true;
+}
+
+struct Material {
+  std::string name;
+  bool hasColor;
+  aiColor4D color;
+  bool transparent;
+  int effect;
+};
+
+struct Primitive {
+  Accessor position, normal, texcoord, tangent, indices;
+  bool hasNormal, hasTexcoord, hasTangent, hasIndices;
+  size_t material;
+};
+
+// Geometry read before the scene is replaced, kept in the mapped file when
+// possible and converted into the arrays here otherwise.
+struct MeshPlan {
+  std::vector<Mesh::MeshData> submeshes;
+  std::vector<glm::vec3> positions, normals, tangents, bitangents;
+  std::vector<glm::vec2> texcoords;
+  std::vector<unsigned int> indices;
+  Mesh::ArrayView view;
+  size_t material;
+  bool valid;
+};
+
+static void readMaterials(const json &doc, std::vector<Material> &out) {
+  const json *materials = member(doc, "materials");
+  if (materials == nullptr || !materials->is_array()) return;
+  for (const json &m : *materials) {
+    Material material = {"", false, aiColor4D(1.f, 1.f, 1.f, 1.f), false, 0};
+    const json *name = member(m, "name");
+    if (name != nullptr && name->is_string()) {
+      material.name = name->get<std::string>();
+    }
+    const json *pbr = member(m, "pbrMetallicRoughness");
+    float color[4];
+    if (pbr != nullptr && getFloats(*pbr, "baseColorFactor", color, 4)) {
+      material.hasColor = true;
+      material.color = aiColor4D(color[0], color[1], color[2], color[3]);
+    }
+    const json *alpha = member(m, "alphaMode");
+    material.transparent = alpha != nullptr && *alpha == "BLEND";
+    const json *extras = member(m, "extras");
+    const json *effect = extras != nullptr ? member(*extras, "effect") : nullptr;
+    if (effect != nullptr && effect->is_number_integer()) {
+      material.effect = effect->get<int>();
+    }
+    out.push_back(material);
+  }
+}
+
+static bool readPrimitive(const json &doc, const json &p,
+                          const unsigned char *bin, size_t binSize,
+                          Primitive &out, bool &skip) {
+  skip = getSize(p, "mode", TRIANGLES) != TRIANGLES;
+  if (skip) return true;
+  const json *attributes = member(p, "attributes");
+  size_t index;
+  if (attributes == nullptr || !getIndex(*attributes, "POSITION", index) ||
+      !readAccessor(doc, index, bin, binSize, out.position) ||
+      out.position.componentType != COMPONENT_FLOAT ||
+      out.position.components != 3) {
+    return false;
+  }
+  const size_t count = out.position.count;
+  out.hasNormal = getIndex(*attributes, "NORMAL", index);
+  if (out.hasNormal && (!readAccessor(doc, index, bin, binSize, out.normal) ||
+                        out.normal.count != count)) {
+    return false;
+  }
+  out.hasTexcoord = getIndex(*attributes, "TEXCOORD_0", index);
+  if (out.hasTexcoord &&
+      (!readAccessor(doc, index, bin, binSize, out.texcoord) ||
+       out.texcoord.count != count)) {
+    return false;
+  }
+  out.hasTangent = getIndex(*attributes, "TANGENT", index);
+  if (out.hasTangent &&
+      (!readAccessor(doc, index, bin, binSize, out.tangent) ||
+       out.tangent.count != count || out.tangent.components != 4)) {
+    return false;
+  }
+  out.hasIndices = getIndex(p, "indices", index);
+  if (out.hasIndices &&
+      (!readAccessor(doc, index, bin, binSize, out.indices) ||
+       out.indices.components != 1 ||
+       (out.indices.componentType != COMPONENT_UNSIGNED_BYTE &&
+        out.indices.componentType != COMPONENT_UNSIGNED_SHORT &&
+        out.indices.componentType != COMPONENT_UNSIGNED_INT))) {
+    return false;
+  }
+  out.material = getSize(p, "material", SIZE_MAX);
+  return true;
+}
+
+// Lays out one vertex attribute of all primitives: in place when they
+// share storage directly usable as T (and inPlace allows it), converted
+// otherwise, into the shared layout or one after the other as given by
+// firsts.
+template <typename T>
+static const T *readAttribute(const std::vector<Accessor> &accessors,
+                              bool shared, const std::vector<size_t> &firsts,
+                              size_t total, std::vector<T> &out,
+                              JobSystem *jobs, bool inPlace = true) {
+  const int components = T::length();
+  std::vector<size_t> own;
+  Accessor merged;
+  if (shared && shareStorage(accessors, own, merged) && own == firsts) {
+    if (inPlace && isDirect(merged, COMPONENT_FLOAT, components)) {
+      return reinterpret_cast<const T *>(merged.data);
+    }
+    out.resize(total);
+    convert(merged, &out[0][0], components, jobs);
+    return out.data();
+  }
+  out.resize(total);
+  for (size_t p = 0; p < accessors.size(); p++) {
+    convert(accessors[p], &out[firsts[p]][0], components, jobs);
+  }
+  return out.data();
+}
+
+static bool readMesh(const json &doc, const json &m, const unsigned char *bin,
+                     size_t binSize, MeshPlan &plan, JobSystem *jobs) {
+  plan.valid = false;
+  plan.material = SIZE_MAX;
+  const json *list = member(m, "primitives");
+  if (list == nullptr || !list->is_array()) return false;
+  std::vector<Primitive> primitives;
+  for (const json &p : *list) {
+    Primitive primitive;
+    bool skip;
+    if (!readPrimitive(doc, p, bin, binSize, primitive, skip)) return false;
+    if (!skip) primitives.push_back(primitive);
+  }
+  if (primitives.empty()) {
+    std::cerr << "WARNING: glTF mesh without triangles skipped." << std::endl;
+    return true;
+  }
+
+  bool normals = true, texcoords = true, tangents = true, indexed = true;
+  std::vector<Accessor> position, normal, texcoord, tangent, indices;
+  for (const Primitive &p : primitives) {
+    normals = normals && p.hasNormal;
+    texcoords = texcoords && p.hasTexcoord;
+    tangents = tangents && p.hasTangent;
+    indexed = indexed && p.hasIndices;
+    position.push_back(p.position);
+    normal.push_back(p.normal);
+    texcoord.push_back(p.texcoord);
+    tangent.push_back(p.tangent);
+    indices.push_back(p.indices);
+  }
+  tangents = tangents && normals;
+  plan.material = primitives[0].material;
+
+  // Vertices: shared as in the files written by save, else concatenated.
+  std::vector<size_t> firsts;
+  Accessor merged;
+  bool shared = shareStorage(position, firsts, merged);
+  size_t total = merged.count;
+  if (!shared) {
+    firsts.assign(primitives.size(), 0);
+    total = 0;
+    for (size_t p = 0; p < primitives.size(); p++) {
+      firsts[p] = total;
+      total += primitives[p].position.count;
+    }
+  }
+  Mesh::ArrayView &view = plan.view;
+  view = {};
+  view.vertexCount = total;
+  view.positions = readAttribute(position, shared, firsts, total,
+                                 plan.positions, jobs);
+  if (normals) {
+    view.normals =
+        readAttribute(normal, shared, firsts, total, plan.normals, jobs);
+  }
+  if (texcoords) {
+    readAttribute(texcoord, shared, firsts, total, plan.texcoords, jobs,
+                  false);
+    forRange(jobs, total, [&](size_t begin, size_t end) {
+      for (size_t v = begin; v < end; v++) {
+        plan.texcoords[v].y = 1.f - plan.texcoords[v].y;
+      }
+    });
+    view.texcoords = plan.texcoords.data();
+  }
+  if (tangents) {
+    std::vector<glm::vec4> handed;
+    const glm::vec4 *t =
+        readAttribute(tangent, shared, firsts, total, handed, jobs);
+    plan.tangents.resize(total);
+    plan.bitangents.resize(total);
+    forRange(jobs, total, [&](size_t begin, size_t end) {
+      for (size_t v = begin; v < end; v++) {
+        plan.tangents[v] = glm::vec3(t[v]);
+        plan.bitangents[v] =
+            glm::cross(view.normals[v], plan.tangents[v]) * t[v].w;
+      }
+    });
+    view.tangents = plan.tangents.data();
+    view.bitangents = plan.bitangents.data();
+  }
+
+  // Indices: in place when 32 bit and shared, else converted.
+  std::vector<size_t> bases(primitives.size());
+  size_t indexTotal = 0;
+  bool sharedIndices = indexed && shareStorage(indices, bases, merged) &&
+                       isDirect(merged, COMPONENT_UNSIGNED_INT, 1);
+  if (sharedIndices) {
+    view.indices = reinterpret_cast<const unsigned int *>(merged.data);
+    indexTotal = merged.count;
+  } else {
+    for (size_t p = 0; p < primitives.size(); p++) {
+      bases[p] = indexTotal;
+      indexTotal += primitives[p].hasIndices ? primitives[p].indices.count
+                                             : primitives[p].position.count;
+    }
+    plan.indices.resize(indexTotal);
+    for (size_t p = 0; p < primitives.size(); p++) {
+      unsigned int *out = plan.indices.data() + bases[p];
+      if (primitives[p].hasIndices) {
+        convertIndices(primitives[p].indices, out, jobs);
+      } else {
+        for (size_t i = 0; i < primitives[p].position.count; i++) {
+          out[i] = static_cast<unsigned int>(i);
+        }
+      }
+    }
+    view.indices = plan.indices.data();
+  }
+  view.indexCount = indexTotal;
+
+  // Indices index into the vertices of their primitive.
+  for (size_t p = 0; p < primitives.size(); p++) {
+    Mesh::MeshData s;
+    s.baseVertex = static_cast<unsigned int>(firsts[p]);
+    s.baseIndex = static_cast<unsigned int>(bases[p]);
+    s.nIndices = static_cast<unsigned int>(
+        primitives[p].hasIndices ? primitives[p].indices.count
+                                 : primitives[p].position.count);
+    const size_t count = primitives[p].position.count;
+    for (size_t i = 0; i < s.nIndices; i++) {
+      if (view.indices[s.baseIndex + i] >= count) return false;
+    }
+    plan.submeshes.push_back(s);
+  }
+  view.meshes = plan.submeshes.data();
+  view.meshCount = plan.submeshes.size();
+  plan.valid = true;
+  return true;
+}
+
+struct NodePlan {
+  int parent;
+  int mesh;
+  bool hasTransform;
+  glm::vec3 translate, scale;
+  glm::quat rotation;
+};
+
+static void readTransform(const json &n, NodePlan &plan) {
+  float values[16];
+  plan.translate = glm::vec3(0.f);
+  plan.rotation = glm::quat(1.f, 0.f, 0.f, 0.f);
+  plan.scale = glm::vec3(1.f);
+  plan.hasTransform = false;
+  if (getFloats(n, "matrix", values, 16)) {
+    glm::mat4 m = glm::make_mat4(values);
+    plan.translate = glm::vec3(m[3]);
+    plan.scale = glm::vec3(glm::length(glm::vec3(m[0])),
+                           glm::length(glm::vec3(m[1])),
+                           glm::length(glm::vec3(m[2])));
+    if (glm::determinant(glm::mat3(m)) < 0.f) plan.scale.x = -plan.scale.x;
+    if (plan.scale.x != 0.f && plan.scale.y != 0.f && plan.scale.z != 0.f) {
+      plan.rotation = glm::quat_cast(glm::mat3(glm::vec3(m[0]) / plan.scale.x,
+                                               glm::vec3(m[1]) / plan.scale.y,
+                                               glm::vec3(m[2]) / plan.scale.z));
+    }
+    plan.hasTransform = true;
+  }
+  if (getFloats(n, "translation", values, 3)) {
+    plan.translate = glm::vec3(values[0], values[1], values[2]);
+    plan.hasTransform = true;
+  }
+  if (getFloats(n, "rotation", values, 4)) {
+    plan.rotation = glm::quat(values[3], values[0], values[1], values[2]);
+    plan.hasTransform = true;
+  }
+  if (getFloats(n, "scale", values, 3)) {
+    plan.scale = glm::vec3(values[0], values[1], values[2]);
+    plan.hasTransform = true;
+  }
+}
+
+// Walks the default scene breadth first; nodes outside it are ignored and
+// a node reached twice (shared or in a cycle) makes the file invalid.
+static bool readNodes(const json &doc, size_t meshCount,
+                      std::vector<NodePlan> &plans) {
+  const json *nodes = member(doc, "nodes");
+  const json *scene = element(doc, "scenes", getSize(doc, "scene", 0));
+  const json *roots = scene != nullptr ? member(*scene, "nodes") : nullptr;
+  if (nodes == nullptr || !nodes->is_array() || roots == nullptr ||
+      !roots->is_array() || roots->empty()) {
+    return false;
+  }
+  std::vector<bool> seen(nodes->size(), false);
+  std::vector<size_t> queue;
+  std::vector<int> parents;
+  if (roots->size() > 1) {
+    NodePlan root = {-1, -1, false, glm::vec3(0.f), glm::vec3(1.f),
+                     glm::quat(1.f, 0.f, 0.f, 0.f)};
+    plans.push_back(root);
+  }
+  for (const json &r : *roots) {
+    if (!r.is_number_unsigned()) return false;
+    queue.push_back(r.get<size_t>());
+    parents.push_back(roots->size() > 1 ? 0 : -1);
+  }
+  for (size_t i = 0; i < queue.size(); i++) {
+    size_t index = queue[i];
+    if (index >= nodes->size() || seen[index]) return false;
+    seen[index] = true;
+    const json &n = (*nodes)[index];
+    NodePlan plan;
+    plan.parent = parents[i];
+    size_t mesh = getSize(n, "mesh", SIZE_MAX);
+    if (mesh != SIZE_MAX && mesh >= meshCount) return false;
+    plan.mesh = mesh == SIZE_MAX ? -1 : static_cast<int>(mesh);
+    readTransform(n, plan);
+    int self = static_cast<int>(plans.size());
+    plans.push_back(plan);
+    const json *children = member(n, "children");
+    if (children == nullptr) continue;
+    if (!children->is_array()) return false;
+    for (const json &c : *children) {
+      if (!c.is_number_unsigned()) return false;
+      queue.push_back(c.get<size_t>());
+      parents.push_back(self);
+    }
+  }
+  return true;
+}
+
+// Replaces the scene once the whole file has been read and checked. Meshes
+// are shared by the nodes using them and get their GL objects in bulk.
+bool GltfFile::load(SceneGraph &scene, const std::string &path,
+                    JobSystem *jobs) {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  MappedFile file;
+  if (!file.open(path)) {
+    std::cerr << "WARNING: could not open glTF file " << path << std::endl;
+    return false;
+  }
+
+  const unsigned char *data = file.data();
+  const size_t size = file.size();
+  const size_t first = sizeof(Header) + sizeof(ChunkHeader);
+  const Header *header = reinterpret_cast<const Header *>(data);
+  const ChunkHeader *jsonChunk =
+      reinterpret_cast<const ChunkHeader *>(data + sizeof(Header));
+  if (size < first || header->magic != MAGIC || header->version != VERSION ||
+      header->length != size || jsonChunk->type != JSON_CHUNK ||
+      jsonChunk->length > size - first) {
+    std::cerr << "WARNING: invalid glTF file " << path << std::endl;
+    return false;
+  }
+  const unsigned char *bin = nullptr;
+  size_t binSize = 0;
+  size_t next = first + align4(jsonChunk->length);
+  if (next + sizeof(ChunkHeader) <= size) {
+    const ChunkHeader *binChunk =
+        reinterpret_cast<const ChunkHeader *>(data + next);
+    if (binChunk->type == BIN_CHUNK &&
+        binChunk->length <= size - next - sizeof(ChunkHeader)) {
+      bin = data + next + sizeof(ChunkHeader);
+      binSize = binChunk->length;
+    }
+  }
+
+  json doc = json::parse(data + first, data + first + jsonChunk->length,
+                         nullptr, false);
+  std::vector<Material> materials;
+  std::vector<MeshPlan> meshes;
+  std::vector<NodePlan> nodes;
+  const json *list = member(doc, "meshes");
+  bool valid = !doc.is_discarded();
+  if (valid && list != nullptr) {
+    readMaterials(doc, materials);
+    meshes.resize(list->is_array() ? list->size() : 0);
+    std::atomic<bool> failed(!list->is_array());
+    auto read = [&](size_t begin, size_t end) {
+      for (size_t m = begin; m < end; m++) {
+        if (!readMesh(doc, (*list)[m], bin, binSize, meshes[m], jobs)) {
+          failed = true;
+        }
+      }
+    };
+    if (jobs != nullptr) {
+      jobs->parallelFor(0, meshes.size(), 1, read);
+    } else {
+      read(0, meshes.size());
+    }
+    valid = !failed;
+  }
+  valid = valid && readNodes(doc, meshes.size(), nodes);
+  if (!valid) {
+    std::cerr << "WARNING: invalid glTF file " << path << std::endl;
+    return false;
+  }
+
+  scene.unload();
+  SceneArena &arena = scene.getArena();
+  std::vector<Mesh *> created(meshes.size(), nullptr);
+  std::vector<Mesh *> uploads;
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const MeshPlan &plan = meshes[m];
+    if (!plan.valid) continue;
+    Mesh *mesh = arena.get(arena.createMesh());
+    mesh->assign(plan.view);
+    if (plan.material < materials.size()) {
+      const Material &material = materials[plan.material];
+      if (!material.name.empty()) {
+        aiString name(material.name);
+        mesh->material.AddProperty(&name, AI_MATKEY_NAME);
+      }
+      if (material.hasColor) {
+        mesh->material.AddProperty(&material.color, 1, AI_MATKEY_BASE_COLOR);
+        mesh->material.AddProperty(&material.color, 1,
+                                   AI_MATKEY_COLOR_DIFFUSE);
+      }
+      mesh->MaterialsLoaded = true;
+      mesh->setEffect(material.effect);
+      mesh->setTransparent(material.transparent);
+    }
+    created[m] = mesh;
+    uploads.push_back(mesh);
+  }
+
+  std::vector<Node *> built(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const NodePlan &plan = nodes[i];
+    Node *node = arena.get(arena.createNode());
+    if (plan.hasTransform) {
+      Transform *transform = arena.get(arena.createTransform());
+      transform->setTranslate(plan.translate);
+      transform->setRotation(plan.rotation);
+      transform->setScale(plan.scale);
+      node->setTransform(transform);
+    }
+    if (plan.mesh >= 0 && created[plan.mesh] != nullptr) {
+      node->setMesh(created[plan.mesh]);
+    }
+    if (plan.parent >= 0) node->setParent(built[plan.parent]);
+    built[i] = node;
+  }
+  scene.setRoot(built[0]);
+  clock::time_point read = clock::now();
+  Mesh::createBufferObjects(uploads);
+  clock::time_point uploaded = clock::now();
+  scene.update();
+  clock::time_point updated = clock::now();
+
+  SceneGraph::LoadTimes times;
+  times.read = std::chrono::duration<double, std::milli>(read - start).count();
+  times.upload =
+      std::chrono::duration<double, std::milli>(uploaded - read).count();
+  times.update =
+      std::chrono::duration<double, std::milli>(updated - uploaded).count();
+  scene.setLoadTimes(times);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,65 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// glTF Binary File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_GLTF_FILE_HPP
+#define MGL_GLTF_FILE_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace mgl {
+
+class GltfFile;
+class JobSystem;
+class SceneGraph;
+
+/////////////////////////////////////////////////////////////////////// GltfFile
+//
+// Native reader and writer for glTF 2.0 binary files (.glb), bypassing
+// Assimp. The file is mapped and accessors are read in place from the
+// binary chunk: float positions and normals and 32 bit indices that are
+// tightly packed go to the meshes as views, with no conversion on the way
+// to the GL buffers. Any other layout (interleaved, normalized or smaller
+// components, glTF tangents with a handedness, texcoords with their origin
+// at the top) is converted, in parallel when given a job system.
+//
+// The node hierarchy and local transforms map one to one; a glTF scene
+// with several roots is loaded under a new root. A mesh becomes a glTF
+// mesh with one primitive per submesh, all sharing its buffer views, and a
+// material holding its base color, alpha mode (transparency) and, as an
+// extra, its effect. Only triangle primitives are read; external buffers,
+// sparse accessors, images and animations are not supported.
+
+class GltfFile {
+ public:
+  static const uint32_t MAGIC = 0x46546c67;       // "glTF"
+  static const uint32_t VERSION = 2;
+  static const uint32_t JSON_CHUNK = 0x4e4f534a;  // "JSON"
+  static const uint32_t BIN_CHUNK = 0x004e4942;   // "BIN\0"
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t length;
+  };
+
+  struct ChunkHeader {
+    uint32_t length;
+    uint32_t type;
+  };
+
+  static bool save(SceneGraph &scene, const std::string &path,
+                   JobSystem *jobs = nullptr);
+  static bool load(SceneGraph &scene, const std::string &path,
+                   JobSystem *jobs = nullptr);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_GLTF_FILE_HPP */
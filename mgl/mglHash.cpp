@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Hashing Functions
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglHash.hpp"
+
+#include <cstring>
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////////// Hash
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+uint64_t hash64(const std::string &s, uint64_t seed) {
+  // Include the terminator so "ab"+"c" and "a"+"bc" differ when chained.
+  return hash64(s.c_str(), s.size() + 1, seed);
+}
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+
+static uint64_t rotate(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t mix(uint64_t lane, uint64_t input) {
+  return rotate(lane + input * PRIME2, 31) * PRIME1;
+}
+
+uint64_t checksum64(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  uint64_t lanes[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed,
+                       seed - PRIME1};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    uint64_t words[4];
+    std::memcpy(words, bytes + i, sizeof(words));
+    for (int l = 0; l < 4; l++) lanes[l] = mix(lanes[l], words[l]);
+  }
+  uint64_t hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) +
+                  rotate(lanes[2], 12) + rotate(lanes[3], 18);
+  hash = hash64(bytes + i, size - i, hash ^ size);
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  return hash;
+}
+
+std::string hashToString(uint64_t hash) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s(16, '0');
+  for (int i = 15; i >= 0; i--) {
+    s[i] = digits[hash & 0xf];
+    hash >>= 4;
+  }
+  return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
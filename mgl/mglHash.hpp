@@ -0,0 +1,35 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Hashing Functions
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_HASH_HPP
+#define MGL_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////////// Hash
+//
+// 64-bit FNV-1a. Hashes can be chained by passing a previous result as seed.
+
+const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed = HASH_SEED);
+uint64_t hash64(const std::string &s, uint64_t seed = HASH_SEED);
+std::string hashToString(uint64_t hash);
+
+// Checksum for large buffers, reading eight bytes at a time in four
+// independent lanes. Much faster than hash64 but not interchangeable.
+uint64_t checksum64(const void *data, size_t size, uint64_t seed = HASH_SEED);
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_HASH_HPP */
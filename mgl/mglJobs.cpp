@@ -0,0 +1,222 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Job System and Task Graph Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglJobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////// JobSystem
+
+const unsigned JobSystem::EXTERNAL_THREADS;
+
+static const unsigned UNREGISTERED = ~0u;
+static thread_local unsigned ThreadIndex = UNREGISTERED;
+
+// Defaults to one thread per hardware thread, the creating thread included.
+// The workers are followed by the deque shared by unregistered threads and
+// those of registered ones.
+JobSystem::JobSystem(unsigned workers) : Queued(0), Running(true) {
+  if (workers == 0) {
+    unsigned hardware = std::thread::hardware_concurrency();
+    workers = hardware > 1 ? hardware - 1 : 1;
+  }
+  ThreadCount = workers + 1;
+  for (unsigned i = 0; i <= workers + 1 + EXTERNAL_THREADS; i++) {
+    Queues.emplace_back(new WorkQueue());
+  }
+  SlotUsed.assign(EXTERNAL_THREADS, false);
+  ThreadIndex = 0;
+  for (unsigned i = 1; i <= workers; i++) {
+    Threads.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(SleepMutex);
+    Running = false;
+  }
+  WakeUp.notify_all();
+  for (std::thread &t : Threads) {
+    t.join();
+  }
+}
+
+unsigned JobSystem::getThreadCount() { return ThreadCount; }
+
+// The pool index of the calling thread, or ~0 for a thread outside the pool
+// that is not registered.
+unsigned JobSystem::getThreadIndex() { return ThreadIndex; }
+
+void JobSystem::registerThread() {
+  std::lock_guard<std::mutex> lock(SlotMutex);
+  for (unsigned s = 0; s < EXTERNAL_THREADS; s++) {
+    if (!SlotUsed[s]) {
+      SlotUsed[s] = true;
+      ThreadIndex = getThreadCount() + 1 + s;
+      return;
+    }
+  }
+  std::cerr << "WARNING: No job queue left for thread, sharing one."
+            << std::endl;
+}
+
+void JobSystem::unregisterThread() {
+  std::lock_guard<std::mutex> lock(SlotMutex);
+  unsigned first = getThreadCount() + 1;
+  if (ThreadIndex != UNREGISTERED && ThreadIndex >= first &&
+      ThreadIndex < Queues.size()) {
+    SlotUsed[ThreadIndex - first] = false;
+  }
+  ThreadIndex = UNREGISTERED;
+}
+
+unsigned JobSystem::getSlot() {
+  return ThreadIndex < Queues.size() ? ThreadIndex : getThreadCount();
+}
+
+bool JobSystem::isWorker(unsigned index) {
+  return index > 0 && index < getThreadCount();
+}
+
+void JobSystem::submit(std::function<void()> job, Counter *counter) {
+  if (counter != nullptr) counter->fetch_add(1);
+  WorkQueue &queue = *Queues[getSlot()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back({std::move(job), counter});
+  }
+  Queued.fetch_add(1);
+  WakeUp.notify_one();
+}
+
+bool JobSystem::pop(unsigned index, Job &job) {
+  WorkQueue &queue = *Queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.jobs.empty()) return false;
+  job = std::move(queue.jobs.back());
+  queue.jobs.pop_back();
+  return true;
+}
+
+bool JobSystem::steal(unsigned index, Job &job) {
+  const unsigned n = static_cast<unsigned>(Queues.size());
+  for (unsigned k = 1; k < n; k++) {
+    WorkQueue &victim = *Queues[(index + k) % n];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool JobSystem::runOne(unsigned index, bool stealing) {
+  Job job;
+  if (!pop(index, job) && (!stealing || !steal(index, job))) return false;
+  Queued.fetch_sub(1);
+  job.function();
+  if (job.counter != nullptr) job.counter->fetch_sub(1);
+  return true;
+}
+
+void JobSystem::workerLoop(unsigned index) {
+  ThreadIndex = index;
+  while (Running) {
+    if (runOne(index, true)) continue;
+    std::unique_lock<std::mutex> lock(SleepMutex);
+    WakeUp.wait_for(lock, std::chrono::milliseconds(1),
+                    [this] { return !Running || Queued.load() > 0; });
+  }
+}
+
+void JobSystem::wait(Counter &counter) {
+  const unsigned index = getSlot();
+  const bool stealing = isWorker(index);
+  while (counter.load() > 0) {
+    if (!runOne(index, stealing)) std::this_thread::yield();
+  }
+}
+
+// Splits [begin, end) into chunks of at least grain items and runs them as
+// jobs; the calling thread takes part until every chunk is done.
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain,
+                            const std::function<void(size_t, size_t)> &body) {
+  if (end <= begin) return;
+  grain = std::max<size_t>(grain, 1);
+  size_t count = end - begin;
+  size_t chunks =
+      std::min<size_t>(getThreadCount() * 4, (count + grain - 1) / grain);
+  if (chunks <= 1) {
+    body(begin, end);
+    return;
+  }
+  size_t step = (count + chunks - 1) / chunks;
+  Counter counter(0);
+  for (size_t b = begin; b < end; b += step) {
+    size_t e = std::min(end, b + step);
+    submit([&body, b, e] { body(b, e); }, &counter);
+  }
+  wait(counter);
+}
+
+////////////////////////////////////////////////////////////////////// TaskGraph
+
+TaskGraph::TaskGraph() {}
+
+TaskGraph::~TaskGraph() {}
+
+TaskGraph::TaskId TaskGraph::add(std::function<void()> task) {
+  Task t;
+  t.function = std::move(task);
+  t.predecessors = 0;
+  t.pending.reset(new std::atomic<int>(0));
+  Tasks.push_back(std::move(t));
+  return Tasks.size() - 1;
+}
+
+void TaskGraph::precede(TaskId before, TaskId after) {
+  Tasks[before].successors.push_back(after);
+  Tasks[after].predecessors++;
+}
+
+void TaskGraph::clear() { Tasks.clear(); }
+
+size_t TaskGraph::size() { return Tasks.size(); }
+
+void TaskGraph::launch(JobSystem &jobs, TaskId id, JobSystem::Counter *done) {
+  jobs.submit(
+      [this, &jobs, id, done] {
+        Task &task = Tasks[id];
+        task.function();
+        for (TaskId s : task.successors) {
+          if (Tasks[s].pending->fetch_sub(1) == 1) launch(jobs, s, done);
+        }
+      },
+      done);
+}
+
+void TaskGraph::run(JobSystem &jobs) {
+  for (Task &t : Tasks) {
+    t.pending->store(t.predecessors);
+  }
+  JobSystem::Counter done(0);
+  for (TaskId i = 0; i < Tasks.size(); i++) {
+    if (Tasks[i].predecessors == 0) launch(jobs, i, &done);
+  }
+  jobs.wait(done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Job System and Task Graph Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_JOBS_HPP
+#define MGL_JOBS_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mgl {
+
+class JobSystem;
+class TaskGraph;
+
+////////////////////////////////////////////////////////////////////// JobSystem
+//
+// Work-stealing scheduler: every thread (the creating thread included, as
+// worker 0) owns a deque, pushes and pops its own jobs at the back and
+// steals from the front of the others when it runs dry. Jobs report to a
+// counter; wait() keeps the calling thread executing jobs until it drops to
+// zero, so waiting inside a job never blocks a worker.
+//
+// Other threads that submit work, such as an update thread, call
+// registerThread() to get a deque of their own; unregistered ones share a
+// single one. Threads outside the pool only run their own jobs while they
+// wait, so the GL thread never picks up simulation work and the other way
+// round; the pool workers steal from everyone.
+
+class JobSystem {
+ public:
+  typedef std::atomic<int> Counter;
+
+  static const unsigned EXTERNAL_THREADS = 4;
+
+  explicit JobSystem(unsigned workers = 0);
+  ~JobSystem();
+
+  void registerThread();
+  void unregisterThread();
+
+  void submit(std::function<void()> job, Counter *counter = nullptr);
+  void wait(Counter &counter);
+  void parallelFor(size_t begin, size_t end, size_t grain,
+                   const std::function<void(size_t, size_t)> &body);
+  unsigned getThreadCount();
+  static unsigned getThreadIndex();
+
+ private:
+  struct Job {
+    std::function<void()> function;
+    Counter *counter;
+  };
+
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> Queues;
+  std::vector<std::thread> Threads;
+  unsigned ThreadCount;  // workers and the creating thread
+  std::mutex SlotMutex;
+  std::vector<bool> SlotUsed;  // per registered thread slot
+  std::mutex SleepMutex;
+  std::condition_variable WakeUp;
+  std::atomic<int> Queued;
+  std::atomic<bool> Running;
+
+  unsigned getSlot();
+  bool isWorker(unsigned index);
+  bool pop(unsigned index, Job &job);
+  bool steal(unsigned index, Job &job);
+  bool runOne(unsigned index, bool stealing);
+  void workerLoop(unsigned index);
+};
+
+////////////////////////////////////////////////////////////////////// TaskGraph
+//
+// Tasks with explicit ordering, built once and run as many times as needed
+// (typically once per frame). run() submits the tasks without predecessors,
+// each finished task releases its successors, and the call returns when the
+// whole graph is done.
+
+class TaskGraph {
+ public:
+  typedef size_t TaskId;
+
+  TaskGraph();
+  ~TaskGraph();
+
+  TaskId add(std::function<void()> task);
+  void precede(TaskId before, TaskId after);
+  void run(JobSystem &jobs);
+  void clear();
+  size_t size();
+
+ private:
+  struct Task {
+    std::function<void()> function;
+    std::vector<TaskId> successors;
+    int predecessors;
+    std::unique_ptr<std::atomic<int>> pending;
+  };
+
+  std::vector<Task> Tasks;
+
+  void launch(JobSystem &jobs, TaskId id, JobSystem::Counter *done);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_JOBS_HPP */
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Memory Mapped File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglMappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mgl {
+
+///////////////////////////////////////////////////////////////////// MappedFile
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : Data(nullptr), Size(0), File(INVALID_HANDLE_VALUE), Mapping(nullptr) {}
+
+// Empty files cannot be mapped and are reported as failures.
+bool MappedFile::open(const std::string &path) {
+  close();
+  File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (File == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(File, &size) || size.QuadPart == 0) {
+    close();
+    return false;
+  }
+  Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (Mapping == nullptr) {
+    close();
+    return false;
+  }
+  Data = static_cast<const unsigned char *>(
+      MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+  if (Data == nullptr) {
+    close();
+    return false;
+  }
+  Size = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if (Data != nullptr) UnmapViewOfFile(Data);
+  if (Mapping != nullptr) CloseHandle(Mapping);
+  if (File != INVALID_HANDLE_VALUE) CloseHandle(File);
+  Data = nullptr;
+  Size = 0;
+  Mapping = nullptr;
+  File = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : Data(nullptr), Size(0), File(-1) {}
+
+// Empty files cannot be mapped and are reported as failures.
+bool MappedFile::open(const std::string &path) {
+  close();
+  File = ::open(path.c_str(), O_RDONLY);
+  if (File < 0) return false;
+  struct stat info;
+  if (fstat(File, &info) != 0 || info.st_size == 0) {
+    close();
+    return false;
+  }
+  void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                    MAP_PRIVATE, File, 0);
+  if (data == MAP_FAILED) {
+    close();
+    return false;
+  }
+  Data = static_cast<const unsigned char *>(data);
+  Size = static_cast<size_t>(info.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (Data != nullptr) munmap(const_cast<unsigned char *>(Data), Size);
+  if (File >= 0) ::close(File);
+  Data = nullptr;
+  Size = 0;
+  File = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::isOpen() const { return Data != nullptr; }
+
+const unsigned char *MappedFile::data() const { return Data; }
+
+size_t MappedFile::size() const { return Size; }
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Memory Mapped File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_MAPPED_FILE_HPP
+#define MGL_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace mgl {
+
+class MappedFile;
+
+///////////////////////////////////////////////////////////////////// MappedFile
+//
+// Read-only view of a whole file, mapped by the OS instead of read into a
+// buffer: pages are only loaded when touched. The view stays valid until
+// close() or destruction.
+
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool open(const std::string &path);
+  void close();
+  bool isOpen() const;
+  const unsigned char *data() const;
+  size_t size() const;
+
+ private:
+  const unsigned char *Data;
+  size_t Size;
+#ifdef _WIN32
+  void *File;
+  void *Mapping;
+#else
+  int File;
+#endif
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_MAPPED_FILE_HPP */
@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Derived Matrix Batch Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglMatrixBatch.hpp"
+
+#include <cmath>
+
+#include "./mglSimd.hpp"
+
+namespace mgl {
+
+//////////////////////////////////////////////////////////////////// MatrixBatch
+
+MatrixBatch::MatrixBatch(GLuint bindingpoint)
+    : BindingPoint(bindingpoint), Capacity(0), Count(0), RigidCount(0) {
+  GLint alignment = 16;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  Stride = sizeof(ObjectMatrices);
+  Stride = (Stride + alignment - 1) / alignment * alignment;
+  glGenBuffers(1, &UboId);
+}
+
+MatrixBatch::~MatrixBatch() {
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glDeleteBuffers(1, &UboId);
+}
+
+size_t MatrixBatch::size() { return Count; }
+
+size_t MatrixBatch::getRigidCount() { return RigidCount; }
+
+MatrixBatch::ObjectMatrices *MatrixBatch::at(size_t index) {
+  return reinterpret_cast<ObjectMatrices *>(&Data[index * Stride]);
+}
+
+// Orthogonal basis vectors of equal length: no shear, no non-uniform scale.
+bool MatrixBatch::isRigid(const glm::mat4 &m) {
+  const float eps = 1e-4f;
+  glm::vec3 x(m[0]), y(m[1]), z(m[2]);
+  float xx = glm::dot(x, x), yy = glm::dot(y, y), zz = glm::dot(z, z);
+  float tolerance = eps * xx;
+  return std::fabs(glm::dot(x, y)) <= tolerance &&
+         std::fabs(glm::dot(y, z)) <= tolerance &&
+         std::fabs(glm::dot(z, x)) <= tolerance &&
+         std::fabs(xx - yy) <= tolerance && std::fabs(xx - zz) <= tolerance;
+}
+
+#ifdef MGL_SSE2
+
+static inline __m128 cross(__m128 a, __m128 b) {
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline float dot3(__m128 a, __m128 b) {
+  __m128 m = _mm_mul_ps(a, b);
+  __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+  s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2)));
+  return _mm_cvtss_f32(s);
+}
+
+void MatrixBatch::compute(const glm::mat4 *models, size_t count,
+                          const glm::mat4 &viewProjection) {
+  Count = count;
+  RigidCount = 0;
+  if (Data.size() < Count * Stride) Data.resize(Count * Stride);
+
+  const float *vp = &viewProjection[0][0];
+  const __m128 vp0 = _mm_loadu_ps(vp), vp1 = _mm_loadu_ps(vp + 4),
+               vp2 = _mm_loadu_ps(vp + 8), vp3 = _mm_loadu_ps(vp + 12);
+  const __m128 xyz_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+  for (size_t i = 0; i < Count; i++) {
+    ObjectMatrices *out = at(i);
+    const float *m = &models[i][0][0];
+    float *mvp = &out->modelViewProjection[0][0];
+    __m128 col[4];
+    for (int c = 0; c < 4; c++) {
+      col[c] = _mm_loadu_ps(m + 4 * c);
+      _mm_storeu_ps(&out->modelMatrix[c][0], col[c]);
+      __m128 r = _mm_mul_ps(vp0, _mm_shuffle_ps(col[c], col[c], 0x00));
+      r = _mm_add_ps(r, _mm_mul_ps(vp1, _mm_shuffle_ps(col[c], col[c], 0x55)));
+      r = _mm_add_ps(r, _mm_mul_ps(vp2, _mm_shuffle_ps(col[c], col[c], 0xaa)));
+      r = _mm_add_ps(r, _mm_mul_ps(vp3, _mm_shuffle_ps(col[c], col[c], 0xff)));
+      _mm_storeu_ps(mvp + 4 * c, r);
+    }
+
+    float *n = &out->normalMatrix[0][0];
+    if (isRigid(models[i])) {
+      RigidCount++;
+      for (int c = 0; c < 3; c++) {
+        _mm_storeu_ps(n + 4 * c, _mm_and_ps(col[c], xyz_mask));
+      }
+    } else {
+      __m128 c0 = cross(col[1], col[2]);
+      __m128 c1 = cross(col[2], col[0]);
+      __m128 c2 = cross(col[0], col[1]);
+      __m128 sign = _mm_set1_ps(dot3(col[0], c0) < 0.f ? -1.f : 1.f);
+      _mm_storeu_ps(n, _mm_and_ps(_mm_mul_ps(c0, sign), xyz_mask));
+      _mm_storeu_ps(n + 4, _mm_and_ps(_mm_mul_ps(c1, sign), xyz_mask));
+      _mm_storeu_ps(n + 8, _mm_and_ps(_mm_mul_ps(c2, sign), xyz_mask));
+    }
+    _mm_storeu_ps(n + 12, _mm_set_ps(1.f, 0.f, 0.f, 0.f));
+  }
+}
+
+#else
+
+void MatrixBatch::compute(const glm::mat4 *models, size_t count,
+                          const glm::mat4 &viewProjection) {
+  Count = count;
+  RigidCount = 0;
+  if (Data.size() < Count * Stride) Data.resize(Count * Stride);
+
+  for (size_t i = 0; i < Count; i++) {
+    ObjectMatrices *out = at(i);
+    const glm::mat4 &m = models[i];
+    out->modelMatrix = m;
+    out->modelViewProjection = viewProjection * m;
+    if (isRigid(m)) {
+      RigidCount++;
+      out->normalMatrix = glm::mat4(glm::mat3(m));
+    } else {
+      glm::vec3 x(m[0]), y(m[1]), z(m[2]);
+      glm::mat3 cofactor(glm::cross(y, z), glm::cross(z, x), glm::cross(x, y));
+      float sign = glm::dot(x, cofactor[0]) < 0.f ? -1.f : 1.f;
+      out->normalMatrix = glm::mat4(cofactor * sign);
+    }
+  }
+}
+
+#endif
+
+void MatrixBatch::upload() {
+  if (Count == 0) return;
+  GLsizeiptr bytes = static_cast<GLsizeiptr>(Count) * Stride;
+  glBindBuffer(GL_UNIFORM_BUFFER, UboId);
+  if (bytes > Capacity) {
+    Capacity = bytes;
+    glBufferData(GL_UNIFORM_BUFFER, Capacity, Data.data(), GL_STREAM_DRAW);
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, Capacity, 0, GL_STREAM_DRAW);  // orphan
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, Data.data());
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void MatrixBatch::bind(size_t index) {
+  glBindBufferRange(GL_UNIFORM_BUFFER, BindingPoint, UboId,
+                    static_cast<GLintptr>(index) * Stride,
+                    sizeof(ObjectMatrices));
+}
+
+void MatrixBatch::record(CommandList &list, size_t index) {
+  list.bindBufferRange(BindingPoint, UboId,
+                       static_cast<GLintptr>(index) * Stride,
+                       sizeof(ObjectMatrices));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
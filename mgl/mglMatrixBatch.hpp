@@ -0,0 +1,65 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Derived Matrix Batch Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_MATRIX_BATCH_HPP
+#define MGL_MATRIX_BATCH_HPP
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mglCommandList.hpp"
+
+namespace mgl {
+
+class MatrixBatch;
+
+//////////////////////////////////////////////////////////////////// MatrixBatch
+//
+// Computes the model, normal and model-view-projection matrices of every
+// draw of a frame in one SIMD pass and uploads them to a single uniform
+// buffer; each draw then binds its own range to the "Object" block.
+// Rigid transforms (rotation and uniform scale) reuse the model matrix as
+// normal matrix, the others use the cofactor matrix (inverse-transpose up
+// to a positive scale, which the shader's normalize() removes).
+
+class MatrixBatch {
+ public:
+  struct ObjectMatrices {
+    glm::mat4 modelMatrix;
+    glm::mat4 normalMatrix;  // std140 mat3 padded to a mat4
+    glm::mat4 modelViewProjection;
+  };
+
+  explicit MatrixBatch(GLuint bindingpoint);
+  ~MatrixBatch();
+
+  void compute(const glm::mat4 *models, size_t count,
+               const glm::mat4 &viewProjection);
+  void upload();
+  void bind(size_t index);
+  void record(CommandList &list, size_t index);
+  size_t size();
+  size_t getRigidCount();
+
+  static bool isRigid(const glm::mat4 &m);
+
+ private:
+  GLuint UboId, BindingPoint;
+  GLsizeiptr Stride, Capacity;
+  size_t Count, RigidCount;
+  std::vector<unsigned char> Data;
+
+  ObjectMatrices *at(size_t index);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_MATRIX_BATCH_HPP */
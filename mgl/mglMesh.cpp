@@ -8,6 +8,11 @@
 
 #include "./mglMesh.hpp"
 
+#include <glm/gtc/type_ptr.hpp>
+
+#include "./mglHash.hpp"
+#include "./mglScenegraph.hpp"
+
 namespace mgl {
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -17,11 +22,20 @@ Mesh::Mesh() {
   TexcoordsLoaded = false;
   TangentsAndBitangentsLoaded = false;
   MaterialsLoaded = false;
+  BonesLoaded = false;
   VaoId = -1;
+  DepthVaoId = -1;
+  PreskinnedVaoId = 0;
+  PreskinnedDepthVaoId = 0;
+  for (GLuint &id : SkinSources) id = 0;
+  for (GLuint &id : SkinTargets) id = 0;
   AssimpFlags = aiProcess_Triangulate;
 }
 
-Mesh::~Mesh() { destroyBufferObjects(); }
+Mesh::~Mesh() {
+  if (!Source) destroyBufferObjects();
+  delete skin;
+}
 
 void Mesh::setAssimpFlags(unsigned int flags) { AssimpFlags = flags; }
 
@@ -51,6 +65,11 @@ bool Mesh::hasTangentsAndBitangents() { return TangentsAndBitangentsLoaded; }
 
 bool Mesh::hasMaterials() { return MaterialsLoaded; }
 
+bool Mesh::hasBones() { return BonesLoaded; }
+
+// Only meshes with bones have a skin.
+Skin *Mesh::getSkin() { return skin; }
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void Mesh::setTransform(Transform* t) {
@@ -95,6 +114,50 @@ void Mesh::processMesh(const aiMesh *mesh) {
   }
 }
 
+// Keeps the four largest influences of each vertex.
+void Mesh::processBones(const aiMesh *mesh, unsigned int baseVertex,
+                        std::vector<glm::vec4> &weights) {
+  for (unsigned int b = 0; b < mesh->mNumBones; b++) {
+    const aiBone *bone = mesh->mBones[b];
+    glm::mat4 offset = glm::transpose(glm::make_mat4(&bone->mOffsetMatrix.a1));
+    int32_t index = skin->getSkeleton().addBone(bone->mName.C_Str(), offset);
+    if (index < 0) continue;
+    for (unsigned int w = 0; w < bone->mNumWeights; w++) {
+      const aiVertexWeight &weight = bone->mWeights[w];
+      unsigned int v = baseVertex + weight.mVertexId;
+      int smallest = 0;
+      for (int k = 1; k < 4; k++) {
+        if (weights[v][k] < weights[v][smallest]) smallest = k;
+      }
+      if (weight.mWeight > weights[v][smallest]) {
+        weights[v][smallest] = weight.mWeight;
+        BoneIndices[v][smallest] = static_cast<uint8_t>(index);
+      }
+    }
+  }
+}
+
+// Weights are normalised and quantised to bytes summing exactly to 255.
+void Mesh::packBones(const std::vector<glm::vec4> &weights) {
+  BoneWeights.resize(weights.size());
+  for (size_t v = 0; v < weights.size(); v++) {
+    const glm::vec4 &w = weights[v];
+    float sum = w.x + w.y + w.z + w.w;
+    if (sum <= 0.f) {
+      BoneWeights[v] = glm::u8vec4(255, 0, 0, 0);
+      continue;
+    }
+    int total = 0, largest = 0;
+    for (int k = 0; k < 4; k++) {
+      BoneWeights[v][k] = static_cast<uint8_t>(w[k] / sum * 255.f + 0.5f);
+      total += BoneWeights[v][k];
+      if (w[k] > w[largest]) largest = k;
+    }
+    BoneWeights[v][largest] =
+        static_cast<uint8_t>(BoneWeights[v][largest] + 255 - total);
+  }
+}
+
 void Mesh::processScene(const aiScene *scene) {
   Meshes.resize(scene->mNumMeshes);
   if (scene->HasMaterials()) {
@@ -115,9 +178,27 @@ void Mesh::processScene(const aiScene *scene) {
   Texcoords.reserve(n_vertices);
   Indices.reserve(n_indices);
 
+  std::vector<glm::vec4> weights;
+  for (unsigned int i = 0; i < Meshes.size(); i++) {
+    if (scene->mMeshes[i]->HasBones() && skin == nullptr) {
+      skin = new Skin();
+      skin->getSkeleton().create(scene->mRootNode);
+      BoneIndices.assign(n_vertices, glm::u8vec4(0));
+      weights.assign(n_vertices, glm::vec4(0.f));
+    }
+  }
   for (unsigned int i = 0; i < Meshes.size(); i++) {
     processMesh(scene->mMeshes[i]);
+    if (skin != nullptr) {
+      processBones(scene->mMeshes[i], Meshes[i].baseVertex, weights);
+    }
+  }
+  if (skin != nullptr) {
+    packBones(weights);
+    skin->addClips(scene);
+    BonesLoaded = true;
   }
+  calculateBounds();
 
 #ifdef DEBUG
   std::cout << "Loaded " << Meshes.size() << " mesh(es) [" << n_vertices
@@ -126,6 +207,18 @@ void Mesh::processScene(const aiScene *scene) {
 #endif
 }
 
+void Mesh::calculateBounds() {
+  if (Positions.empty()) {
+    BoundsMin = BoundsMax = glm::vec3(0.f);
+    return;
+  }
+  BoundsMin = BoundsMax = Positions[0];
+  for (const glm::vec3 &p : Positions) {
+    BoundsMin = glm::min(BoundsMin, p);
+    BoundsMax = glm::max(BoundsMax, p);
+  }
+}
+
 void Mesh::create(const std::string &filename) {
   Assimp::Importer importer;
   const aiScene *scene = importer.ReadFile(filename, AssimpFlags);
@@ -140,60 +233,245 @@ void Mesh::create(const std::string &filename) {
   std::cout << "Processing [" << filename << "]" << std::endl;
 #endif
 
+  unshare();
   processScene(scene);
+  ContentHash = 0;
+  markChanged();
+  createBufferObjects();
+}
+
+void Mesh::create(const ArrayView &view) {
+  assign(view);
   createBufferObjects();
 }
 
+// Copies the arrays, so the view may go away once this returns. No GL
+// objects are created, see createBufferObjects(meshes) to do it in bulk.
+void Mesh::assign(const ArrayView &view) {
+  unshare();
+  Meshes.assign(view.meshes, view.meshes + view.meshCount);
+  Positions.assign(view.positions, view.positions + view.vertexCount);
+  NormalsLoaded = view.normals != nullptr;
+  TexcoordsLoaded = view.texcoords != nullptr;
+  TangentsAndBitangentsLoaded =
+      view.tangents != nullptr && view.bitangents != nullptr;
+  if (NormalsLoaded) {
+    Normals.assign(view.normals, view.normals + view.vertexCount);
+  }
+  if (TexcoordsLoaded) {
+    Texcoords.assign(view.texcoords, view.texcoords + view.vertexCount);
+  }
+  if (TangentsAndBitangentsLoaded) {
+    Tangents.assign(view.tangents, view.tangents + view.vertexCount);
+    Bitangents.assign(view.bitangents, view.bitangents + view.vertexCount);
+  }
+  Indices.assign(view.indices, view.indices + view.indexCount);
+  ContentHash = 0;
+  calculateBounds();
+  markChanged();
+}
+
+// Draws the geometry and GL objects of source instead of its own, which are
+// released. The source lives on as long as a mesh shares it; effect,
+// transparency and material stay per mesh. Not for skinned meshes.
+void Mesh::share(const std::shared_ptr<Mesh> &source) {
+  std::shared_ptr<Mesh> owner = source->Source ? source->Source : source;
+  if (!Source) destroyBufferObjects();
+  delete skin;
+  skin = nullptr;
+  Source = owner;
+  Meshes = owner->Meshes;
+  Positions = std::vector<glm::vec3>();
+  Normals = std::vector<glm::vec3>();
+  Texcoords = std::vector<glm::vec2>();
+  Tangents = std::vector<glm::vec3>();
+  Bitangents = std::vector<glm::vec3>();
+  Indices = std::vector<unsigned int>();
+  BoneIndices = std::vector<glm::u8vec4>();
+  BoneWeights = std::vector<glm::u8vec4>();
+  NormalsLoaded = owner->NormalsLoaded;
+  TexcoordsLoaded = owner->TexcoordsLoaded;
+  TangentsAndBitangentsLoaded = owner->TangentsAndBitangentsLoaded;
+  BonesLoaded = false;
+  VaoId = owner->VaoId;
+  DepthVaoId = owner->DepthVaoId;
+  IndexOffset = owner->IndexOffset;
+  BoundsMin = owner->BoundsMin;
+  BoundsMax = owner->BoundsMax;
+  ContentHash = owner->getContentHash();
+  markChanged();
+}
+
+// Drops a shared source before new geometry is assigned.
+void Mesh::unshare() {
+  if (!Source) return;
+  Source.reset();
+  VaoId = -1;
+  DepthVaoId = -1;
+  IndexOffset = 0;
+}
+
 void Mesh::createBufferObjects() {
-    GLuint buffNum = 7;
-  GLuint boId[7];
+  GLuint boId[BUFFER_COUNT];
+  glGenBuffers(BUFFER_COUNT, boId);
+  uploadBuffer(boId[POSITION], Positions);
+  if (NormalsLoaded) uploadBuffer(boId[NORMAL], Normals);
+  if (TexcoordsLoaded) uploadBuffer(boId[TEXCOORD], Texcoords);
+  if (TangentsAndBitangentsLoaded) {
+    uploadBuffer(boId[TANGENT], Tangents);
+#ifdef CREATE_BITANGENT
+    uploadBuffer(boId[BITANGENT], Bitangents);
+#endif
+  }
+  if (BonesLoaded) {
+    uploadBuffer(boId[BONE_INDICES], BoneIndices);
+    uploadBuffer(boId[BONE_WEIGHTS], BoneWeights);
+  }
+  uploadBuffer(boId[INDEX], Indices);
+
+  IndexOffset = 0;
+  createVertexArrays(boId, 0);
+  if (BonesLoaded) createSkinningObjects(boId);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(BUFFER_COUNT, boId);
+}
+
+// Packs the meshes into one buffer per attribute plus one index buffer, each
+// allocated once and filled range by range. Every mesh still gets its own
+// vertex arrays, pointing at its range, so vertex indices stay local and only
+// the index offset changes at draw time. The buffer names are released at
+// the end: the vertex arrays keep the storage alive. Skinned meshes need
+// buffers of their own for the compute pass and are created one by one.
+void Mesh::createBufferObjects(const std::vector<Mesh *> &meshes) {
+  std::vector<Mesh *> shared;
+  std::vector<GLuint> firstVertex;
+  size_t sizes[BUFFER_COUNT] = {};
+  GLuint vertices = 0, indices = 0;
+  for (Mesh *mesh : meshes) {
+    if (mesh->Positions.empty()) continue;
+    if (mesh->BonesLoaded) {
+      mesh->createBufferObjects();
+      continue;
+    }
+    shared.push_back(mesh);
+    firstVertex.push_back(vertices);
+    sizes[POSITION] = sizeof(glm::vec3);
+    if (mesh->NormalsLoaded) sizes[NORMAL] = sizeof(glm::vec3);
+    if (mesh->TexcoordsLoaded) sizes[TEXCOORD] = sizeof(glm::vec2);
+    if (mesh->TangentsAndBitangentsLoaded) {
+      sizes[TANGENT] = sizeof(glm::vec3);
+#ifdef CREATE_BITANGENT
+      sizes[BITANGENT] = sizeof(glm::vec3);
+#endif
+    }
+    mesh->IndexOffset = indices;
+    vertices += static_cast<GLuint>(mesh->Positions.size());
+    indices += static_cast<GLuint>(mesh->Indices.size());
+  }
+  if (shared.empty()) return;
+
+  // An attribute found in any mesh is sized for all vertices, so that
+  // firstVertex addresses every buffer alike.
+  GLuint boId[BUFFER_COUNT] = {};
+  glGenBuffers(BUFFER_COUNT, boId);
+  for (GLuint b = 0; b < BUFFER_COUNT; b++) {
+    if (sizes[b] == 0 && b != INDEX) continue;
+    glBindBuffer(GL_ARRAY_BUFFER, boId[b]);
+    GLsizeiptr size = b == INDEX ? sizeof(unsigned int) * indices
+                                 : sizes[b] * vertices;
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  }
+  for (size_t i = 0; i < shared.size(); i++) {
+    Mesh *mesh = shared[i];
+    const GLuint first = firstVertex[i];
+    uploadRange(boId[POSITION], first, mesh->Positions);
+    if (mesh->NormalsLoaded) uploadRange(boId[NORMAL], first, mesh->Normals);
+    if (mesh->TexcoordsLoaded) {
+      uploadRange(boId[TEXCOORD], first, mesh->Texcoords);
+    }
+    if (mesh->TangentsAndBitangentsLoaded) {
+      uploadRange(boId[TANGENT], first, mesh->Tangents);
+#ifdef CREATE_BITANGENT
+      uploadRange(boId[BITANGENT], first, mesh->Bitangents);
+#endif
+    }
+    uploadRange(boId[INDEX], mesh->IndexOffset, mesh->Indices);
+    mesh->createVertexArrays(boId, first);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(BUFFER_COUNT, boId);
+}
+
+template <typename T>
+void Mesh::uploadBuffer(GLuint buffer, const std::vector<T> &data) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(T) * data.size(), data.data(),
+               GL_STATIC_DRAW);
+}
+
+template <typename T>
+void Mesh::uploadRange(GLuint buffer, GLuint first,
+                       const std::vector<T> &data) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferSubData(GL_ARRAY_BUFFER, sizeof(T) * first, sizeof(T) * data.size(),
+                  data.data());
+}
+
+// Vertex arrays over buffers already filled, starting at firstVertex.
+void Mesh::createVertexArrays(const GLuint *boId, GLuint firstVertex) {
+  auto offset = [firstVertex](size_t size) {
+    return reinterpret_cast<void *>(size * firstVertex);
+  };
 
   glGenVertexArrays(1, &VaoId);
   glBindVertexArray(VaoId);
   {
-    glGenBuffers(buffNum, boId);
-
     glBindBuffer(GL_ARRAY_BUFFER, boId[POSITION]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(),
-                 &Positions[0], GL_STATIC_DRAW);
     glEnableVertexAttribArray(POSITION);
-    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0,
+                          offset(sizeof(glm::vec3)));
 
     if (NormalsLoaded) {
       glBindBuffer(GL_ARRAY_BUFFER, boId[NORMAL]);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(Normals[0]) * Normals.size(),
-                   &Normals[0], GL_STATIC_DRAW);
       glEnableVertexAttribArray(NORMAL);
-      glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, 0,
+                            offset(sizeof(glm::vec3)));
     }
 
     if (TexcoordsLoaded) {
       glBindBuffer(GL_ARRAY_BUFFER, boId[TEXCOORD]);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(Texcoords[0]) * Texcoords.size(),
-                   &Texcoords[0], GL_STATIC_DRAW);
       glEnableVertexAttribArray(TEXCOORD);
-      glVertexAttribPointer(TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
+      glVertexAttribPointer(TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0,
+                            offset(sizeof(glm::vec2)));
     }
 
     if (TangentsAndBitangentsLoaded) {
       glBindBuffer(GL_ARRAY_BUFFER, boId[TANGENT]);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(Tangents[0]) * Tangents.size(),
-                   &Tangents[0], GL_STATIC_DRAW);
       glEnableVertexAttribArray(TANGENT);
-      glVertexAttribPointer(TANGENT, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glVertexAttribPointer(TANGENT, 3, GL_FLOAT, GL_FALSE, 0,
+                            offset(sizeof(glm::vec3)));
 
 #ifdef CREATE_BITANGENT
       glBindBuffer(GL_ARRAY_BUFFER, boId[BITANGENT]);
-      glBufferData(GL_ARRAY_BUFFER, sizeof(Bitangents[0]) * Bitangents.size(),
-                   &Bitangents[0], GL_STATIC_DRAW);
       glEnableVertexAttribArray(BITANGENT);
-      glVertexAttribPointer(BITANGENT, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glVertexAttribPointer(BITANGENT, 3, GL_FLOAT, GL_FALSE, 0,
+                            offset(sizeof(glm::vec3)));
 #endif
     }
 
+    if (BonesLoaded) {
+      glBindBuffer(GL_ARRAY_BUFFER, boId[BONE_INDICES]);
+      glEnableVertexAttribArray(BONE_INDICES);
+      glVertexAttribIPointer(BONE_INDICES, 4, GL_UNSIGNED_BYTE, 0,
+                             offset(sizeof(glm::u8vec4)));
+
+      glBindBuffer(GL_ARRAY_BUFFER, boId[BONE_WEIGHTS]);
+      glEnableVertexAttribArray(BONE_WEIGHTS);
+      glVertexAttribPointer(BONE_WEIGHTS, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+                            offset(sizeof(glm::u8vec4)));
+    }
+
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boId[INDEX]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices[0]) * Indices.size(),
-                 &Indices[0], GL_STATIC_DRAW);
 
     ////////////////////// COLORS //////////////////////////////
     //glBindBuffer(GL_ARRAY_BUFFER, boId[COLOR]);
@@ -208,11 +486,88 @@ void Mesh::createBufferObjects() {
     //////////////////////////////////////////////////////////////////
   }
   glBindVertexArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glDeleteBuffers(buffNum, boId);
+
+  // Position-only binding for the depth pre-pass, sharing the same buffers.
+  glGenVertexArrays(1, &DepthVaoId);
+  glBindVertexArray(DepthVaoId);
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, boId[POSITION]);
+    glEnableVertexAttribArray(POSITION);
+    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0,
+                          offset(sizeof(glm::vec3)));
+    if (BonesLoaded) {
+      glBindBuffer(GL_ARRAY_BUFFER, boId[BONE_INDICES]);
+      glEnableVertexAttribArray(BONE_INDICES);
+      glVertexAttribIPointer(BONE_INDICES, 4, GL_UNSIGNED_BYTE, 0,
+                             offset(sizeof(glm::u8vec4)));
+      glBindBuffer(GL_ARRAY_BUFFER, boId[BONE_WEIGHTS]);
+      glEnableVertexAttribArray(BONE_WEIGHTS);
+      glVertexAttribPointer(BONE_WEIGHTS, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+                            offset(sizeof(glm::u8vec4)));
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boId[INDEX]);
+  }
+  glBindVertexArray(0);
+}
+
+void Mesh::createSkinningObjects(GLuint *boId) {
+  SkinSources[0] = boId[POSITION];
+  SkinSources[1] = NormalsLoaded ? boId[NORMAL] : boId[POSITION];
+  SkinSources[2] = boId[BONE_INDICES];
+  SkinSources[3] = boId[BONE_WEIGHTS];
+  boId[POSITION] = boId[BONE_INDICES] = boId[BONE_WEIGHTS] = 0;
+  if (NormalsLoaded) boId[NORMAL] = 0;
+
+  GLsizeiptr size = sizeof(Positions[0]) * Positions.size();
+  glGenBuffers(2, SkinTargets);
+  for (GLuint target : SkinTargets) {
+    glBindBuffer(GL_ARRAY_BUFFER, target);
+    glBufferData(GL_ARRAY_BUFFER, size, 0, GL_DYNAMIC_COPY);
+  }
+
+  glGenVertexArrays(1, &PreskinnedVaoId);
+  glBindVertexArray(PreskinnedVaoId);
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, SkinTargets[0]);
+    glEnableVertexAttribArray(POSITION);
+    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    if (NormalsLoaded) {
+      glBindBuffer(GL_ARRAY_BUFFER, SkinTargets[1]);
+      glEnableVertexAttribArray(NORMAL);
+      glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    }
+    if (TexcoordsLoaded) {
+      glBindBuffer(GL_ARRAY_BUFFER, boId[TEXCOORD]);
+      glEnableVertexAttribArray(TEXCOORD);
+      glVertexAttribPointer(TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    }
+    if (TangentsAndBitangentsLoaded) {
+      glBindBuffer(GL_ARRAY_BUFFER, boId[TANGENT]);
+      glEnableVertexAttribArray(TANGENT);
+      glVertexAttribPointer(TANGENT, 3, GL_FLOAT, GL_FALSE, 0, 0);
+#ifdef CREATE_BITANGENT
+      glBindBuffer(GL_ARRAY_BUFFER, boId[BITANGENT]);
+      glEnableVertexAttribArray(BITANGENT);
+      glVertexAttribPointer(BITANGENT, 3, GL_FLOAT, GL_FALSE, 0, 0);
+#endif
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boId[INDEX]);
+  }
+  glGenVertexArrays(1, &PreskinnedDepthVaoId);
+  glBindVertexArray(PreskinnedDepthVaoId);
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, SkinTargets[0]);
+    glEnableVertexAttribArray(POSITION);
+    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boId[INDEX]);
+  }
+  glBindVertexArray(0);
 }
 
+// Meshes that never created their GL objects, or share another's, have
+// nothing to release.
 void Mesh::destroyBufferObjects() {
+  if (VaoId == static_cast<GLuint>(-1)) return;
   glBindVertexArray(VaoId);
   glDisableVertexAttribArray(POSITION);
   glDisableVertexAttribArray(NORMAL);
@@ -223,29 +578,106 @@ void Mesh::destroyBufferObjects() {
 #endif
   glDisableVertexAttribArray(COLOR);
   glDeleteVertexArrays(1, &VaoId);
+  glDeleteVertexArrays(1, &DepthVaoId);
   glBindVertexArray(0);
+  if (BonesLoaded) {
+    glDeleteVertexArrays(1, &PreskinnedVaoId);
+    glDeleteVertexArrays(1, &PreskinnedDepthVaoId);
+    glDeleteBuffers(4, SkinSources);
+    glDeleteBuffers(2, SkinTargets);
+    PreskinnedVaoId = 0;
+    PreskinnedDepthVaoId = 0;
+    for (GLuint &id : SkinSources) id = 0;
+    for (GLuint &id : SkinTargets) id = 0;
+  }
+  VaoId = -1;
+  DepthVaoId = -1;
+}
+
+GLuint Mesh::getVertexArray(bool depth) {
+  if (skin != nullptr && skin->isPreskinned()) {
+    return depth ? PreskinnedDepthVaoId : PreskinnedVaoId;
+  }
+  return depth ? DepthVaoId : VaoId;
+}
+
+// Skins the vertices into the preskinned arrays; the Animator binds the
+// program and the palette.
+void Mesh::preskin() {
+  for (GLuint i = 0; i < 4; i++) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, SkinSources[i]);
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, SkinTargets[0]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, SkinTargets[1]);
+  GLuint count = static_cast<GLuint>(Positions.size());
+  glDispatchCompute((count + 63) / 64, 1, 1);
 }
 
 void Mesh::draw() {
-  glBindVertexArray(VaoId);
+  glBindVertexArray(getVertexArray(false));
   for (MeshData &mesh : Meshes) {
     glDrawElementsBaseVertex(
         GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT,
-        reinterpret_cast<void *>((sizeof(unsigned int) * mesh.baseIndex)),
+        reinterpret_cast<void *>(sizeof(unsigned int) *
+                                 (IndexOffset + mesh.baseIndex)),
         mesh.baseVertex);
   }
   glBindVertexArray(0);
 }
 
+void Mesh::drawDepth() {
+  glBindVertexArray(getVertexArray(true));
+  for (MeshData &mesh : Meshes) {
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT,
+        reinterpret_cast<void *>(sizeof(unsigned int) *
+                                 (IndexOffset + mesh.baseIndex)),
+        mesh.baseVertex);
+  }
+  glBindVertexArray(0);
+}
+
+// Same calls as draw() and drawDepth(), without touching GL. The vertex
+// array is left bound for the next command, which usually binds its own.
+void Mesh::record(CommandList &list) {
+  list.bindVertexArray(getVertexArray(false));
+  for (MeshData &mesh : Meshes) {
+    list.drawElements(mesh.nIndices, IndexOffset + mesh.baseIndex,
+                      mesh.baseVertex);
+  }
+}
+
+void Mesh::recordDepth(CommandList &list) {
+  list.bindVertexArray(getVertexArray(true));
+  for (MeshData &mesh : Meshes) {
+    list.drawElements(mesh.nIndices, IndexOffset + mesh.baseIndex,
+                      mesh.baseVertex);
+  }
+}
+
 void Mesh::setEffect(int e) {
     this->effect = e;
+    markChanged();
 }
 
 int Mesh::getEffect() {
     return effect;
 }
 
-json glmVec3ToJSON(glm::vec3 v) {
+void Mesh::setTransparent(bool t) {
+    transparent = t;
+    markChanged();
+}
+
+void Mesh::markChanged() {
+  if (arena != nullptr) arena->markChanged(this);
+}
+
+bool Mesh::isTransparent() {
+    return transparent;
+}
+
+json glmVec3ToJSON(const glm::vec3 &v) {
     json j = json::array();
     j.push_back(v.x);
     j.push_back(v.y);
@@ -254,7 +686,7 @@ json glmVec3ToJSON(glm::vec3 v) {
     return j;
 }
 
-json glmVec2ToJSON(glm::vec2 v) {
+json glmVec2ToJSON(const glm::vec2 &v) {
     json j = json::array();
     j.push_back(v.x);
     j.push_back(v.y);
@@ -272,31 +704,34 @@ json glmVec2ToJSON(glm::vec2 v) {
 //    return j;
 //}
 
-json vecOfGlmVec3ToJSON(std::vector<glm::vec3> vec) {
+json vecOfGlmVec3ToJSON(const std::vector<glm::vec3> &vec) {
     json j = json::array();
+    j.get_ref<json::array_t &>().reserve(vec.size());
     for (int i = 0; i < vec.size(); i++) {
         j.push_back(glmVec3ToJSON(vec[i]));
     }
     return j;
 }
 
-json vecOfGlmVec2ToJSON(std::vector<glm::vec2> vec) {
+json vecOfGlmVec2ToJSON(const std::vector<glm::vec2> &vec) {
     json j = json::array();
+    j.get_ref<json::array_t &>().reserve(vec.size());
     for (int i = 0; i < vec.size(); i++) {
         j.push_back(glmVec2ToJSON(vec[i]));
     }
     return j;
 }
 
-json vecOfIntToJSON(std::vector<unsigned int> vec) {
+json vecOfIntToJSON(const std::vector<unsigned int> &vec) {
     json j = json::array();
+    j.get_ref<json::array_t &>().reserve(vec.size());
     for (int i = 0; i < vec.size(); i++) {
         j.push_back(vec[i]);
     }
     return j;
 }
 
-json Mesh::vecOfMeshDataToJSON(std::vector<MeshData> vec) {
+json Mesh::vecOfMeshDataToJSON(const std::vector<MeshData> &vec) {
     json j = json::array();
     for (int i = 0; i < vec.size(); i++) {
         json jMeshData = json::object();
@@ -308,57 +743,68 @@ json Mesh::vecOfMeshDataToJSON(std::vector<MeshData> vec) {
     return j;
 }
 
+// ArraySizes sorts before the arrays, so streaming readers can reserve.
 json Mesh::toJSON() {
     json j;
 
-    j["Positions"] = vecOfGlmVec3ToJSON(Positions);
-    j["Normals"] = vecOfGlmVec3ToJSON(Normals);
-    j["Texcoords"] = vecOfGlmVec2ToJSON(Texcoords);
-    j["Tangents"] = vecOfGlmVec3ToJSON(Tangents);
-    j["Bitangents"] = vecOfGlmVec3ToJSON(Bitangents);
-    j["Indices"] = vecOfIntToJSON(Indices);
+    j["ArraySizes"]["Positions"] = getPositions().size();
+    j["ArraySizes"]["Normals"] = getNormals().size();
+    j["ArraySizes"]["Texcoords"] = getTexcoords().size();
+    j["ArraySizes"]["Tangents"] = getTangents().size();
+    j["ArraySizes"]["Bitangents"] = getBitangents().size();
+    j["ArraySizes"]["Indices"] = getIndices().size();
+    j["ArraySizes"]["Meshes"] = Meshes.size();
+    j["Positions"] = vecOfGlmVec3ToJSON(getPositions());
+    j["Normals"] = vecOfGlmVec3ToJSON(getNormals());
+    j["Texcoords"] = vecOfGlmVec2ToJSON(getTexcoords());
+    j["Tangents"] = vecOfGlmVec3ToJSON(getTangents());
+    j["Bitangents"] = vecOfGlmVec3ToJSON(getBitangents());
+    j["Indices"] = vecOfIntToJSON(getIndices());
     j["Meshes"] = vecOfMeshDataToJSON(Meshes);
+    j["effect"] = effect;
+    j["transparent"] = transparent;
     return j;
 }
 
-std::vector<glm::vec3> toVecOfGlmVec3(json j) {
+std::vector<glm::vec3> toVecOfGlmVec3(const json &j) {
     std::vector<glm::vec3> result;
-   
-    for (json::iterator it = j.begin(); it != j.end(); ++it) {
-        float vecArr[3] = { 0, 0, 0 };
-        int i = 0;
-        for (json::iterator it2 = it->begin(); it2 != it->end(); it2++) {
-            vecArr[i++] = it2.value();
+    result.reserve(j.size());
+    for (const json &v : j) {
+        glm::vec3 vec(0.0f);
+        for (int i = 0; i < 3 && i < v.size(); i++) {
+            vec[i] = v[i].get<float>();
         }
-        result.push_back(glm::vec3(vecArr[0], vecArr[1], vecArr[2]));
+        result.push_back(vec);
     }
 
     return result;
 }
 
-std::vector<glm::vec2> toVecOfGlmVec2(json j) {
+std::vector<glm::vec2> toVecOfGlmVec2(const json &j) {
     std::vector<glm::vec2> result;
-    for (json::iterator it = j.begin(); it != j.end(); ++it) {
-        float vecArr[2] = { 0, 0 };
-        int i = 0;
-        for (json::iterator it2 = it->begin(); it2 != it->end(); it2++) {
-            vecArr[i++] = it2.value();
+    result.reserve(j.size());
+    for (const json &v : j) {
+        glm::vec2 vec(0.0f);
+        for (int i = 0; i < 2 && i < v.size(); i++) {
+            vec[i] = v[i].get<float>();
         }
-        result.push_back(glm::vec2(vecArr[0], vecArr[1]));
+        result.push_back(vec);
     }
     return result;
 }
 
-std::vector<unsigned int> toVecOfUint(json j) {
+std::vector<unsigned int> toVecOfUint(const json &j) {
     std::vector<unsigned int> result;
-    for (int i = 0; i < j.size(); i++) {
-        result.push_back(j[i]);
+    result.reserve(j.size());
+    for (const json &v : j) {
+        result.push_back(v.get<unsigned int>());
     }
     return result;
 }
 
-std::vector<Mesh::MeshData> Mesh::toVecOfMeshData(json j) {
+std::vector<Mesh::MeshData> Mesh::toVecOfMeshData(const json &j) {
     std::vector<MeshData> result;
+    result.reserve(j.size());
     for (int i = 0; i < j.size(); i++) {
         MeshData md{};
         md.nIndices = j[i]["nIndices"];
@@ -369,18 +815,83 @@ std::vector<Mesh::MeshData> Mesh::toVecOfMeshData(json j) {
     return result;
 }
 
-void Mesh::fromJSON(json j) {
-    Positions = toVecOfGlmVec3(j["Positions"]);
-    Normals = toVecOfGlmVec3(j["Normals"]);
-    Texcoords = toVecOfGlmVec2(j["Texcoords"]);
-    Tangents = toVecOfGlmVec3(j["Tangents"]);
-    Bitangents = toVecOfGlmVec3(j["Bitangents"]);
-    Indices = toVecOfUint(j["Indices"]);
-    Meshes = toVecOfMeshData(j["Meshes"]);
+void Mesh::fromJSON(const json &j) {
+    unshare();
+    Positions = toVecOfGlmVec3(j.at("Positions"));
+    Normals = toVecOfGlmVec3(j.at("Normals"));
+    Texcoords = toVecOfGlmVec2(j.at("Texcoords"));
+    Tangents = toVecOfGlmVec3(j.at("Tangents"));
+    Bitangents = toVecOfGlmVec3(j.at("Bitangents"));
+    Indices = toVecOfUint(j.at("Indices"));
+    Meshes = toVecOfMeshData(j.at("Meshes"));
+    effect = j.value("effect", 0);
+    transparent = j.value("transparent", false);
+    NormalsLoaded = !Normals.empty();
+    TexcoordsLoaded = !Texcoords.empty();
+    TangentsAndBitangentsLoaded = !Tangents.empty() && !Bitangents.empty();
+    ContentHash = 0;
+    calculateBounds();
 }
 
 Transform* Mesh::getTransform() {
     return transform;
 }
+
+const std::vector<Mesh::MeshData> &Mesh::getMeshData() { return Meshes; }
+
+const std::vector<glm::vec3> &Mesh::getPositions() {
+  return Source ? Source->Positions : Positions;
+}
+
+const std::vector<glm::vec3> &Mesh::getNormals() {
+  return Source ? Source->Normals : Normals;
+}
+
+const std::vector<glm::vec2> &Mesh::getTexcoords() {
+  return Source ? Source->Texcoords : Texcoords;
+}
+
+const std::vector<glm::vec3> &Mesh::getTangents() {
+  return Source ? Source->Tangents : Tangents;
+}
+
+const std::vector<glm::vec3> &Mesh::getBitangents() {
+  return Source ? Source->Bitangents : Bitangents;
+}
+
+const std::vector<unsigned int> &Mesh::getIndices() {
+  return Source ? Source->Indices : Indices;
+}
+
+template <typename T>
+static uint64_t hashVector(uint64_t hash, const std::vector<T> &v) {
+  const size_t n = v.size() * sizeof(T);
+  return hash64(&n, sizeof(n), hash64(v.data(), n, hash));
+}
+
+// 64-bit FNV-1a of the geometry, computed on first use: identical meshes
+// loaded twice share a hash, whatever their effect or transform.
+uint64_t Mesh::getContentHash() {
+  if (ContentHash != 0) return ContentHash;
+  std::vector<unsigned int> meshes;
+  for (const MeshData &m : Meshes) {
+    meshes.push_back(m.nIndices);
+    meshes.push_back(m.baseIndex);
+    meshes.push_back(m.baseVertex);
+  }
+  uint64_t hash = hashVector(HASH_SEED, meshes);
+  hash = hashVector(hash, Positions);
+  hash = hashVector(hash, Normals);
+  hash = hashVector(hash, Texcoords);
+  hash = hashVector(hash, Tangents);
+  hash = hashVector(hash, Bitangents);
+  hash = hashVector(hash, Indices);
+  ContentHash = hash != 0 ? hash : 1;
+  return ContentHash;
+}
+
+glm::vec3 Mesh::getBoundsMin() { return BoundsMin; }
+
+glm::vec3 Mesh::getBoundsMax() { return BoundsMax; }
 ////////////////////////////////////////////////////////////////////////////////
 }  // namespace mgl
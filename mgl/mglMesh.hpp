@@ -17,10 +17,14 @@
 
 #include <assimp/Importer.hpp>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "mglCommandList.hpp"
+#include "mglSkinning.hpp"
 #include "mglTransform.hpp"
 
 using json = nlohmann::json;
@@ -32,6 +36,7 @@ public:
 };
 
 class Mesh;
+class SceneArena;
 
 #define CREATE_BITANGENT
 
@@ -48,6 +53,30 @@ class Mesh : public IDrawable {
   static const GLuint BITANGENT = 6;
 #endif
   static const GLuint COLOR = 5;
+  static const GLuint BONE_INDICES = 8;
+  static const GLuint BONE_WEIGHTS = 9;
+  static const GLuint BUFFER_COUNT = 10;
+
+  struct MeshData {
+    unsigned int nIndices = 0;
+    unsigned int baseIndex = 0;
+    unsigned int baseVertex = 0;
+  };
+
+  // Vertex data owned by someone else, such as a mapped scene file. Absent
+  // attributes are null.
+  struct ArrayView {
+    const MeshData *meshes;
+    size_t meshCount;
+    const glm::vec3 *positions;
+    const glm::vec3 *normals;
+    const glm::vec2 *texcoords;
+    const glm::vec3 *tangents;
+    const glm::vec3 *bitangents;
+    size_t vertexCount;
+    const unsigned int *indices;
+    size_t indexCount;
+  };
 
   aiMaterial material;
 
@@ -63,6 +92,10 @@ class Mesh : public IDrawable {
   void flipUVs();
 
   void create(const std::string &filename);
+  void create(const ArrayView &view);
+  void assign(const ArrayView &view);
+  void share(const std::shared_ptr<Mesh> &source);
+  static void createBufferObjects(const std::vector<Mesh *> &meshes);
   void draw() override;
   //void draw(bool drawChildren = true, Mesh* drawSelected = NULL);
 
@@ -74,25 +107,53 @@ class Mesh : public IDrawable {
   bool hasTexcoords();
   bool hasTangentsAndBitangents();
   bool hasMaterials();
+  bool hasBones();
+  Skin *getSkin();
+  void preskin();
 
   void setEffect(int);
   int getEffect();
+  void setTransparent(bool);
+  bool isTransparent();
+  void drawDepth();
+  void record(CommandList &list);
+  void recordDepth(CommandList &list);
+
+  const std::vector<MeshData> &getMeshData();
+  const std::vector<glm::vec3> &getPositions();
+  const std::vector<glm::vec3> &getNormals();
+  const std::vector<glm::vec2> &getTexcoords();
+  const std::vector<glm::vec3> &getTangents();
+  const std::vector<glm::vec3> &getBitangents();
+  const std::vector<unsigned int> &getIndices();
+  uint64_t getContentHash();
+  glm::vec3 getBoundsMin();
+  glm::vec3 getBoundsMax();
 
   json toJSON();
-  void fromJSON(json j);
+  void fromJSON(const json &j);
 
  private:
-  GLuint VaoId;
+  GLuint VaoId, DepthVaoId;
   unsigned int AssimpFlags;
   bool NormalsLoaded, TexcoordsLoaded, TangentsAndBitangentsLoaded, MaterialsLoaded;
+  bool BonesLoaded;
+  Skin *skin = nullptr;
+  // Skinned meshes keep their source buffers for the compute pass, which
+  // writes the skinned positions and normals drawn by the preskinned arrays.
+  GLuint SkinSources[4], SkinTargets[2];
+  GLuint PreskinnedVaoId, PreskinnedDepthVaoId;
   Transform* transform = nullptr;
   int effect;
+  bool transparent = false;
+  glm::vec3 BoundsMin = glm::vec3(0.f);
+  glm::vec3 BoundsMax = glm::vec3(0.f);
+  uint64_t ContentHash = 0;
+  SceneArena *arena = nullptr;  // told about changes, when set
+  bool changed = false;
+  GLuint IndexOffset = 0;  // first index in a buffer shared with other meshes
+  std::shared_ptr<Mesh> Source;  // owner of the geometry, when shared
 
-  struct MeshData {
-    unsigned int nIndices = 0;
-    unsigned int baseIndex = 0;
-    unsigned int baseVertex = 0;
-  };
   std::vector<MeshData> Meshes;
 
   std::vector<glm::vec3> Positions;
@@ -103,13 +164,34 @@ class Mesh : public IDrawable {
   std::vector<glm::vec3> Bitangents;
 #endif
   std::vector<unsigned int> Indices;
+  std::vector<glm::u8vec4> BoneIndices;
+  std::vector<glm::u8vec4> BoneWeights;
 
   void processScene(const aiScene *scene);
   void processMesh(const aiMesh *mesh);
+  void processBones(const aiMesh *mesh, unsigned int baseVertex,
+                    std::vector<glm::vec4> &weights);
+  void packBones(const std::vector<glm::vec4> &weights);
+  void createSkinningObjects(GLuint *boId);
+  GLuint getVertexArray(bool depth);
+  void calculateBounds();
+  void markChanged();
+  void unshare();
   void createBufferObjects();
+  void createVertexArrays(const GLuint *boId, GLuint firstVertex);
   void destroyBufferObjects();
-  json vecOfMeshDataToJSON(std::vector<MeshData> vec);
-  std::vector<MeshData> toVecOfMeshData(json j);
+  template <typename T>
+  static void uploadBuffer(GLuint buffer, const std::vector<T> &data);
+  template <typename T>
+  static void uploadRange(GLuint buffer, GLuint first,
+                          const std::vector<T> &data);
+  json vecOfMeshDataToJSON(const std::vector<MeshData> &vec);
+  std::vector<MeshData> toVecOfMeshData(const json &j);
+
+  friend class AssetStore;
+  friend class GltfFile;
+  friend class SceneReader;
+  friend class SceneArena;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Shader Permutations Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglPermutations.hpp"
+
+#include "./mglConventions.hpp"
+
+namespace mgl {
+
+///////////////////////////////////////////////////////////// ShaderPermutations
+
+ShaderPermutations::ShaderPermutations() {}
+
+ShaderPermutations::~ShaderPermutations() {
+  for (auto &i : Programs) {
+    delete i.second;
+  }
+}
+
+void ShaderPermutations::addShader(const GLenum shader_type,
+                                   const std::string &filename) {
+  Shaders.push_back({shader_type, filename});
+}
+
+void ShaderPermutations::addAttribute(const std::string &name,
+                                      const GLuint index) {
+  Attributes.push_back({name, index});
+}
+
+void ShaderPermutations::addUniform(const std::string &name) {
+  Uniforms.push_back(name);
+}
+
+void ShaderPermutations::addUniformBlock(const std::string &name,
+                                         const GLuint binding_point,
+                                         const PermutationKey feature) {
+  Ubos.push_back({name, binding_point, feature});
+}
+
+void ShaderPermutations::addFeature(const PermutationKey feature,
+                                    const std::string &define) {
+  Features[feature] = define;
+}
+
+PermutationKey ShaderPermutations::makeKey(int effect,
+                                           PermutationKey features) {
+  PermutationKey e = effect < 0 ? 0 : (static_cast<PermutationKey>(effect) + 1);
+  return (e & EFFECT_MASK) | (features << FEATURE_SHIFT);
+}
+
+int ShaderPermutations::getEffect(PermutationKey key) {
+  return static_cast<int>(key & EFFECT_MASK) - 1;
+}
+
+void ShaderPermutations::request(PermutationKey key) { submit(key); }
+
+bool ShaderPermutations::isReady(PermutationKey key) {
+  return submit(key)->isReady();
+}
+
+ShaderProgram *ShaderPermutations::get(PermutationKey key) {
+  ShaderProgram *program = submit(key);
+  program->finish();
+  return program;
+}
+
+ShaderProgram *ShaderPermutations::getReady(PermutationKey key) {
+  ShaderProgram *program = submit(key);
+  if (program->isFinished()) return program;
+  if (program->isReady()) {
+    program->finish();
+    return program;
+  }
+  PermutationKey fallback = key & ~EFFECT_MASK;
+  return fallback == key ? get(key) : get(fallback);
+}
+
+size_t ShaderPermutations::size() { return Programs.size(); }
+
+ShaderProgram *ShaderPermutations::submit(PermutationKey key) {
+  auto it = Programs.find(key);
+  if (it != Programs.end()) return it->second;
+
+  ShaderProgram *program = new ShaderProgram();
+  Programs[key] = program;
+  int effect = getEffect(key);
+  if (effect >= 0) {
+    program->addDefine(EFFECT_DEFINE, std::to_string(effect));
+  }
+  PermutationKey features = key >> FEATURE_SHIFT;
+  for (auto &f : Features) {
+    if (features & f.first) {
+      program->addDefine(f.second);
+    }
+  }
+
+  for (auto &s : Shaders) {
+    program->addShader(s.first, s.second);
+  }
+  for (auto &a : Attributes) {
+    program->addAttribute(a.first, a.second);
+  }
+  for (auto &u : Uniforms) {
+    program->addUniform(u);
+  }
+  for (auto &b : Ubos) {
+    if (b.feature == 0 || (features & b.feature)) {
+      program->addUniformBlock(b.name, b.binding_point);
+    }
+  }
+  program->submit();
+
+#ifdef DEBUG
+  std::cout << "Submitted permutation 0x" << std::hex << key << std::dec
+            << std::endl;
+#endif
+  return program;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Shader Permutations Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_PERMUTATIONS_HPP
+#define MGL_PERMUTATIONS_HPP
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mglShader.hpp"
+
+namespace mgl {
+
+class ShaderPermutations;
+
+typedef uint32_t PermutationKey;
+
+///////////////////////////////////////////////////////////// ShaderPermutations
+//
+// Describes a family of programs built from the same sources. A key holds an
+// effect number (compiled in as EFFECT) and a set of feature bits (each one
+// a #define); every key is compiled the first time it is asked for and kept.
+// Keys without an effect keep the runtime "effect" uniform, if the shader
+// declares one.
+//
+// Uniform blocks tied to a feature are only bound in the variants using it.
+//
+// request() starts compiling in the background; getReady() returns the
+// program once the driver is done and the generic variant until then.
+
+class ShaderPermutations {
+ public:
+  static const PermutationKey EFFECT_MASK = 0xff;
+  static const PermutationKey FEATURE_SHIFT = 8;
+
+  ShaderPermutations();
+  ~ShaderPermutations();
+
+  void addShader(const GLenum shader_type, const std::string &filename);
+  void addAttribute(const std::string &name, const GLuint index);
+  void addUniform(const std::string &name);
+  void addUniformBlock(const std::string &name, const GLuint binding_point,
+                       const PermutationKey feature = 0);
+  void addFeature(const PermutationKey feature, const std::string &define);
+
+  static PermutationKey makeKey(int effect, PermutationKey features = 0);
+  static int getEffect(PermutationKey key);
+
+  void request(PermutationKey key);
+  bool isReady(PermutationKey key);
+  ShaderProgram *get(PermutationKey key);
+  ShaderProgram *getReady(PermutationKey key);
+  size_t size();
+
+ private:
+  std::vector<std::pair<GLenum, std::string>> Shaders;
+  std::vector<std::pair<std::string, GLuint>> Attributes;
+  std::vector<std::string> Uniforms;
+  struct UboInfo {
+    std::string name;
+    GLuint binding_point;
+    PermutationKey feature;
+  };
+
+  std::vector<UboInfo> Ubos;
+  std::map<PermutationKey, std::string> Features;
+  std::map<PermutationKey, ShaderProgram *> Programs;
+
+  ShaderProgram *submit(PermutationKey key);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_PERMUTATIONS_HPP */
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Object Pool and Generational Handle Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_POOL_HPP
+#define MGL_POOL_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mgl {
+
+template <typename T>
+struct Handle;
+template <typename T>
+class Pool;
+
+///////////////////////////////////////////////////////////////////////// Handle
+//
+// Slot index plus the generation the slot had when the object was created.
+// Destroying the object bumps the generation, so stale handles resolve to
+// nullptr instead of to whatever reuses the slot.
+
+template <typename T>
+struct Handle {
+  static const uint32_t INVALID = 0xffffffff;
+
+  uint32_t index = INVALID;
+  uint32_t generation = 0;
+
+  bool isValid() const { return index != INVALID; }
+  bool operator==(const Handle &other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const Handle &other) const { return !(*this == other); }
+};
+
+/////////////////////////////////////////////////////////////////////////// Pool
+//
+// Typed pool storing objects in fixed-size chunks, so addresses stay stable
+// and neighbours are allocated next to each other. Freed slots are reused
+// last-in first-out; clear() destroys every live object but keeps the
+// chunks, so rebuilding a scene does not go back to the allocator.
+
+template <typename T>
+class Pool {
+ public:
+  static const uint32_t CHUNK_SIZE = 64;
+
+  Pool() : Count(0), Live(0) {}
+  ~Pool() { clear(); }
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  template <typename... Args>
+  Handle<T> create(Args &&...args) {
+    uint32_t index;
+    if (!Free.empty()) {
+      index = Free.back();
+      Free.pop_back();
+    } else {
+      if (Count % CHUNK_SIZE == 0) {
+        Chunks.emplace_back(new Slot[CHUNK_SIZE]);
+      }
+      index = Count++;
+    }
+    Slot &s = slot(index);
+    new (&s.storage) T(std::forward<Args>(args)...);
+    s.alive = true;
+    Live++;
+    Handle<T> h;
+    h.index = index;
+    h.generation = s.generation;
+    return h;
+  }
+
+  T *get(Handle<T> h) {
+    if (!isAlive(h)) return nullptr;
+    return object(slot(h.index));
+  }
+
+  bool isAlive(Handle<T> h) {
+    if (h.index >= Count) return false;
+    Slot &s = slot(h.index);
+    return s.alive && s.generation == h.generation;
+  }
+
+  void destroy(Handle<T> h) {
+    if (!isAlive(h)) return;
+    release(slot(h.index));
+    Free.push_back(h.index);
+  }
+
+  void clear() {
+    Free.clear();
+    for (uint32_t i = Count; i-- > 0;) {
+      Slot &s = slot(i);
+      if (s.alive) release(s);
+      Free.push_back(i);
+    }
+  }
+
+  template <typename F>
+  void forEach(F f) {
+    for (uint32_t i = 0; i < Count; i++) {
+      Slot &s = slot(i);
+      if (s.alive) f(*object(s));
+    }
+  }
+
+  // The handle of a live object of this pool, or an invalid one.
+  Handle<T> find(const T *object) {
+    const Slot *s = reinterpret_cast<const Slot *>(object);
+    std::less<const Slot *> before;
+    for (size_t c = 0; c < Chunks.size(); c++) {
+      const Slot *first = Chunks[c].get();
+      if (before(s, first) || !before(s, first + CHUNK_SIZE)) continue;
+      uint32_t index = static_cast<uint32_t>(c * CHUNK_SIZE + (s - first));
+      Handle<T> h;
+      if (index < Count && s->alive) {
+        h.index = index;
+        h.generation = s->generation;
+      }
+      return h;
+    }
+    return Handle<T>();
+  }
+
+  size_t size() { return Live; }
+
+  // Exchanges the objects of both pools; their addresses do not change.
+  void swap(Pool &other) {
+    Chunks.swap(other.Chunks);
+    Free.swap(other.Free);
+    std::swap(Count, other.Count);
+    std::swap(Live, other.Live);
+  }
+
+ private:
+  struct Slot {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    uint32_t generation = 0;
+    bool alive = false;
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> Chunks;
+  std::vector<uint32_t> Free;
+  uint32_t Count, Live;
+
+  Slot &slot(uint32_t index) {
+    return Chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+  }
+  static T *object(Slot &s) { return reinterpret_cast<T *>(&s.storage); }
+  void release(Slot &s) {
+    object(s)->~T();
+    s.alive = false;
+    s.generation++;
+    Live--;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_POOL_HPP */
@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU Query Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglQuery.hpp"
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////////// Query
+
+Query::Query(GLenum target) : Target(target), Current(0), Result(0) {
+  glGenQueries(RING_SIZE, QueryIds);
+  for (bool &p : Pending) p = false;
+}
+
+Query::~Query() { glDeleteQueries(RING_SIZE, QueryIds); }
+
+bool Query::isSupported(GLenum target) {
+  switch (target) {
+    case GL_FRAGMENT_SHADER_INVOCATIONS_ARB:
+    case GL_VERTEX_SHADER_INVOCATIONS_ARB:
+    case GL_PRIMITIVES_SUBMITTED_ARB:
+      return GLEW_VERSION_4_6 || GLEW_ARB_pipeline_statistics_query;
+    case GL_TIME_ELAPSED:
+      return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    default:
+      return true;
+  }
+}
+
+void Query::begin() { glBeginQuery(Target, QueryIds[Current]); }
+
+void Query::end() {
+  glEndQuery(Target);
+  Pending[Current] = true;
+  Current = (Current + 1) % RING_SIZE;
+}
+
+GLuint64 Query::getResult() {
+  for (int i = 0; i < RING_SIZE; i++) {
+    int slot = (Current + i) % RING_SIZE;  // oldest first
+    if (!Pending[slot]) continue;
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(QueryIds[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == GL_FALSE) break;
+    glGetQueryObjectui64v(QueryIds[slot], GL_QUERY_RESULT, &Result);
+    Pending[slot] = false;
+  }
+  return Result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
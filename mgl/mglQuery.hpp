@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GPU Query Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_QUERY_HPP
+#define MGL_QUERY_HPP
+
+#include <GL/glew.h>
+
+namespace mgl {
+
+class Query;
+
+////////////////////////////////////////////////////////////////////////// Query
+//
+// Wraps a small ring of query objects so a result can be read every frame
+// without waiting on the GPU: getResult() returns the newest finished one.
+// E.g. Query(GL_FRAGMENT_SHADER_INVOCATIONS_ARB) counts fragment shader runs.
+
+class Query {
+ public:
+  static const int RING_SIZE = 3;
+
+  explicit Query(GLenum target);
+  ~Query();
+
+  static bool isSupported(GLenum target);
+
+  void begin();
+  void end();
+  GLuint64 getResult();
+
+ private:
+  GLenum Target;
+  GLuint QueryIds[RING_SIZE];
+  bool Pending[RING_SIZE];
+  int Current;
+  GLuint64 Result;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_QUERY_HPP */
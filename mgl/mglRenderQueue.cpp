@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Render Queue Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglRenderQueue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "./mglConventions.hpp"
+
+namespace mgl {
+
+//////////////////////////////////////////////////////////////////// RenderQueue
+
+RenderQueue::RenderQueue()
+    : DepthShaders(nullptr),
+      Batch(nullptr),
+      DepthPrepass(false),
+      RecordTime(0.0),
+      ReplayTime(0.0) {}
+
+RenderQueue::~RenderQueue() {}
+
+void RenderQueue::clear() {
+  Items.clear();
+  Batch = nullptr;
+}
+
+void RenderQueue::push(PermutationKey key, Mesh *mesh,
+                       const glm::mat4 &modelMatrix) {
+  Items.push_back({key, mesh->isTransparent(), mesh, modelMatrix});
+}
+
+// Items built elsewhere, such as a list per range of a scene.
+void RenderQueue::append(const std::vector<RenderItem> &items) {
+  Items.insert(Items.end(), items.begin(), items.end());
+}
+
+// With a job system, runs of items are sorted in parallel and then merged
+// pairwise, each round of merges in parallel too. Both steps are stable, so
+// the order is the same as without jobs.
+void RenderQueue::sort(JobSystem *jobs) {
+  auto less = [](const RenderItem &a, const RenderItem &b) {
+    if (a.transparent != b.transparent) return b.transparent;
+    return a.key < b.key;
+  };
+  const size_t n = Items.size();
+  const size_t runs =
+      jobs == nullptr ? 1 : std::min<size_t>(jobs->getThreadCount(),
+                                             n / SORT_GRAIN);
+  if (runs <= 1) {
+    std::stable_sort(Items.begin(), Items.end(), less);
+    return;
+  }
+  const size_t step = (n + runs - 1) / runs;
+  jobs->parallelFor(0, runs, 1, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      std::stable_sort(Items.begin() + r * step,
+                       Items.begin() + std::min(n, (r + 1) * step), less);
+    }
+  });
+  Sorted.resize(n);
+  for (size_t width = step; width < n; width *= 2) {
+    const size_t pairs = (n + 2 * width - 1) / (2 * width);
+    jobs->parallelFor(0, pairs, 1, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+        const size_t lo = p * 2 * width;
+        const size_t mid = std::min(n, lo + width);
+        const size_t hi = std::min(n, lo + 2 * width);
+        std::merge(Items.begin() + lo, Items.begin() + mid,
+                   Items.begin() + mid, Items.begin() + hi,
+                   Sorted.begin() + lo, less);
+      }
+    });
+    Items.swap(Sorted);
+  }
+}
+
+// Must follow sort(), as the batch is indexed by item position.
+void RenderQueue::prepare(MatrixBatch *batch, const glm::mat4 &viewProjection) {
+  Models.resize(Items.size());
+  for (size_t i = 0; i < Items.size(); i++) {
+    Models[i] = Items[i].modelMatrix;
+  }
+  batch->compute(Models.data(), Models.size(), viewProjection);
+  Batch = batch;
+}
+
+const std::vector<RenderQueue::RenderItem> &RenderQueue::getItems() {
+  return Items;
+}
+
+void RenderQueue::setDepthShaders(ShaderPermutations *shaders) {
+  DepthShaders = shaders;
+}
+
+void RenderQueue::setDepthPrepass(bool enabled) { DepthPrepass = enabled; }
+
+bool RenderQueue::getDepthPrepass() { return DepthPrepass; }
+
+RenderQueue::Binding RenderQueue::makeBinding(ShaderProgram *program) {
+  return {program->ProgramId, program->getUniformLocation(EFFECT_HANDLE),
+          program->getUniformLocation(MODEL_MATRIX_HANDLE)};
+}
+
+// Programs may still be compiling and locations are resolved lazily, so
+// this stays on the GL thread. Depth variants only differ in features, so
+// their effect bits are dropped.
+void RenderQueue::resolve(ShaderPermutations *permutations, size_t depthEnd) {
+  Colors.resize(Items.size());
+  Depths.resize(depthEnd);
+  Binding binding = {0, -1, -1};
+  PermutationKey key = 0;
+  for (size_t i = 0; i < Items.size(); i++) {
+    if (i == 0 || Items[i].key != key) {
+      key = Items[i].key;
+      binding = makeBinding(permutations->getReady(key));
+    }
+    Colors[i] = binding;
+  }
+  for (size_t i = 0; i < depthEnd; i++) {
+    PermutationKey features = Items[i].key & ~ShaderPermutations::EFFECT_MASK;
+    if (i == 0 || features != key) {
+      key = features;
+      binding = makeBinding(DepthShaders->get(key));
+      binding.effect = -1;
+    }
+    Depths[i] = binding;
+  }
+}
+
+void RenderQueue::split(size_t begin, size_t end, Pass pass) {
+  for (size_t b = begin; b < end; b += RECORD_GRAIN) {
+    Chunks.push_back({b, std::min(end, b + RECORD_GRAIN), pass});
+  }
+}
+
+// Runs on any thread: only reads the items and writes its own list.
+void RenderQueue::record(CommandList &list, const Chunk &chunk) {
+  list.clear();
+  switch (chunk.pass) {
+    case BEGIN_DEPTH:
+      list.colorMask(false);
+      return;
+    case END_DEPTH:
+      list.colorMask(true);
+      list.depthFunc(GL_EQUAL);
+      list.depthMask(false);
+      return;
+    case END_PREPASS:
+      list.depthFunc(GL_LEQUAL);
+      list.depthMask(true);
+      return;
+    case FINISH:
+      list.bindVertexArray(0);
+      list.bindProgram(0);
+      return;
+    default:
+      break;
+  }
+  const bool depth = chunk.pass == DEPTH_PASS;
+  for (size_t i = chunk.begin; i < chunk.end; i++) {
+    const RenderItem &item = Items[i];
+    const Binding &binding = depth ? Depths[i] : Colors[i];
+    list.bindProgram(binding.program);
+    list.uniform(binding.effect, item.mesh->getEffect());
+    if (Batch != nullptr) {
+      Batch->record(list, i);
+    } else {
+      list.uniform(binding.modelMatrix, item.modelMatrix);
+    }
+    if ((item.key >> ShaderPermutations::FEATURE_SHIFT) & SKINNED_FEATURE) {
+      item.mesh->getSkin()->record(list);
+    }
+    if (depth) {
+      item.mesh->recordDepth(list);
+    } else {
+      item.mesh->record(list);
+    }
+  }
+}
+
+void RenderQueue::draw(ShaderPermutations *permutations, JobSystem *jobs) {
+  typedef std::chrono::steady_clock clock;
+  if (Batch != nullptr) Batch->upload();
+  clock::time_point start = clock::now();
+
+  size_t opaque = 0;
+  while (opaque < Items.size() && !Items[opaque].transparent) opaque++;
+  const bool prepass = DepthPrepass && DepthShaders != nullptr;
+  resolve(permutations, prepass ? opaque : 0);
+
+  Chunks.clear();
+  if (prepass) {
+    Chunks.push_back({0, 0, BEGIN_DEPTH});
+    split(0, opaque, DEPTH_PASS);
+    Chunks.push_back({0, 0, END_DEPTH});
+    split(0, opaque, COLOR_PASS);
+    Chunks.push_back({0, 0, END_PREPASS});
+    split(opaque, Items.size(), COLOR_PASS);
+  } else {
+    split(0, Items.size(), COLOR_PASS);
+  }
+  Chunks.push_back({0, 0, FINISH});
+  if (Lists.size() < Chunks.size()) Lists.resize(Chunks.size());
+
+  auto body = [this](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) record(Lists[i], Chunks[i]);
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, Chunks.size(), 1, body);
+  } else {
+    body(0, Chunks.size());
+  }
+  clock::time_point recorded = clock::now();
+
+  for (size_t i = 0; i < Chunks.size(); i++) Lists[i].execute();
+  clock::time_point replayed = clock::now();
+
+  RecordTime =
+      std::chrono::duration<double, std::milli>(recorded - start).count();
+  ReplayTime =
+      std::chrono::duration<double, std::milli>(replayed - recorded).count();
+}
+
+// Milliseconds of CPU time spent by the last draw(). Replay only measures
+// the submission to the driver, not the GPU work.
+double RenderQueue::getRecordTime() { return RecordTime; }
+
+double RenderQueue::getReplayTime() { return ReplayTime; }
+
+size_t RenderQueue::getCommandCount() {
+  size_t count = 0;
+  for (size_t i = 0; i < Chunks.size(); i++) count += Lists[i].size();
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Render Queue Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_RENDER_QUEUE_HPP
+#define MGL_RENDER_QUEUE_HPP
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mglCommandList.hpp"
+#include "mglJobs.hpp"
+#include "mglMatrixBatch.hpp"
+#include "mglMesh.hpp"
+#include "mglPermutations.hpp"
+#include "mglShader.hpp"
+
+namespace mgl {
+
+class RenderQueue;
+
+//////////////////////////////////////////////////////////////////// RenderQueue
+//
+// Collects the draws of a frame, sorts them by permutation key (opaque before
+// transparent) and binds each program only when the key changes. Variants
+// still being compiled are drawn with their generic program meanwhile.
+// After prepare(), derived matrices come from a MatrixBatch, one range per
+// item, instead of being recomputed per vertex. Everything up to draw() is
+// CPU-only and may run on a job thread; draw() uploads and issues GL calls.
+// draw() resolves programs on the GL thread, records the GL calls into
+// command lists (in parallel when given a job system) and replays them;
+// both phases are timed on the CPU.
+
+class RenderQueue {
+ public:
+  struct RenderItem {
+    PermutationKey key;
+    bool transparent;
+    Mesh *mesh;
+    glm::mat4 modelMatrix;
+  };
+
+  RenderQueue();
+  ~RenderQueue();
+
+  void clear();
+  void push(PermutationKey key, Mesh *mesh, const glm::mat4 &modelMatrix);
+  void append(const std::vector<RenderItem> &items);
+  void sort(JobSystem *jobs = nullptr);
+  void prepare(MatrixBatch *batch, const glm::mat4 &viewProjection);
+  void draw(ShaderPermutations *permutations, JobSystem *jobs = nullptr);
+
+  void setDepthShaders(ShaderPermutations *shaders);
+  void setDepthPrepass(bool enabled);
+  bool getDepthPrepass();
+
+  const std::vector<RenderItem> &getItems();
+  double getRecordTime();
+  double getReplayTime();
+  size_t getCommandCount();
+
+ private:
+  static const size_t RECORD_GRAIN = 256;
+  static const size_t SORT_GRAIN = 1024;
+
+  struct Binding {
+    GLuint program;
+    GLint effect;
+    GLint modelMatrix;
+  };
+
+  // A range of items drawn in one pass, or a change of pass state.
+  enum Pass { DEPTH_PASS, COLOR_PASS, BEGIN_DEPTH, END_DEPTH, END_PREPASS,
+              FINISH };
+  struct Chunk {
+    size_t begin, end;
+    Pass pass;
+  };
+
+  std::vector<RenderItem> Items;
+  std::vector<RenderItem> Sorted;  // merge target of sort()
+  std::vector<glm::mat4> Models;
+  std::vector<Binding> Colors, Depths;
+  std::vector<Chunk> Chunks;
+  std::vector<CommandList> Lists;
+  ShaderPermutations *DepthShaders;
+  MatrixBatch *Batch;
+  bool DepthPrepass;
+  double RecordTime, ReplayTime;
+
+  static Binding makeBinding(ShaderProgram *program);
+  void resolve(ShaderPermutations *permutations, size_t depthEnd);
+  void split(size_t begin, size_t end, Pass pass);
+  void record(CommandList &list, const Chunk &chunk);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_RENDER_QUEUE_HPP */
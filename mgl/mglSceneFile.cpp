@@ -0,0 +1,496 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Binary Scene File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglSceneFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "./mglCompression.hpp"
+#include "./mglHash.hpp"
+#include "./mglJobs.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////////// SceneFile
+
+static uint64_t align8(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+template <typename T>
+static void append(std::vector<unsigned char> &blob, const std::vector<T> &v) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(v.data());
+  blob.insert(blob.end(), bytes, bytes + v.size() * sizeof(T));
+}
+
+static uint64_t expectedBlobSize(const SceneFile::MeshRecord &m) {
+  uint64_t vertex = sizeof(glm::vec3);
+  if (m.flags & SceneFile::NORMALS) vertex += sizeof(glm::vec3);
+  if (m.flags & SceneFile::TEXCOORDS) vertex += sizeof(glm::vec2);
+  if (m.flags & SceneFile::TANGENTS) vertex += 2 * sizeof(glm::vec3);
+  return uint64_t(m.subMeshCount) * sizeof(Mesh::MeshData) +
+         uint64_t(m.vertexCount) * vertex +
+         uint64_t(m.indexCount) * sizeof(unsigned int);
+}
+
+// Offsets are left to the caller.
+SceneFile::MeshRecord SceneFile::describe(Mesh &mesh, bool embed) {
+  MeshRecord m = {mesh.getContentHash(), 0, 0, 0, 0, 0,
+                  embed ? uint32_t(EMBEDDED) : 0};
+  m.subMeshCount = static_cast<uint32_t>(mesh.getMeshData().size());
+  m.vertexCount = static_cast<uint32_t>(mesh.getPositions().size());
+  m.indexCount = static_cast<uint32_t>(mesh.getIndices().size());
+  if (mesh.hasNormals()) m.flags |= NORMALS;
+  if (mesh.hasTexcoords()) m.flags |= TEXCOORDS;
+  if (mesh.hasTangentsAndBitangents() &&
+      mesh.getBitangents().size() == m.vertexCount) {
+    m.flags |= TANGENTS;
+  }
+  if (embed) m.blobSize = expectedBlobSize(m);
+  return m;
+}
+
+void SceneFile::writeBlob(Mesh &mesh, const MeshRecord &m,
+                          std::vector<unsigned char> &out) {
+  out.reserve(out.size() + static_cast<size_t>(expectedBlobSize(m)));
+  append(out, mesh.getMeshData());
+  append(out, mesh.getPositions());
+  if (m.flags & NORMALS) append(out, mesh.getNormals());
+  if (m.flags & TEXCOORDS) append(out, mesh.getTexcoords());
+  if (m.flags & TANGENTS) {
+    append(out, mesh.getTangents());
+    append(out, mesh.getBitangents());
+  }
+  append(out, mesh.getIndices());
+}
+
+// The blob must hold at least blobSize bytes.
+bool SceneFile::checkBlob(const MeshRecord &m, const unsigned char *blob) {
+  if (m.blobSize != expectedBlobSize(m)) return false;
+  const Mesh::MeshData *sub = reinterpret_cast<const Mesh::MeshData *>(blob);
+  for (uint32_t s = 0; s < m.subMeshCount; s++) {
+    if (uint64_t(sub[s].baseIndex) + sub[s].nIndices > m.indexCount ||
+        sub[s].baseVertex > m.vertexCount) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Chunks that do not get smaller are stored as they are.
+static void packChunk(const unsigned char *src, SceneFile::ChunkRecord &chunk,
+                      std::vector<unsigned char> &packed) {
+  packed.resize(chunk.size);
+  size_t size = compressBlock(src, chunk.size, packed.data(), chunk.size - 1);
+  if (size == 0) {
+    std::memcpy(packed.data(), src, chunk.size);
+    size = chunk.size;
+  }
+  packed.resize(size);
+  chunk.packedSize = static_cast<uint32_t>(size);
+  chunk.checksum = checksum64(packed.data(), size);
+}
+
+// Parents are written before their children (breadth first).
+bool SceneFile::save(SceneGraph &scene, const std::string &path, bool embed,
+                     bool compress, JobSystem *jobs) {
+  std::vector<NodeRecord> nodes;
+  std::vector<TransformRecord> transforms;
+  std::vector<MeshRecord> meshes;
+  std::vector<Mesh *> sources;
+  std::map<uint64_t, int32_t> hashes;
+
+  std::vector<std::pair<Node *, int32_t>> queue;
+  queue.push_back({&scene.getRoot(), -1});
+  for (size_t i = 0; i < queue.size(); i++) {
+    Node *node = queue[i].first;
+    NodeRecord record = {queue[i].second, -1, -1, 0, 0, 0};
+
+    Transform *t = node->getLocalTransform();
+    if (t != nullptr) {
+      glm::vec3 translate = t->getTranslate();
+      glm::quat rotation = t->getRotation();
+      glm::vec3 scale = t->getScale();
+      record.transform = static_cast<int32_t>(transforms.size());
+      transforms.push_back({{translate.x, translate.y, translate.z},
+                            {rotation.x, rotation.y, rotation.z, rotation.w},
+                            {scale.x, scale.y, scale.z}});
+    }
+
+    Mesh *mesh = node->getMesh();
+    if (mesh != nullptr) {
+      uint64_t hash = mesh->getContentHash();
+      auto found = hashes.find(hash);
+      if (found == hashes.end()) {
+        found = hashes.insert({hash, static_cast<int32_t>(meshes.size())}).first;
+        meshes.push_back(describe(*mesh, embed));
+        sources.push_back(mesh);
+      }
+      record.mesh = found->second;
+      record.effect = mesh->getEffect();
+      if (mesh->isTransparent()) record.flags |= TRANSPARENT;
+    }
+    nodes.push_back(record);
+
+    for (Node *child : node->getChildren()) {
+      queue.push_back({child, static_cast<int32_t>(i)});
+    }
+  }
+
+  Header header = {MAGIC, VERSION, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  header.nodeCount = static_cast<uint32_t>(nodes.size());
+  header.transformCount = static_cast<uint32_t>(transforms.size());
+  header.meshCount = static_cast<uint32_t>(meshes.size());
+  header.nodeOffset = align8(sizeof(Header));
+  header.transformOffset =
+      align8(header.nodeOffset + nodes.size() * sizeof(NodeRecord));
+  header.meshOffset = align8(header.transformOffset +
+                             transforms.size() * sizeof(TransformRecord));
+  header.chunkOffset =
+      align8(header.meshOffset + meshes.size() * sizeof(MeshRecord));
+
+  std::vector<std::vector<unsigned char>> blobs(meshes.size());
+  for (size_t i = 0; embed && i < meshes.size(); i++) {
+    writeBlob(*sources[i], meshes[i], blobs[i]);
+    meshes[i].blobSize = blobs[i].size();
+  }
+
+  std::vector<ChunkRecord> chunks;
+  std::vector<std::pair<size_t, size_t>> chunkSources;  // blob, start
+  for (size_t i = 0; embed && compress && i < meshes.size(); i++) {
+    meshes[i].flags |= COMPRESSED;
+    meshes[i].blobOffset = chunks.size();
+    for (size_t start = 0; start < blobs[i].size();
+         start += COMPRESSION_CHUNK) {
+      size_t size = std::min(COMPRESSION_CHUNK, blobs[i].size() - start);
+      chunks.push_back({0, 0, 0, static_cast<uint32_t>(size)});
+      chunkSources.push_back({i, start});
+    }
+  }
+  std::vector<std::vector<unsigned char>> packed(chunks.size());
+  auto packChunks = [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) {
+      const std::vector<unsigned char> &blob = blobs[chunkSources[c].first];
+      packChunk(blob.data() + chunkSources[c].second, chunks[c], packed[c]);
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, chunks.size(), 1, packChunks);
+  } else {
+    packChunks(0, chunks.size());
+  }
+  header.chunkCount = static_cast<uint32_t>(chunks.size());
+
+  uint64_t offset =
+      align8(header.chunkOffset + chunks.size() * sizeof(ChunkRecord));
+  if (embed && compress) {
+    for (ChunkRecord &chunk : chunks) {
+      chunk.offset = offset;
+      offset += chunk.packedSize;
+    }
+    offset = align8(offset);
+  } else {
+    for (size_t i = 0; embed && i < meshes.size(); i++) {
+      meshes[i].blobOffset = offset;
+      offset = align8(offset + blobs[i].size());
+    }
+  }
+  header.fileSize = offset;
+
+  std::vector<unsigned char> out(static_cast<size_t>(offset), 0);
+  std::memcpy(&out[0], &header, sizeof(Header));
+  if (!nodes.empty()) {
+    std::memcpy(&out[header.nodeOffset], nodes.data(),
+                nodes.size() * sizeof(NodeRecord));
+  }
+  if (!transforms.empty()) {
+    std::memcpy(&out[header.transformOffset], transforms.data(),
+                transforms.size() * sizeof(TransformRecord));
+  }
+  if (!meshes.empty()) {
+    std::memcpy(&out[header.meshOffset], meshes.data(),
+                meshes.size() * sizeof(MeshRecord));
+  }
+  if (!chunks.empty()) {
+    std::memcpy(&out[header.chunkOffset], chunks.data(),
+                chunks.size() * sizeof(ChunkRecord));
+  }
+  for (size_t c = 0; c < chunks.size(); c++) {
+    std::memcpy(&out[chunks[c].offset], packed[c].data(), packed[c].size());
+  }
+  for (size_t i = 0; !compress && i < blobs.size(); i++) {
+    if (!blobs[i].empty()) {
+      std::memcpy(&out[meshes[i].blobOffset], blobs[i].data(), blobs[i].size());
+    }
+  }
+
+  std::ofstream o(path, std::ios::binary);
+  o.write(reinterpret_cast<const char *>(out.data()), out.size());
+  if (!o.good()) {
+    std::cerr << "WARNING: could not write scene file " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool inRange(uint64_t offset, uint64_t count, uint64_t size,
+                    uint64_t file) {
+  return offset % 8 == 0 && offset <= file && count <= (file - offset) / size;
+}
+
+// Checks every offset, count and index, so that loading can trust the
+// tables without further tests.
+bool SceneFile::validate(const MappedFile &file) {
+  const uint64_t size = file.size();
+  if (size < sizeof(Header)) return false;
+  const Header &h = *reinterpret_cast<const Header *>(file.data());
+  if (h.magic != MAGIC || h.version != VERSION || h.fileSize != size ||
+      h.nodeCount == 0 ||
+      !inRange(h.nodeOffset, h.nodeCount, sizeof(NodeRecord), size) ||
+      !inRange(h.transformOffset, h.transformCount, sizeof(TransformRecord),
+               size) ||
+      !inRange(h.meshOffset, h.meshCount, sizeof(MeshRecord), size) ||
+      !inRange(h.chunkOffset, h.chunkCount, sizeof(ChunkRecord), size)) {
+    return false;
+  }
+  const NodeRecord *nodes =
+      reinterpret_cast<const NodeRecord *>(file.data() + h.nodeOffset);
+  for (uint32_t i = 0; i < h.nodeCount; i++) {
+    const NodeRecord &n = nodes[i];
+    bool parent = i == 0 ? n.parent == -1
+                         : n.parent >= 0 && uint32_t(n.parent) < i;
+    if (!parent || n.transform < -1 || n.mesh < -1 ||
+        (n.transform >= 0 && uint32_t(n.transform) >= h.transformCount) ||
+        (n.mesh >= 0 && uint32_t(n.mesh) >= h.meshCount)) {
+      return false;
+    }
+  }
+  const MeshRecord *meshes =
+      reinterpret_cast<const MeshRecord *>(file.data() + h.meshOffset);
+  const ChunkRecord *chunks =
+      reinterpret_cast<const ChunkRecord *>(file.data() + h.chunkOffset);
+  for (uint32_t i = 0; i < h.chunkCount; i++) {
+    const ChunkRecord &c = chunks[i];
+    if (c.size == 0 || c.size > COMPRESSION_CHUNK || c.packedSize > c.size ||
+        c.offset > size || c.packedSize > size - c.offset) {
+      return false;
+    }
+  }
+  // The blobs of compressed meshes are checked once unpacked.
+  for (uint32_t i = 0; i < h.meshCount; i++) {
+    const MeshRecord &m = meshes[i];
+    if (!(m.flags & EMBEDDED)) continue;
+    if (m.flags & COMPRESSED) {
+      uint64_t count = (m.blobSize + COMPRESSION_CHUNK - 1) / COMPRESSION_CHUNK;
+      if (m.blobSize != expectedBlobSize(m) || m.blobOffset > h.chunkCount ||
+          count > h.chunkCount - m.blobOffset) {
+        return false;
+      }
+      for (uint64_t k = 0; k < count; k++) {
+        uint64_t rest = m.blobSize - k * COMPRESSION_CHUNK;
+        if (chunks[m.blobOffset + k].size !=
+            std::min<uint64_t>(rest, COMPRESSION_CHUNK)) {
+          return false;
+        }
+      }
+      continue;
+    }
+    if (!inRange(m.blobOffset, m.blobSize, 1, size) ||
+        !checkBlob(m, file.data() + m.blobOffset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes the compressed blobs, given their offsets into unpacked. Chunks
+// are verified against their checksums and decoded concurrently.
+bool SceneFile::unpack(const MappedFile &file, JobSystem *jobs,
+                       std::vector<unsigned char> &unpacked,
+                       std::vector<uint64_t> &offsets) {
+  const Header &h = *reinterpret_cast<const Header *>(file.data());
+  const MeshRecord *meshes =
+      reinterpret_cast<const MeshRecord *>(file.data() + h.meshOffset);
+  const ChunkRecord *chunks =
+      reinterpret_cast<const ChunkRecord *>(file.data() + h.chunkOffset);
+
+  std::vector<std::pair<uint64_t, uint64_t>> work;  // chunk, destination
+  uint64_t total = 0;
+  offsets.assign(h.meshCount, 0);
+  for (uint32_t i = 0; i < h.meshCount; i++) {
+    const MeshRecord &m = meshes[i];
+    if ((m.flags & (EMBEDDED | COMPRESSED)) != (EMBEDDED | COMPRESSED)) {
+      continue;
+    }
+    offsets[i] = total;
+    for (uint64_t start = 0; start < m.blobSize; start += COMPRESSION_CHUNK) {
+      work.push_back({m.blobOffset + start / COMPRESSION_CHUNK, total + start});
+    }
+    total = align8(total + m.blobSize);
+  }
+  if (work.empty()) return true;
+  unpacked.resize(static_cast<size_t>(total));
+
+  std::atomic<bool> damaged(false);
+  auto decode = [&](size_t begin, size_t end) {
+    for (size_t w = begin; w < end && !damaged; w++) {
+      const ChunkRecord &c = chunks[work[w].first];
+      const unsigned char *src = file.data() + c.offset;
+      unsigned char *dst = unpacked.data() + work[w].second;
+      bool ok = checksum64(src, c.packedSize) == c.checksum;
+      if (ok && c.packedSize == c.size) {
+        std::memcpy(dst, src, c.size);
+      } else if (ok) {
+        ok = decompressBlock(src, c.packedSize, dst, c.size);
+      }
+      if (!ok) damaged = true;
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, work.size(), 1, decode);
+  } else {
+    decode(0, work.size());
+  }
+  if (damaged) return false;
+
+  for (uint32_t i = 0; i < h.meshCount; i++) {
+    if ((meshes[i].flags & COMPRESSED) && (meshes[i].flags & EMBEDDED) &&
+        !checkBlob(meshes[i], unpacked.data() + offsets[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SceneFile::readBlob(const unsigned char *blob, const MeshRecord &m,
+                         Mesh &mesh) {
+  Mesh::ArrayView view = {};
+  view.meshes = reinterpret_cast<const Mesh::MeshData *>(blob);
+  view.meshCount = m.subMeshCount;
+  blob += m.subMeshCount * sizeof(Mesh::MeshData);
+  view.vertexCount = m.vertexCount;
+  view.positions = reinterpret_cast<const glm::vec3 *>(blob);
+  blob += m.vertexCount * sizeof(glm::vec3);
+  if (m.flags & NORMALS) {
+    view.normals = reinterpret_cast<const glm::vec3 *>(blob);
+    blob += m.vertexCount * sizeof(glm::vec3);
+  }
+  if (m.flags & TEXCOORDS) {
+    view.texcoords = reinterpret_cast<const glm::vec2 *>(blob);
+    blob += m.vertexCount * sizeof(glm::vec2);
+  }
+  if (m.flags & TANGENTS) {
+    view.tangents = reinterpret_cast<const glm::vec3 *>(blob);
+    blob += m.vertexCount * sizeof(glm::vec3);
+    view.bitangents = reinterpret_cast<const glm::vec3 *>(blob);
+    blob += m.vertexCount * sizeof(glm::vec3);
+  }
+  view.indices = reinterpret_cast<const unsigned int *>(blob);
+  view.indexCount = m.indexCount;
+  mesh.assign(view);
+}
+
+// Replaces the scene. Meshes neither embedded nor resolved are left out,
+// keeping their nodes. Embedded meshes get their GL objects in bulk once
+// every node is in place.
+bool SceneFile::load(SceneGraph &scene, const std::string &path,
+                     const MeshResolver &resolver, JobSystem *jobs) {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  MappedFile file;
+  if (!file.open(path)) {
+    std::cerr << "WARNING: could not open scene file " << path << std::endl;
+    return false;
+  }
+  std::vector<unsigned char> unpacked;
+  std::vector<uint64_t> unpackedOffsets;
+  if (!validate(file) || !unpack(file, jobs, unpacked, unpackedOffsets)) {
+    std::cerr << "WARNING: invalid scene file " << path << std::endl;
+    return false;
+  }
+  const unsigned char *data = file.data();
+  const Header &h = *reinterpret_cast<const Header *>(data);
+  const NodeRecord *nodes =
+      reinterpret_cast<const NodeRecord *>(data + h.nodeOffset);
+  const TransformRecord *transforms =
+      reinterpret_cast<const TransformRecord *>(data + h.transformOffset);
+  const MeshRecord *meshes =
+      reinterpret_cast<const MeshRecord *>(data + h.meshOffset);
+
+  scene.unload();
+  SceneArena &arena = scene.getArena();
+  std::vector<Node *> created(h.nodeCount);
+  std::vector<Mesh *> embedded;
+  for (uint32_t i = 0; i < h.nodeCount; i++) {
+    const NodeRecord &r = nodes[i];
+    Node *node = arena.get(arena.createNode());
+
+    if (r.transform >= 0) {
+      const TransformRecord &t = transforms[r.transform];
+      Transform *transform = arena.get(arena.createTransform());
+      transform->setTranslate(
+          glm::vec3(t.translate[0], t.translate[1], t.translate[2]));
+      transform->setRotation(glm::quat(t.rotation[3], t.rotation[0],
+                                       t.rotation[1], t.rotation[2]));
+      transform->setScale(glm::vec3(t.scale[0], t.scale[1], t.scale[2]));
+      node->setTransform(transform);
+    }
+
+    if (r.mesh >= 0) {
+      const MeshRecord &m = meshes[r.mesh];
+      MeshHandle handle = arena.createMesh();
+      Mesh *mesh = arena.get(handle);
+      bool found = true;
+      if (m.flags & EMBEDDED) {
+        const unsigned char *blob =
+            (m.flags & COMPRESSED) ? unpacked.data() + unpackedOffsets[r.mesh]
+                                   : data + m.blobOffset;
+        readBlob(blob, m, *mesh);
+        embedded.push_back(mesh);
+      } else {
+        found = resolver && resolver(m.hash, *mesh);
+      }
+      if (found) {
+        mesh->setEffect(r.effect);
+        mesh->setTransparent((r.flags & TRANSPARENT) != 0);
+        node->setMesh(mesh);
+      } else {
+        std::cerr << "WARNING: mesh " << std::hex << m.hash << std::dec
+                  << " not found." << std::endl;
+        arena.destroy(handle);
+      }
+    }
+
+    if (r.parent >= 0) node->setParent(created[r.parent]);
+    created[i] = node;
+  }
+  scene.setRoot(created[0]);
+  clock::time_point read = clock::now();
+  Mesh::createBufferObjects(embedded);
+  clock::time_point uploaded = clock::now();
+  scene.update();
+  clock::time_point updated = clock::now();
+
+  SceneGraph::LoadTimes times;
+  times.read = std::chrono::duration<double, std::milli>(read - start).count();
+  times.upload =
+      std::chrono::duration<double, std::milli>(uploaded - read).count();
+  times.update =
+      std::chrono::duration<double, std::milli>(updated - uploaded).count();
+  scene.setLoadTimes(times);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
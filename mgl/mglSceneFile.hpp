@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Binary Scene File Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SCENE_FILE_HPP
+#define MGL_SCENE_FILE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "mglMappedFile.hpp"
+
+namespace mgl {
+
+class SceneFile;
+class SceneGraph;
+class Mesh;
+class JobSystem;
+
+////////////////////////////////////////////////////////////////////// SceneFile
+//
+// Compact binary scene container, loaded by mapping the file and reading
+// its tables in place. After the header come a node table (parent first,
+// parents always before their children), a transform table and a mesh
+// table. Mesh entries are keyed by the content hash of their geometry, so a
+// mesh used by several nodes is stored once; its vertex data is embedded as
+// a blob, or left out and found through a resolver when loading. Every
+// section starts on an 8 byte boundary and all values are little endian.
+// JSON (SceneGraph::save) remains the readable debug and export format.
+//
+// Embedded blobs can be compressed. They are then split in chunks of
+// COMPRESSION_CHUNK bytes, each compressed on its own and listed with its
+// checksum in a chunk table; the mesh record points to its first chunk
+// instead of the blob. Chunks are checked and decoded in parallel, each
+// straight into its place in the unpacked blob, before the scene changes.
+
+class SceneFile {
+ public:
+  static const uint32_t MAGIC = 0x534c474d;  // "MGLS"
+  static const uint32_t VERSION = 2;
+
+  enum MeshFlags : uint32_t {
+    EMBEDDED = 1,
+    NORMALS = 2,
+    TEXCOORDS = 4,
+    TANGENTS = 8,
+    COMPRESSED = 16
+  };
+  enum NodeFlags : uint32_t { TRANSPARENT = 1 };
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t transformCount;
+    uint32_t meshCount;
+    uint32_t chunkCount;
+    uint64_t nodeOffset;
+    uint64_t transformOffset;
+    uint64_t meshOffset;
+    uint64_t chunkOffset;
+    uint64_t fileSize;
+  };
+
+  struct NodeRecord {
+    int32_t parent;     // -1 for the root
+    int32_t transform;  // -1 without a local transform
+    int32_t mesh;       // -1 without a mesh
+    int32_t effect;
+    uint32_t flags;
+    uint32_t reserved;
+  };
+
+  struct TransformRecord {
+    float translate[3];
+    float rotation[4];  // x, y, z, w
+    float scale[3];
+  };
+
+  // The blob holds the submeshes, positions, optional normals, texcoords,
+  // tangents and bitangents, and the indices, each 4 byte aligned. When
+  // COMPRESSED, blobOffset is the index of the first chunk of the blob and
+  // blobSize its unpacked size.
+  struct MeshRecord {
+    uint64_t hash;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+    uint32_t subMeshCount;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t flags;
+  };
+
+  // A chunk stored as is has a packed size equal to its size. The checksum
+  // is the checksum64 of the packed bytes.
+  struct ChunkRecord {
+    uint64_t offset;
+    uint64_t checksum;
+    uint32_t packedSize;
+    uint32_t size;
+  };
+
+  // Fills the mesh with the geometry of that hash; false when unknown.
+  typedef std::function<bool(uint64_t hash, Mesh &mesh)> MeshResolver;
+
+  static bool save(SceneGraph &scene, const std::string &path,
+                   bool embed = true, bool compress = false,
+                   JobSystem *jobs = nullptr);
+  static bool load(SceneGraph &scene, const std::string &path,
+                   const MeshResolver &resolver = MeshResolver(),
+                   JobSystem *jobs = nullptr);
+
+  // Mesh blobs, also used by SceneJournal. The record from describe() has
+  // its blob size set when embedding, but no offset.
+  static MeshRecord describe(Mesh &mesh, bool embed);
+  static void writeBlob(Mesh &mesh, const MeshRecord &record,
+                        std::vector<unsigned char> &out);
+  static bool checkBlob(const MeshRecord &record, const unsigned char *blob);
+  static void readBlob(const unsigned char *blob, const MeshRecord &record,
+                       Mesh &mesh);
+
+ private:
+  static bool validate(const MappedFile &file);
+  static bool unpack(const MappedFile &file, JobSystem *jobs,
+                     std::vector<unsigned char> &unpacked,
+                     std::vector<uint64_t> &offsets);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_SCENE_FILE_HPP */
@@ -0,0 +1,443 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scene Journal Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglSceneJournal.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "./mglHash.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+////////////////////////////////////////////////////////////////// SceneJournal
+
+static size_t padding(size_t size) { return (8 - (size & 7)) & 7; }
+
+static Mesh::ArrayView arraysOf(Mesh &mesh) {
+  Mesh::ArrayView view = {};
+  view.meshes = mesh.getMeshData().data();
+  view.meshCount = mesh.getMeshData().size();
+  view.positions = mesh.getPositions().data();
+  view.vertexCount = mesh.getPositions().size();
+  if (mesh.hasNormals()) view.normals = mesh.getNormals().data();
+  if (mesh.hasTexcoords()) view.texcoords = mesh.getTexcoords().data();
+  if (mesh.hasTangentsAndBitangents()) {
+    view.tangents = mesh.getTangents().data();
+    view.bitangents = mesh.getBitangents().data();
+  }
+  view.indices = mesh.getIndices().data();
+  view.indexCount = mesh.getIndices().size();
+  return view;
+}
+
+SceneJournal::SceneJournal(SceneGraph &scene, const std::string &path)
+    : Scene(scene),
+      BasePath(path),
+      JournalPath(path + ".journal"),
+      HasBase(false),
+      BaseSize(0),
+      BaseHash(0),
+      JournalSize(0),
+      CompactionRatio(0.5),
+      LastEntryCount(0),
+      NextIndex(0) {}
+
+void SceneJournal::setCompactionRatio(double ratio) {
+  CompactionRatio = ratio;
+}
+
+uint64_t SceneJournal::getJournalSize() { return JournalSize; }
+
+size_t SceneJournal::getLastEntryCount() { return LastEntryCount; }
+
+// Same order as SceneFile::save, and as the nodes SceneFile::load creates.
+std::vector<Node *> SceneJournal::breadthFirst() {
+  std::vector<Node *> nodes;
+  nodes.push_back(&Scene.getRoot());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    for (Node *child : nodes[i]->getChildren()) {
+      nodes.push_back(child);
+    }
+  }
+  return nodes;
+}
+
+// Numbers the nodes by position, null entries being removed nodes.
+void SceneJournal::index(const std::vector<Node *> &nodes) {
+  Indices.clear();
+  NodeMeshes.clear();
+  Users.clear();
+  Hashes.clear();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i] == nullptr) continue;
+    Indices[nodes[i]] = static_cast<uint32_t>(i);
+    track(nodes[i], nodes[i]->getMesh());
+    if (nodes[i]->getMesh() != nullptr) {
+      Hashes.insert(nodes[i]->getMesh()->getContentHash());
+    }
+  }
+  NextIndex = static_cast<uint32_t>(nodes.size());
+}
+
+void SceneJournal::track(Node *node, Mesh *mesh) {
+  auto found = NodeMeshes.find(node);
+  if (found != NodeMeshes.end()) {
+    if (found->second == mesh) return;
+    auto range = Users.equal_range(found->second);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == node) {
+        Users.erase(it);
+        break;
+      }
+    }
+  }
+  NodeMeshes[node] = mesh;
+  if (mesh != nullptr) Users.insert({mesh, node});
+}
+
+// The node may be destroyed already: only its address is used.
+void SceneJournal::forget(Node *node) {
+  track(node, nullptr);
+  NodeMeshes.erase(node);
+  Indices.erase(node);
+}
+
+// New parents are written first, so that replay always finds them.
+void SceneJournal::write(Node *node, Batch &batch) {
+  if (!batch.written.insert(node).second) return;
+  int32_t parent = -1;
+  if (node->parent != nullptr) {
+    if (Indices.find(node->parent) == Indices.end()) {
+      write(node->parent, batch);
+    }
+    parent = static_cast<int32_t>(Indices[node->parent]);
+  }
+  auto found = Indices.find(node);
+  if (found == Indices.end()) {
+    found = Indices.insert({node, NextIndex++}).first;
+  }
+
+  Entry e = {};
+  e.op = NODE;
+  e.node = found->second;
+  e.parent = parent;
+  Transform *t = node->getLocalTransform();
+  if (t != nullptr) {
+    glm::vec3 translate = t->getTranslate();
+    glm::quat rotation = t->getRotation();
+    glm::vec3 scale = t->getScale();
+    e.flags |= HAS_TRANSFORM;
+    e.transform = {{translate.x, translate.y, translate.z},
+                   {rotation.x, rotation.y, rotation.z, rotation.w},
+                   {scale.x, scale.y, scale.z}};
+  }
+  Mesh *mesh = node->getMesh();
+  if (mesh != nullptr) {
+    bool embed = Hashes.insert(mesh->getContentHash()).second;
+    e.flags |= HAS_MESH;
+    e.effect = mesh->getEffect();
+    if (mesh->isTransparent()) e.flags |= TRANSPARENT;
+    e.mesh = SceneFile::describe(*mesh, embed);
+    if (embed) {
+      e.mesh.blobOffset = batch.blobs.size();
+      SceneFile::writeBlob(*mesh, e.mesh, batch.blobs);
+      batch.blobs.resize(batch.blobs.size() + padding(batch.blobs.size()), 0);
+    }
+  }
+  track(node, mesh);
+  batch.entries.push_back(e);
+}
+
+bool SceneJournal::append(const Batch &batch) {
+  const size_t entries = batch.entries.size() * sizeof(Entry);
+  BatchHeader header = {BATCH_MAGIC,
+                        static_cast<uint32_t>(batch.entries.size()),
+                        entries + batch.blobs.size(), 0};
+  header.checksum = hash64(batch.blobs.data(), batch.blobs.size(),
+                           hash64(batch.entries.data(), entries));
+
+  std::ofstream o(JournalPath, std::ios::binary | std::ios::app);
+  o.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  o.write(reinterpret_cast<const char *>(batch.entries.data()), entries);
+  o.write(reinterpret_cast<const char *>(batch.blobs.data()),
+          batch.blobs.size());
+  if (!o.good()) {
+    std::cerr << "WARNING: could not append to " << JournalPath << std::endl;
+    return false;
+  }
+  JournalSize += sizeof(header) + header.payloadSize;
+  return true;
+}
+
+// Starts an empty journal for the current base file.
+bool SceneJournal::reset() {
+  MappedFile base;
+  if (!base.open(BasePath)) {
+    std::cerr << "WARNING: could not open scene file " << BasePath
+              << std::endl;
+    return false;
+  }
+  BaseSize = base.size();
+  BaseHash = hash64(base.data(), base.size());
+  Header header = {MAGIC, VERSION, BaseSize, BaseHash};
+  std::ofstream o(JournalPath, std::ios::binary | std::ios::trunc);
+  o.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  if (!o.good()) {
+    std::cerr << "WARNING: could not write " << JournalPath << std::endl;
+    return false;
+  }
+  JournalSize = sizeof(header);
+  HasBase = true;
+  return true;
+}
+
+bool SceneJournal::compact() {
+  if (!SceneFile::save(Scene, BasePath)) return false;
+  Scene.getArena().discardChanges();
+  index(breadthFirst());
+  LastEntryCount = 0;
+  return reset();
+}
+
+// The first save writes the base file.
+bool SceneJournal::save() {
+  if (!HasBase) return compact();
+  std::vector<Node *> changed, destroyed;
+  std::vector<Mesh *> meshes;
+  Scene.getArena().takeChanges(changed, meshes, destroyed);
+
+  Batch batch;
+  for (Node *node : destroyed) {
+    auto found = Indices.find(node);
+    if (found == Indices.end()) continue;
+    Entry e = {};
+    e.op = REMOVE;
+    e.node = found->second;
+    e.parent = -1;
+    batch.entries.push_back(e);
+    forget(node);
+  }
+  for (Node *node : changed) {
+    write(node, batch);
+  }
+  for (Mesh *mesh : meshes) {
+    auto range = Users.equal_range(mesh);
+    std::vector<Node *> users;
+    for (auto it = range.first; it != range.second; ++it) {
+      users.push_back(it->second);
+    }
+    for (Node *node : users) {
+      write(node, batch);
+    }
+  }
+  LastEntryCount = batch.entries.size();
+  if (batch.entries.empty()) return true;
+  if (!append(batch)) return false;
+  if (JournalSize > CompactionRatio * BaseSize) return compact();
+  return true;
+}
+
+// Destroys a mesh replaced during replay once no node uses it any more.
+void SceneJournal::drop(Mesh *mesh,
+                        std::unordered_map<uint64_t, Mesh *> &meshes,
+                        std::vector<Mesh *> &uploads) {
+  if (mesh == nullptr || Users.count(mesh) != 0) return;
+  auto found = meshes.find(mesh->getContentHash());
+  if (found != meshes.end() && found->second == mesh) meshes.erase(found);
+  uploads.erase(std::remove(uploads.begin(), uploads.end(), mesh),
+                uploads.end());
+  SceneArena &arena = Scene.getArena();
+  arena.destroy(arena.find(mesh));
+}
+
+// A parent of -1 detaches any node but the root, and an entry without a
+// transform or mesh takes away the one the node had.
+bool SceneJournal::replay(const unsigned char *payload,
+                          const BatchHeader &header,
+                          std::vector<Node *> &nodes,
+                          std::unordered_map<uint64_t, Mesh *> &meshes,
+                          std::vector<Mesh *> &uploads,
+                          const SceneFile::MeshResolver &resolver) {
+  SceneArena &arena = Scene.getArena();
+  const Entry *entries = reinterpret_cast<const Entry *>(payload);
+  const unsigned char *blobs = payload + header.entryCount * sizeof(Entry);
+  const uint64_t blobSize =
+      header.payloadSize - header.entryCount * sizeof(Entry);
+
+  for (uint32_t i = 0; i < header.entryCount; i++) {
+    const Entry &e = entries[i];
+    if (e.node > nodes.size() || (e.node < nodes.size() && !nodes[e.node])) {
+      return false;
+    }
+    if (e.op == REMOVE) {
+      if (e.node == nodes.size()) return false;
+      nodes[e.node]->unlink();
+      nodes[e.node] = nullptr;
+      continue;
+    }
+    if (e.op != NODE || e.parent < -1 || e.parent == int32_t(e.node) ||
+        (e.parent >= 0 &&
+         (uint32_t(e.parent) >= nodes.size() || !nodes[e.parent]))) {
+      return false;
+    }
+    const bool embedded = (e.flags & HAS_MESH) &&
+                          (e.mesh.flags & SceneFile::EMBEDDED);
+    if (embedded && (e.mesh.blobOffset % 8 != 0 ||
+                     e.mesh.blobOffset > blobSize ||
+                     e.mesh.blobSize > blobSize - e.mesh.blobOffset ||
+                     !SceneFile::checkBlob(e.mesh, blobs + e.mesh.blobOffset))) {
+      return false;
+    }
+
+    Node *node;
+    if (e.node == nodes.size()) {
+      node = arena.get(arena.createNode());
+      nodes.push_back(node);
+    } else {
+      node = nodes[e.node];
+    }
+    if (e.parent >= 0 && node->parent != nodes[e.parent]) {
+      node->setParent(nodes[e.parent]);
+    } else if (e.parent < 0 && node->parent != nullptr) {
+      node->setParent(nullptr);
+    }
+
+    if (e.flags & HAS_TRANSFORM) {
+      Transform *t = node->getLocalTransform();
+      if (t == nullptr) {
+        t = arena.get(arena.createTransform());
+        node->setTransform(t);
+      }
+      t->setTranslate(glm::vec3(e.transform.translate[0],
+                                e.transform.translate[1],
+                                e.transform.translate[2]));
+      t->setRotation(glm::quat(e.transform.rotation[3], e.transform.rotation[0],
+                               e.transform.rotation[1],
+                               e.transform.rotation[2]));
+      t->setScale(glm::vec3(e.transform.scale[0], e.transform.scale[1],
+                            e.transform.scale[2]));
+    } else if (node->getTransform() != nullptr) {
+      Transform *t = node->getTransform();
+      node->setTransform(nullptr);
+      arena.destroy(arena.find(t));
+    }
+
+    Mesh *mesh = node->getMesh();
+    if (!(e.flags & HAS_MESH)) {
+      if (mesh != nullptr) {
+        node->setMesh(nullptr);
+        track(node, nullptr);
+        drop(mesh, meshes, uploads);
+      }
+      continue;
+    }
+    if (mesh == nullptr || mesh->getContentHash() != e.mesh.hash) {
+      MeshHandle handle = arena.createMesh();
+      mesh = arena.get(handle);
+      auto found = meshes.find(e.mesh.hash);
+      bool ok = true;
+      if (embedded) {
+        SceneFile::readBlob(blobs + e.mesh.blobOffset, e.mesh, *mesh);
+        uploads.push_back(mesh);
+      } else if (found != meshes.end()) {
+        mesh->assign(arraysOf(*found->second));
+        uploads.push_back(mesh);
+      } else {
+        ok = resolver && resolver(e.mesh.hash, *mesh);
+      }
+      if (!ok) {
+        std::cerr << "WARNING: mesh " << std::hex << e.mesh.hash << std::dec
+                  << " not found." << std::endl;
+        arena.destroy(handle);
+        continue;
+      }
+      meshes[e.mesh.hash] = mesh;
+      Mesh *replaced = node->getMesh();
+      node->setMesh(mesh);
+      track(node, mesh);
+      drop(replaced, meshes, uploads);
+    }
+    mesh->setEffect(e.effect);
+    mesh->setTransparent((e.flags & TRANSPARENT) != 0);
+  }
+  return true;
+}
+
+// Loads the base file and replays the journal over it. A journal written
+// for another base is ignored and restarted; a damaged tail is dropped, and
+// the scene compacted so that nothing is appended after it.
+bool SceneJournal::load(const SceneFile::MeshResolver &resolver) {
+  if (!SceneFile::load(Scene, BasePath, resolver)) return false;
+  std::vector<Node *> nodes = breadthFirst();
+
+  MappedFile base, journal;
+  if (!base.open(BasePath)) return false;
+  BaseSize = base.size();
+  BaseHash = hash64(base.data(), base.size());
+  base.close();
+
+  bool current = false, damaged = false;
+  uint64_t offset = sizeof(Header);
+  if (journal.open(JournalPath) && journal.size() >= sizeof(Header)) {
+    const Header &h = *reinterpret_cast<const Header *>(journal.data());
+    current = h.magic == MAGIC && h.version == VERSION &&
+              h.baseSize == BaseSize && h.baseHash == BaseHash;
+    if (!current) {
+      std::cerr << "WARNING: " << JournalPath
+                << " does not match its scene file and is ignored."
+                << std::endl;
+    }
+  }
+  if (current) {
+    // Indexed up front for the mesh users, so that replay can tell when a
+    // replaced mesh is no longer used.
+    index(nodes);
+    std::unordered_map<uint64_t, Mesh *> meshes;
+    for (Node *node : nodes) {
+      if (node->getMesh() != nullptr) {
+        meshes[node->getMesh()->getContentHash()] = node->getMesh();
+      }
+    }
+    std::vector<Mesh *> uploads;
+    while (offset < journal.size()) {
+      const uint64_t left = journal.size() - offset;
+      const BatchHeader *b =
+          reinterpret_cast<const BatchHeader *>(journal.data() + offset);
+      const unsigned char *payload = journal.data() + offset + sizeof(*b);
+      if (left < sizeof(*b) || b->magic != BATCH_MAGIC ||
+          b->payloadSize % 8 != 0 || b->payloadSize > left - sizeof(*b) ||
+          b->entryCount > b->payloadSize / sizeof(Entry) ||
+          hash64(payload, b->payloadSize) != b->checksum ||
+          !replay(payload, *b, nodes, meshes, uploads, resolver)) {
+        damaged = true;
+        break;
+      }
+      offset += sizeof(*b) + b->payloadSize;
+    }
+    Mesh::createBufferObjects(uploads);
+  }
+  journal.close();
+
+  Scene.getArena().discardChanges();
+  index(nodes);
+  if (damaged) {
+    std::cerr << "WARNING: " << JournalPath << " is damaged after byte "
+              << offset << ", compacting." << std::endl;
+    return compact();
+  }
+  if (!current) return reset();
+  HasBase = true;
+  JournalSize = offset;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scene Journal Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SCENE_JOURNAL_HPP
+#define MGL_SCENE_JOURNAL_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mglSceneFile.hpp"
+
+namespace mgl {
+
+class SceneJournal;
+class Node;
+
+////////////////////////////////////////////////////////////////// SceneJournal
+//
+// Incremental saving on top of a binary scene file. The base file holds the
+// scene as of the last compaction; every save() after that appends one batch
+// to "<base>.journal" with an entry per node changed since the previous save
+// (taken from the SceneArena change lists), so its cost follows the edit and
+// not the scene. Entries carry the whole node record, and the geometry of
+// meshes the files do not hold yet.
+//
+// Nodes are numbered as in the base file, new ones get the next numbers.
+// Batches are checksummed: a torn tail, as left by a crash, is dropped on
+// load. Once the journal outgrows a ratio of the base, save() compacts: the
+// base is rewritten from the scene and the journal emptied.
+
+class SceneJournal {
+ public:
+  static const uint32_t MAGIC = 0x4a4c474d;        // "MGLJ"
+  static const uint32_t BATCH_MAGIC = 0x48435442;  // "BTCH"
+  static const uint32_t VERSION = 1;
+
+  enum EntryOp : uint32_t { NODE = 1, REMOVE = 2 };
+  enum EntryFlags : uint32_t {
+    HAS_TRANSFORM = 1,
+    HAS_MESH = 2,
+    TRANSPARENT = 4
+  };
+
+  // The base file is identified by its size and hash.
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t baseSize;
+    uint64_t baseHash;
+  };
+
+  // Entries are followed by the mesh blobs, which are 8 byte aligned and
+  // addressed from the end of the entries.
+  struct BatchHeader {
+    uint32_t magic;
+    uint32_t entryCount;
+    uint64_t payloadSize;
+    uint64_t checksum;
+  };
+
+  struct Entry {
+    uint32_t op;
+    uint32_t node;
+    int32_t parent;  // -1 for the root or a detached node
+    int32_t effect;
+    uint32_t flags;
+    uint32_t reserved;
+    SceneFile::TransformRecord transform;
+    SceneFile::MeshRecord mesh;
+  };
+
+  SceneJournal(SceneGraph &scene, const std::string &path);
+
+  bool load(const SceneFile::MeshResolver &resolver =
+                SceneFile::MeshResolver());
+  bool save();
+  bool compact();
+  void setCompactionRatio(double ratio);
+  uint64_t getJournalSize();
+  size_t getLastEntryCount();
+
+ private:
+  struct Batch {
+    std::vector<Entry> entries;
+    std::vector<unsigned char> blobs;
+    std::unordered_set<Node *> written;
+  };
+
+  SceneGraph &Scene;
+  std::string BasePath, JournalPath;
+  bool HasBase;
+  uint64_t BaseSize, BaseHash, JournalSize;
+  double CompactionRatio;
+  size_t LastEntryCount;
+  uint32_t NextIndex;
+  std::unordered_map<Node *, uint32_t> Indices;
+  std::unordered_map<Node *, Mesh *> NodeMeshes;
+  std::unordered_multimap<Mesh *, Node *> Users;
+  std::unordered_set<uint64_t> Hashes;
+
+  std::vector<Node *> breadthFirst();
+  void index(const std::vector<Node *> &nodes);
+  void track(Node *node, Mesh *mesh);
+  void forget(Node *node);
+  void write(Node *node, Batch &batch);
+  bool append(const Batch &batch);
+  bool reset();
+  void drop(Mesh *mesh, std::unordered_map<uint64_t, Mesh *> &meshes,
+            std::vector<Mesh *> &uploads);
+  bool replay(const unsigned char *payload, const BatchHeader &header,
+              std::vector<Node *> &nodes,
+              std::unordered_map<uint64_t, Mesh *> &meshes,
+              std::vector<Mesh *> &uploads,
+              const SceneFile::MeshResolver &resolver);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_SCENE_JOURNAL_HPP */
@@ -0,0 +1,301 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Streaming JSON Scene Reader Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglSceneReader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace mgl {
+
+static const double MAX_COUNT = std::numeric_limits<unsigned int>::max();
+
+//////////////////////////////////////////////////////////////////// SceneReader
+
+SceneReader::SceneReader(SceneArena &arena, Node *root, size_t fileSize)
+    : Arena(arena), Root(root), FileSize(fileSize) {}
+
+const std::vector<Mesh *> &SceneReader::getMeshes() { return Meshes; }
+
+// True when a whole document with a root node was read.
+bool SceneReader::isComplete() { return RootRead && Frames.empty(); }
+
+bool SceneReader::null() { return true; }
+
+bool SceneReader::boolean(bool val) {
+  if (!Frames.empty() && Frames.back() == MESH && Key == "transparent") {
+    Current->transparent = val;
+  }
+  return true;
+}
+
+bool SceneReader::number_integer(number_integer_t val) {
+  return value(static_cast<double>(val));
+}
+
+bool SceneReader::number_unsigned(number_unsigned_t val) {
+  return value(static_cast<double>(val));
+}
+
+bool SceneReader::number_float(number_float_t val, const string_t &) {
+  return value(val);
+}
+
+bool SceneReader::string(string_t &) { return true; }
+
+bool SceneReader::binary(binary_t &) { return true; }
+
+bool SceneReader::value(double v) {
+  if (Frames.empty()) return true;
+  switch (Frames.back()) {
+    case COMPONENTS: {
+      float f = static_cast<float>(v);
+      switch (Array) {
+        case TEXCOORDS:
+          if (Component < 2) Current->Texcoords.back()[Component] = f;
+          break;
+        case POSITIONS:
+          if (Component < 3) Current->Positions.back()[Component] = f;
+          break;
+        case NORMALS:
+          if (Component < 3) Current->Normals.back()[Component] = f;
+          break;
+        case TANGENTS:
+          if (Component < 3) Current->Tangents.back()[Component] = f;
+          break;
+        case BITANGENTS:
+          if (Component < 3) Current->Bitangents.back()[Component] = f;
+          break;
+      }
+      Component++;
+      break;
+    }
+    case TRANSFORM_VECTOR:
+      if (Component < VectorSize) Vector[Component] = static_cast<float>(v);
+      Component++;
+      break;
+    case MESH:
+      if (Key == "effect") Current->effect = static_cast<int>(v);
+      break;
+    case INDICES: {
+      unsigned int u;
+      if (!count(v, MAX_COUNT, u)) return false;
+      Current->Indices.push_back(u);
+      break;
+    }
+    case SUBMESH: {
+      Mesh::MeshData &m = Current->Meshes.back();
+      unsigned int u;
+      if (!count(v, MAX_COUNT, u)) return false;
+      if (Key == "nIndices") m.nIndices = u;
+      if (Key == "baseIndex") m.baseIndex = u;
+      if (Key == "baseVertex") m.baseVertex = u;
+      break;
+    }
+    case ARRAY_SIZES: {
+      // Every element takes at least a byte of the file, so a larger size
+      // can only be a bad file and must not reach the allocator.
+      unsigned int n;
+      if (!count(v, std::min<double>(FileSize, MAX_COUNT), n)) return false;
+      if (Key == "Positions") Current->Positions.reserve(n);
+      if (Key == "Normals") Current->Normals.reserve(n);
+      if (Key == "Texcoords") Current->Texcoords.reserve(n);
+      if (Key == "Tangents") Current->Tangents.reserve(n);
+      if (Key == "Bitangents") Current->Bitangents.reserve(n);
+      if (Key == "Indices") Current->Indices.reserve(n);
+      if (Key == "Meshes") Current->Meshes.reserve(n);
+      break;
+    }
+    default:
+      break;
+  }
+  return true;
+}
+
+// Accepts whole numbers from 0 to limit.
+bool SceneReader::count(double v, double limit, unsigned int &n) {
+  if (!(v >= 0.0 && v <= limit) || std::floor(v) != v) {
+    std::cerr << "WARNING: scene value " << v << " of " << Key
+              << " is out of range" << std::endl;
+    return false;
+  }
+  n = static_cast<unsigned int>(v);
+  return true;
+}
+
+bool SceneReader::start_object(std::size_t) {
+  Frame top = Frames.empty() ? SKIP : Frames.back();
+  Frame next = SKIP;
+  if (Frames.empty()) {
+    next = DOCUMENT;
+  } else if (top == DOCUMENT && Key == "root" && !RootRead) {
+    RootRead = true;
+    Nodes.push_back(Root);
+    next = NODE;
+  } else if (top == CHILDREN) {
+    Node *child = Arena.get(Arena.createNode());
+    child->setParent(Nodes.back());
+    Nodes.push_back(child);
+    next = NODE;
+  } else if (top == NODE && Key == "transform") {
+    Translate[0] = Translate[1] = Translate[2] = 0.0f;
+    Rotation[0] = Rotation[1] = Rotation[2] = 0.0f;
+    Rotation[3] = 1.0f;
+    Scale[0] = Scale[1] = Scale[2] = 1.0f;
+    next = TRANSFORM;
+  } else if (top == NODE && Key == "mesh" && Current == nullptr) {
+    Current = Arena.get(Arena.createMesh());
+    next = MESH;
+  } else if (top == MESH && Key == "ArraySizes") {
+    next = ARRAY_SIZES;
+  } else if (top == SUBMESHES) {
+    Current->Meshes.push_back(Mesh::MeshData());
+    next = SUBMESH;
+  }
+  Frames.push_back(next);
+  return true;
+}
+
+bool SceneReader::key(string_t &val) {
+  Key.swap(val);
+  return true;
+}
+
+bool SceneReader::end_object() {
+  Frame top = Frames.back();
+  Frames.pop_back();
+  if (top == NODE) {
+    Nodes.pop_back();
+  } else if (top == MESH) {
+    return finishMesh();
+  } else if (top == TRANSFORM) {
+    finishTransform();
+  }
+  return true;
+}
+
+bool SceneReader::start_array(std::size_t) {
+  Frame top = Frames.empty() ? SKIP : Frames.back();
+  Frame next = SKIP;
+  if (top == NODE && Key == "children") {
+    next = CHILDREN;
+  } else if (top == TRANSFORM) {
+    next = TRANSFORM_VECTOR;
+    Component = 0;
+    if (Key == "translate") {
+      Vector = Translate;
+      VectorSize = 3;
+    } else if (Key == "rotation") {
+      Vector = Rotation;
+      VectorSize = 4;
+    } else if (Key == "scale") {
+      Vector = Scale;
+      VectorSize = 3;
+    } else {
+      next = SKIP;
+    }
+  } else if (top == MESH) {
+    next = VECTORS;
+    if (Key == "Positions") {
+      Array = POSITIONS;
+    } else if (Key == "Normals") {
+      Array = NORMALS;
+    } else if (Key == "Texcoords") {
+      Array = TEXCOORDS;
+    } else if (Key == "Tangents") {
+      Array = TANGENTS;
+    } else if (Key == "Bitangents") {
+      Array = BITANGENTS;
+    } else if (Key == "Indices") {
+      next = INDICES;
+    } else if (Key == "Meshes") {
+      next = SUBMESHES;
+    } else {
+      next = SKIP;
+    }
+  } else if (top == VECTORS) {
+    // The element is appended first and its components written in place.
+    switch (Array) {
+      case POSITIONS:
+        Current->Positions.push_back(glm::vec3(0.0f));
+        break;
+      case NORMALS:
+        Current->Normals.push_back(glm::vec3(0.0f));
+        break;
+      case TEXCOORDS:
+        Current->Texcoords.push_back(glm::vec2(0.0f));
+        break;
+      case TANGENTS:
+        Current->Tangents.push_back(glm::vec3(0.0f));
+        break;
+      case BITANGENTS:
+        Current->Bitangents.push_back(glm::vec3(0.0f));
+        break;
+    }
+    Component = 0;
+    next = COMPONENTS;
+  }
+  Frames.push_back(next);
+  return true;
+}
+
+bool SceneReader::end_array() {
+  Frames.pop_back();
+  return true;
+}
+
+bool SceneReader::parse_error(std::size_t position,
+                              const std::string &,
+                              const nlohmann::detail::exception &ex) {
+  std::cerr << "WARNING: scene parse error at byte " << position << ": "
+            << ex.what() << std::endl;
+  return false;
+}
+
+// Submeshes are checked as SceneFile::checkBlob does, and their indices
+// against the vertices they can reach, so that no draw reads past the arrays.
+bool SceneReader::finishMesh() {
+  Mesh *mesh = Current;
+  const size_t n = mesh->Positions.size();
+  for (const Mesh::MeshData &m : mesh->Meshes) {
+    bool valid = uint64_t(m.baseIndex) + m.nIndices <= mesh->Indices.size() &&
+                 m.baseVertex <= n;
+    for (unsigned int i = 0; valid && i < m.nIndices; i++) {
+      valid = uint64_t(m.baseVertex) + mesh->Indices[m.baseIndex + i] < n;
+    }
+    if (!valid) {
+      std::cerr << "WARNING: scene mesh has a submesh out of range"
+                << std::endl;
+      return false;
+    }
+  }
+  mesh->NormalsLoaded = mesh->Normals.size() == n && n > 0;
+  mesh->TexcoordsLoaded = mesh->Texcoords.size() == n && n > 0;
+  mesh->TangentsAndBitangentsLoaded =
+      mesh->Tangents.size() == n && mesh->Bitangents.size() == n && n > 0;
+  mesh->ContentHash = 0;
+  mesh->calculateBounds();
+  Nodes.back()->setMesh(mesh);
+  Meshes.push_back(mesh);
+  Current = nullptr;
+  return true;
+}
+
+void SceneReader::finishTransform() {
+  Transform *transform = Arena.get(Arena.createTransform());
+  transform->setTranslate(glm::vec3(Translate[0], Translate[1], Translate[2]));
+  transform->setRotation(
+      glm::quat(Rotation[3], Rotation[0], Rotation[1], Rotation[2]));
+  transform->setScale(glm::vec3(Scale[0], Scale[1], Scale[2]));
+  Nodes.back()->setTransform(transform);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
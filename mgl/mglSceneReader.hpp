@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Streaming JSON Scene Reader Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SCENE_READER_HPP
+#define MGL_SCENE_READER_HPP
+
+#include <json.hpp>
+#include <string>
+#include <vector>
+
+#include "mglScenegraph.hpp"
+
+namespace mgl {
+
+class SceneReader;
+
+//////////////////////////////////////////////////////////////////// SceneReader
+//
+// SAX handler for the JSON written by SceneGraph::save. No document is
+// built: nodes and meshes are created as their objects open and every
+// number is written straight into the mesh arrays, reserved up front from
+// the "ArraySizes" entry when the file has one. Unknown keys are skipped.
+// The meshes read are kept, without GL objects, for a bulk upload.
+//
+// Sizes, indices and submesh ranges are checked as they are read, and the
+// first bad one stops the parse; what was built by then is left in the
+// arena for the caller to drop.
+
+class SceneReader : public nlohmann::json_sax<json> {
+ public:
+  SceneReader(SceneArena &arena, Node *root, size_t fileSize);
+  const std::vector<Mesh *> &getMeshes();
+  bool isComplete();
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &s) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t position, const std::string &last_token,
+                   const nlohmann::detail::exception &ex) override;
+
+ private:
+  enum Frame {
+    DOCUMENT,
+    NODE,
+    CHILDREN,
+    MESH,
+    ARRAY_SIZES,
+    VECTORS,
+    COMPONENTS,
+    INDICES,
+    SUBMESHES,
+    SUBMESH,
+    TRANSFORM,
+    TRANSFORM_VECTOR,
+    SKIP
+  };
+  enum Target { POSITIONS, NORMALS, TEXCOORDS, TANGENTS, BITANGENTS };
+
+  SceneArena &Arena;
+  Node *Root;
+  size_t FileSize;
+  bool RootRead = false;
+  std::vector<Frame> Frames;
+  std::vector<Node *> Nodes;
+  std::vector<Mesh *> Meshes;
+  Mesh *Current = nullptr;
+  Target Array = POSITIONS;
+  unsigned int Component = 0;
+  std::string Key;
+  float Translate[3], Rotation[4], Scale[3];  // rotation as x, y, z, w
+  float *Vector = nullptr;
+  unsigned int VectorSize = 0;
+
+  bool value(double v);
+  bool count(double v, double limit, unsigned int &n);
+  bool finishMesh();
+  void finishTransform();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_SCENE_READER_HPP */
@@ -0,0 +1,548 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Parallel JSON Scene Writer Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglSceneWriter.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "./mglJobs.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+/////////////////////////////////////////////////////////// Shortest float digits
+//
+// Ryu (Ulf Adams, PLDI 2018) for 32 bit floats: finds the shortest decimal
+// inside the interval of values that round to the float, using only 64 bit
+// multiplications by precomputed powers of five.
+
+static const int POW5_INV_BITCOUNT = 59;
+static const int POW5_BITCOUNT = 61;
+
+static const uint64_t POW5_INV_SPLIT[31] = {
+    0x0800000000000001ull, 0x0666666666666667ull, 0x051eb851eb851eb9ull,
+    0x04189374bc6a7efaull, 0x068db8bac710cb2aull, 0x053e2d6238da3c22ull,
+    0x0431bde82d7b634eull, 0x06b5fca6af2bd216ull, 0x055e63b88c230e78ull,
+    0x044b82fa09b5a52dull, 0x06df37f675ef6eaeull, 0x057f5ff85e592558ull,
+    0x0465e6604b7a8447ull, 0x0709709a125da071ull, 0x05a126e1a84ae6c1ull,
+    0x0480ebe7b9d58567ull, 0x0734aca5f6226f0bull, 0x05c3bd5191b525a3ull,
+    0x049c97747490eae9ull, 0x0760f253edb4ab0eull, 0x05e72843249088d8ull,
+    0x04b8ed0283a6d3e0ull, 0x078e480405d7b966ull, 0x060b6cd004ac9452ull,
+    0x04d5f0a66a23a9dbull, 0x07bcb43d769f762bull, 0x063090312bb2c4efull,
+    0x04f3a68dbc8f03f3ull, 0x07ec3daf94180651ull, 0x065697bfa9acd1daull,
+    0x051212ffbaf0a7e2ull};
+
+static const uint64_t POW5_SPLIT[47] = {
+    0x1000000000000000ull, 0x1400000000000000ull, 0x1900000000000000ull,
+    0x1f40000000000000ull, 0x1388000000000000ull, 0x186a000000000000ull,
+    0x1e84800000000000ull, 0x1312d00000000000ull, 0x17d7840000000000ull,
+    0x1dcd650000000000ull, 0x12a05f2000000000ull, 0x174876e800000000ull,
+    0x1d1a94a200000000ull, 0x12309ce540000000ull, 0x16bcc41e90000000ull,
+    0x1c6bf52634000000ull, 0x11c37937e0800000ull, 0x16345785d8a00000ull,
+    0x1bc16d674ec80000ull, 0x1158e460913d0000ull, 0x15af1d78b58c4000ull,
+    0x1b1ae4d6e2ef5000ull, 0x10f0cf064dd59200ull, 0x152d02c7e14af680ull,
+    0x1a784379d99db420ull, 0x108b2a2c28029094ull, 0x14adf4b7320334b9ull,
+    0x19d971e4fe8401e7ull, 0x1027e72f1f128130ull, 0x1431e0fae6d7217cull,
+    0x193e5939a08ce9dbull, 0x1f8def8808b02452ull, 0x13b8b5b5056e16b3ull,
+    0x18a6e32246c99c60ull, 0x1ed09bead87c0378ull, 0x13426172c74d822bull,
+    0x1812f9cf7920e2b6ull, 0x1e17b84357691b64ull, 0x12ced32a16a1b11eull,
+    0x178287f49c4a1d66ull, 0x1d6329f1c35ca4bfull, 0x125dfa371a19e6f7ull,
+    0x16f578c4e0a060b5ull, 0x1cb2d6f618c878e3ull, 0x11efc659cf7d4b8dull,
+    0x166bb7f0435c9e71ull, 0x1c06a5ec5433c60dull};
+
+static int32_t pow5bits(int32_t e) {
+  return static_cast<int32_t>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+}
+
+static int32_t log10Pow2(int32_t e) {
+  return static_cast<int32_t>((static_cast<uint32_t>(e) * 78913) >> 18);
+}
+
+static int32_t log10Pow5(int32_t e) {
+  return static_cast<int32_t>((static_cast<uint32_t>(e) * 732923) >> 20);
+}
+
+static bool multipleOfPowerOf5(uint32_t value, int32_t p) {
+  int32_t count = 0;
+  for (; value % 5 == 0; value /= 5) ++count;
+  return count >= p;
+}
+
+static bool multipleOfPowerOf2(uint32_t value, int32_t p) {
+  return (value & ((1u << p) - 1)) == 0;
+}
+
+static uint32_t mulShift(uint32_t m, uint64_t factor, int32_t shift) {
+  uint64_t low = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor);
+  uint64_t high = static_cast<uint64_t>(m) * (factor >> 32);
+  return static_cast<uint32_t>(((low >> 32) + high) >> (shift - 32));
+}
+
+// Nonzero finite floats only; value = digits * 10^exponent.
+static void shortestDigits(uint32_t bits, uint32_t &digits, int32_t &exponent) {
+  uint32_t mantissa = bits & ((1u << 23) - 1);
+  uint32_t biased = (bits >> 23) & 0xff;
+  int32_t e2;
+  uint32_t m2;
+  if (biased == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = mantissa;
+  } else {
+    e2 = static_cast<int32_t>(biased) - 127 - 23 - 2;
+    m2 = (1u << 23) | mantissa;
+  }
+  bool acceptBounds = (m2 & 1) == 0;
+
+  uint32_t mv = 4 * m2;
+  uint32_t mp = 4 * m2 + 2;
+  uint32_t mmShift = mantissa != 0 || biased <= 1;
+  uint32_t mm = 4 * m2 - 1 - mmShift;
+
+  uint32_t vr, vp, vm;
+  int32_t e10;
+  bool vmIsTrailingZeros = false;
+  bool vrIsTrailingZeros = false;
+  uint32_t lastRemovedDigit = 0;
+  if (e2 >= 0) {
+    int32_t q = log10Pow2(e2);
+    e10 = q;
+    int32_t k = POW5_INV_BITCOUNT + pow5bits(q) - 1;
+    int32_t i = -e2 + q + k;
+    vr = mulShift(mv, POW5_INV_SPLIT[q], i);
+    vp = mulShift(mp, POW5_INV_SPLIT[q], i);
+    vm = mulShift(mm, POW5_INV_SPLIT[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      int32_t l = POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+      lastRemovedDigit =
+          mulShift(mv, POW5_INV_SPLIT[q - 1], -e2 + q - 1 + l) % 10;
+    }
+    if (q <= 9) {
+      if (mv % 5 == 0) {
+        vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+      } else if (acceptBounds) {
+        vmIsTrailingZeros = multipleOfPowerOf5(mm, q);
+      } else {
+        vp -= multipleOfPowerOf5(mp, q);
+      }
+    }
+  } else {
+    int32_t q = log10Pow5(-e2);
+    e10 = q + e2;
+    int32_t i = -e2 - q;
+    int32_t k = pow5bits(i) - POW5_BITCOUNT;
+    int32_t j = q - k;
+    vr = mulShift(mv, POW5_SPLIT[i], j);
+    vp = mulShift(mp, POW5_SPLIT[i], j);
+    vm = mulShift(mm, POW5_SPLIT[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = q - 1 - (pow5bits(i + 1) - POW5_BITCOUNT);
+      lastRemovedDigit = mulShift(mv, POW5_SPLIT[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      vrIsTrailingZeros = true;
+      if (acceptBounds) {
+        vmIsTrailingZeros = mmShift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 31) {
+      vrIsTrailingZeros = multipleOfPowerOf2(mv, q - 1);
+    }
+  }
+
+  int32_t removed = 0;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        ++removed;
+      }
+    }
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+      lastRemovedDigit = 4;
+    }
+    digits = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                   lastRemovedDigit >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      lastRemovedDigit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      ++removed;
+    }
+    digits = vr + (vr == vm || lastRemovedDigit >= 5);
+  }
+  exponent = e10 + removed;
+}
+
+// Same notation as the json serializer: plain decimals (with a ".0" for
+// whole numbers) from 0.0001 up to 1e15, scientific notation outside.
+size_t SceneWriter::formatFloat(float value, char *buffer) {
+  if (!std::isfinite(value)) {
+    std::memcpy(buffer, "null", 4);
+    return 4;
+  }
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  char *out = buffer;
+  if (bits >> 31) *out++ = '-';
+  if ((bits & 0x7fffffff) == 0) {
+    std::memcpy(out, "0.0", 3);
+    return out + 3 - buffer;
+  }
+
+  uint32_t digits;
+  int32_t exponent;
+  shortestDigits(bits, digits, exponent);
+  char text[10];
+  int k = 0;
+  for (uint32_t d = digits; d != 0; d /= 10) text[9 - k++] = '0' + d % 10;
+  const char *first = text + 10 - k;
+  int n = k + exponent;  // position of the decimal point
+
+  if (k <= n && n <= 15) {
+    std::memcpy(out, first, k);
+    std::memset(out + k, '0', n - k);
+    out += n;
+    *out++ = '.';
+    *out++ = '0';
+  } else if (0 < n && n <= 15) {
+    std::memcpy(out, first, n);
+    out[n] = '.';
+    std::memcpy(out + n + 1, first + n, k - n);
+    out += k + 1;
+  } else if (-4 < n && n <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    std::memset(out, '0', -n);
+    std::memcpy(out - n, first, k);
+    out += k - n;
+  } else {
+    *out++ = first[0];
+    if (k > 1) {
+      *out++ = '.';
+      std::memcpy(out, first + 1, k - 1);
+      out += k - 1;
+    }
+    int e = n - 1;
+    *out++ = 'e';
+    *out++ = e < 0 ? '-' : '+';
+    if (e < 0) e = -e;
+    if (e >= 10) *out++ = '0' + e / 10;
+    else *out++ = '0';
+    *out++ = '0' + e % 10;
+  }
+  return out - buffer;
+}
+
+//////////////////////////////////////////////////////////////// Text fragments
+
+static void indent(std::string &out, int level) { out.append(4 * level, ' '); }
+
+static void appendUnsigned(std::string &out, uint64_t value) {
+  char text[20];
+  int k = 0;
+  do {
+    text[19 - k++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  out.append(text + 20 - k, k);
+}
+
+static void appendInt(std::string &out, int value) {
+  if (value < 0) out += '-';
+  appendUnsigned(out, value < 0 ? 0 - static_cast<uint64_t>(value)
+                                 : static_cast<uint64_t>(value));
+}
+
+static void appendFloat(std::string &out, float value) {
+  char text[24];
+  out.append(text, SceneWriter::formatFloat(value, text));
+}
+
+// Opens a key of an object whose members are at the given level; every
+// key but the first closes the previous member.
+static void appendKey(std::string &out, int level, const char *key,
+                      bool first = false) {
+  out += first ? "{\n" : ",\n";
+  indent(out, level);
+  out += '"';
+  out += key;
+  out += "\": ";
+}
+
+static void closeObject(std::string &out, int level) {
+  out += '\n';
+  indent(out, level);
+  out += '}';
+}
+
+// An array of floats as the value of a member at the given level.
+static void appendFloats(std::string &out, const float *values, size_t count,
+                         int level) {
+  out += "[\n";
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) out += ",\n";
+    indent(out, level + 1);
+    appendFloat(out, values[i]);
+  }
+  out += '\n';
+  indent(out, level);
+  out += ']';
+}
+
+template <typename V>
+static void appendVectors(std::string &out, const std::vector<V> &vectors,
+                          int level) {
+  if (vectors.empty()) {
+    out += "[]";
+    return;
+  }
+  out.reserve(out.size() + vectors.size() * V::length() * (4 * level + 24));
+  out += "[\n";
+  for (size_t i = 0; i < vectors.size(); i++) {
+    if (i > 0) out += ",\n";
+    indent(out, level + 1);
+    appendFloats(out, &vectors[i][0], V::length(), level + 1);
+  }
+  out += '\n';
+  indent(out, level);
+  out += ']';
+}
+
+static void appendIndices(std::string &out,
+                          const std::vector<unsigned int> &indices,
+                          int level) {
+  if (indices.empty()) {
+    out += "[]";
+    return;
+  }
+  out.reserve(out.size() + indices.size() * (4 * level + 12));
+  out += "[\n";
+  for (size_t i = 0; i < indices.size(); i++) {
+    if (i > 0) out += ",\n";
+    indent(out, level + 1);
+    appendUnsigned(out, indices[i]);
+  }
+  out += '\n';
+  indent(out, level);
+  out += ']';
+}
+
+//////////////////////////////////////////////////////////////////// SceneWriter
+
+SceneWriter::SceneWriter(JobSystem *jobs) : Jobs(jobs) {}
+
+// Document order without recursion; the root is a member of the top level
+// object, each child an element of the "children" array of its parent.
+void SceneWriter::flatten(Node &root) {
+  Entries.clear();
+  std::vector<size_t> parents;
+  std::vector<Entry> stack = {{&root, 1, 0}};
+  std::vector<size_t> stackParents = {0};
+  while (!stack.empty()) {
+    Entry e = stack.back();
+    size_t parent = stackParents.back();
+    stack.pop_back();
+    stackParents.pop_back();
+    size_t index = Entries.size();
+    e.next = 1;
+    Entries.push_back(e);
+    parents.push_back(parent);
+    const std::vector<Node *> &children = e.node->getChildren();
+    for (size_t i = children.size(); i-- > 0;) {
+      stack.push_back({children[i], e.level + 2, 0});
+      stackParents.push_back(index);
+    }
+  }
+  for (size_t i = Entries.size(); i-- > 1;) {
+    Entries[parents[i]].next += Entries[i].next;
+  }
+  for (size_t i = 0; i < Entries.size(); i++) Entries[i].next += i;
+}
+
+void SceneWriter::encodeMesh(Mesh &mesh, int level, std::string &out) {
+  const int inner = level + 1;
+  appendKey(out, inner, "ArraySizes", true);
+  appendKey(out, inner + 1, "Bitangents", true);
+  appendUnsigned(out, mesh.getBitangents().size());
+  appendKey(out, inner + 1, "Indices");
+  appendUnsigned(out, mesh.getIndices().size());
+  appendKey(out, inner + 1, "Meshes");
+  appendUnsigned(out, mesh.getMeshData().size());
+  appendKey(out, inner + 1, "Normals");
+  appendUnsigned(out, mesh.getNormals().size());
+  appendKey(out, inner + 1, "Positions");
+  appendUnsigned(out, mesh.getPositions().size());
+  appendKey(out, inner + 1, "Tangents");
+  appendUnsigned(out, mesh.getTangents().size());
+  appendKey(out, inner + 1, "Texcoords");
+  appendUnsigned(out, mesh.getTexcoords().size());
+  closeObject(out, inner);
+
+  appendKey(out, inner, "Bitangents");
+  appendVectors(out, mesh.getBitangents(), inner);
+  appendKey(out, inner, "Indices");
+  appendIndices(out, mesh.getIndices(), inner);
+
+  const std::vector<Mesh::MeshData> &meshes = mesh.getMeshData();
+  appendKey(out, inner, "Meshes");
+  if (meshes.empty()) {
+    out += "[]";
+  } else {
+    out += "[\n";
+    for (size_t i = 0; i < meshes.size(); i++) {
+      if (i > 0) out += ",\n";
+      indent(out, inner + 1);
+      appendKey(out, inner + 2, "baseIndex", true);
+      appendUnsigned(out, meshes[i].baseIndex);
+      appendKey(out, inner + 2, "baseVertex");
+      appendUnsigned(out, meshes[i].baseVertex);
+      appendKey(out, inner + 2, "nIndices");
+      appendUnsigned(out, meshes[i].nIndices);
+      closeObject(out, inner + 1);
+    }
+    out += '\n';
+    indent(out, inner);
+    out += ']';
+  }
+
+  appendKey(out, inner, "Normals");
+  appendVectors(out, mesh.getNormals(), inner);
+  appendKey(out, inner, "Positions");
+  appendVectors(out, mesh.getPositions(), inner);
+  appendKey(out, inner, "Tangents");
+  appendVectors(out, mesh.getTangents(), inner);
+  appendKey(out, inner, "Texcoords");
+  appendVectors(out, mesh.getTexcoords(), inner);
+  appendKey(out, inner, "effect");
+  appendInt(out, mesh.getEffect());
+  appendKey(out, inner, "transparent");
+  out += mesh.isTransparent() ? "true" : "false";
+  closeObject(out, level);
+}
+
+// Everything after the "children" array of a node, up to its closing brace.
+void SceneWriter::encodeTail(size_t index) {
+  Node *node = Entries[index].node;
+  const int inner = Entries[index].level + 1;
+  std::string &out = Tails[index];
+  out.clear();
+
+  Mesh *mesh = node->getMesh();
+  if (mesh != nullptr) {
+    appendKey(out, inner, "mesh");
+    encodeMesh(*mesh, inner, out);
+  }
+  Transform *t = node->getLocalTransform();
+  if (t != nullptr) {
+    glm::vec3 translate = t->getTranslate();
+    glm::quat r = t->getRotation();
+    float rotation[4] = {r.x, r.y, r.z, r.w};
+    glm::vec3 scale = t->getScale();
+    appendKey(out, inner, "transform");
+    appendKey(out, inner + 1, "rotation", true);
+    appendFloats(out, rotation, 4, inner + 1);
+    appendKey(out, inner + 1, "scale");
+    appendFloats(out, &scale[0], 3, inner + 1);
+    appendKey(out, inner + 1, "translate");
+    appendFloats(out, &translate[0], 3, inner + 1);
+    closeObject(out, inner);
+  }
+  closeObject(out, Entries[index].level);
+}
+
+// Everything before the first child of a node.
+void SceneWriter::encodeHead(size_t index, std::string &out) {
+  out.clear();
+  const Entry &e = Entries[index];
+  if (index > 0) indent(out, e.level);
+  out += "{\n";
+  indent(out, e.level + 1);
+  out += "\"children\": ";
+  out += e.next == index + 1 ? "[]" : "[\n";
+}
+
+void SceneWriter::write(Node &root, std::ostream &out) {
+  flatten(root);
+  Tails.assign(Entries.size(), std::string());
+
+  // Nodes with a mesh are jobs of their own, the rest go in ranges.
+  if (Jobs != nullptr && Entries.size() > 1) {
+    JobSystem::Counter counter(0);
+    for (size_t i = 0; i < Entries.size(); i++) {
+      if (Entries[i].node->getMesh() != nullptr) {
+        Jobs->submit([this, i] { encodeTail(i); }, &counter);
+      }
+    }
+    Jobs->parallelFor(0, Entries.size(), 64, [this](size_t b, size_t e) {
+      for (size_t i = b; i < e; i++) {
+        if (Entries[i].node->getMesh() == nullptr) encodeTail(i);
+      }
+    });
+    Jobs->wait(counter);
+  } else {
+    for (size_t i = 0; i < Entries.size(); i++) encodeTail(i);
+  }
+
+  // Stitching: a node is closed once the next entry is past its subtree.
+  std::string head;
+  std::vector<size_t> open;
+  out << "{\n    \"root\": ";
+  for (size_t i = 0; i < Entries.size(); i++) {
+    encodeHead(i, head);
+    out << head;
+    if (Entries[i].next != i + 1) {
+      open.push_back(i);
+      continue;
+    }
+    out << Tails[i];
+    std::string().swap(Tails[i]);
+    while (!open.empty() && Entries[open.back()].next == i + 1) {
+      const Entry &parent = Entries[open.back()];
+      head = "\n";
+      indent(head, parent.level + 1);
+      out << head << ']' << Tails[open.back()];
+      std::string().swap(Tails[open.back()]);
+      open.pop_back();
+    }
+    if (i + 1 < Entries.size()) out << ",\n";
+  }
+  out << "\n}" << std::endl;
+}
+
+bool SceneWriter::write(Node &root, const std::string &path) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    std::cerr << "WARNING: Could not write scene file " << path << std::endl;
+    return false;
+  }
+  write(root, out);
+  return static_cast<bool>(out);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
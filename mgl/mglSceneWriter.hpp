@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Parallel JSON Scene Writer Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SCENE_WRITER_HPP
+#define MGL_SCENE_WRITER_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mgl {
+
+class SceneWriter;
+class JobSystem;
+class Mesh;
+class Node;
+
+//////////////////////////////////////////////////////////////////// SceneWriter
+//
+// Writes the JSON read by SceneGraph::load without building a document.
+// The tree is flattened in document order and the part of every node that
+// follows its children (its mesh and transform, where nearly all the text
+// is) is encoded into a buffer of its own, concurrently when given a job
+// system. The buffers are then stitched together in order, so the output is
+// the same byte for byte with or without jobs. The layout is the one of a
+// json document dumped with an indent of 4; floats are written with the
+// shortest digits that read back to the same float.
+
+class SceneWriter {
+ public:
+  explicit SceneWriter(JobSystem *jobs = nullptr);
+
+  void write(Node &root, std::ostream &out);
+  bool write(Node &root, const std::string &path);
+
+  // Writes at most 24 characters to buffer and returns how many.
+  static size_t formatFloat(float value, char *buffer);
+
+ private:
+  struct Entry {
+    Node *node;
+    int level;
+    size_t next;  // index past the last node of the subtree
+  };
+
+  JobSystem *Jobs;
+  std::vector<Entry> Entries;
+  std::vector<std::string> Tails;
+
+  void flatten(Node &root);
+  void encodeTail(size_t index);
+  void encodeMesh(Mesh &mesh, int level, std::string &out);
+  void encodeHead(size_t index, std::string &out);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_SCENE_WRITER_HPP */
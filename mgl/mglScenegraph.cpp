@@ -1,8 +1,13 @@
 #include "mglScenegraph.hpp"
 #include "mglConventions.hpp"
+#include "mglSceneReader.hpp"
+#include "mglSceneWriter.hpp"
 #include <json.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <iostream>
 
 using json = nlohmann::json;
 
@@ -12,17 +17,61 @@ namespace mgl {
 
 	}
 
+	// Links to other nodes are cut by unlink() when a node is destroyed on
+	// its own; a SceneArena drops all the nodes of a scene together.
 	Node::~Node() {
-		//TODO
+
+	}
+
+	void Node::unlink() {
+		if (scene != nullptr) {
+			scene->erase(this);
+		}
+		if (parent != nullptr) {
+			parent->children.erase(std::remove(parent->children.begin(),
+				parent->children.end(), this), parent->children.end());
+		}
+		for (Node* c : children) {
+			c->parent = nullptr;
+		}
+		children.clear();
+		parent = nullptr;
+		if (transform != nullptr) {
+			transform->setOwner(nullptr);
+		}
+		else if (mesh != nullptr && mesh->getTransform() != nullptr) {
+			mesh->getTransform()->setOwner(nullptr);
+		}
 	}
 
-	std::vector<Node *> Node::getChildren() {
+	const std::vector<Node *>& Node::getChildren() {
 		return children;
 	}
 
+	Node& Node::getParent() {
+		return *parent;
+	}
+
+	// A null parent detaches the node, which keeps its children.
 	void Node::setParent(Node* p) {
+		if (arena != nullptr) {
+			arena->markChanged(this);
+		}
+		if (parent != nullptr) {
+			parent->children.erase(std::remove(parent->children.begin(),
+				parent->children.end(), this), parent->children.end());
+		}
+		if (scene != nullptr) {
+			scene->detach(this);
+		}
 		parent = p;
+		if (parent == nullptr) {
+			return;
+		}
 		parent->addChild(this);
+		if (parent->scene != nullptr) {
+			parent->scene->attach(this);
+		}
 	}
 
 	void Node::addChild(Node* c) {
@@ -31,25 +80,64 @@ namespace mgl {
 
 	void Node::setMesh(Mesh* m) {
 		mesh = m;
+		if (transform == nullptr && mesh != nullptr && mesh->getTransform() != nullptr) {
+			mesh->getTransform()->setOwner(this);
+		}
+		invalidate();
 	}
 
 	Mesh* Node::getMesh() {
 		return mesh;
 	}
 
-	void Node::draw(ShaderProgram* shaderProgram) {
-		glUniform1i(shaderProgram->Uniforms["effect"].index, (GLuint) mesh->getEffect());
-		if (mesh->getTransform() == nullptr) {
-			glUniformMatrix4fv(shaderProgram->Uniforms[mgl::MODEL_MATRIX].index, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.f)));
+	void Node::setTransform(Transform* t) {
+		transform = t;
+		if (transform != nullptr) {
+			transform->setOwner(this);
 		}
-		else {
-			auto modelMatrix = mesh->getTransform()->getModelMatrix();
-			glUniformMatrix4fv(shaderProgram->Uniforms[mgl::MODEL_MATRIX].index, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+		invalidate();
+	}
+
+	Transform* Node::getTransform() {
+		return transform;
+	}
+
+	Transform* Node::getLocalTransform() {
+		if (transform != nullptr) {
+			return transform;
 		}
-		mesh->draw();
+		return mesh != nullptr ? mesh->getTransform() : nullptr;
+	}
+
+	glm::mat4 Node::getLocalMatrix() {
+		Transform* t = getLocalTransform();
+		return t != nullptr ? t->getModelMatrix() : glm::mat4(1.f);
+	}
 
-		for (Node* n : children) {
-			n->draw(shaderProgram);
+	// Up to date after SceneGraph::update(); nodes outside a compiled scene
+	// walk up their parents instead.
+	glm::mat4 Node::getWorldMatrix() {
+		if (scene != nullptr) {
+			return scene->getWorldMatrix(flatIndex);
+		}
+		if (parent != nullptr) {
+			return parent->getWorldMatrix() * getLocalMatrix();
+		}
+		return getLocalMatrix();
+	}
+
+	// Changes whenever the compiled world matrix does; 0 outside a compiled
+	// scene, where it cannot be tracked.
+	uint64_t Node::getWorldVersion() {
+		return scene != nullptr ? scene->getWorldVersion(flatIndex) : 0;
+	}
+
+	void Node::invalidate() {
+		if (scene != nullptr) {
+			scene->invalidate(flatIndex);
+		}
+		if (arena != nullptr) {
+			arena->markChanged(this);
 		}
 	}
 
@@ -58,6 +146,15 @@ namespace mgl {
 		if (mesh != nullptr) {
 			j["mesh"] = mesh->toJSON();
 		}
+		Transform* t = getLocalTransform();
+		if (t != nullptr) {
+			glm::vec3 translate = t->getTranslate();
+			glm::quat rotation = t->getRotation();
+			glm::vec3 scale = t->getScale();
+			j["transform"]["translate"] = { translate.x, translate.y, translate.z };
+			j["transform"]["rotation"] = { rotation.x, rotation.y, rotation.z, rotation.w };
+			j["transform"]["scale"] = { scale.x, scale.y, scale.z };
+		}
 		j["children"] = json::array();
 		for (int i = 0; i < children.size(); i++) {
 			j["children"].push_back(children[i]->toJSON());
@@ -65,14 +162,169 @@ namespace mgl {
 		return j;
 	}
 
-	void Node::fromJSON(json j) {
-		mesh = new Mesh();
-		mesh->fromJSON(j["mesh"]);
-		for (int i = 0; i < j["children"].size(); i++) {
-			Node* child = new Node();
-			child->fromJSON(j["children"][i]);
-			children.push_back(child);
+	void Node::fromJSON(const json& j, SceneArena& arena) {
+		if (j.contains("mesh")) {
+			mesh = arena.get(arena.createMesh());
+			mesh->fromJSON(j.at("mesh"));
 		}
+		if (j.contains("transform")) {
+			const json& t = j.at("transform");
+			const json& r = t.at("rotation");
+			Transform* transform = arena.get(arena.createTransform());
+			transform->setTranslate(glm::vec3(t.at("translate")[0], t.at("translate")[1], t.at("translate")[2]));
+			transform->setRotation(glm::quat(r[3], r[0], r[1], r[2]));
+			transform->setScale(glm::vec3(t.at("scale")[0], t.at("scale")[1], t.at("scale")[2]));
+			setTransform(transform);
+		}
+		const json& children = j.at("children");
+		for (int i = 0; i < children.size(); i++) {
+			Node* child = arena.get(arena.createNode());
+			child->fromJSON(children[i], arena);
+			child->setParent(this);
+		}
+	}
+
+	///////////////////////////////////////////////// SceneArena
+	SceneArena::~SceneArena() {
+		clear();
+	}
+
+	NodeHandle SceneArena::createNode() {
+		NodeHandle h = nodes.create();
+		nodes.get(h)->arena = this;
+		return h;
+	}
+
+	MeshHandle SceneArena::createMesh() {
+		MeshHandle h = meshes.create();
+		meshes.get(h)->arena = this;
+		return h;
+	}
+
+	TransformHandle SceneArena::createTransform() {
+		return transforms.create();
+	}
+
+	Node* SceneArena::get(NodeHandle h) {
+		return nodes.get(h);
+	}
+
+	Mesh* SceneArena::get(MeshHandle h) {
+		return meshes.get(h);
+	}
+
+	Transform* SceneArena::get(TransformHandle h) {
+		return transforms.get(h);
+	}
+
+	// Linear in the number of pool chunks.
+	MeshHandle SceneArena::find(Mesh* mesh) {
+		return meshes.find(mesh);
+	}
+
+	TransformHandle SceneArena::find(Transform* transform) {
+		return transforms.find(transform);
+	}
+
+	void SceneArena::destroy(NodeHandle h) {
+		Node* node = nodes.get(h);
+		if (node != nullptr) {
+			node->unlink();
+			if (node->changed) {
+				changedNodes.erase(std::remove(changedNodes.begin(),
+					changedNodes.end(), node), changedNodes.end());
+			}
+			destroyedNodes.push_back(node);
+			nodes.destroy(h);
+		}
+	}
+
+	// The caller must first detach the mesh or transform from its nodes.
+	void SceneArena::destroy(MeshHandle h) {
+		Mesh* mesh = meshes.get(h);
+		if (mesh != nullptr && mesh->changed) {
+			changedMeshes.erase(std::remove(changedMeshes.begin(),
+				changedMeshes.end(), mesh), changedMeshes.end());
+		}
+		meshes.destroy(h);
+	}
+
+	void SceneArena::destroy(TransformHandle h) {
+		transforms.destroy(h);
+	}
+
+	// Nodes go first, as they may still be registered with transforms.
+	void SceneArena::clear() {
+		nodes.clear();
+		meshes.clear();
+		transforms.clear();
+		changedNodes.clear();
+		changedMeshes.clear();
+		destroyedNodes.clear();
+	}
+
+	// The objects stay where they are; only the arena they report to changes.
+	void SceneArena::swap(SceneArena& other) {
+		nodes.swap(other.nodes);
+		meshes.swap(other.meshes);
+		transforms.swap(other.transforms);
+		changedNodes.swap(other.changedNodes);
+		changedMeshes.swap(other.changedMeshes);
+		destroyedNodes.swap(other.destroyedNodes);
+		for (SceneArena* a : { this, &other }) {
+			a->nodes.forEach([a](Node& node) { node.arena = a; });
+			a->meshes.forEach([a](Mesh& mesh) { mesh.arena = a; });
+		}
+	}
+
+	void SceneArena::markChanged(Node* node) {
+		if (!node->changed) {
+			node->changed = true;
+			changedNodes.push_back(node);
+		}
+	}
+
+	void SceneArena::markChanged(Mesh* mesh) {
+		if (!mesh->changed) {
+			mesh->changed = true;
+			changedMeshes.push_back(mesh);
+		}
+	}
+
+	// Destroyed nodes are only addresses by now, and one may already be
+	// reused by a node among the changed ones.
+	void SceneArena::takeChanges(std::vector<Node*>& nodesChanged,
+		std::vector<Mesh*>& meshesChanged, std::vector<Node*>& nodesDestroyed) {
+		for (Node* node : changedNodes) {
+			node->changed = false;
+		}
+		for (Mesh* mesh : changedMeshes) {
+			mesh->changed = false;
+		}
+		nodesChanged.swap(changedNodes);
+		meshesChanged.swap(changedMeshes);
+		nodesDestroyed.swap(destroyedNodes);
+		changedNodes.clear();
+		changedMeshes.clear();
+		destroyedNodes.clear();
+	}
+
+	void SceneArena::discardChanges() {
+		std::vector<Node*> nodesChanged, nodesDestroyed;
+		std::vector<Mesh*> meshesChanged;
+		takeChanges(nodesChanged, meshesChanged, nodesDestroyed);
+	}
+
+	size_t SceneArena::getNodeCount() {
+		return nodes.size();
+	}
+
+	size_t SceneArena::getMeshCount() {
+		return meshes.size();
+	}
+
+	size_t SceneArena::getTransformCount() {
+		return transforms.size();
 	}
 
 	///////////////////////////////////////////////// SceneGraph
@@ -80,34 +332,142 @@ namespace mgl {
 
 	}
 
+	SceneGraph::~SceneGraph() {
+		unload();
+	}
+
+	void SceneGraph::addNode(Node* node) {
+		node->setParent(root);
+	}
+
+	// The flat scene is dropped first, since it still refers to the nodes.
+	void SceneGraph::unload() {
+		flat.build(nullptr);
+		root = nullptr;
+		arena.clear();
+	}
+
+	SceneArena& SceneGraph::getArena() {
+		return arena;
+	}
+
 	void SceneGraph::setRoot(Node* r) {
 		root = r;
 	}	
 
+	Node& SceneGraph::getRoot() {
+		return *root;
+	}
+
+	FlatScene& SceneGraph::getFlatScene() {
+		return flat;
+	}
+
+	// Compiles the hierarchy on first use, applies queued structural changes
+	// and refreshes the world matrices of changed nodes only.
+	void SceneGraph::update(JobSystem* jobs) {
+		if (flat.getRoot() != root) {
+			flat.build(root);
+		}
+		flat.commit();
+		flat.update(jobs);
+	}
+
+	size_t SceneGraph::cull(const glm::mat4& viewProjection, JobSystem* jobs) {
+		update(jobs);
+		return flat.cull(viewProjection, jobs);
+	}
+
+	void SceneGraph::submit(RenderQueue& queue, PermutationKey features,
+		JobSystem* jobs) {
+		update(jobs);
+		flat.submit(queue, features, jobs);
+	}
+
+	void SceneGraph::setDepthShaders(ShaderProgram* s) {
+		depthShaders = s;
+	}
+
+	void SceneGraph::setDepthPrepass(bool enabled) {
+		depthPrepass = enabled;
+	}
+
+	bool SceneGraph::getDepthPrepass() {
+		return depthPrepass;
+	}
+
+	// With the depth pre-pass enabled, opaque depth is laid down first with a
+	// position-only program; the shading pass then only passes GL_EQUAL, so each
+	// visible pixel is shaded once. Transparent meshes are drawn last as usual.
 	void SceneGraph::draw(ShaderProgram* shaderProgram) {
-		for (Node* n : root->getChildren()) {
-			n->draw(shaderProgram);
+		update();
+		if (!depthPrepass || depthShaders == nullptr) {
+			flat.draw(shaderProgram);
+			return;
 		}
+
+		depthShaders->bind();
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		flat.drawDepth(depthShaders);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		shaderProgram->bind();
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+		flat.draw(shaderProgram, DRAW_OPAQUE);
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_TRUE);
+		flat.draw(shaderProgram, DRAW_TRANSPARENT);
 	}
 
-	void SceneGraph::save(const char *path) {
-		json j = json({});
-		j["root"] = root->toJSON();
-		std::ofstream o(path);
-		o << std::setw(4) << j << std::endl;
-		o.close();
-	}
-
-	void SceneGraph::load(const char* path) {
-		std::ifstream i(path);
-		json j;
-		i >> j;
-		root = new Node();
-		for (json::iterator it = j.begin(); it != j.end(); ++it) {
-			if (it.key() == "root") {
-				root->fromJSON(it.value());
-			}
+	// Meshes and subtrees are encoded concurrently when given a job system;
+	// the file is the same either way.
+	void SceneGraph::save(const char *path, JobSystem* jobs) {
+		SceneWriter(jobs).write(*root, path);
+	}
+
+	// Streams the file through a SceneReader instead of parsing a document.
+	// The scene is read into an arena of its own and only replaces the
+	// current one once the whole file has been read and checked, so a bad
+	// file leaves the current scene as it was.
+	bool SceneGraph::load(const char* path) {
+		std::ifstream i(path, std::ios::binary | std::ios::ate);
+		if (!i) {
+			std::cerr << "WARNING: could not open scene file " << path << std::endl;
+			return false;
+		}
+		const std::streamoff size = i.tellg();
+		i.seekg(0);
+		typedef std::chrono::steady_clock clock;
+		clock::time_point start = clock::now();
+		SceneArena staging;
+		Node* staged = staging.get(staging.createNode());
+		SceneReader reader(staging, staged, static_cast<size_t>(size));
+		if (!json::sax_parse(i, &reader) || !reader.isComplete()) {
+			std::cerr << "WARNING: invalid scene file " << path << std::endl;
+			return false;
 		}
-		
+		flat.build(nullptr);
+		arena.swap(staging);
+		root = staged;
+		staging.clear();
+		clock::time_point read = clock::now();
+		Mesh::createBufferObjects(reader.getMeshes());
+		clock::time_point uploaded = clock::now();
+		update();
+		clock::time_point updated = clock::now();
+
+		loadTimes.read = std::chrono::duration<double, std::milli>(read - start).count();
+		loadTimes.upload = std::chrono::duration<double, std::milli>(uploaded - read).count();
+		loadTimes.update = std::chrono::duration<double, std::milli>(updated - uploaded).count();
+		return true;
+	}
+
+	const SceneGraph::LoadTimes& SceneGraph::getLoadTimes() {
+		return loadTimes;
+	}
+
+	void SceneGraph::setLoadTimes(const LoadTimes& times) {
+		loadTimes = times;
 	}
 }
\ No newline at end of file
@@ -15,21 +15,39 @@
 
 using json = nlohmann::json;
 
+#include "mglFlatScene.hpp"
 #include "mglMesh.hpp"
+#include "mglPermutations.hpp"
+#include "mglPool.hpp"
+#include "mglRenderQueue.hpp"
 #include "mglShader.hpp"
+#include "mglTransform.hpp"
 
 namespace mgl {
 
+class SceneArena;
+
+// Each node owns an optional local transform (falling back to its mesh's
+// transform). Once its scene is compiled, the world matrix lives in the
+// FlatScene; changes only mark the node's slot dirty there, and structural
+// changes are queued until the next update. Nodes created by a SceneArena
+// also report their changes to it, for incremental saving.
 class Node {
+	friend class FlatScene;
+	friend class SceneArena;
+	friend class SceneJournal;
 private:
-	static std::vector<Node*> nodes;
 	Mesh *mesh = nullptr;
+	Transform *transform = nullptr;
+	FlatScene *scene = nullptr;
+	int32_t flatIndex = -1;
+	SceneArena *arena = nullptr;
+	bool changed = false;
 protected:
 	Node *parent = nullptr;
 	std::vector<Node *> children;
 public:
-	static std::vector<Node *> &getNodes(void);
-	std::vector<Node *> getChildren();
+	const std::vector<Node *>& getChildren();
 	void addChild(Node *);
 	void setParent(Node *);
 	Node &getParent(void);
@@ -37,24 +55,101 @@ public:
 	virtual ~Node();
 	void setMesh(Mesh* m);
 	Mesh* getMesh();
-	void draw(ShaderProgram*);
+	void setTransform(Transform* t);
+	Transform* getTransform();
+	Transform* getLocalTransform();
+	glm::mat4 getLocalMatrix();
+	glm::mat4 getWorldMatrix();
+	uint64_t getWorldVersion();
+	void invalidate();
+	void unlink();
 	json toJSON();
-	void fromJSON(json j);
+	void fromJSON(const json& j, SceneArena& arena);
 
 };
 
+typedef Handle<Node> NodeHandle;
+typedef Handle<Mesh> MeshHandle;
+typedef Handle<Transform> TransformHandle;
+
+// Owns the nodes, meshes and transforms of one scene in typed pools. The
+// objects still point at each other directly; handles are for the code that
+// creates and destroys them, and go stale instead of dangling. clear()
+// drops the whole scene at once and keeps the pool memory for the next one.
+//
+// The arena also collects the nodes and meshes changed since the last
+// takeChanges(), each once, and the nodes destroyed in between, so that
+// saving can skip everything else. swap() exchanges whole scenes between
+// two arenas, which is how a scene is loaded aside and then put in place.
+class SceneArena {
+private:
+	Pool<Node> nodes;
+	Pool<Mesh> meshes;
+	Pool<Transform> transforms;
+	std::vector<Node*> changedNodes;
+	std::vector<Mesh*> changedMeshes;
+	std::vector<Node*> destroyedNodes;
+public:
+	~SceneArena();
+	NodeHandle createNode();
+	MeshHandle createMesh();
+	TransformHandle createTransform();
+	Node* get(NodeHandle h);
+	Mesh* get(MeshHandle h);
+	Transform* get(TransformHandle h);
+	MeshHandle find(Mesh* mesh);
+	TransformHandle find(Transform* transform);
+	void destroy(NodeHandle h);
+	void destroy(MeshHandle h);
+	void destroy(TransformHandle h);
+	void clear();
+	void swap(SceneArena& other);
+	void markChanged(Node* node);
+	void markChanged(Mesh* mesh);
+	void takeChanges(std::vector<Node*>& nodesChanged,
+		std::vector<Mesh*>& meshesChanged, std::vector<Node*>& nodesDestroyed);
+	void discardChanges();
+	size_t getNodeCount();
+	size_t getMeshCount();
+	size_t getTransformCount();
+};
+
 class SceneGraph {
+public:
+	// Milliseconds spent in each phase of the last load.
+	struct LoadTimes {
+		double read = 0.0;    // parsing or mapping, filling the mesh arrays
+		double upload = 0.0;  // creating buffers and vertex arrays in bulk
+		double update = 0.0;  // flattening the hierarchy
+	};
 private:
-	Node* root;
+	Node* root = nullptr;
+	SceneArena arena;
+	LoadTimes loadTimes;
+	FlatScene flat;
+	ShaderProgram* depthShaders = nullptr;
+	bool depthPrepass = false;
 public:
 	SceneGraph();
 	~SceneGraph();
 	void addNode(Node *node);
+	void update(JobSystem* jobs = nullptr);
+	size_t cull(const glm::mat4& viewProjection, JobSystem* jobs = nullptr);
 	void draw(ShaderProgram*);
-	void load(const char* path);
-	void save(const char* path);
+	void submit(RenderQueue&, PermutationKey features = 0,
+		JobSystem* jobs = nullptr);
+	void setDepthShaders(ShaderProgram*);
+	void setDepthPrepass(bool);
+	bool getDepthPrepass();
+	bool load(const char* path);
+	void save(const char* path, JobSystem* jobs = nullptr);
+	void unload();
 	void setRoot(Node *node);
 	Node &getRoot();
+	FlatScene &getFlatScene();
+	SceneArena &getArena();
+	const LoadTimes &getLoadTimes();
+	void setLoadTimes(const LoadTimes &times);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -8,13 +8,39 @@
 
 #include "./mglShader.hpp"
 
-#include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <iterator>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "./mglHash.hpp"
 
 namespace mgl {
 
 	////////////////////////////////////////////////////////////////// ShaderProgram
 
+	static const char CACHE_MAGIC[4] = { 'M', 'G', 'L', 'P' };
+	static const uint32_t CACHE_VERSION = 1;
+
+	struct CacheHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+		uint64_t checksum;
+	};
+
+	std::string ShaderProgram::CacheDirectory;
+
 	const std::string ShaderProgram::read(const std::string& filename) {
 		std::string line, shader_string;
 		std::ifstream ifile(filename);
@@ -24,6 +50,21 @@ namespace mgl {
 		return shader_string;
 	}
 
+	// Inserts the program's #defines right after the #version directive.
+	const std::string ShaderProgram::preprocess(const std::string& source) {
+		if (Defines.empty()) return source;
+		std::string defines;
+		for (auto& d : Defines) {
+			defines += "#define " + d.first + " " + d.second + "\n";
+		}
+		size_t version = source.find("#version");
+		if (version == std::string::npos) return defines + source;
+		size_t eol = source.find('\n', version);
+		if (eol == std::string::npos) return source + "\n" + defines;
+		return source.substr(0, eol + 1) + defines + "#line 2\n" +
+			source.substr(eol + 1);
+	}
+
 	const GLuint ShaderProgram::checkCompilation(const GLuint shader_id,
 		const std::string& filename) {
 		GLint compiled;
@@ -54,7 +95,10 @@ namespace mgl {
 		}
 	}
 
-	ShaderProgram::ShaderProgram() : ProgramId(glCreateProgram()) {
+	ShaderProgram::ShaderProgram()
+		: ProgramId(glCreateProgram()), Cached(false), UseCache(false),
+		Submitted(false), Finished(false), CacheKey(0) {
+		std::fill(Locations, Locations + MAX_UNIFORM_HANDLES, UNRESOLVED);
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
@@ -64,17 +108,14 @@ namespace mgl {
 		glDeleteProgram(ProgramId);
 	}
 
+	void ShaderProgram::addDefine(const std::string& name,
+		const std::string& value) {
+		Defines.push_back({ name, value });
+	}
+
 	void ShaderProgram::addShader(const GLenum shader_type,
 		const std::string& filename) {
-		const GLuint shader_id = glCreateShader(shader_type);
-		const std::string scode = read(filename);
-		const GLchar* code = scode.c_str();
-		glShaderSource(shader_id, 1, &code, 0);
-		glCompileShader(shader_id);
-		checkCompilation(shader_id, filename);
-		glAttachShader(ProgramId, shader_id);
-
-		Shaders[shader_type] = { shader_id };
+		Sources.push_back({ shader_type, filename, read(filename), "" });
 	}
 
 	void ShaderProgram::addAttribute(const std::string& name, const GLuint index) {
@@ -103,13 +144,81 @@ namespace mgl {
 		return Ubos.find(name) != Ubos.end();
 	}
 
-	void ShaderProgram::create() {
+	void ShaderProgram::compile() {
+		for (auto& s : Sources) {
+			const GLuint shader_id = glCreateShader(s.type);
+			const GLchar* code = s.code.c_str();
+			glShaderSource(shader_id, 1, &code, 0);
+			glCompileShader(shader_id);
+			glAttachShader(ProgramId, shader_id);
+
+			Shaders[s.type] = { shader_id };
+		}
+		if (UseCache) {
+			glProgramParameteri(ProgramId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
 		glLinkProgram(ProgramId);
-		checkLinkage();
+	}
+
+	// No status is queried here, so with KHR_parallel_shader_compile the
+	// driver keeps compiling on its own threads until finish() or isReady().
+	void ShaderProgram::submit() {
+		if (Submitted) return;
+		Submitted = true;
+		for (auto& s : Sources) {
+			s.code = preprocess(s.source);
+		}
+		enableParallelCompile();
+		UseCache = !CacheDirectory.empty() && isCacheSupported();
+		CacheKey = UseCache ? cacheKey() : 0;
+		Cached = UseCache && loadBinary(CacheKey);
+		if (!Cached) {
+			compile();
+		}
+#ifdef DEBUG
+		if (UseCache) {
+			std::cout << "Program cache " << (Cached ? "hit " : "miss ")
+				<< hashToString(CacheKey) << std::endl;
+		}
+#endif
+	}
+
+	bool ShaderProgram::isReady() {
+		if (!Submitted) return false;
+		if (Finished || Cached || !GLEW_KHR_parallel_shader_compile) return true;
+		GLint completed = GL_FALSE;
+		glGetProgramiv(ProgramId, GL_COMPLETION_STATUS_KHR, &completed);
+		return completed == GL_TRUE;
+	}
+
+	bool ShaderProgram::isFinished() { return Finished; }
+
+	void ShaderProgram::create() {
+		submit();
+		finish();
+	}
+
+	void ShaderProgram::finish() {
+		if (Finished) return;
+		submit();
+		if (!Cached) {
+			GLint linked;
+			glGetProgramiv(ProgramId, GL_LINK_STATUS, &linked);
+			if (linked == GL_FALSE) {
+				for (auto& s : Sources) {
+					checkCompilation(Shaders[s.type], s.filename);
+				}
+				checkLinkage();
+			}
+			if (UseCache) storeBinary(CacheKey);
+		}
+		Finished = true;
+
 		for (auto& i : Shaders) {
 			glDetachShader(ProgramId, i.second);
 			glDeleteShader(i.second);
 		}
+		reflect();
 
 		for (auto& i : Uniforms) {
 			i.second.index = glGetUniformLocation(ProgramId, i.first.c_str());
@@ -128,5 +237,267 @@ namespace mgl {
 
 	void ShaderProgram::unbind() { glUseProgram(0); }
 
+	/////////////////////////////////////////////////////////////////// Reflection
+
+	std::vector<uint32_t>& ShaderProgram::handleHashes() {
+		static std::vector<uint32_t> hashes(std::begin(BUILTIN_UNIFORM_HASHES),
+			std::end(BUILTIN_UNIFORM_HASHES));
+		return hashes;
+	}
+
+	// Guards the handle registry, which any thread may extend.
+	std::mutex& ShaderProgram::handleMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	// Every program has a location table of MAX_UNIFORM_HANDLES entries, so
+	// running out of handles is fatal in every build.
+	UniformHandle ShaderProgram::getUniformHandle(const std::string& name) {
+		std::lock_guard<std::mutex> lock(handleMutex());
+		std::vector<uint32_t>& hashes = handleHashes();
+		uint32_t hash = nameHash(name.c_str());
+		auto it = std::find(hashes.begin(), hashes.end(), hash);
+		if (it != hashes.end()) {
+			return static_cast<UniformHandle>(it - hashes.begin());
+		}
+		if (hashes.size() >= MAX_UNIFORM_HANDLES) {
+			std::cerr << "[UNIFORM] More than " << MAX_UNIFORM_HANDLES
+				<< " uniform handles, cannot add " << name << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		hashes.push_back(hash);
+		return static_cast<UniformHandle>(hashes.size() - 1);
+	}
+
+	GLint ShaderProgram::resolveUniform(const UniformHandle handle) {
+		if (!Finished) return -1;
+		uint32_t hash;
+		{
+			std::lock_guard<std::mutex> lock(handleMutex());
+			hash = handleHashes()[handle];
+		}
+		auto it = std::lower_bound(ActiveUniforms.begin(), ActiveUniforms.end(), hash,
+			[](const ResourceInfo& r, uint32_t h) { return r.hash < h; });
+		Locations[handle] = (it != ActiveUniforms.end() && it->hash == hash) ?
+			it->location : -1;
+		return Locations[handle];
+	}
+
+	// Arrays are reported as "name[0]"; they are hashed as plain "name".
+	static uint32_t resourceHash(const char* name) {
+		std::string s(name);
+		if (s.size() > 3 && s.compare(s.size() - 3, 3, "[0]") == 0) {
+			s.resize(s.size() - 3);
+		}
+		return nameHash(s.c_str());
+	}
+
+	static void sortResources(std::vector<ShaderProgram::ResourceInfo>& resources) {
+		std::sort(resources.begin(), resources.end(),
+			[](const ShaderProgram::ResourceInfo& a, const ShaderProgram::ResourceInfo& b) {
+				return a.hash < b.hash;
+			});
+	}
+
+	void ShaderProgram::reflect() {
+		ActiveUniforms.clear();
+		ActiveAttributes.clear();
+		ActiveBlocks.clear();
+		if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query) {
+			reflectInterface(GL_UNIFORM, ActiveUniforms);
+			reflectInterface(GL_PROGRAM_INPUT, ActiveAttributes);
+			reflectInterface(GL_UNIFORM_BLOCK, ActiveBlocks);
+		}
+		else {
+			reflectLegacy();
+		}
+		sortResources(ActiveUniforms);
+		sortResources(ActiveAttributes);
+		sortResources(ActiveBlocks);
+		std::fill(Locations, Locations + MAX_UNIFORM_HANDLES, UNRESOLVED);
+	}
+
+	void ShaderProgram::reflectInterface(GLenum interface,
+		std::vector<ResourceInfo>& resources) {
+		GLint count = 0, max_length = 0;
+		glGetProgramInterfaceiv(ProgramId, interface, GL_ACTIVE_RESOURCES, &count);
+		glGetProgramInterfaceiv(ProgramId, interface, GL_MAX_NAME_LENGTH, &max_length);
+		std::vector<GLchar> name(max_length + 1);
+		for (GLint i = 0; i < count; i++) {
+			glGetProgramResourceName(ProgramId, interface, i, max_length + 1, 0, name.data());
+			ResourceInfo r = { resourceHash(name.data()), i, 0, 0 };
+			if (interface == GL_UNIFORM_BLOCK) {
+				const GLenum props[] = { GL_BUFFER_DATA_SIZE };
+				glGetProgramResourceiv(ProgramId, interface, i, 1, props, 1, 0, &r.size);
+			}
+			else {
+				const GLenum props[] = { GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+				GLint values[3];
+				glGetProgramResourceiv(ProgramId, interface, i, 3, props, 3, 0, values);
+				if (values[0] < 0) continue;  // member of a uniform block
+				r.location = values[0];
+				r.type = static_cast<GLenum>(values[1]);
+				r.size = values[2];
+			}
+			resources.push_back(r);
+		}
+	}
+
+	void ShaderProgram::reflectLegacy() {
+		GLint count = 0, max_length = 0;
+		glGetProgramiv(ProgramId, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ProgramId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+		std::vector<GLchar> name(max_length + 1);
+		for (GLint i = 0; i < count; i++) {
+			ResourceInfo r = { 0, -1, 0, 0 };
+			glGetActiveUniform(ProgramId, i, max_length + 1, 0, &r.size, &r.type, name.data());
+			r.location = glGetUniformLocation(ProgramId, name.data());
+			if (r.location < 0) continue;
+			r.hash = resourceHash(name.data());
+			ActiveUniforms.push_back(r);
+		}
+
+		glGetProgramiv(ProgramId, GL_ACTIVE_ATTRIBUTES, &count);
+		glGetProgramiv(ProgramId, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+		name.resize(max_length + 1);
+		for (GLint i = 0; i < count; i++) {
+			ResourceInfo r = { 0, -1, 0, 0 };
+			glGetActiveAttrib(ProgramId, i, max_length + 1, 0, &r.size, &r.type, name.data());
+			r.location = glGetAttribLocation(ProgramId, name.data());
+			r.hash = resourceHash(name.data());
+			ActiveAttributes.push_back(r);
+		}
+
+		glGetProgramiv(ProgramId, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		glGetProgramiv(ProgramId, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+		name.resize(max_length + 1);
+		for (GLint i = 0; i < count; i++) {
+			ResourceInfo r = { 0, i, 0, 0 };
+			glGetActiveUniformBlockName(ProgramId, i, max_length + 1, 0, name.data());
+			glGetActiveUniformBlockiv(ProgramId, i, GL_UNIFORM_BLOCK_DATA_SIZE, &r.size);
+			r.hash = resourceHash(name.data());
+			ActiveBlocks.push_back(r);
+		}
+	}
+
+	void ShaderProgram::enableParallelCompile() {
+		static bool enabled = false;
+		if (enabled) return;
+		enabled = true;
+		if (GLEW_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////// Binary cache
+
+	void ShaderProgram::setCacheDirectory(const std::string& directory) {
+		CacheDirectory = directory;
+		if (CacheDirectory.empty()) return;
+		char last = CacheDirectory.back();
+		if (last != '/' && last != '\\') CacheDirectory += "/";
+#ifdef _WIN32
+		_mkdir(CacheDirectory.c_str());
+#else
+		mkdir(CacheDirectory.c_str(), 0755);
+#endif
+	}
+
+	bool ShaderProgram::isCacheSupported() {
+		if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) return false;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+
+	bool ShaderProgram::isCached() { return Cached; }
+
+	// Everything that changes the linked result, plus the driver identity:
+	// binaries are only valid for the driver build that produced them.
+	uint64_t ShaderProgram::cacheKey() {
+		uint64_t key = hash64(&CACHE_VERSION, sizeof(CACHE_VERSION));
+		key = hash64(std::string(reinterpret_cast<const char*>(glGetString(GL_RENDERER))), key);
+		key = hash64(std::string(reinterpret_cast<const char*>(glGetString(GL_VERSION))), key);
+		for (auto& s : Sources) {
+			key = hash64(&s.type, sizeof(s.type), key);
+			key = hash64(s.code, key);
+		}
+		for (auto& a : Attributes) {
+			key = hash64(a.first, key);
+			key = hash64(&a.second.index, sizeof(a.second.index), key);
+		}
+		return key;
+	}
+
+	std::string ShaderProgram::cacheFilename(uint64_t key) {
+		return CacheDirectory + hashToString(key) + ".bin";
+	}
+
+	// Any mismatch, truncation or driver rejection discards the entry and
+	// falls back to compiling from source.
+	bool ShaderProgram::loadBinary(uint64_t key) {
+		const std::string filename = cacheFilename(key);
+		std::ifstream ifile(filename, std::ios::binary);
+		if (!ifile) return false;
+
+		CacheHeader header;
+		std::vector<char> binary;
+		bool valid = false;
+		if (ifile.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+			std::equal(header.magic, header.magic + 4, CACHE_MAGIC) &&
+			header.version == CACHE_VERSION && header.key == key &&
+			header.length > 0) {
+			binary.resize(header.length);
+			valid = ifile.read(binary.data(), binary.size()) &&
+				hash64(binary.data(), binary.size()) == header.checksum;
+		}
+		ifile.close();
+
+		if (valid) {
+			glProgramBinary(ProgramId, header.format, binary.data(), header.length);
+			GLint linked = GL_FALSE;
+			glGetProgramiv(ProgramId, GL_LINK_STATUS, &linked);
+			valid = linked == GL_TRUE;
+		}
+		if (!valid) {
+			std::cerr << "WARNING: Discarding program cache entry " << filename
+				<< std::endl;
+			std::remove(filename.c_str());
+		}
+		return valid;
+	}
+
+	void ShaderProgram::storeBinary(uint64_t key) {
+		GLint length = 0;
+		glGetProgramiv(ProgramId, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(ProgramId, length, &length, &format, binary.data());
+
+		CacheHeader header;
+		std::copy(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic);
+		header.version = CACHE_VERSION;
+		header.key = key;
+		header.format = format;
+		header.length = static_cast<uint32_t>(length);
+		header.checksum = hash64(binary.data(), header.length);
+
+		// Write aside and rename so a crash never leaves a half-written entry.
+		const std::string filename = cacheFilename(key);
+		const std::string tmpname = filename + ".tmp";
+		std::ofstream ofile(tmpname, std::ios::binary);
+		ofile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		ofile.write(binary.data(), header.length);
+		ofile.close();
+		if (!ofile) {
+			std::remove(tmpname.c_str());
+			return;
+		}
+		std::remove(filename.c_str());
+		std::rename(tmpname.c_str(), filename.c_str());
+	}
+
 	////////////////////////////////////////////////////////////////////////////////
 }  // namespace mgl
@@ -11,9 +11,15 @@
 
 #include <GL/glew.h>
 
+#include <cstdint>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "mglConventions.hpp"
 
 namespace mgl {
 
@@ -46,8 +52,22 @@ namespace mgl {
 		};
 		std::map<std::string, UboInfo> Ubos;
 
+		// Filled by create() from the linked program, sorted by name hash.
+		// For blocks, location holds the block index and size the data size.
+		struct ResourceInfo {
+			uint32_t hash;
+			GLint location;
+			GLenum type;
+			GLint size;
+		};
+		std::vector<ResourceInfo> ActiveUniforms;
+		std::vector<ResourceInfo> ActiveAttributes;
+		std::vector<ResourceInfo> ActiveBlocks;
+
 		ShaderProgram();
 		~ShaderProgram();
+		// Defines apply to every shader, whenever added before submit().
+		void addDefine(const std::string& name, const std::string& value = "");
 		void addShader(const GLenum shader_type, const std::string& filename);
 		void addAttribute(const std::string& name, const GLuint index);
 		bool isAttribute(const std::string& name);
@@ -55,12 +75,61 @@ namespace mgl {
 		bool isUniform(const std::string& name);
 		void addUniformBlock(const std::string& name, const GLuint binding_point);
 		bool isUniformBlock(const std::string& name);
+		// create() is submit() followed by finish(). Calling submit() alone starts
+		// compiling without waiting; poll isReady() and call finish() once true.
 		void create();
+		void submit();
+		bool isReady();
+		void finish();
+		bool isFinished();
 		void bind();
 		void unbind();
 
+		// Linked programs are stored here with glGetProgramBinary and reloaded
+		// with glProgramBinary when sources, defines, attributes and driver match.
+		// An empty directory (the default) disables the cache.
+		static void setCacheDirectory(const std::string& directory);
+		static bool isCacheSupported();
+		bool isCached();
+
+		static UniformHandle getUniformHandle(const std::string& name);
+		inline GLint getUniformLocation(const UniformHandle handle) {
+			GLint location = Locations[handle];
+			return location != UNRESOLVED ? location : resolveUniform(handle);
+		}
+
 	private:
+		static const GLint UNRESOLVED = -2;
+		GLint Locations[MAX_UNIFORM_HANDLES];
+
+		struct SourceInfo {
+			GLenum type;
+			std::string filename;
+			std::string source;  // as read from the file
+			std::string code;    // with the defines, set by submit()
+		};
+		std::vector<SourceInfo> Sources;
+		std::vector<std::pair<std::string, std::string>> Defines;
+		bool Cached, UseCache, Submitted, Finished;
+		uint64_t CacheKey;
+
+		static std::string CacheDirectory;
+
+		static std::vector<uint32_t>& handleHashes();
+		static std::mutex& handleMutex();
+		GLint resolveUniform(const UniformHandle handle);
+		void reflect();
+		void reflectInterface(GLenum interface, std::vector<ResourceInfo>& resources);
+		void reflectLegacy();
+		static void enableParallelCompile();
+		void compile();
+		uint64_t cacheKey();
+		std::string cacheFilename(uint64_t key);
+		bool loadBinary(uint64_t key);
+		void storeBinary(uint64_t key);
+
 		const std::string read(const std::string& filename);
+		const std::string preprocess(const std::string& source);
 		const GLuint checkCompilation(const GLuint shader_id,
 			const std::string& filename);
 		void checkLinkage();
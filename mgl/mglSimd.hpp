@@ -0,0 +1,31 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// SIMD Instruction Set Detection
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SIMD_HPP
+#define MGL_SIMD_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Compile-time selection only: MSVC x64 always has SSE2 and defines __AVX2__
+// under /arch:AVX2, GCC and Clang follow -m flags. glm is left in its scalar
+// configuration so its types keep the same layout in every translation unit.
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MGL_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(MGL_SSE2) && defined(__AVX2__)
+#define MGL_AVX2
+#include <immintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif /* MGL_SIMD_HPP */
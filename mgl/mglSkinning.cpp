@@ -0,0 +1,467 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Skeletal Animation and Skinning Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglSkinning.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+
+#include "./mglConventions.hpp"
+#include "./mglMesh.hpp"
+#include "./mglScenegraph.hpp"
+
+namespace mgl {
+
+static glm::mat4 toMat4(const aiMatrix4x4 &m) {
+  return glm::transpose(glm::make_mat4(&m.a1));
+}
+
+/////////////////////////////////////////////////////////////////////// Skeleton
+
+Skeleton::Skeleton() : globalInverse(1.f) {}
+
+// Preorder traversal, so every parent precedes its children.
+void Skeleton::create(const aiNode *root) {
+  names.clear();
+  parents.clear();
+  bones.clear();
+  translates.clear();
+  rotations.clear();
+  scales.clear();
+  offsets.clear();
+  globalInverse = glm::inverse(toMat4(root->mTransformation));
+
+  std::vector<std::pair<const aiNode *, int32_t>> stack;
+  stack.push_back({root, -1});
+  while (!stack.empty()) {
+    const aiNode *node = stack.back().first;
+    int32_t parent = stack.back().second;
+    stack.pop_back();
+
+    aiVector3D scale, translate;
+    aiQuaternion rotation;
+    node->mTransformation.Decompose(scale, rotation, translate);
+    int32_t index = static_cast<int32_t>(names.size());
+    names.push_back(node->mName.C_Str());
+    parents.push_back(parent);
+    bones.push_back(-1);
+    translates.push_back(glm::vec3(translate.x, translate.y, translate.z));
+    rotations.push_back(glm::quat(rotation.w, rotation.x, rotation.y,
+                                  rotation.z));
+    scales.push_back(glm::vec3(scale.x, scale.y, scale.z));
+
+    for (unsigned int i = node->mNumChildren; i-- > 0;) {
+      stack.push_back({node->mChildren[i], index});
+    }
+  }
+}
+
+int32_t Skeleton::findJoint(const std::string &name) const {
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == name) return static_cast<int32_t>(i);
+  }
+  return -1;
+}
+
+// Returns the bone index of the named joint, adding it on first use.
+int32_t Skeleton::addBone(const std::string &name, const glm::mat4 &offset) {
+  int32_t joint = findJoint(name);
+  if (joint < 0) {
+    std::cerr << "WARNING: bone " << name << " has no node." << std::endl;
+    return -1;
+  }
+  if (bones[joint] >= 0) return bones[joint];
+  if (offsets.size() >= MAX_BONES) {
+    std::cerr << "WARNING: more than " << MAX_BONES << " bones, " << name
+              << " ignored." << std::endl;
+    return -1;
+  }
+  bones[joint] = static_cast<int32_t>(offsets.size());
+  offsets.push_back(offset);
+  return bones[joint];
+}
+
+size_t Skeleton::size() const { return names.size(); }
+
+size_t Skeleton::getBoneCount() const { return offsets.size(); }
+
+////////////////////////////////////////////////////////////////// AnimationClip
+
+template <typename K>
+static unsigned int findKey(const K *keys, unsigned int count, double time) {
+  unsigned int i = 0;
+  while (i + 2 < count && keys[i + 1].mTime <= time) i++;
+  return i;
+}
+
+template <typename K>
+static float keyBlend(const K *keys, unsigned int i, double time) {
+  double span = keys[i + 1].mTime - keys[i].mTime;
+  if (span <= 0.0) return 0.f;
+  return static_cast<float>(
+      std::min(1.0, std::max(0.0, (time - keys[i].mTime) / span)));
+}
+
+static aiVector3D sampleKeys(const aiVectorKey *keys, unsigned int count,
+                             double time) {
+  if (count == 1) return keys[0].mValue;
+  unsigned int i = findKey(keys, count, time);
+  float alpha = keyBlend(keys, i, time);
+  return keys[i].mValue + (keys[i + 1].mValue - keys[i].mValue) * alpha;
+}
+
+static aiQuaternion sampleKeys(const aiQuatKey *keys, unsigned int count,
+                               double time) {
+  if (count == 1) return keys[0].mValue;
+  unsigned int i = findKey(keys, count, time);
+  aiQuaternion q;
+  aiQuaternion::Interpolate(q, keys[i].mValue, keys[i + 1].mValue,
+                            keyBlend(keys, i, time));
+  return q.Normalize();
+}
+
+AnimationClip::AnimationClip()
+    : Duration(0.f), FrameRate(0.f), Frames(0), Joints(0) {}
+
+const float *AnimationClip::key(size_t frame, int component) const {
+  return &Keys[(frame * TransformBatch::COMPONENTS + component) * Joints];
+}
+
+float *AnimationClip::key(size_t frame, int component) {
+  return &Keys[(frame * TransformBatch::COMPONENTS + component) * Joints];
+}
+
+// Joints without a channel hold their bind pose.
+void AnimationClip::create(const aiAnimation *animation,
+                           const Skeleton &skeleton, float frameRate) {
+  double ticks =
+      animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+  Name = animation->mName.C_Str();
+  Duration = static_cast<float>(animation->mDuration / ticks);
+  FrameRate = frameRate;
+  Frames = static_cast<size_t>(std::ceil(Duration * FrameRate)) + 1;
+  Joints = skeleton.size();
+  Keys.resize(Frames * TransformBatch::COMPONENTS * Joints);
+
+  for (size_t f = 0; f < Frames; f++) {
+    for (size_t j = 0; j < Joints; j++) {
+      const glm::vec3 &t = skeleton.translates[j];
+      const glm::quat &q = skeleton.rotations[j];
+      const glm::vec3 &s = skeleton.scales[j];
+      const float values[TransformBatch::COMPONENTS] = {
+          t.x, t.y, t.z, q.x, q.y, q.z, q.w, s.x, s.y, s.z};
+      for (int c = 0; c < TransformBatch::COMPONENTS; c++) {
+        key(f, c)[j] = values[c];
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < animation->mNumChannels; i++) {
+    const aiNodeAnim *channel = animation->mChannels[i];
+    int32_t j = skeleton.findJoint(channel->mNodeName.C_Str());
+    if (j < 0) continue;
+    for (size_t f = 0; f < Frames; f++) {
+      double time = std::min(f / FrameRate, Duration) * ticks;
+      if (channel->mNumPositionKeys > 0) {
+        aiVector3D t = sampleKeys(channel->mPositionKeys,
+                                  channel->mNumPositionKeys, time);
+        key(f, TransformBatch::TX)[j] = t.x;
+        key(f, TransformBatch::TY)[j] = t.y;
+        key(f, TransformBatch::TZ)[j] = t.z;
+      }
+      if (channel->mNumRotationKeys > 0) {
+        aiQuaternion q = sampleKeys(channel->mRotationKeys,
+                                    channel->mNumRotationKeys, time);
+        if (f > 0) {
+          float dot = q.x * key(f - 1, TransformBatch::QX)[j] +
+                      q.y * key(f - 1, TransformBatch::QY)[j] +
+                      q.z * key(f - 1, TransformBatch::QZ)[j] +
+                      q.w * key(f - 1, TransformBatch::QW)[j];
+          if (dot < 0.f) q = aiQuaternion(-q.w, -q.x, -q.y, -q.z);
+        }
+        key(f, TransformBatch::QX)[j] = q.x;
+        key(f, TransformBatch::QY)[j] = q.y;
+        key(f, TransformBatch::QZ)[j] = q.z;
+        key(f, TransformBatch::QW)[j] = q.w;
+      }
+      if (channel->mNumScalingKeys > 0) {
+        aiVector3D s = sampleKeys(channel->mScalingKeys,
+                                  channel->mNumScalingKeys, time);
+        key(f, TransformBatch::SX)[j] = s.x;
+        key(f, TransformBatch::SY)[j] = s.y;
+        key(f, TransformBatch::SZ)[j] = s.z;
+      }
+    }
+  }
+}
+
+void AnimationClip::sample(float time, bool loop, TransformBatch &pose) const {
+  if (pose.size() != Joints) pose.resize(Joints);
+  if (Frames == 0 || Joints == 0) return;
+  if (loop && Duration > 0.f) {
+    time = std::fmod(time, Duration);
+    if (time < 0.f) time += Duration;
+  } else {
+    time = std::min(std::max(time, 0.f), Duration);
+  }
+  float frame = time * FrameRate;
+  size_t f0 = std::min(static_cast<size_t>(frame), Frames - 1);
+  size_t f1 = std::min(f0 + 1, Frames - 1);
+  float alpha = frame - static_cast<float>(f0);
+
+  for (int c = 0; c < TransformBatch::COMPONENTS; c++) {
+    const float *a = key(f0, c);
+    const float *b = key(f1, c);
+    float *out = pose.data(static_cast<TransformBatch::Component>(c));
+    for (size_t j = 0; j < Joints; j++) {
+      out[j] = a[j] + (b[j] - a[j]) * alpha;
+    }
+  }
+
+  float *qx = pose.data(TransformBatch::QX);
+  float *qy = pose.data(TransformBatch::QY);
+  float *qz = pose.data(TransformBatch::QZ);
+  float *qw = pose.data(TransformBatch::QW);
+  for (size_t j = 0; j < Joints; j++) {
+    float scale = 1.f / std::sqrt(qx[j] * qx[j] + qy[j] * qy[j] +
+                                  qz[j] * qz[j] + qw[j] * qw[j]);
+    qx[j] *= scale;
+    qy[j] *= scale;
+    qz[j] *= scale;
+    qw[j] *= scale;
+  }
+}
+
+const std::string &AnimationClip::getName() const { return Name; }
+
+float AnimationClip::getDuration() const { return Duration; }
+
+/////////////////////////////////////////////////////////////////////////// Skin
+
+Skin::Skin()
+    : Clip(-1),
+      Loop(true),
+      Preskinned(false),
+      Time(0.f),
+      Speed(1.f),
+      Owner(nullptr),
+      Slot(0) {}
+
+Skin::~Skin() {}
+
+Skeleton &Skin::getSkeleton() { return Bones; }
+
+void Skin::addClips(const aiScene *scene) {
+  for (unsigned int i = 0; i < scene->mNumAnimations; i++) {
+    Clips.emplace_back();
+    Clips.back().create(scene->mAnimations[i], Bones);
+  }
+}
+
+size_t Skin::getClipCount() { return Clips.size(); }
+
+const AnimationClip &Skin::getClip(size_t index) { return Clips[index]; }
+
+void Skin::play(size_t clip, bool loop) {
+  if (clip >= Clips.size()) return;
+  Clip = static_cast<int32_t>(clip);
+  Loop = loop;
+  Time = 0.f;
+}
+
+// Back to the bind pose.
+void Skin::stop() { Clip = -1; }
+
+void Skin::setSpeed(float speed) { Speed = speed; }
+
+void Skin::setPreskinned(bool preskinned) { Preskinned = preskinned; }
+
+bool Skin::isPreskinned() { return Preskinned; }
+
+void Skin::update(double elapsed) {
+  const size_t n = Bones.size();
+  if (Clip >= 0) {
+    Time += static_cast<float>(elapsed) * Speed;
+    Clips[Clip].sample(Time, Loop, Pose);
+  } else {
+    Pose.clear();
+    for (size_t j = 0; j < n; j++) {
+      Pose.add(Bones.translates[j], Bones.rotations[j], Bones.scales[j]);
+    }
+  }
+  Locals.resize(n);
+  Globals.resize(n);
+  Palette.resize(Bones.getBoneCount(), glm::mat4(1.f));
+  if (n == 0) return;
+
+  Pose.compute(Locals.data());
+  for (size_t j = 0; j < n; j++) {
+    int32_t parent = Bones.parents[j];
+    Globals[j] = parent < 0 ? Locals[j] : Globals[parent] * Locals[j];
+    int32_t bone = Bones.bones[j];
+    if (bone >= 0) {
+      Palette[bone] = Bones.globalInverse * Globals[j] * Bones.offsets[bone];
+    }
+  }
+}
+
+const std::vector<glm::mat4> &Skin::getPalette() { return Palette; }
+
+void Skin::record(CommandList &list) {
+  if (Owner != nullptr) Owner->record(list, Slot);
+}
+
+/////////////////////////////////////////////////////////////////////// Animator
+
+Animator::Animator(GLuint bindingpoint)
+    : BindingPoint(bindingpoint), Capacity(0), PreskinShaders(nullptr) {
+  GLint alignment = 16;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  Stride = Skeleton::MAX_BONES * sizeof(glm::mat4);
+  Stride = (Stride + alignment - 1) / alignment * alignment;
+  glGenBuffers(1, &UboId);
+  VertexCountId = ShaderProgram::getUniformHandle("VertexCount");
+}
+
+Animator::~Animator() {
+  clear();
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glDeleteBuffers(1, &UboId);
+  delete PreskinShaders;
+}
+
+bool Animator::isPreskinSupported() {
+  return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader &&
+                              GLEW_ARB_shader_storage_buffer_object);
+}
+
+void Animator::collect(Node *node) {
+  Mesh *mesh = node->getMesh();
+  if (mesh != nullptr) add(mesh);
+  for (Node *n : node->getChildren()) {
+    collect(n);
+  }
+}
+
+void Animator::build(SceneGraph *scene) {
+  clear();
+  collect(&scene->getRoot());
+}
+
+// Meshes without a skin are ignored.
+void Animator::add(Mesh *mesh) {
+  Skin *skin = mesh->getSkin();
+  if (skin == nullptr || skin->Owner != nullptr) return;
+  skin->Owner = this;
+  skin->Slot = Meshes.size();
+  Meshes.push_back(mesh);
+}
+
+void Animator::clear() {
+  for (Mesh *mesh : Meshes) mesh->getSkin()->Owner = nullptr;
+  Meshes.clear();
+}
+
+size_t Animator::size() { return Meshes.size(); }
+
+// Applies to every skin; skins without that clip keep their state.
+void Animator::play(size_t clip, bool loop) {
+  for (Mesh *mesh : Meshes) mesh->getSkin()->play(clip, loop);
+}
+
+void Animator::setPreskinned(bool preskinned) {
+  for (Mesh *mesh : Meshes) mesh->getSkin()->setPreskinned(preskinned);
+}
+
+void Animator::update(double elapsed, JobSystem *jobs) {
+  update(elapsed, Data, jobs);
+}
+
+void Animator::update(double elapsed, std::vector<unsigned char> &palettes,
+                      JobSystem *jobs) {
+  palettes.resize(Meshes.size() * Stride);
+  auto body = [this, elapsed, &palettes](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      Skin *skin = Meshes[i]->getSkin();
+      skin->update(elapsed);
+      const std::vector<glm::mat4> &palette = skin->getPalette();
+      std::memcpy(&palettes[i * Stride], palette.data(),
+                  palette.size() * sizeof(glm::mat4));
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, Meshes.size(), 1, body);
+  } else {
+    body(0, Meshes.size());
+  }
+}
+
+void Animator::upload() { upload(Data); }
+
+void Animator::upload(const std::vector<unsigned char> &palettes) {
+  if (palettes.empty()) return;
+  GLsizeiptr bytes = static_cast<GLsizeiptr>(palettes.size());
+  glBindBuffer(GL_UNIFORM_BUFFER, UboId);
+  if (bytes > Capacity) {
+    Capacity = bytes;
+    glBufferData(GL_UNIFORM_BUFFER, Capacity, palettes.data(),
+                 GL_STREAM_DRAW);
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, Capacity, 0, GL_STREAM_DRAW);  // orphan
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, palettes.data());
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Without compute shaders the meshes fall back to vertex shader skinning.
+void Animator::preskin() {
+  bool any = false;
+  for (Mesh *mesh : Meshes) any = any || mesh->getSkin()->isPreskinned();
+  if (!any) return;
+  if (!isPreskinSupported()) {
+    std::cerr << "WARNING: pre-skinning needs compute shaders." << std::endl;
+    for (Mesh *mesh : Meshes) mesh->getSkin()->setPreskinned(false);
+    return;
+  }
+  if (PreskinShaders == nullptr) {
+    PreskinShaders = new ShaderProgram();
+    PreskinShaders->addShader(GL_COMPUTE_SHADER, "skin-cs.glsl");
+    PreskinShaders->addUniform("VertexCount");
+    PreskinShaders->addUniformBlock(BONES_BLOCK, BindingPoint);
+    PreskinShaders->create();
+  }
+  PreskinShaders->bind();
+  GLint count = PreskinShaders->getUniformLocation(VertexCountId);
+  for (size_t i = 0; i < Meshes.size(); i++) {
+    if (!Meshes[i]->getSkin()->isPreskinned()) continue;
+    bind(i);
+    glUniform1ui(count,
+                 static_cast<GLuint>(Meshes[i]->getPositions().size()));
+    Meshes[i]->preskin();
+  }
+  PreskinShaders->unbind();
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Animator::bind(size_t slot) {
+  glBindBufferRange(GL_UNIFORM_BUFFER, BindingPoint, UboId,
+                    static_cast<GLintptr>(slot) * Stride,
+                    Skeleton::MAX_BONES * sizeof(glm::mat4));
+}
+
+void Animator::record(CommandList &list, size_t slot) {
+  list.bindBufferRange(BindingPoint, UboId,
+                       static_cast<GLintptr>(slot) * Stride,
+                       Skeleton::MAX_BONES * sizeof(glm::mat4));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Skeletal Animation and Skinning Classes
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_SKINNING_HPP
+#define MGL_SKINNING_HPP
+
+#include <GL/glew.h>
+#include <assimp/scene.h>
+
+#include <atomic>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <string>
+#include <vector>
+
+#include "mglCommandList.hpp"
+#include "mglJobs.hpp"
+#include "mglShader.hpp"
+#include "mglTransformBatch.hpp"
+
+namespace mgl {
+
+class Skeleton;
+class AnimationClip;
+class Skin;
+class Animator;
+class Mesh;
+class SceneGraph;
+class Node;
+
+/////////////////////////////////////////////////////////////////////// Skeleton
+//
+// The node hierarchy of an imported scene in parent-first order, with each
+// joint's bind pose. Joints referenced by mesh bones also get a bone index,
+// the slot of their matrix in the palette the vertex shader reads.
+
+class Skeleton {
+ public:
+  static const int32_t MAX_BONES = 128;
+
+  std::vector<std::string> names;
+  std::vector<int32_t> parents;  // -1 for the root
+  std::vector<int32_t> bones;    // bone index of each joint, or -1
+  std::vector<glm::vec3> translates;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<glm::mat4> offsets;  // inverse bind matrix of each bone
+  glm::mat4 globalInverse;
+
+  Skeleton();
+
+  void create(const aiNode *root);
+  int32_t findJoint(const std::string &name) const;
+  int32_t addBone(const std::string &name, const glm::mat4 &offset);
+  size_t size() const;
+  size_t getBoneCount() const;
+};
+
+////////////////////////////////////////////////////////////////// AnimationClip
+//
+// An Assimp animation resampled at a fixed rate for every joint, so that
+// sampling is two frame lookups and a linear blend. Keys are stored frame by
+// frame, one contiguous array per component (translation, rotation, scale),
+// which sample() blends straight into a TransformBatch. Quaternions are kept
+// in the same hemisphere as the previous frame, so blending them linearly
+// and normalising (nlerp) does not take the long way round.
+
+class AnimationClip {
+ public:
+  AnimationClip();
+
+  void create(const aiAnimation *animation, const Skeleton &skeleton,
+              float frameRate = 30.f);
+  void sample(float time, bool loop, TransformBatch &pose) const;
+  const std::string &getName() const;
+  float getDuration() const;
+
+ private:
+  std::string Name;
+  float Duration, FrameRate;
+  size_t Frames, Joints;
+  std::vector<float> Keys;  // [frame][component][joint]
+
+  const float *key(size_t frame, int component) const;
+  float *key(size_t frame, int component);
+};
+
+/////////////////////////////////////////////////////////////////////////// Skin
+//
+// Skeleton, clips and playback state of a skinned mesh. update() samples
+// the current clip and rebuilds the bone palette; it only touches this skin,
+// so skins can be updated on different threads. Preskinned meshes are
+// skinned once per frame by a compute pass and then drawn like static ones;
+// the flag is read by the update thread and may be set by the GL thread.
+
+class Skin {
+  friend class Animator;
+
+ public:
+  Skin();
+  ~Skin();
+
+  Skeleton &getSkeleton();
+  void addClips(const aiScene *scene);
+  size_t getClipCount();
+  const AnimationClip &getClip(size_t index);
+
+  void play(size_t clip, bool loop = true);
+  void stop();
+  void setSpeed(float speed);
+  void setPreskinned(bool preskinned);
+  bool isPreskinned();
+
+  void update(double elapsed);
+  const std::vector<glm::mat4> &getPalette();
+  void record(CommandList &list);
+
+ private:
+  Skeleton Bones;
+  std::vector<AnimationClip> Clips;
+  int32_t Clip;
+  bool Loop;
+  std::atomic<bool> Preskinned;
+  float Time, Speed;
+  TransformBatch Pose;
+  std::vector<glm::mat4> Locals, Globals, Palette;
+  Animator *Owner;
+  size_t Slot;
+};
+
+/////////////////////////////////////////////////////////////////////// Animator
+//
+// Updates the skins of a scene on the job system and uploads all their
+// palettes to one uniform buffer, each skin binding its range to the
+// "Bones" block. update() and upload() work on the animator's own copy of
+// the palettes, or on one given, such as that of a frame packet: the update
+// thread samples into it without GL calls and the GL thread only uploads
+// it. preskin() runs the compute pass of the preskinned meshes (OpenGL
+// 4.3); call it after upload() and before drawing.
+
+class Animator {
+ public:
+  explicit Animator(GLuint bindingpoint);
+  ~Animator();
+
+  static bool isPreskinSupported();
+
+  void build(SceneGraph *scene);
+  void add(Mesh *mesh);
+  void clear();
+  size_t size();
+  void play(size_t clip, bool loop = true);
+  void setPreskinned(bool preskinned);
+
+  void update(double elapsed, JobSystem *jobs = nullptr);
+  void update(double elapsed, std::vector<unsigned char> &palettes,
+              JobSystem *jobs = nullptr);
+  void upload();
+  void upload(const std::vector<unsigned char> &palettes);
+  void preskin();
+  void bind(size_t slot);
+  void record(CommandList &list, size_t slot);
+
+ private:
+  std::vector<Mesh *> Meshes;
+  GLuint UboId, BindingPoint;
+  GLsizeiptr Stride, Capacity;
+  std::vector<unsigned char> Data;
+  ShaderProgram *PreskinShaders;
+  UniformHandle VertexCountId;
+
+  void collect(Node *node);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_SKINNING_HPP */
@@ -1,29 +1,71 @@
 #include "mglTransform.hpp"
+#include "mglScenegraph.hpp"
 #include <glm/glm.hpp>
 #include <GL/glew.h>
 
 namespace mgl {
+	void Transform::invalidate() {
+		dirty = true;
+		if (owner != nullptr) {
+			owner->invalidate();
+		}
+	}
+
 	void Transform::setTranslate(glm::vec3 t) {
 		translate = t;
+		invalidate();
 	}
 
 	void Transform::setRotation(float degrees, glm::vec3 axis) {
-		rotationAxis = axis;
-		rotationDegrees = degrees;
+		rotation = glm::angleAxis(glm::radians(degrees), glm::normalize(axis));
+		invalidate();
+	}
+
+	void Transform::setRotation(const glm::quat& q) {
+		rotation = glm::normalize(q);
+		invalidate();
 	}
 
 	void Transform::setScale(glm::vec3 s) {
 		scale = s;
+		invalidate();
 	}
 
 	void Transform::calculateModelMatrix() {
 		glm::mat4 T = glm::translate(glm::mat4(1.f), translate);
-		glm::mat4 R = glm::rotate(T, glm::radians(rotationDegrees), rotationAxis);
+		glm::mat4 R = T * glm::mat4_cast(rotation);
 		
 		this->modelMatrix = glm::scale(R, scale);
+		dirty = false;
 	}
 
 	glm::mat4 Transform::getModelMatrix() {
+		if (dirty) {
+			calculateModelMatrix();
+		}
 		return modelMatrix;
 	}
-}
\ No newline at end of file
+
+	glm::vec3 Transform::getTranslate() {
+		return translate;
+	}
+
+	glm::quat Transform::getRotation() {
+		return rotation;
+	}
+
+	glm::vec3 Transform::getScale() {
+		return scale;
+	}
+
+	bool Transform::isDirty() {
+		return dirty;
+	}
+
+	void Transform::setOwner(Node* node) {
+		owner = node;
+		if (owner != nullptr) {
+			owner->invalidate();
+		}
+	}
+}
@@ -3,14 +3,27 @@
 
 #include <glm/glm.hpp>
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/quaternion.hpp"
 
 namespace mgl {
+	class Node;
+
+	// The model matrix is rebuilt lazily after a setter has changed it; the
+	// setters also invalidate the owning node so the scene graph can refresh
+	// the world matrices below it. Writing the fields directly bypasses this.
+	// Rotations are kept as unit quaternions; TransformBatch converts many
+	// transforms to matrices at once.
 	class Transform {
 
+	private:
+		bool dirty = true;
+		Node* owner = nullptr;
+
+		void invalidate();
+
 	public:
 		glm::vec3 translate = glm::vec3(0, 0, 0);
-		float rotationDegrees = 0;
-		glm::vec3 rotationAxis = glm::vec3(0, 1, 0);
+		glm::quat rotation = glm::quat(1, 0, 0, 0);
 		glm::vec3 scale = glm::vec3(1.0f);
 		glm::mat4 modelMatrix = glm::mat4(1.0f);
 
@@ -19,9 +32,15 @@ namespace mgl {
 
 		void setTranslate(glm::vec3 t);
 		void setRotation(float degrees, glm::vec3 axis);
+		void setRotation(const glm::quat& q);
+		glm::vec3 getTranslate();
+		glm::quat getRotation();
+		glm::vec3 getScale();
 		void setScale(glm::vec3 s);
 		void calculateModelMatrix();
 		glm::mat4 getModelMatrix();
+		bool isDirty();
+		void setOwner(Node* node);
 
 	};
 }
@@ -0,0 +1,223 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transform Batch Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglTransformBatch.hpp"
+
+#include "./mglSimd.hpp"
+
+namespace mgl {
+
+///////////////////////////////////////////////////////////////// TransformBatch
+
+TransformBatch::TransformBatch() {}
+
+TransformBatch::~TransformBatch() {}
+
+size_t TransformBatch::add(const glm::vec3 &translate,
+                           const glm::quat &rotation, const glm::vec3 &scale) {
+  Tx.push_back(translate.x);
+  Ty.push_back(translate.y);
+  Tz.push_back(translate.z);
+  Qx.push_back(rotation.x);
+  Qy.push_back(rotation.y);
+  Qz.push_back(rotation.z);
+  Qw.push_back(rotation.w);
+  Sx.push_back(scale.x);
+  Sy.push_back(scale.y);
+  Sz.push_back(scale.z);
+  return Tx.size() - 1;
+}
+
+void TransformBatch::set(size_t index, const glm::vec3 &translate,
+                         const glm::quat &rotation, const glm::vec3 &scale) {
+  Tx[index] = translate.x;
+  Ty[index] = translate.y;
+  Tz[index] = translate.z;
+  Qx[index] = rotation.x;
+  Qy[index] = rotation.y;
+  Qz[index] = rotation.z;
+  Qw[index] = rotation.w;
+  Sx[index] = scale.x;
+  Sy[index] = scale.y;
+  Sz[index] = scale.z;
+}
+
+void TransformBatch::clear() {
+  Tx.clear();
+  Ty.clear();
+  Tz.clear();
+  Qx.clear();
+  Qy.clear();
+  Qz.clear();
+  Qw.clear();
+  Sx.clear();
+  Sy.clear();
+  Sz.clear();
+}
+
+void TransformBatch::resize(size_t count) {
+  Tx.resize(count);
+  Ty.resize(count);
+  Tz.resize(count);
+  Qx.resize(count);
+  Qy.resize(count);
+  Qz.resize(count);
+  Qw.resize(count);
+  Sx.resize(count);
+  Sy.resize(count);
+  Sz.resize(count);
+}
+
+size_t TransformBatch::size() { return Tx.size(); }
+
+float *TransformBatch::data(Component component) {
+  switch (component) {
+    case TX: return Tx.data();
+    case TY: return Ty.data();
+    case TZ: return Tz.data();
+    case QX: return Qx.data();
+    case QY: return Qy.data();
+    case QZ: return Qz.data();
+    case QW: return Qw.data();
+    case SX: return Sx.data();
+    case SY: return Sy.data();
+    default: return Sz.data();
+  }
+}
+
+void TransformBatch::computeScalar(glm::mat4 *out, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    float x = Qx[i], y = Qy[i], z = Qz[i], w = Qw[i];
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+    glm::mat4 &m = out[i];
+    m[0] = glm::vec4(1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy),
+                     0.f) * Sx[i];
+    m[1] = glm::vec4(2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx),
+                     0.f) * Sy[i];
+    m[2] = glm::vec4(2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy),
+                     0.f) * Sz[i];
+    m[3] = glm::vec4(Tx[i], Ty[i], Tz[i], 1.f);
+  }
+}
+
+#ifdef MGL_SSE2
+
+// Four lanes hold the same matrix element of four entries; transposing each
+// column's rows turns them back into per-entry columns.
+static inline void storeColumns(glm::mat4 *out, __m128 r0, __m128 r1,
+                                __m128 r2, __m128 r3, int column) {
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_ps(&out[0][column][0], r0);
+  _mm_storeu_ps(&out[1][column][0], r1);
+  _mm_storeu_ps(&out[2][column][0], r2);
+  _mm_storeu_ps(&out[3][column][0], r3);
+}
+
+static inline void trs4(glm::mat4 *out, __m128 tx, __m128 ty, __m128 tz,
+                        __m128 x, __m128 y, __m128 z, __m128 w, __m128 sx,
+                        __m128 sy, __m128 sz) {
+  const __m128 one = _mm_set1_ps(1.f), two = _mm_set1_ps(2.f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+  __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+  __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+  __m128 m00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+  __m128 m01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+  __m128 m02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+  __m128 m10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+  __m128 m11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+  __m128 m12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+  __m128 m20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+  __m128 m21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+  __m128 m22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+  storeColumns(out, _mm_mul_ps(m00, sx), _mm_mul_ps(m01, sx),
+               _mm_mul_ps(m02, sx), zero, 0);
+  storeColumns(out, _mm_mul_ps(m10, sy), _mm_mul_ps(m11, sy),
+               _mm_mul_ps(m12, sy), zero, 1);
+  storeColumns(out, _mm_mul_ps(m20, sz), _mm_mul_ps(m21, sz),
+               _mm_mul_ps(m22, sz), zero, 2);
+  storeColumns(out, tx, ty, tz, one, 3);
+}
+
+#ifdef MGL_AVX2
+
+// Same as trs4 over eight lanes; each 8-wide row is split for the stores.
+static inline void storeColumns8(glm::mat4 *out, __m256 r0, __m256 r1,
+                                 __m256 r2, __m256 r3, int column) {
+  storeColumns(out, _mm256_castps256_ps128(r0), _mm256_castps256_ps128(r1),
+               _mm256_castps256_ps128(r2), _mm256_castps256_ps128(r3), column);
+  storeColumns(out + 4, _mm256_extractf128_ps(r0, 1),
+               _mm256_extractf128_ps(r1, 1), _mm256_extractf128_ps(r2, 1),
+               _mm256_extractf128_ps(r3, 1), column);
+}
+
+static inline void trs8(glm::mat4 *out, __m256 tx, __m256 ty, __m256 tz,
+                        __m256 x, __m256 y, __m256 z, __m256 w, __m256 sx,
+                        __m256 sy, __m256 sz) {
+  const __m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f);
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y);
+  __m256 zz = _mm256_mul_ps(z, z), xy = _mm256_mul_ps(x, y);
+  __m256 xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+  __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y);
+  __m256 wz = _mm256_mul_ps(w, z);
+
+  __m256 m00 = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz)));
+  __m256 m01 = _mm256_mul_ps(two, _mm256_add_ps(xy, wz));
+  __m256 m02 = _mm256_mul_ps(two, _mm256_sub_ps(xz, wy));
+  __m256 m10 = _mm256_mul_ps(two, _mm256_sub_ps(xy, wz));
+  __m256 m11 = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz)));
+  __m256 m12 = _mm256_mul_ps(two, _mm256_add_ps(yz, wx));
+  __m256 m20 = _mm256_mul_ps(two, _mm256_add_ps(xz, wy));
+  __m256 m21 = _mm256_mul_ps(two, _mm256_sub_ps(yz, wx));
+  __m256 m22 = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy)));
+
+  storeColumns8(out, _mm256_mul_ps(m00, sx), _mm256_mul_ps(m01, sx),
+                _mm256_mul_ps(m02, sx), zero, 0);
+  storeColumns8(out, _mm256_mul_ps(m10, sy), _mm256_mul_ps(m11, sy),
+                _mm256_mul_ps(m12, sy), zero, 1);
+  storeColumns8(out, _mm256_mul_ps(m20, sz), _mm256_mul_ps(m21, sz),
+                _mm256_mul_ps(m22, sz), zero, 2);
+  storeColumns8(out, tx, ty, tz, one, 3);
+}
+
+#endif
+
+void TransformBatch::compute(glm::mat4 *out) {
+  const size_t n = size();
+  size_t i = 0;
+#ifdef MGL_AVX2
+  for (; i + 8 <= n; i += 8) {
+    trs8(out + i, _mm256_loadu_ps(&Tx[i]), _mm256_loadu_ps(&Ty[i]),
+         _mm256_loadu_ps(&Tz[i]), _mm256_loadu_ps(&Qx[i]),
+         _mm256_loadu_ps(&Qy[i]), _mm256_loadu_ps(&Qz[i]),
+         _mm256_loadu_ps(&Qw[i]), _mm256_loadu_ps(&Sx[i]),
+         _mm256_loadu_ps(&Sy[i]), _mm256_loadu_ps(&Sz[i]));
+  }
+#endif
+  for (; i + 4 <= n; i += 4) {
+    trs4(out + i, _mm_loadu_ps(&Tx[i]), _mm_loadu_ps(&Ty[i]),
+         _mm_loadu_ps(&Tz[i]), _mm_loadu_ps(&Qx[i]), _mm_loadu_ps(&Qy[i]),
+         _mm_loadu_ps(&Qz[i]), _mm_loadu_ps(&Qw[i]), _mm_loadu_ps(&Sx[i]),
+         _mm_loadu_ps(&Sy[i]), _mm_loadu_ps(&Sz[i]));
+  }
+  computeScalar(out, i, n);
+}
+
+#else
+
+void TransformBatch::compute(glm::mat4 *out) { computeScalar(out, 0, size()); }
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
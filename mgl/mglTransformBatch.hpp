@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transform Batch Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_TRANSFORM_BATCH_HPP
+#define MGL_TRANSFORM_BATCH_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+namespace mgl {
+
+class TransformBatch;
+
+///////////////////////////////////////////////////////////////// TransformBatch
+//
+// Translation, rotation (unit quaternion) and scale of many transforms in
+// structure-of-arrays form, one array per component. compute() builds the
+// T * R * S matrices of 8 (AVX2) or 4 (SSE2) entries per iteration, the
+// remainder and non-SIMD builds taking the scalar path. data() exposes a
+// component array so producers such as animation sampling can write
+// straight into the batch.
+
+class TransformBatch {
+ public:
+  enum Component { TX, TY, TZ, QX, QY, QZ, QW, SX, SY, SZ, COMPONENTS };
+
+  TransformBatch();
+  ~TransformBatch();
+
+  size_t add(const glm::vec3 &translate, const glm::quat &rotation,
+             const glm::vec3 &scale);
+  void set(size_t index, const glm::vec3 &translate, const glm::quat &rotation,
+           const glm::vec3 &scale);
+  void clear();
+  void resize(size_t count);
+  size_t size();
+  float *data(Component component);
+
+  void compute(glm::mat4 *out);
+  void computeScalar(glm::mat4 *out, size_t begin, size_t end);
+
+ private:
+  std::vector<float> Tx, Ty, Tz;
+  std::vector<float> Qx, Qy, Qz, Qw;
+  std::vector<float> Sx, Sy, Sz;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_TRANSFORM_BATCH_HPP */
@@ -0,0 +1,834 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Virtual Mesh Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "./mglVirtualMesh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+#include "./mglCamera.hpp"
+#include "./mglHash.hpp"
+#include "./mglJobs.hpp"
+
+namespace mgl {
+
+const size_t VirtualMesh::CLUSTER_TRIANGLES;
+const size_t VirtualMesh::CLUSTER_VERTICES;
+const size_t VirtualMesh::GROUP_CLUSTERS;
+const size_t VirtualMesh::PAGE_COUNT;
+
+////////////////////////////////////////////////////////////////////// Geometry
+
+static uint32_t spreadBits(uint32_t x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+// Orders points along a Morton curve over their bounds, so that runs of
+// them are spatially compact.
+static void mortonOrder(const std::vector<glm::vec3> &points,
+                        std::vector<uint32_t> &order) {
+  glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (const glm::vec3 &p : points) {
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  glm::vec3 scale(0.f);
+  for (int a = 0; a < 3; a++) {
+    if (hi[a] > lo[a]) scale[a] = 1023.f / (hi[a] - lo[a]);
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> keyed(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    glm::vec3 q = glm::clamp((points[i] - lo) * scale, 0.f, 1023.f);
+    uint32_t key = spreadBits(static_cast<uint32_t>(q.x)) |
+                   spreadBits(static_cast<uint32_t>(q.y)) << 1 |
+                   spreadBits(static_cast<uint32_t>(q.z)) << 2;
+    keyed[i] = std::make_pair(key, static_cast<uint32_t>(i));
+  }
+  std::sort(keyed.begin(), keyed.end());
+  order.resize(points.size());
+  for (size_t i = 0; i < keyed.size(); i++) order[i] = keyed[i].second;
+}
+
+static glm::vec4 boundingSphere(const std::vector<glm::vec3> &points) {
+  glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (const glm::vec3 &p : points) {
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  glm::vec3 center = 0.5f * (lo + hi);
+  float radius = 0.f;
+  for (const glm::vec3 &p : points) {
+    radius = std::max(radius, glm::length(p - center));
+  }
+  return glm::vec4(center, radius);
+}
+
+static glm::vec4 mergeSpheres(const glm::vec4 &a, const glm::vec4 &b) {
+  glm::vec3 d = glm::vec3(b) - glm::vec3(a);
+  float distance = glm::length(d);
+  if (distance + b.w <= a.w) return a;
+  if (distance + a.w <= b.w) return b;
+  float radius = 0.5f * (distance + a.w + b.w);
+  return glm::vec4(glm::vec3(a) + d * ((radius - a.w) / distance), radius);
+}
+
+struct PositionHash {
+  size_t operator()(const glm::vec3 &p) const {
+    const glm::vec3 q = p + glm::vec3(0.f);  // -0 hashes as 0
+    return static_cast<size_t>(hash64(&q, sizeof(q)));
+  }
+};
+
+////////////////////////////////////////////////////////////////// Simplifying
+
+// Symmetric 4x4 matrix summing the squared distances to a set of planes,
+// weighted by area. error() is their mean, so it does not grow with the
+// number of planes.
+struct Quadric {
+  double q[10] = {};
+  double weight = 0.0;
+
+  void addPlane(const glm::vec3 &n, float d, float area) {
+    const double p[4] = {n.x, n.y, n.z, d};
+    for (int i = 0, k = 0; i < 4; i++) {
+      for (int j = i; j < 4; j++) q[k++] += area * p[i] * p[j];
+    }
+    weight += area;
+  }
+
+  void add(const Quadric &other) {
+    for (int i = 0; i < 10; i++) q[i] += other.q[i];
+    weight += other.weight;
+  }
+
+  double error(const glm::vec3 &v) const {
+    if (weight <= 0.0) return 0.0;
+    const double x = v.x, y = v.y, z = v.z;
+    double sum = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+                 2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z +
+                 2 * q[6] * y + q[7] * z * z + 2 * q[8] * z + q[9];
+    return std::max(0.0, sum / weight);
+  }
+};
+
+struct Collapse {
+  double cost;
+  uint32_t from, to;
+  uint32_t fromVersion, toVersion;
+
+  bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+static uint64_t edgeKey(uint32_t a, uint32_t b) {
+  return a < b ? uint64_t(a) << 32 | b : uint64_t(b) << 32 | a;
+}
+
+// Collapses edges onto one of their ends, cheapest quadric error first,
+// until target triangles remain. Locked vertices, and those on an edge with
+// a single triangle in the group, never move; collapses that would flip a
+// triangle are skipped. Returns the largest error taken, as a distance.
+static float simplifyGroup(const std::vector<glm::vec3> &positions,
+                           const std::vector<uint8_t> &locked,
+                           std::vector<uint32_t> &triangles, size_t target) {
+  std::unordered_map<uint32_t, uint32_t> local;
+  std::vector<uint32_t> global;
+  std::vector<uint32_t> tris(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    auto inserted = local.insert(std::make_pair(
+        triangles[i], static_cast<uint32_t>(global.size())));
+    if (inserted.second) global.push_back(triangles[i]);
+    tris[i] = inserted.first->second;
+  }
+  const size_t n = global.size();
+  const size_t count = tris.size() / 3;
+  std::vector<glm::vec3> p(n);
+  std::vector<uint8_t> fixed(n), removed(n, 0);
+  std::vector<uint32_t> version(n, 0);
+  std::vector<Quadric> quadrics(n);
+  std::vector<std::vector<uint32_t>> around(n);
+  std::vector<uint8_t> alive(count, 1);
+  std::unordered_map<uint64_t, uint32_t> edges;
+  for (size_t v = 0; v < n; v++) {
+    p[v] = positions[global[v]];
+    fixed[v] = locked[global[v]];
+  }
+  for (uint32_t t = 0; t < count; t++) {
+    const uint32_t *v = &tris[3 * t];
+    glm::vec3 normal = glm::cross(p[v[1]] - p[v[0]], p[v[2]] - p[v[0]]);
+    float length = glm::length(normal);
+    for (int k = 0; k < 3; k++) {
+      if (length > 0.f) {
+        quadrics[v[k]].addPlane(normal / length,
+                                -glm::dot(normal / length, p[v[0]]),
+                                0.5f * length);
+      }
+      around[v[k]].push_back(t);
+      edges[edgeKey(v[k], v[(k + 1) % 3])]++;
+    }
+  }
+  for (const std::pair<const uint64_t, uint32_t> &e : edges) {
+    if (e.second == 1) {
+      fixed[e.first >> 32] = 1;
+      fixed[e.first & 0xffffffff] = 1;
+    }
+  }
+
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>>
+      heap;
+  auto push = [&](uint32_t from, uint32_t to) {
+    if (fixed[from]) return;
+    Quadric q = quadrics[from];
+    q.add(quadrics[to]);
+    Collapse c = {q.error(p[to]), from, to, version[from], version[to]};
+    heap.push(c);
+  };
+  for (const std::pair<const uint64_t, uint32_t> &e : edges) {
+    uint32_t a = static_cast<uint32_t>(e.first >> 32);
+    uint32_t b = static_cast<uint32_t>(e.first & 0xffffffff);
+    push(a, b);
+    push(b, a);
+  }
+
+  size_t remaining = count;
+  double worst = 0.0;
+  std::vector<uint32_t> ring, shared;
+  while (remaining > target && !heap.empty()) {
+    Collapse c = heap.top();
+    heap.pop();
+    if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion ||
+        version[c.to] != c.toVersion) {
+      continue;
+    }
+    size_t adjacent = 0;
+    bool flips = false;
+    ring.clear();
+    for (uint32_t t : around[c.from]) {
+      if (!alive[t]) continue;
+      const uint32_t *v = &tris[3 * t];
+      for (int k = 0; k < 3; k++) {
+        if (v[k] != c.from && v[k] != c.to) ring.push_back(v[k]);
+      }
+      if (v[0] == c.to || v[1] == c.to || v[2] == c.to) {
+        adjacent++;
+        continue;
+      }
+      glm::vec3 q[3];
+      for (int k = 0; k < 3; k++) q[k] = v[k] == c.from ? p[c.to] : p[v[k]];
+      glm::vec3 before = glm::cross(p[v[1]] - p[v[0]], p[v[2]] - p[v[0]]);
+      glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+      if (glm::dot(before, after) <= 0.f) {
+        flips = true;
+        break;
+      }
+    }
+    if (adjacent == 0 || flips) continue;
+
+    // Both ends may only share the vertices opposite the edge, or the
+    // collapse would leave the surface non manifold. Locked vertices may
+    // already be joined outside the group, so no new edge between two of
+    // them is made.
+    std::sort(ring.begin(), ring.end());
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+    shared.clear();
+    for (uint32_t t : around[c.to]) {
+      if (!alive[t]) continue;
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = tris[3 * t + k];
+        if (v != c.to && v != c.from &&
+            std::binary_search(ring.begin(), ring.end(), v)) {
+          shared.push_back(v);
+        }
+      }
+    }
+    std::sort(shared.begin(), shared.end());
+    shared.erase(std::unique(shared.begin(), shared.end()), shared.end());
+    bool joins = false;
+    for (size_t i = 0; i < ring.size() && locked[global[c.to]]; i++) {
+      joins = locked[global[ring[i]]] &&
+              !std::binary_search(shared.begin(), shared.end(), ring[i]);
+      if (joins) break;
+    }
+    if (shared.size() != adjacent || joins) continue;
+
+    for (uint32_t t : around[c.from]) {
+      if (!alive[t]) continue;
+      uint32_t *v = &tris[3 * t];
+      if (v[0] == c.to || v[1] == c.to || v[2] == c.to) {
+        alive[t] = 0;
+        remaining--;
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        if (v[k] == c.from) v[k] = c.to;
+      }
+      around[c.to].push_back(t);
+    }
+    quadrics[c.to].add(quadrics[c.from]);
+    removed[c.from] = 1;
+    version[c.to]++;
+    worst = std::max(worst, c.cost);
+    for (uint32_t t : around[c.to]) {
+      if (!alive[t]) continue;
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = tris[3 * t + k];
+        if (v == c.to) continue;
+        push(v, c.to);
+        push(c.to, v);
+      }
+    }
+  }
+
+  triangles.clear();
+  for (uint32_t t = 0; t < count; t++) {
+    if (!alive[t]) continue;
+    for (int k = 0; k < 3; k++) triangles.push_back(global[tris[3 * t + k]]);
+  }
+  return static_cast<float>(std::sqrt(std::max(0.0, worst)));
+}
+
+//////////////////////////////////////////////////////////////////// Clustering
+
+// Grows clusters of at most CLUSTER_TRIANGLES triangles and CLUSTER_VERTICES
+// vertices from seeds taken along a Morton curve of the triangle centroids,
+// adding the adjacent triangle nearest to the seed until full. Each cluster
+// gets its own copy of its vertices and byte indices.
+static void makeClusters(const std::vector<VirtualMesh::Vertex> &welded,
+                         const std::vector<uint32_t> &triangles, uint32_t level,
+                         std::vector<VirtualMesh::Vertex> &vertices,
+                         std::vector<uint8_t> &indices,
+                         std::vector<VirtualMesh::Cluster> &clusters,
+                         std::vector<std::vector<uint32_t>> &clusterTriangles) {
+  const size_t count = triangles.size() / 3;
+  std::vector<glm::vec3> centroids(count);
+  for (size_t t = 0; t < count; t++) {
+    centroids[t] = (welded[triangles[3 * t]].position +
+                    welded[triangles[3 * t + 1]].position +
+                    welded[triangles[3 * t + 2]].position) /
+                   3.f;
+  }
+  std::vector<uint32_t> order;
+  mortonOrder(centroids, order);
+
+  std::unordered_map<uint32_t, uint32_t> local;
+  std::vector<uint32_t> members, current;
+  auto close = [&]() {
+    if (current.empty()) return;
+    VirtualMesh::Cluster c = {};
+    c.vertexOffset = static_cast<uint32_t>(vertices.size());
+    c.vertexCount = static_cast<uint32_t>(members.size());
+    c.indexOffset = static_cast<uint32_t>(indices.size());
+    c.indexCount = static_cast<uint32_t>(current.size());
+    c.level = level;
+    std::vector<glm::vec3> points;
+    for (uint32_t v : members) {
+      vertices.push_back(welded[v]);
+      points.push_back(welded[v].position);
+    }
+    for (uint32_t v : current) indices.push_back(static_cast<uint8_t>(local[v]));
+    c.bounds = boundingSphere(points);
+    c.lodBounds = c.bounds;
+    c.error = 0.f;
+    c.parentBounds = c.bounds;
+    c.parentError = FLT_MAX;
+    clusters.push_back(c);
+    clusterTriangles.push_back(current);
+    local.clear();
+    members.clear();
+    current.clear();
+  };
+  std::unordered_map<uint32_t, uint32_t> slot;
+  std::vector<uint32_t> start(1, 0);
+  for (uint32_t v : triangles) {
+    if (slot.insert(std::make_pair(v, static_cast<uint32_t>(slot.size())))
+            .second) {
+      start.push_back(0);
+    }
+    start[slot[v] + 1]++;
+  }
+  for (size_t v = 1; v < start.size(); v++) start[v] += start[v - 1];
+  std::vector<uint32_t> adjacent(triangles.size());
+  std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+  for (size_t i = 0; i < triangles.size(); i++) {
+    adjacent[fill[slot[triangles[i]]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  typedef std::pair<float, uint32_t> Candidate;
+  std::vector<Candidate> frontier;
+  std::vector<uint8_t> assigned(count, 0);
+  for (size_t cursor = 0; cursor < count; cursor++) {
+    if (assigned[order[cursor]]) continue;
+    const glm::vec3 center = centroids[order[cursor]];
+    frontier.assign(1, Candidate(0.f, order[cursor]));
+    while (!frontier.empty() &&
+           current.size() < 3 * VirtualMesh::CLUSTER_TRIANGLES) {
+      std::pop_heap(frontier.begin(), frontier.end(),
+                    std::greater<Candidate>());
+      uint32_t t = frontier.back().second;
+      frontier.pop_back();
+      if (assigned[t]) continue;
+      const uint32_t *v = &triangles[3 * t];
+      size_t added = 0;
+      for (int k = 0; k < 3; k++) added += local.count(v[k]) == 0;
+      if (members.size() + added > VirtualMesh::CLUSTER_VERTICES) continue;
+      assigned[t] = 1;
+      for (int k = 0; k < 3; k++) {
+        auto inserted = local.insert(
+            std::make_pair(v[k], static_cast<uint32_t>(members.size())));
+        if (inserted.second) members.push_back(v[k]);
+        current.push_back(v[k]);
+        uint32_t s = slot[v[k]];
+        for (uint32_t i = start[s]; i < start[s + 1]; i++) {
+          if (assigned[adjacent[i]]) continue;
+          glm::vec3 d = centroids[adjacent[i]] - center;
+          frontier.push_back(Candidate(glm::dot(d, d), adjacent[i]));
+          std::push_heap(frontier.begin(), frontier.end(),
+                         std::greater<Candidate>());
+        }
+      }
+    }
+    close();
+  }
+}
+
+// Grows groups from seeds taken along a Morton curve of the cluster centers,
+// adding the neighbour that shares the most vertices with the group until it
+// holds the triangles of GROUP_CLUSTERS full clusters, so that groups are
+// compact, their borders short, and the small clusters of upper levels still
+// merge.
+static void groupClusters(
+    const std::vector<uint32_t> &level, const std::vector<glm::vec3> &centers,
+    const std::vector<std::vector<uint32_t>> &clusterTriangles,
+    std::vector<std::vector<uint32_t>> &groups) {
+  std::vector<std::pair<uint32_t, uint32_t>> uses;
+  std::vector<uint32_t> unique;
+  for (size_t i = 0; i < level.size(); i++) {
+    unique = clusterTriangles[level[i]];
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    for (uint32_t v : unique) {
+      uses.push_back(std::make_pair(v, static_cast<uint32_t>(i)));
+    }
+  }
+  std::sort(uses.begin(), uses.end());
+  std::vector<std::unordered_map<uint32_t, uint32_t>> shared(level.size());
+  for (size_t run = 0, end = 0; run < uses.size(); run = end) {
+    while (end < uses.size() && uses[end].first == uses[run].first) end++;
+    for (size_t a = run; a < end; a++) {
+      for (size_t b = a + 1; b < end; b++) {
+        shared[uses[a].second][uses[b].second]++;
+        shared[uses[b].second][uses[a].second]++;
+      }
+    }
+  }
+
+  std::vector<uint32_t> order;
+  mortonOrder(centers, order);
+  std::vector<uint8_t> grouped(level.size(), 0);
+  std::unordered_map<uint32_t, uint32_t> score;
+  groups.clear();
+  for (uint32_t seed : order) {
+    if (grouped[seed]) continue;
+    std::vector<uint32_t> group;
+    score.clear();
+    uint32_t next = seed;
+    size_t triangles = 0;
+    while (true) {
+      grouped[next] = 1;
+      group.push_back(level[next]);
+      triangles += clusterTriangles[level[next]].size() / 3;
+      if (triangles >= VirtualMesh::GROUP_CLUSTERS *
+                           VirtualMesh::CLUSTER_TRIANGLES) {
+        break;
+      }
+      for (const std::pair<const uint32_t, uint32_t> &n : shared[next]) {
+        if (!grouped[n.first]) score[n.first] += n.second;
+      }
+      uint32_t best = 0, bestScore = 0;
+      for (const std::pair<const uint32_t, uint32_t> &s : score) {
+        if (grouped[s.first]) continue;
+        if (s.second > bestScore || (s.second == bestScore && s.first < best)) {
+          best = s.first;
+          bestScore = s.second;
+        }
+      }
+      if (bestScore == 0) break;
+      next = best;
+    }
+    groups.push_back(group);
+  }
+}
+
+/////////////////////////////////////////////////////////////////// VirtualMesh
+
+VirtualMesh::VirtualMesh()
+    : LevelCount(0), VaoId(0), Clock(0), Frame(0), PoolWarned(false) {
+  BufferIds[0] = BufferIds[1] = 0;
+}
+
+VirtualMesh::~VirtualMesh() { destroyBufferObjects(); }
+
+// Groups are formed anew at every level, so that the locked borders move. A
+// group takes the largest error of its clusters and of its own
+// simplification, and bounds enclosing theirs, so errors and bounds only
+// grow towards the roots. Building stops at one cluster, or once a level no
+// longer simplifies.
+void VirtualMesh::build(Mesh &mesh, JobSystem *jobs) {
+  Vertices.clear();
+  Indices.clear();
+  Clusters.clear();
+  Selected.clear();
+  LevelCount = 0;
+
+  const std::vector<glm::vec3> &positions = mesh.getPositions();
+  const std::vector<glm::vec3> &normals = mesh.getNormals();
+  const std::vector<unsigned int> &indices = mesh.getIndices();
+  const bool hasNormals = mesh.hasNormals() && normals.size() == positions.size();
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> weld;
+  std::vector<uint32_t> remap(positions.size());
+  std::vector<Vertex> welded;
+  for (size_t v = 0; v < positions.size(); v++) {
+    auto inserted = weld.insert(
+        std::make_pair(positions[v], static_cast<uint32_t>(welded.size())));
+    if (inserted.second) {
+      Vertex vertex = {positions[v], glm::vec3(0.f)};
+      welded.push_back(vertex);
+    }
+    remap[v] = inserted.first->second;
+    if (hasNormals) welded[remap[v]].normal += normals[v];
+  }
+  std::vector<uint32_t> triangles;
+  for (const Mesh::MeshData &sub : mesh.getMeshData()) {
+    for (size_t i = 0; i + 2 < sub.nIndices; i += 3) {
+      uint32_t t[3];
+      bool valid = true;
+      for (int k = 0; k < 3; k++) {
+        size_t v = size_t(indices[sub.baseIndex + i + k]) + sub.baseVertex;
+        valid = valid && v < remap.size();
+        t[k] = valid ? remap[v] : 0;
+      }
+      if (!valid || t[0] == t[1] || t[1] == t[2] || t[0] == t[2]) continue;
+      triangles.insert(triangles.end(), t, t + 3);
+    }
+  }
+  if (!hasNormals) {
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+      const glm::vec3 &a = welded[triangles[i]].position;
+      glm::vec3 n = glm::cross(welded[triangles[i + 1]].position - a,
+                               welded[triangles[i + 2]].position - a);
+      for (int k = 0; k < 3; k++) welded[triangles[i + k]].normal += n;
+    }
+  }
+  std::vector<glm::vec3> weldedPositions(welded.size());
+  for (size_t v = 0; v < welded.size(); v++) {
+    float length = glm::length(welded[v].normal);
+    welded[v].normal = length > 0.f ? welded[v].normal / length
+                                    : glm::vec3(0.f, 1.f, 0.f);
+    weldedPositions[v] = welded[v].position;
+  }
+
+  std::vector<std::vector<uint32_t>> clusterTriangles;
+  makeClusters(welded, triangles, 0, Vertices, Indices, Clusters,
+               clusterTriangles);
+  std::vector<uint32_t> level(Clusters.size());
+  for (size_t c = 0; c < level.size(); c++) level[c] = static_cast<uint32_t>(c);
+  LevelCount = Clusters.empty() ? 0 : 1;
+
+  std::vector<int32_t> owner(welded.size());
+  std::vector<uint8_t> locked(welded.size());
+  std::vector<glm::vec3> centers;
+  while (level.size() > 1) {
+    centers.resize(level.size());
+    for (size_t i = 0; i < level.size(); i++) {
+      centers[i] = glm::vec3(Clusters[level[i]].bounds);
+    }
+    std::vector<std::vector<uint32_t>> groups;
+    groupClusters(level, centers, clusterTriangles, groups);
+
+    // Vertices used by more than one group are locked.
+    std::fill(owner.begin(), owner.end(), -1);
+    for (size_t g = 0; g < groups.size(); g++) {
+      for (uint32_t c : groups[g]) {
+        for (uint32_t v : clusterTriangles[c]) {
+          int32_t group = static_cast<int32_t>(g);
+          owner[v] = owner[v] == -1 || owner[v] == group ? group : -2;
+        }
+      }
+    }
+    for (size_t v = 0; v < owner.size(); v++) locked[v] = owner[v] == -2;
+
+    std::vector<std::vector<uint32_t>> simplified(groups.size());
+    std::vector<float> errors(groups.size(), 0.f);
+    auto simplify = [&](size_t begin, size_t end) {
+      for (size_t g = begin; g < end; g++) {
+        for (uint32_t c : groups[g]) {
+          simplified[g].insert(simplified[g].end(), clusterTriangles[c].begin(),
+                               clusterTriangles[c].end());
+        }
+        errors[g] = simplifyGroup(weldedPositions, locked, simplified[g],
+                                  simplified[g].size() / 6);
+      }
+    };
+    if (jobs != nullptr) {
+      jobs->parallelFor(0, groups.size(), 1, simplify);
+    } else {
+      simplify(0, groups.size());
+    }
+    size_t before = 0, after = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+      for (uint32_t c : groups[g]) before += clusterTriangles[c].size();
+      after += simplified[g].size();
+    }
+    if (after * 20 > before * 19) break;
+
+    std::vector<uint32_t> next;
+    for (size_t g = 0; g < groups.size(); g++) {
+      float error = errors[g];
+      glm::vec4 bounds = Clusters[groups[g][0]].lodBounds;
+      for (uint32_t c : groups[g]) {
+        error = std::max(error, Clusters[c].error);
+        bounds = mergeSpheres(bounds, Clusters[c].lodBounds);
+      }
+      for (uint32_t c : groups[g]) {
+        Clusters[c].parentError = error;
+        Clusters[c].parentBounds = bounds;
+      }
+      size_t first = Clusters.size();
+      makeClusters(welded, simplified[g], LevelCount, Vertices, Indices,
+                   Clusters, clusterTriangles);
+      for (size_t c = first; c < Clusters.size(); c++) {
+        Clusters[c].error = error;
+        Clusters[c].lodBounds = bounds;
+        next.push_back(static_cast<uint32_t>(c));
+      }
+    }
+    level.swap(next);
+    LevelCount++;
+  }
+
+  Visible.assign(Clusters.size(), 0);
+  ClusterPage.assign(Clusters.size(), -1);
+  std::fill(PageCluster.begin(), PageCluster.end(), -1);
+}
+
+void VirtualMesh::createBufferObjects(size_t pages) {
+  destroyBufferObjects();
+  glGenVertexArrays(1, &VaoId);
+  glBindVertexArray(VaoId);
+  glGenBuffers(2, BufferIds);
+  glBindBuffer(GL_ARRAY_BUFFER, BufferIds[0]);
+  glBufferData(GL_ARRAY_BUFFER, pages * CLUSTER_VERTICES * sizeof(Vertex),
+               nullptr, GL_DYNAMIC_DRAW);
+  glEnableVertexAttribArray(Mesh::POSITION);
+  glVertexAttribPointer(Mesh::POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, position)));
+  glEnableVertexAttribArray(Mesh::NORMAL);
+  glVertexAttribPointer(Mesh::NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, normal)));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, BufferIds[1]);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, pages * CLUSTER_TRIANGLES * 3, nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  PageCluster.assign(pages, -1);
+  PageFrame.assign(pages, 0);
+  ClusterPage.assign(Clusters.size(), -1);
+  Clock = 0;
+  Frame = 0;
+  PoolWarned = false;
+}
+
+void VirtualMesh::destroyBufferObjects() {
+  if (VaoId == 0) return;
+  glDeleteVertexArrays(1, &VaoId);
+  glDeleteBuffers(2, BufferIds);
+  VaoId = 0;
+  BufferIds[0] = BufferIds[1] = 0;
+}
+
+// Error in pixels of a group seen from eye; infinite from inside its
+// bounds, so that the cut refines there.
+static float projectedError(const glm::vec4 &bounds, float error,
+                            const glm::vec3 &eye, float scale,
+                            bool perspective) {
+  if (error <= 0.f || error == FLT_MAX) return error;
+  if (!perspective) return error * scale;
+  float distance = glm::length(glm::vec3(bounds) - eye) - bounds.w;
+  return distance > 0.f ? error * scale / distance : FLT_MAX;
+}
+
+// Everything is done in model space. The frustum planes come from the rows
+// of the model view projection matrix, and the error scale from the
+// projection: pixels per unit at unit distance, or at any distance for an
+// orthographic projection, given the scale of the model view. Each call
+// starts a frame for the page pool, however many passes then draw it.
+size_t VirtualMesh::select(const glm::mat4 &modelView,
+                           const glm::mat4 &projection, float viewportHeight,
+                           float pixelError, JobSystem *jobs) {
+  Frame++;
+  const glm::mat4 clip = projection * modelView;
+  glm::vec4 planes[6];
+  for (int i = 0; i < 3; i++) {
+    glm::vec4 row(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+    glm::vec4 w(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+    planes[2 * i] = w + row;
+    planes[2 * i + 1] = w - row;
+  }
+  for (glm::vec4 &plane : planes) {
+    float length = glm::length(glm::vec3(plane));
+    if (length > 0.f) plane /= length;
+  }
+  const glm::vec3 eye = glm::vec3(glm::inverse(modelView)[3]);
+  const bool perspective = projection[3][3] == 0.f;
+  float scale = projection[1][1] * viewportHeight * 0.5f;
+  if (!perspective) scale *= glm::length(glm::vec3(modelView[0]));
+
+  auto test = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const Cluster &c = Clusters[i];
+      bool visible =
+          projectedError(c.lodBounds, c.error, eye, scale, perspective) <=
+              pixelError &&
+          projectedError(c.parentBounds, c.parentError, eye, scale,
+                         perspective) > pixelError;
+      for (int p = 0; p < 6 && visible; p++) {
+        visible = glm::dot(glm::vec3(planes[p]), glm::vec3(c.bounds)) +
+                      planes[p].w >=
+                  -c.bounds.w;
+      }
+      Visible[i] = visible;
+    }
+  };
+  if (jobs != nullptr) {
+    jobs->parallelFor(0, Clusters.size(), 1024, test);
+  } else {
+    test(0, Clusters.size());
+  }
+  Selected.clear();
+  for (size_t i = 0; i < Clusters.size(); i++) {
+    if (Visible[i]) Selected.push_back(static_cast<uint32_t>(i));
+  }
+  return Selected.size();
+}
+
+size_t VirtualMesh::select(Camera &camera, const glm::mat4 &model,
+                           float viewportHeight, float pixelError,
+                           JobSystem *jobs) {
+  return select(camera.getViewMatrix() * model, camera.getProjectionMatrix(),
+                viewportHeight, pixelError, jobs);
+}
+
+// A free page, else the next one in clock order not drawn last frame, else
+// any not drawn this frame. Returns -1 when the frame fills the pool.
+int32_t VirtualMesh::allocatePage() {
+  const size_t pages = PageCluster.size();
+  int32_t page = -1;
+  for (size_t i = 0; i < pages && page < 0; i++) {
+    size_t p = Clock;
+    Clock = (Clock + 1) % pages;
+    if (PageCluster[p] < 0 || PageFrame[p] + 1 < Frame) {
+      page = static_cast<int32_t>(p);
+    }
+  }
+  for (size_t p = 0; p < pages && page < 0; p++) {
+    if (PageFrame[p] < Frame) page = static_cast<int32_t>(p);
+  }
+  if (page >= 0 && PageCluster[page] >= 0) {
+    ClusterPage[PageCluster[page]] = -1;
+    PageCluster[page] = -1;
+  }
+  return page;
+}
+
+// The vertex array must be bound, as it holds the index buffer.
+void VirtualMesh::uploadCluster(uint32_t cluster, int32_t page) {
+  const Cluster &c = Clusters[cluster];
+  glBindBuffer(GL_ARRAY_BUFFER, BufferIds[0]);
+  glBufferSubData(GL_ARRAY_BUFFER, page * CLUSTER_VERTICES * sizeof(Vertex),
+                  c.vertexCount * sizeof(Vertex), &Vertices[c.vertexOffset]);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, page * CLUSTER_TRIANGLES * 3,
+                  c.indexCount, &Indices[c.indexOffset]);
+  PageCluster[page] = static_cast<int32_t>(cluster);
+  ClusterPage[cluster] = page;
+}
+
+// Streams in the selected clusters that are not resident and draws them all
+// in one call, each from its page.
+void VirtualMesh::draw() {
+  if (VaoId == 0 || Selected.empty()) return;
+  std::vector<GLsizei> counts;
+  std::vector<void *> offsets;
+  std::vector<GLint> bases;
+  counts.reserve(Selected.size());
+  offsets.reserve(Selected.size());
+  bases.reserve(Selected.size());
+  size_t missing = 0;
+  glBindVertexArray(VaoId);
+  for (uint32_t c : Selected) {
+    int32_t page = ClusterPage[c];
+    if (page < 0) {
+      page = allocatePage();
+      if (page < 0) {
+        missing++;
+        continue;
+      }
+      uploadCluster(c, page);
+    }
+    PageFrame[page] = Frame;
+    counts.push_back(static_cast<GLsizei>(Clusters[c].indexCount));
+    offsets.push_back(
+        reinterpret_cast<void *>(size_t(page) * CLUSTER_TRIANGLES * 3));
+    bases.push_back(static_cast<GLint>(page * CLUSTER_VERTICES));
+  }
+  if (missing > 0 && !PoolWarned) {
+    std::cerr << "WARNING: " << missing << " clusters did not fit in "
+              << PageCluster.size() << " pages." << std::endl;
+    PoolWarned = true;
+  }
+  glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_BYTE,
+                                offsets.data(),
+                                static_cast<GLsizei>(counts.size()),
+                                bases.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+const std::vector<VirtualMesh::Cluster> &VirtualMesh::getClusters() {
+  return Clusters;
+}
+
+const std::vector<uint32_t> &VirtualMesh::getSelected() { return Selected; }
+
+uint32_t VirtualMesh::getLevelCount() { return LevelCount; }
+
+size_t VirtualMesh::getSelectedTriangles() {
+  size_t triangles = 0;
+  for (uint32_t c : Selected) triangles += Clusters[c].indexCount / 3;
+  return triangles;
+}
+
+size_t VirtualMesh::getResidentCount() {
+  size_t resident = 0;
+  for (int32_t cluster : PageCluster) resident += cluster >= 0;
+  return resident;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Virtual Mesh Class
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MGL_VIRTUAL_MESH_HPP
+#define MGL_VIRTUAL_MESH_HPP
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "mglMesh.hpp"
+
+namespace mgl {
+
+class Camera;
+class JobSystem;
+class VirtualMesh;
+
+//////////////////////////////////////////////////////////////////// VirtualMesh
+//
+// Continuous level of detail for very dense meshes. build() splits the mesh
+// in clusters of up to CLUSTER_TRIANGLES triangles, then level by level
+// groups neighbouring clusters, simplifies each group to half its triangles
+// with the vertices it shares with other groups locked, and splits the
+// result into the clusters of the next level. The clusters form a DAG
+// whose errors grow towards the roots.
+//
+// Every frame, select() draws a cluster when its own error, projected from
+// the bounds of the group that made it, is within the pixel error and the
+// error of the group it was simplified into is not. Clusters of one group
+// share both values, so a group is swapped for its simplification as a
+// whole and the cut has no cracks. Only the selected clusters within the
+// view frustum are drawn, streamed into a fixed pool of GPU pages that are
+// reused in clock order once not drawn for a frame, so the triangles drawn
+// follow the screen resolution rather than the mesh.
+//
+// Vertices are welded by position and carry a position and a normal only.
+
+class VirtualMesh : public IDrawable {
+ public:
+  static const size_t CLUSTER_TRIANGLES = 128;
+  static const size_t CLUSTER_VERTICES = 256;  // local indices are bytes
+  static const size_t GROUP_CLUSTERS = 4;  // in triangles of full clusters
+  static const size_t PAGE_COUNT = 4096;
+
+  struct Vertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  // Spheres are center and radius. Roots have an infinite parent error.
+  struct Cluster {
+    uint32_t vertexOffset, vertexCount;
+    uint32_t indexOffset, indexCount;
+    uint32_t level;
+    glm::vec4 bounds;
+    glm::vec4 lodBounds;
+    float error;
+    glm::vec4 parentBounds;
+    float parentError;
+  };
+
+  VirtualMesh();
+  ~VirtualMesh();
+
+  void build(Mesh &mesh, JobSystem *jobs = nullptr);
+  void createBufferObjects(size_t pages = PAGE_COUNT);
+
+  // Picks the clusters to draw for a view of the mesh and returns how many.
+  // Called once per frame, before the passes that draw the mesh.
+  size_t select(const glm::mat4 &modelView, const glm::mat4 &projection,
+                float viewportHeight, float pixelError = 1.f,
+                JobSystem *jobs = nullptr);
+  size_t select(Camera &camera, const glm::mat4 &model, float viewportHeight,
+                float pixelError = 1.f, JobSystem *jobs = nullptr);
+  void draw() override;
+
+  const std::vector<Cluster> &getClusters();
+  const std::vector<uint32_t> &getSelected();
+  uint32_t getLevelCount();
+  size_t getSelectedTriangles();
+  size_t getResidentCount();
+
+ private:
+  std::vector<Vertex> Vertices;
+  std::vector<uint8_t> Indices;
+  std::vector<Cluster> Clusters;
+  std::vector<uint32_t> Selected;
+  std::vector<uint8_t> Visible;
+  uint32_t LevelCount;
+
+  GLuint VaoId, BufferIds[2];
+  std::vector<int32_t> PageCluster;  // -1 when free
+  std::vector<int32_t> ClusterPage;  // -1 when not resident
+  std::vector<uint64_t> PageFrame;   // frame the page was last drawn in
+  size_t Clock;
+  uint64_t Frame;
+  bool PoolWarned;
+
+  int32_t allocatePage();
+  void uploadCluster(uint32_t cluster, int32_t page);
+  void destroyBufferObjects();
+
+  VirtualMesh(const VirtualMesh &) = delete;
+  VirtualMesh &operator=(const VirtualMesh &) = delete;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}  // namespace mgl
+
+#endif /* MGL_VIRTUAL_MESH_HPP */
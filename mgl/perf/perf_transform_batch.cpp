@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transform Batch Performance Test
+//
+// Copyright (c)2023 by Carlos Martinho
+//
+// Times TransformBatch::compute() against building the same matrices one
+// Transform at a time, and checks that the batch kernel, its scalar path and
+// Transform::getModelMatrix() agree. The kernel is chosen at compile time
+// (see mglSimd.hpp): build once as is for SSE2 and once with -mavx2 (or
+// /arch:AVX2) for AVX2. Returns the number of mismatching matrices.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdio>
+#include <glm/ext/matrix_relational.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <random>
+#include <vector>
+
+#include "../mglSimd.hpp"
+#include "../mglTransform.hpp"
+#include "../mglTransformBatch.hpp"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static int elapsed(Clock::time_point t1, Clock::time_point t2) {
+  return static_cast<int>(
+      std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count());
+}
+
+// Odd sizes leave a remainder for the scalar tail after the SIMD loop.
+static void fill(std::vector<mgl::Transform> &transforms,
+                 mgl::TransformBatch &batch, size_t samples) {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> position(-100.f, 100.f);
+  std::uniform_real_distribution<float> unit(-1.f, 1.f);
+  std::uniform_real_distribution<float> size(0.1f, 4.f);
+  transforms.resize(samples);
+  batch.clear();
+  for (size_t i = 0; i < samples; i++) {
+    glm::vec3 t(position(random), position(random), position(random));
+    glm::quat q(unit(random), unit(random), unit(random), unit(random));
+    if (glm::length(q) < 1e-3f) q = glm::quat(1.f, 0.f, 0.f, 0.f);
+    glm::vec3 s(size(random), size(random), size(random));
+    transforms[i].setTranslate(t);
+    transforms[i].setRotation(q);
+    transforms[i].setScale(s);
+    batch.add(t, transforms[i].getRotation(), s);
+  }
+}
+
+static int launch_per_object(std::vector<mgl::Transform> &transforms,
+                             std::vector<glm::mat4> &out) {
+  out.resize(transforms.size());
+  Clock::time_point t1 = Clock::now();
+  for (size_t i = 0; i < transforms.size(); i++) {
+    out[i] = transforms[i].getModelMatrix();
+  }
+  Clock::time_point t2 = Clock::now();
+  return elapsed(t1, t2);
+}
+
+static int launch_batch(mgl::TransformBatch &batch,
+                        std::vector<glm::mat4> &out) {
+  out.resize(batch.size());
+  Clock::time_point t1 = Clock::now();
+  batch.compute(out.data());
+  Clock::time_point t2 = Clock::now();
+  return elapsed(t1, t2);
+}
+
+static int launch_scalar(mgl::TransformBatch &batch,
+                         std::vector<glm::mat4> &out) {
+  out.resize(batch.size());
+  Clock::time_point t1 = Clock::now();
+  batch.computeScalar(out.data(), 0, batch.size());
+  Clock::time_point t2 = Clock::now();
+  return elapsed(t1, t2);
+}
+
+static int compare(const std::vector<glm::mat4> &a,
+                   const std::vector<glm::mat4> &b) {
+  int error = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    error += glm::all(glm::equal(a[i], b[i], 1e-4f)) ? 0 : 1;
+  }
+  return error;
+}
+
+static int comp_batch_per_object(size_t samples) {
+  std::vector<mgl::Transform> transforms;
+  mgl::TransformBatch batch;
+  fill(transforms, batch, samples);
+
+  std::vector<glm::mat4> object, simd, scalar;
+  std::printf("- per object: %d us\n", launch_per_object(transforms, object));
+#if defined(MGL_AVX2)
+  std::printf("- batch AVX2: %d us\n", launch_batch(batch, simd));
+#elif defined(MGL_SSE2)
+  std::printf("- batch SSE2: %d us\n", launch_batch(batch, simd));
+#else
+  std::printf("- batch: %d us\n", launch_batch(batch, simd));
+#endif
+  std::printf("- batch scalar: %d us\n", launch_scalar(batch, scalar));
+
+  int error = compare(object, simd) + compare(object, scalar);
+  if (error != 0) std::printf("- %d mismatches\n", error);
+  return error;
+}
+
+int main() {
+  int error = 0;
+
+  std::printf("TRS to mat4, 100003 transforms:\n");
+  error += comp_batch_per_object(100003);
+
+  std::printf("TRS to mat4, 7 transforms:\n");
+  error += comp_batch_per_object(7);
+
+  return error;
+}
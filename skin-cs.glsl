@@ -0,0 +1,64 @@
+#version 430 core
+layout(local_size_x = 64) in;
+
+#define MAX_BONES 128
+uniform Bones {
+	mat4 BoneMatrices[MAX_BONES];
+};
+
+// Tightly packed vec3 arrays, as uploaded for the vertex arrays.
+layout(std430, binding = 0) readonly buffer InPositions {
+	float inPositions[];
+};
+
+layout(std430, binding = 1) readonly buffer InNormals {
+	float inNormals[];
+};
+
+// Four bytes per vertex, as read by the inBoneIndices/inBoneWeights attributes.
+layout(std430, binding = 2) readonly buffer InBoneIndices {
+	uint inBoneIndices[];
+};
+
+layout(std430, binding = 3) readonly buffer InBoneWeights {
+	uint inBoneWeights[];
+};
+
+layout(std430, binding = 4) writeonly buffer OutPositions {
+	float outPositions[];
+};
+
+layout(std430, binding = 5) writeonly buffer OutNormals {
+	float outNormals[];
+};
+
+uniform uint VertexCount;
+
+// Same blend as the SKINNED path of global-vs.glsl.
+void main(void)
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= VertexCount) return;
+
+	uint packed = inBoneIndices[i];
+	uvec4 bones = uvec4(packed & 0xffu, (packed >> 8) & 0xffu,
+	                    (packed >> 16) & 0xffu, packed >> 24);
+	vec4 weights = unpackUnorm4x8(inBoneWeights[i]);
+	mat4 Skin = weights.x * BoneMatrices[bones.x]
+	          + weights.y * BoneMatrices[bones.y]
+	          + weights.z * BoneMatrices[bones.z]
+	          + weights.w * BoneMatrices[bones.w];
+
+	uint v = 3u * i;
+	vec3 position = vec3(inPositions[v], inPositions[v + 1u], inPositions[v + 2u]);
+	vec3 normal = vec3(inNormals[v], inNormals[v + 1u], inNormals[v + 2u]);
+	position = vec3(Skin * vec4(position, 1.0));
+	normal = mat3(Skin) * normal;
+
+	outPositions[v] = position.x;
+	outPositions[v + 1u] = position.y;
+	outPositions[v + 2u] = position.z;
+	outNormals[v] = normal.x;
+	outNormals[v + 1u] = normal.y;
+	outNormals[v + 2u] = normal.z;
+}